@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "socket/address.h"
+#include "socket/socket.h"
+#include "transport/memory_transport.h"
+
+// presets compared by the benchmarks (see socket/tuning.h)
+inline const std::vector<std::string> bench_presets = { "default", "low-latency", "bulk-throughput" };
+
+typedef std::chrono::steady_clock bench_clock;
+
+inline double elapsed_us(bench_clock::time_point start, bench_clock::time_point end = bench_clock::now()) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+// percentile of unsorted samples
+inline double percentile(std::vector<double> samples, double p) {
+    if (samples.empty())
+        return 0;
+    size_t index = std::min(samples.size() - 1, (size_t) (p * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+// a minimal blocking WebSocket client, frames are masked with a zero key
+struct BenchClient {
+
+    int fd = -1;
+    std::vector<uint8_t> buffer;
+    size_t offset = 0;
+
+    // a kernel socket or the client end of a memory pipe
+    Transport * transport = Transport::kernel();
+
+    bool connect(const std::string & address) {
+
+        Address::Endpoint endpoint;
+        if (!Address::parse(address, endpoint))
+            return false;
+
+        fd = socket(endpoint.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (::connect(fd, endpoint.addr(), endpoint.length) < 0)
+            return false;
+
+        return handshake();
+
+    }
+
+    // the socket serves the other end of a new memory pipe
+    bool connect(Socket & socket, MemoryTransport & memory) {
+
+        auto [server, client] = memory.pair();
+        if (server == -1)
+            return false;
+
+        fd = client;
+        transport = &memory;
+        socket.serve(&memory, server);
+
+        return handshake();
+
+    }
+
+    ssize_t read(void * data, size_t size) {
+        iovec iov { data, size };
+        return transport->read(fd, &iov, 1);
+    }
+
+    ssize_t write(const void * data, size_t size) {
+        iovec iov { (void *) data, size };
+        return transport->write(fd, &iov, 1);
+    }
+
+    bool handshake() {
+
+        const char * request =
+            "GET / HTTP/1.1\r\n"
+            "Host: localhost\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n";
+
+        if (write(request, strlen(request)) <= 0)
+            return false;
+
+        std::string response;
+        char chunk[512];
+        while (response.find("\r\n\r\n") == std::string::npos) {
+            ssize_t bytes = read(chunk, sizeof(chunk));
+            if (bytes <= 0)
+                return false;
+            response.append(chunk, bytes);
+        }
+
+        // frames sent right after the response
+        size_t end = response.find("\r\n\r\n") + 4;
+        buffer.assign(response.begin() + end, response.end());
+
+        return response.rfind("HTTP/1.1 101", 0) == 0;
+
+    }
+
+    bool send(const std::string & payload) {
+
+        std::vector<uint8_t> frame = { 0x81 };
+        size_t size = payload.size();
+
+        if (size > 0xffff) {
+            frame.push_back(0x80 | 127);
+            for (int i = 7; i >= 0; i--)
+                frame.push_back(size >> (i * 8));
+        } else if (size > 125) {
+            frame.push_back(0x80 | 126);
+            frame.push_back(size >> 8);
+            frame.push_back(size);
+        } else {
+            frame.push_back(0x80 | size);
+        }
+
+        frame.insert(frame.end(), 4, 0);
+        frame.insert(frame.end(), payload.begin(), payload.end());
+
+        size_t sent = 0;
+        while (sent < frame.size()) {
+            ssize_t bytes = write(frame.data() + sent, frame.size() - sent);
+            if (bytes <= 0)
+                return false;
+            sent += bytes;
+        }
+
+        return true;
+
+    }
+
+    // payload size of the next complete frame, -1 if there is none buffered
+    long next_frame(size_t & header) {
+
+        size_t available = buffer.size() - offset;
+        const uint8_t * data = buffer.data() + offset;
+
+        if (available < 2)
+            return -1;
+
+        uint64_t size = data[1] & 0x7f;
+        header = 2;
+
+        if (size == 126) {
+            if (available < 4)
+                return -1;
+            size = (data[2] << 8) | data[3];
+            header = 4;
+        } else if (size == 127) {
+            if (available < 10)
+                return -1;
+            size = 0;
+            for (int i = 2; i < 10; i++)
+                size = (size << 8) | data[i];
+            header = 10;
+        }
+
+        if (available < header + size)
+            return -1;
+
+        return size;
+
+    }
+
+    // waits for the next frame, its payload size or -1 after timeout_ms
+    long receive(int timeout_ms = 5000) {
+
+        while (true) {
+
+            size_t header;
+            long size = next_frame(header);
+            if (size >= 0) {
+                offset += header + size;
+                return size;
+            }
+
+            if (offset > 0) {
+                buffer.erase(buffer.begin(), buffer.begin() + offset);
+                offset = 0;
+            }
+
+            // a memory pipe blocks in read()
+            pollfd pfd { fd, POLLIN, 0 };
+            if (transport->pollable() && poll(&pfd, 1, timeout_ms) <= 0)
+                return -1;
+
+            size_t used = buffer.size();
+            buffer.resize(used + 64 * 1024);
+            ssize_t bytes = read(buffer.data() + used, 64 * 1024);
+            buffer.resize(used + std::max<ssize_t>(bytes, 0));
+            if (bytes <= 0)
+                return -1;
+
+        }
+
+    }
+
+    // one read of what has arrived, the number of complete frames in it
+    int receive_available() {
+
+        if (offset > 0) {
+            buffer.erase(buffer.begin(), buffer.begin() + offset);
+            offset = 0;
+        }
+
+        size_t used = buffer.size();
+        buffer.resize(used + 64 * 1024);
+        ssize_t bytes = read(buffer.data() + used, 64 * 1024);
+        buffer.resize(used + std::max<ssize_t>(bytes, 0));
+        if (bytes <= 0)
+            return -1;
+
+        int frames = 0;
+        size_t header;
+        long size;
+        while ((size = next_frame(header)) >= 0) {
+            offset += header + size;
+            frames++;
+        }
+
+        return frames;
+
+    }
+
+    void close() {
+        if (fd != -1)
+            transport->close(fd);
+        fd = -1;
+    }
+
+};
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <thread>
+#include "socket/socket.h"
+#include "bench.h"
+
+// broadcast_bench [preset...]
+//
+// fan-out: one message to BROADCAST_SUBSCRIBERS clients, the time until the
+// last one has received it
+// burst: BROADCAST_BURST messages back to back, deliveries per second
+
+#define BROADCAST_SUBSCRIBERS 100
+#define BROADCAST_ROUNDS 200
+#define BROADCAST_BURST 2000
+#define BROADCAST_SIZE 128
+
+// reads from all clients until each has received count frames
+bool receive_all(std::vector<BenchClient> & clients, int count) {
+
+    std::vector<pollfd> pfds;
+    for (auto & client : clients)
+        pfds.push_back({ client.fd, POLLIN, 0 });
+
+    std::vector<int> received(clients.size(), 0);
+    size_t done = 0;
+
+    while (done < clients.size()) {
+
+        if (poll(pfds.data(), pfds.size(), 5000) <= 0)
+            return false;
+
+        for (size_t i = 0; i < clients.size(); i++) {
+
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+
+            int frames = clients[i].receive_available();
+            if (frames < 0)
+                return false;
+
+            received[i] += frames;
+            if (received[i] >= count) {
+                pfds[i].fd = -1;
+                done++;
+            }
+
+        }
+
+    }
+
+    return true;
+
+}
+
+int main(int argc, char * argv[]) {
+
+    std::vector<std::string> presets = bench_presets;
+    if (argc > 1)
+        presets.assign(argv + 1, argv + argc);
+
+    std::string message(BROADCAST_SIZE, 'x');
+
+    for (auto & preset : presets) {
+
+        Socket socket(0, false, BROADCAST_SUBSCRIBERS * 2);
+        socket.set_drain_timeout(std::chrono::milliseconds(100));
+        socket.add_address("127.0.0.1:0");
+
+        if (!socket.set_tuning(preset) || !socket.listen(true))
+            return 1;
+
+        std::string address = "127.0.0.1:" + std::to_string(socket.port());
+
+        std::vector<BenchClient> clients(BROADCAST_SUBSCRIBERS);
+        for (auto & client : clients) {
+            if (!client.connect(address)) {
+                printf("connect failed\n");
+                return 1;
+            }
+        }
+
+        while (socket.connections() != clients.size())
+            std::this_thread::yield();
+
+        printf("%s\n", preset.c_str());
+
+        std::vector<double> samples;
+        for (int i = 0; i < BROADCAST_ROUNDS; i++) {
+            auto start = bench_clock::now();
+            socket.broadcast(message);
+            if (!receive_all(clients, 1))
+                break;
+            samples.push_back(elapsed_us(start));
+        }
+
+        printf("  fan-out %4d clients  p50 %8.1f us  p99 %8.1f us\n",
+            BROADCAST_SUBSCRIBERS, percentile(samples, 0.5), percentile(samples, 0.99));
+
+        auto start = bench_clock::now();
+
+        std::thread broadcaster([&]() {
+            for (int i = 0; i < BROADCAST_BURST; i++)
+                socket.broadcast(message);
+        });
+
+        bool complete = receive_all(clients, BROADCAST_BURST);
+        broadcaster.join();
+
+        double seconds = elapsed_us(start) / 1e6;
+        printf("  burst   %4d msgs     %10.0f deliveries/s%s\n", BROADCAST_BURST,
+            (double) BROADCAST_BURST * BROADCAST_SUBSCRIBERS / seconds, complete ? "" : " (incomplete)");
+
+        for (auto & client : clients)
+            client.close();
+
+        socket.stop();
+
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include "../tests/conformance_cases.h"
+
+// conformance_bench <baseline> [--record] [--full] [case prefix]
+//
+// Times the Autobahn cases of tests/conformance_cases.h (conformance_test
+// checks that they pass). Every case runs CONFORMANCE_RUNS times, its
+// fastest run is compared to the baseline file. A case CONFORMANCE_SLOWDOWN
+// times as slow as its baseline is reported as slower, scaled by the
+// calibration loop that ran on the machine recording the baseline and on
+// this one. --record writes the baseline instead.
+
+#define CONFORMANCE_RUNS 3
+#define CONFORMANCE_SLOWDOWN 2.5
+// timer and scheduler noise of the short cases
+#define CONFORMANCE_SLACK_MS 5.0
+
+typedef std::chrono::steady_clock conformance_clock;
+
+double elapsed_ms(conformance_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(conformance_clock::now() - start).count();
+}
+
+// a fixed amount of work like the one of the cases (copying and masking
+// bytes), how fast this machine is
+double calibrate() {
+
+    double best = 1e9;
+
+    for (int run = 0; run < CONFORMANCE_RUNS; run++) {
+        auto start = conformance_clock::now();
+        std::vector<uint8_t> data = payload(4 * 1024 * 1024, DataFrame::BinaryFrame);
+        std::vector<uint8_t> copy;
+        for (size_t i = 0; i < data.size(); i++)
+            copy.push_back(data[i] ^ (uint8_t) i);
+        if (copy.size() != data.size())
+            printf("calibration failed\n");
+        best = std::min(best, elapsed_ms(start));
+    }
+
+    return best;
+
+}
+
+// "id milliseconds" per line, "calibration" is the calibration loop
+std::map<std::string, double> read_baseline(const std::string & path) {
+
+    std::map<std::string, double> baseline;
+    std::ifstream file(path);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string id;
+        double ms;
+        if (fields >> id >> ms)
+            baseline[id] = ms;
+    }
+
+    return baseline;
+
+}
+
+int main(int argc, char * argv[]) {
+
+    std::string baseline_path, prefix;
+    bool record = false, full = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--record")
+            record = true;
+        else if (arg == "--full")
+            full = true;
+        else if (baseline_path.empty())
+            baseline_path = arg;
+        else
+            prefix = arg;
+    }
+
+    if (baseline_path.empty()) {
+        printf("conformance_bench <baseline> [--record] [--full] [case prefix]\n");
+        return 1;
+    }
+
+    Echo echo;
+    Protocols protocols;
+    protocols.add("echo", echo);
+
+    Socket server(0, false, 4);
+    server.set_protocols(&protocols);
+    server.set_drain_timeout(std::chrono::milliseconds(100));
+
+    std::vector<Case> cases;
+    add_cases(cases, full);
+
+    std::map<std::string, double> baseline = read_baseline(baseline_path);
+    double calibration = calibrate();
+    // this machine compared to the one of the baseline
+    double speed = baseline.contains("calibration") ? calibration / baseline["calibration"] : 1.0;
+
+    printf("calibration %.1f ms (%.2fx the baseline)\n", calibration, speed);
+
+    std::vector<std::pair<std::string, double>> timings;
+    int slower = 0;
+
+    for (const Case & c : cases) {
+
+        if (!c.id.starts_with(prefix))
+            continue;
+
+        double best = 1e9;
+        bool passed = true;
+
+        for (int run = 0; run < CONFORMANCE_RUNS && passed; run++) {
+            double ms = 0;
+            passed = run_case(server, c, &ms);
+            best = std::min(best, ms);
+        }
+
+        if (!passed) {
+            printf("failed  %-7s %s (see conformance_test)\n", c.id.c_str(), c.description.c_str());
+            continue;
+        }
+
+        timings.emplace_back(c.id, best);
+
+        if (!record && baseline.contains(c.id)) {
+            double limit = baseline[c.id] * speed * CONFORMANCE_SLOWDOWN + CONFORMANCE_SLACK_MS;
+            if (best > limit)
+                slower++;
+            printf("%s%-7s %-45s %8.2f ms  (baseline %.2f ms)\n", best > limit ? "SLOWER " : "",
+                c.id.c_str(), c.description.c_str(), best, baseline[c.id]);
+        } else {
+            printf("%-7s %-45s %8.2f ms\n", c.id.c_str(), c.description.c_str(), best);
+        }
+
+    }
+
+    if (record) {
+        // the cases not run keep their baseline
+        for (auto & [id, ms] : timings)
+            baseline[id] = ms;
+        baseline["calibration"] = calibration;
+
+        std::ofstream file(baseline_path);
+        file << "# conformance_bench --record: milliseconds of the fastest of "
+             << CONFORMANCE_RUNS << " runs per case\n";
+        for (auto & [id, ms] : baseline)
+            file << id << " " << std::fixed << std::setprecision(2) << ms << "\n";
+        printf("baseline written to %s\n", baseline_path.c_str());
+    }
+
+    server.stop();
+
+    return slower > 0 ? 1 : 0;
+
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <thread>
+#include <mutex>
+#include "socket/socket.h"
+#include "bench.h"
+
+// echo_bench [preset...]
+//
+// small messages: ECHO_CLIENTS clients send one message at a time and wait
+// for the echo (round trip latency)
+// bulk: one client keeps ECHO_WINDOW large messages in flight (throughput)
+
+#define ECHO_CLIENTS 4
+#define ECHO_ROUNDS 2000
+#define ECHO_SMALL_SIZE 64
+#define ECHO_BULK_SIZE (64 * 1024)
+#define ECHO_BULK_MESSAGES 1000
+#define ECHO_WINDOW 8
+
+void ping_pong(const std::string & address) {
+
+    std::vector<double> samples;
+    std::mutex mutex;
+    std::vector<std::thread> clients;
+
+    auto start = bench_clock::now();
+
+    for (int c = 0; c < ECHO_CLIENTS; c++) {
+        clients.emplace_back([&]() {
+
+            BenchClient client;
+            if (!client.connect(address)) {
+                printf("connect failed\n");
+                return;
+            }
+
+            std::string message(ECHO_SMALL_SIZE, 'x');
+            std::vector<double> local;
+
+            for (int i = 0; i < ECHO_ROUNDS; i++) {
+                auto sent = bench_clock::now();
+                if (!client.send(message) || client.receive() != ECHO_SMALL_SIZE)
+                    break;
+                local.push_back(elapsed_us(sent));
+            }
+
+            client.close();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            samples.insert(samples.end(), local.begin(), local.end());
+
+        });
+    }
+
+    for (auto & client : clients)
+        client.join();
+
+    double seconds = elapsed_us(start) / 1e6;
+
+    printf("  small  %6zu msgs  %9.0f msg/s  p50 %7.1f us  p99 %7.1f us\n",
+        samples.size(), samples.size() / seconds, percentile(samples, 0.5), percentile(samples, 0.99));
+
+}
+
+void bulk(const std::string & address) {
+
+    BenchClient client;
+    if (!client.connect(address)) {
+        printf("connect failed\n");
+        return;
+    }
+
+    std::string message(ECHO_BULK_SIZE, 'x');
+    int sent = 0, received = 0;
+
+    auto start = bench_clock::now();
+
+    // the reader keeps up with the writer, the window bounds the server queue
+    while (received < ECHO_BULK_MESSAGES) {
+        while (sent < ECHO_BULK_MESSAGES && sent - received < ECHO_WINDOW && client.send(message))
+            sent++;
+        if (client.receive() != ECHO_BULK_SIZE)
+            break;
+        received++;
+    }
+
+    double seconds = elapsed_us(start) / 1e6;
+    client.close();
+
+    printf("  bulk   %6d msgs  %9.1f MB/s\n", received, 2.0 * received * ECHO_BULK_SIZE / seconds / 1e6);
+
+}
+
+int main(int argc, char * argv[]) {
+
+    std::vector<std::string> presets = bench_presets;
+    if (argc > 1)
+        presets.assign(argv + 1, argv + argc);
+
+    for (auto & preset : presets) {
+
+        Socket socket(0, false, 64);
+        socket.set_drain_timeout(std::chrono::milliseconds(100));
+        socket.add_address("127.0.0.1:0");
+
+        if (!socket.set_tuning(preset))
+            return 1;
+
+        socket.on_open([](WebSocket * ws) {
+            ws->on_message([ws](std::string message) {
+                ws->send_message(message);
+            });
+        });
+
+        if (!socket.listen(true))
+            return 1;
+
+        std::string address = "127.0.0.1:" + std::to_string(socket.port());
+
+        printf("%s\n", preset.c_str());
+        ping_pong(address);
+        bulk(address);
+
+        socket.stop();
+
+    }
+
+    return 0;
+
+}
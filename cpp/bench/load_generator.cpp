@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <sys/resource.h>
+#include <deque>
+#include <memory>
+#include <thread>
+#include "event/task.h"
+#include "websocket/websocket_client.h"
+#include "bench.h"
+
+// load_generator [--connections 1000] [--messages 100] [--size 64]
+//                [--window 1] [--threads 1] [--address 127.0.0.1:3000]
+//
+// opens the connections with WebSocketClient, one event loop per thread.
+// Every connection keeps window messages in flight until all of its
+// messages came back, then closes. Without --address against an echo server
+// (coroutine connections on its event loop) in this process.
+
+struct Connection {
+
+    WebSocketClient client;
+    bench_clock::time_point started;
+    std::deque<bench_clock::time_point> in_flight;
+    int sent = 0;
+    int received = 0;
+
+    explicit Connection(EventLoop * loop) : client(loop) {};
+
+};
+
+struct Options {
+    int connections = 1000;
+    int messages = 100;
+    size_t size = 64;
+    int window = 1;
+    int threads = 1;
+    std::string address;
+};
+
+struct Result {
+    std::vector<double> connect_us;
+    std::vector<double> latency_us;
+    int open = 0;
+    int failed = 0;
+    int closed = 0;
+};
+
+// the connections of one thread
+void generate(const Options & options, int connections, Result & result) {
+
+    EventLoop loop;
+    std::vector<std::unique_ptr<Connection>> clients;
+    std::string message(options.size, 'x');
+
+    auto send = [&](Connection & c) {
+        c.in_flight.push_back(bench_clock::now());
+        c.client.send(message);
+        c.sent++;
+    };
+
+    auto closed = [&]() {
+        if (++result.closed == connections)
+            loop.stop();
+    };
+
+    for (int i = 0; i < connections; i++) {
+
+        clients.push_back(std::make_unique<Connection>(&loop));
+        Connection & c = *clients.back();
+
+        c.client.on_open([&]() {
+            result.connect_us.push_back(elapsed_us(c.started));
+            result.open++;
+            while (c.sent < std::min(options.window, options.messages))
+                send(c);
+            if (options.messages == 0)
+                c.client.close();
+        });
+
+        c.client.on_message([&](const WebSocket::Message &) {
+            result.latency_us.push_back(elapsed_us(c.in_flight.front()));
+            c.in_flight.pop_front();
+            if (++c.received == options.messages)
+                c.client.close();
+            else if (c.sent < options.messages)
+                send(c);
+        });
+
+        c.client.on_close([&](uint16_t statuscode) {
+            if (statuscode != 1000)
+                result.failed++;
+            closed();
+        });
+
+        c.started = bench_clock::now();
+        if (!c.client.connect(options.address)) {
+            result.failed++;
+            closed();
+        }
+
+    }
+
+    if (result.closed < connections)
+        loop.run();
+
+}
+
+int main(int argc, char * argv[]) {
+
+    Options options;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--connections")
+            options.connections = atoi(argv[i + 1]);
+        else if (arg == "--messages")
+            options.messages = atoi(argv[i + 1]);
+        else if (arg == "--size")
+            options.size = strtoul(argv[i + 1], nullptr, 10);
+        else if (arg == "--window")
+            options.window = std::max(1, atoi(argv[i + 1]));
+        else if (arg == "--threads")
+            options.threads = std::max(1, atoi(argv[i + 1]));
+        else if (arg == "--address")
+            options.address = argv[i + 1];
+    }
+
+    // a descriptor per connection, twice with the server in this process
+    rlimit limit {};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    Socket server(0, false, options.connections + 16);
+    server.set_drain_timeout(std::chrono::milliseconds(100));
+
+    if (options.address.empty()) {
+
+        server.on_connection([](WebSocket & ws) -> Task {
+            while (auto message = co_await ws.receive())
+                co_await ws.send(message->data(), message->opcode);
+        });
+
+        if (!server.add_address("127.0.0.1:0") || !server.listen(true)) {
+            printf("listen failed\n");
+            return 1;
+        }
+
+        options.address = "127.0.0.1:" + std::to_string(server.port());
+
+    }
+
+    printf("%d connections to %s, %d messages of %zu bytes each, window %d, %d threads\n",
+        options.connections, options.address.c_str(), options.messages, options.size,
+        options.window, options.threads);
+
+    std::vector<Result> results(options.threads);
+    std::vector<std::thread> threads;
+
+    auto start = bench_clock::now();
+
+    for (int t = 0; t < options.threads; t++) {
+        int connections = options.connections / options.threads + (t < options.connections % options.threads);
+        threads.emplace_back([&, t, connections]() {
+            generate(options, connections, results[t]);
+        });
+    }
+
+    for (auto & thread : threads)
+        thread.join();
+
+    double seconds = elapsed_us(start) / 1e6;
+
+    Result total;
+    for (Result & result : results) {
+        total.connect_us.insert(total.connect_us.end(), result.connect_us.begin(), result.connect_us.end());
+        total.latency_us.insert(total.latency_us.end(), result.latency_us.begin(), result.latency_us.end());
+        total.open += result.open;
+        total.failed += result.failed;
+    }
+
+    printf("  connect   %6d open, %d failed  p50 %8.1f us  p99 %8.1f us\n", total.open, total.failed,
+        percentile(total.connect_us, 0.5), percentile(total.connect_us, 0.99));
+    printf("  messages  %6zu in %.2f s  %9.0f msg/s  p50 %8.1f us  p99 %8.1f us\n",
+        total.latency_us.size(), seconds, total.latency_us.size() / seconds,
+        percentile(total.latency_us, 0.5), percentile(total.latency_us, 0.99));
+
+    server.stop();
+
+    return 0;
+
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "socket/connection_table.h"
+#include "socket/placement.h"
+#include "bench.h"
+
+// numa_bench [--cpu 0] [--slots 100000] [--lookups 2000000]
+//
+// looks up random connections in a table, like the event loop does for
+// every event, with the table on the node of the CPU (local) or on another
+// node (remote, only with several nodes), on small and on huge pages.
+// Where perf events are allowed (kernel.perf_event_paranoid, containers),
+// it reports the dTLB misses and the loads served by another node per
+// lookup as well.
+
+// a hardware cache counter of this thread, -1 if perf events are not
+// available
+struct PerfCounter {
+
+    int fd = -1;
+
+    PerfCounter(uint64_t cache, uint64_t result) {
+
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+    }
+
+    ~PerfCounter() {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    long long stop() {
+        long long value = -1;
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &value, sizeof(value)) != sizeof(value))
+                value = -1;
+        }
+        return value;
+    }
+
+};
+
+volatile size_t sink;
+
+std::string per_lookup(long long count, size_t lookups) {
+
+    if (count < 0)
+        return "-";
+
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f", (double) count / lookups);
+    return text;
+
+}
+
+int main(int argc, char * argv[]) {
+
+    int cpu = 0;
+    size_t slots = 100000;
+    size_t lookups = 2000000;
+
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--cpu")
+            cpu = atoi(argv[i + 1]);
+        else if (std::string(argv[i]) == "--slots")
+            slots = strtoull(argv[i + 1], nullptr, 10);
+        else if (std::string(argv[i]) == "--lookups")
+            lookups = strtoull(argv[i + 1], nullptr, 10);
+    }
+
+    // the loop of a reactor pinned to its CPU
+    Placement::pin({ cpu });
+
+    int local = Placement::node_of(cpu);
+    int nodes = Placement::nodes();
+
+    std::vector<std::pair<const char *, int>> placements = { { "local", local } };
+    if (nodes > 1)
+        placements.push_back({ "remote", (local + 1) % nodes });
+
+    PerfCounter tlb_misses(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS);
+    PerfCounter remote_loads(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_RESULT_MISS);
+
+    printf("cpu %d on node %d of %d, %zu slots of %zu bytes\n", cpu, local, nodes, slots, sizeof(WebSocket));
+    if (tlb_misses.fd < 0 && remote_loads.fd < 0)
+        printf("perf events not available, no counters\n");
+
+    printf("%8s %12s %12s %14s %14s\n", "node", "pages", "ns/lookup", "dTLB miss", "remote loads");
+
+    for (auto [name, node] : placements) {
+        for (bool huge_pages : { false, true }) {
+
+            ConnectionTable table(slots, node, huge_pages);
+
+            std::vector<uint64_t> ids;
+            for (size_t i = 0; i < slots; i++)
+                ids.push_back(table.acquire(i)->id());
+
+            // random connections, beyond the reach of the caches
+            std::mt19937_64 random(42);
+            std::vector<uint64_t> order(lookups);
+            for (uint64_t & id : order)
+                id = ids[random() % ids.size()];
+
+            size_t sum = 0;
+
+            tlb_misses.start();
+            remote_loads.start();
+            auto start = bench_clock::now();
+
+            for (uint64_t id : order) {
+                WebSocket * webSocket = table.find(id);
+                sum += webSocket->state() + webSocket->buffered();
+            }
+
+            double ns = elapsed_us(start) * 1000 / lookups;
+            long long tlb = tlb_misses.stop();
+            long long remote = remote_loads.stop();
+
+            const char * pages[] = { "small", "transparent", "huge" };
+            printf("%8s %12s %12.1f %14s %14s\n", name, pages[table.region().pages], ns,
+                per_lookup(tlb, lookups).c_str(), per_lookup(remote, lookups).c_str());
+
+            // the lookups are not optimized away
+            sink = sum;
+
+        }
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <thread>
+#include <mutex>
+#include <map>
+#include "socket/socket.h"
+#include "transport/capture.h"
+#include "transport/memory_transport.h"
+#include "bench.h"
+
+// replay <capture> [--fast] [--address 127.0.0.1:3000]
+//
+// plays the connections of a capture (wsserver --capture, see
+// transport/capture.h) or of a raw stream (corpus/con_big) back. With
+// --address to a running server over loopback, otherwise to an echo server
+// in this process over memory pipes. Every connection sends its records at
+// their original times, with --fast as fast as it can.
+//
+// The n-th frame of the server answers the n-th frame of the client (an
+// echo, "Hello back!", a pong or the close frame), the latency of a frame is
+// the time until its answer.
+
+#define REPLAY_ANSWER_TIMEOUT_MS 1000
+
+struct Step {
+    uint64_t time;
+    std::span<const uint8_t> bytes;
+};
+
+// counts the whole frames (the last one of a message) of one direction,
+// behind the HTTP request or response
+struct FrameCounter {
+
+    bool in_http = true;
+    uint32_t last_bytes = 0;
+
+    // header of the current frame, then its payload
+    uint8_t header[14];
+    size_t header_size = 0;
+    uint64_t remaining = 0;
+    bool in_payload = false;
+
+    size_t feed(std::span<const uint8_t> bytes) {
+
+        size_t frames = 0;
+        size_t i = 0;
+
+        while (in_http && i < bytes.size()) {
+            last_bytes = (last_bytes << 8) | bytes[i++];
+            in_http = last_bytes != 0x0d0a0d0a;
+        }
+
+        while (i < bytes.size()) {
+
+            if (in_payload) {
+                size_t skip = std::min<uint64_t>(remaining, bytes.size() - i);
+                i += skip;
+                remaining -= skip;
+            } else {
+                header[header_size++] = bytes[i++];
+                if (!header_complete())
+                    continue;
+            }
+
+            if (in_payload && remaining > 0)
+                continue;
+
+            if (header[0] & 0x80)
+                frames++;
+            header_size = 0;
+            in_payload = false;
+
+        }
+
+        return frames;
+
+    }
+
+    // false until the whole header is there, then starts the payload
+    bool header_complete() {
+
+        if (header_size < 2)
+            return false;
+
+        uint8_t length = header[1] & 0x7f;
+        size_t size = 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) + ((header[1] & 0x80) ? 4 : 0);
+        if (header_size < size)
+            return false;
+
+        remaining = length;
+        if (length == 126)
+            remaining = (header[2] << 8) | header[3];
+        if (length == 127) {
+            remaining = 0;
+            for (int i = 2; i < 10; i++)
+                remaining = (remaining << 8) | header[i];
+        }
+
+        in_payload = true;
+        return true;
+
+    }
+
+};
+
+struct Result {
+    std::mutex mutex;
+    std::vector<double> latencies;
+    size_t frames = 0;
+    size_t bytes = 0;
+    size_t failed = 0;
+    bench_clock::time_point last_write;
+};
+
+void replay(const std::vector<Step> & steps, const std::string & address, Socket & server,
+            MemoryTransport & memory, bool fast, bench_clock::time_point start, Result & result)
+{
+
+    int fd;
+    Transport * transport;
+
+    if (!address.empty()) {
+        Address::Endpoint endpoint;
+        Address::parse(address, endpoint);
+        transport = Transport::kernel();
+        fd = socket(endpoint.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (::connect(fd, endpoint.addr(), endpoint.length) < 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    } else {
+        auto [server_end, client_end] = memory.pair();
+        transport = &memory;
+        fd = client_end;
+        if (fd != -1)
+            server.serve(&memory, server_end);
+    }
+
+    if (fd == -1) {
+        std::lock_guard<std::mutex> lock(result.mutex);
+        result.failed++;
+        return;
+    }
+
+    std::vector<bench_clock::time_point> sent, answered;
+    std::mutex mutex;
+
+    std::thread reader([&]() {
+        FrameCounter counter;
+        uint8_t buffer[64 * 1024];
+        iovec iov { buffer, sizeof(buffer) };
+        ssize_t bytes;
+        while ((bytes = transport->read(fd, &iov, 1)) > 0) {
+            size_t frames = counter.feed({ buffer, (size_t) bytes });
+            std::lock_guard<std::mutex> lock(mutex);
+            answered.insert(answered.end(), frames, bench_clock::now());
+        }
+    });
+
+    FrameCounter counter;
+    size_t bytes_sent = 0;
+
+    for (const Step & step : steps) {
+
+        // the client closed the connection here
+        if (step.bytes.empty())
+            break;
+
+        if (!fast)
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(step.time));
+
+        auto now = bench_clock::now();
+        size_t written = 0;
+        while (written < step.bytes.size()) {
+            iovec iov { (void *) (step.bytes.data() + written), step.bytes.size() - written };
+            ssize_t bytes = transport->write(fd, &iov, 1);
+            if (bytes <= 0)
+                break;
+            written += bytes;
+        }
+        bytes_sent += written;
+
+        size_t frames = counter.feed(step.bytes);
+        std::lock_guard<std::mutex> lock(mutex);
+        sent.insert(sent.end(), frames, now);
+
+    }
+
+    auto last_write = bench_clock::now();
+
+    for (int i = 0; i < REPLAY_ANSWER_TIMEOUT_MS; i++) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (answered.size() >= sent.size())
+                break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    transport->shutdown(fd);
+    reader.join();
+    transport->close(fd);
+
+    std::lock_guard<std::mutex> lock(result.mutex);
+    for (size_t i = 0; i < std::min(sent.size(), answered.size()); i++)
+        result.latencies.push_back(elapsed_us(sent[i], answered[i]));
+    result.frames += sent.size();
+    result.bytes += bytes_sent;
+    result.last_write = std::max(result.last_write, last_write);
+
+}
+
+int main(int argc, char * argv[]) {
+
+    std::string path, address;
+    bool fast = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--fast")
+            fast = true;
+        else if (arg == "--address" && i + 1 < argc)
+            address = argv[++i];
+        else
+            path = arg;
+    }
+
+    Capture::File file;
+    if (path.empty() || !file.open(path)) {
+        printf("replay <capture> [--fast] [--address 127.0.0.1:3000]\n");
+        return 1;
+    }
+
+    // the records of every connection in order
+    std::map<uint32_t, std::vector<Step>> connections;
+    Capture::Record record;
+    std::span<const uint8_t> bytes;
+    size_t records = 0;
+
+    while (file.next(record, bytes)) {
+        connections[record.connection].push_back({ record.time, bytes });
+        records++;
+    }
+
+    // the capture starts with its first record
+    uint64_t first = UINT64_MAX;
+    for (auto & [connection, steps] : connections)
+        first = std::min(first, steps.front().time);
+    for (auto & [connection, steps] : connections)
+        for (Step & step : steps)
+            step.time -= first;
+
+    Socket server(0, false, connections.size() + 16);
+    server.set_drain_timeout(std::chrono::milliseconds(100));
+    server.on_open([](WebSocket * ws) {
+        ws->on_message([ws](std::string message) {
+            ws->send_message(message);
+        });
+    });
+
+    MemoryTransport memory(connections.size());
+    Result result;
+
+    printf("%s: %zu connections, %zu records, %s%s\n", path.c_str(), connections.size(), records,
+        address.empty() ? "in process" : address.c_str(), fast ? ", as fast as possible" : "");
+
+    auto start = bench_clock::now();
+    result.last_write = start;
+
+    std::vector<std::thread> threads;
+    for (auto & [connection, steps] : connections)
+        threads.emplace_back([&, &steps = steps]() {
+            replay(steps, address, server, memory, fast, start, result);
+        });
+
+    for (auto & thread : threads)
+        thread.join();
+
+    double seconds = elapsed_us(start, result.last_write) / 1e6;
+
+    printf("  sent      %zu bytes in %.3f s, %.1f MB/s, %.0f records/s\n",
+        result.bytes, seconds, result.bytes / seconds / 1e6, records / seconds);
+    printf("  answered  %zu of %zu frames, p50 %.1f us  p99 %.1f us  max %.1f us\n",
+        result.latencies.size(), result.frames, percentile(result.latencies, 0.5),
+        percentile(result.latencies, 0.99), percentile(result.latencies, 1.0));
+    if (result.failed > 0)
+        printf("  failed    %zu connections\n", result.failed);
+
+    server.stop();
+
+    return 0;
+
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "pubsub/topic_index.h"
+#include "bench.h"
+
+// topic_bench
+//
+// subscribes many connections to one pattern ("chat"): a change copies one
+// chunk of the subscribers (see TOPIC_CHUNK_SIZE), the time per subscribe
+// should stay near flat instead of growing with them.
+//
+// Then matches topics against growing numbers of subscriptions: one per
+// symbol ("prices.<region>.<symbol>") plus a few wildcard patterns. The time
+// per match should stay flat, it depends on the words of the topic and not
+// on the subscriptions (the larger tries only miss the caches more often).
+// The large tries come last, their freed nodes slow down the allocator.
+
+int main() {
+
+    const char * regions[] = { "EU", "US", "ASIA", "LATAM" };
+
+    printf("%11s %14s %14s %14s\n", "subscribers", "subscribe ns", "unsubscribe ns", "match us");
+
+    for (size_t subscribers : { 1000, 10000, 100000, 160000 }) {
+
+        TopicIndex index;
+
+        auto start = bench_clock::now();
+        for (uint64_t id = 1; id <= subscribers; id++)
+            index.subscribe("chat", id);
+        double subscribe_ns = elapsed_us(start) * 1000 / subscribers;
+
+        std::vector<uint64_t> ids;
+        int rounds = 20;
+
+        start = bench_clock::now();
+        for (int r = 0; r < rounds; r++)
+            index.match("chat", ids);
+        double match_us = elapsed_us(start) / rounds;
+
+        // every other one, from the middle of the chunks
+        start = bench_clock::now();
+        for (uint64_t id = 1; id <= subscribers; id += 2)
+            index.unsubscribe("chat", id);
+        double unsubscribe_ns = elapsed_us(start) * 1000 / ((subscribers + 1) / 2);
+
+        printf("%11zu %14.0f %14.0f %14.0f\n", subscribers, subscribe_ns, unsubscribe_ns, match_us);
+
+    }
+
+    printf("\n%10s %8s %14s %14s\n", "patterns", "nodes", "subscribe ns", "match ns");
+
+    for (size_t symbols : { 1000, 10000, 100000, 1000000 }) {
+
+        TopicIndex index;
+        uint64_t id = 1;
+
+        auto start = bench_clock::now();
+
+        for (size_t s = 0; s < symbols; s++)
+            index.subscribe(std::string("prices.") + regions[s % 4] + ".S" + std::to_string(s), id++);
+
+        double subscribe_ns = elapsed_us(start) * 1000 / symbols;
+
+        index.subscribe("prices.EU.*", id++);
+        index.subscribe("prices.#", id++);
+        index.subscribe("#", id++);
+
+        std::vector<std::string> topics;
+        for (size_t t = 0; t < 1000; t++) {
+            size_t s = (t * 7919) % symbols;
+            topics.push_back(std::string("prices.") + regions[s % 4] + ".S" + std::to_string(s));
+        }
+
+        std::vector<uint64_t> ids;
+        size_t matched = 0;
+        int rounds = 200;
+
+        start = bench_clock::now();
+        for (int r = 0; r < rounds; r++) {
+            for (const std::string & topic : topics) {
+                index.match(topic, ids);
+                matched += ids.size();
+            }
+        }
+
+        double match_ns = elapsed_us(start) * 1000 / (rounds * topics.size());
+
+        printf("%10zu %8zu %14.0f %14.0f  (%.2f ids)\n", symbols + 3, index.nodes(), subscribe_ns, match_ns,
+            (double) matched / (rounds * topics.size()));
+
+    }
+
+    return 0;
+
+}
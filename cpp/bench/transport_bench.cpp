@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "socket/socket.h"
+#include "transport/memory_transport.h"
+#include "bench.h"
+
+// transport_bench
+//
+// the same echo server over a Unix socket and over a memory pipe, the
+// difference is what the kernel costs, the rest is the protocol stack
+// (handshake, parsing, handlers, outbound batches)
+//
+// round trip: one message at a time
+// pipelined: TRANSPORT_WINDOW messages in flight
+
+#define TRANSPORT_ROUNDS 20000
+#define TRANSPORT_MESSAGES 200000
+#define TRANSPORT_WINDOW 64
+#define TRANSPORT_SIZE 64
+
+void round_trip(BenchClient & client) {
+
+    std::string message(TRANSPORT_SIZE, 'x');
+    std::vector<double> samples;
+
+    auto start = bench_clock::now();
+
+    for (int i = 0; i < TRANSPORT_ROUNDS; i++) {
+        auto sent = bench_clock::now();
+        if (!client.send(message) || client.receive() != TRANSPORT_SIZE)
+            break;
+        samples.push_back(elapsed_us(sent));
+    }
+
+    double seconds = elapsed_us(start) / 1e6;
+
+    printf("  round trip  %6zu msgs  %9.0f msg/s  p50 %6.2f us  p99 %6.2f us\n",
+        samples.size(), samples.size() / seconds, percentile(samples, 0.5), percentile(samples, 0.99));
+
+}
+
+void pipelined(BenchClient & client) {
+
+    std::string message(TRANSPORT_SIZE, 'x');
+    int sent = 0, received = 0;
+
+    auto start = bench_clock::now();
+
+    while (received < TRANSPORT_MESSAGES) {
+        while (sent < TRANSPORT_MESSAGES && sent - received < TRANSPORT_WINDOW && client.send(message))
+            sent++;
+        if (client.receive() != TRANSPORT_SIZE)
+            break;
+        received++;
+    }
+
+    double seconds = elapsed_us(start) / 1e6;
+
+    printf("  pipelined   %6d msgs  %9.0f msg/s\n", received, received / seconds);
+
+}
+
+int main() {
+
+    for (const char * name : { "unix", "memory" }) {
+
+        Socket socket(0, false, 4);
+        socket.set_drain_timeout(std::chrono::milliseconds(100));
+
+        socket.on_open([](WebSocket * ws) {
+            ws->on_message([ws](std::string message) {
+                ws->send_message(message);
+            });
+        });
+
+        MemoryTransport memory(1);
+        BenchClient client;
+
+        bool connected;
+
+        if (std::string(name) == "unix") {
+            std::string path = "/tmp/transport_bench.sock";
+            unlink(path.c_str());
+            socket.add_address("unix:" + path);
+            connected = socket.listen(true) && client.connect("unix:" + path);
+        } else {
+            connected = client.connect(socket, memory);
+        }
+
+        if (!connected) {
+            printf("%s: connect failed\n", name);
+            return 1;
+        }
+
+        printf("%s\n", name);
+        round_trip(client);
+        pipelined(client);
+
+        client.close();
+        socket.stop();
+
+    }
+
+    return 0;
+
+}
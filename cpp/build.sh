@@ -1,7 +1,18 @@
 #!/bin/bash
 
+if [ "$1" == "cert" ]; then
+    # self-signed certificate for ./build/wsserver --tls cert.pem key.pem
+    openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes \
+        -keyout src/key.pem -out src/cert.pem -days 30 -subj /CN=localhost
+    exit
+fi
+
 if [ "$1" == "test" ]; then
     cd ./tests
+elif [ "$1" == "bench" ]; then
+    cd ./bench
+elif [ "$1" == "fuzz" ]; then
+    cd ./fuzz
 else
     cd ./src
 fi
@@ -20,12 +31,23 @@ if [ "$1" == "run" ]; then
 fi
 
 if [ "$1" == "fuzz" ]; then
+    # ./build.sh fuzz 1000000: the corpus and that many inputs per target,
+    # new inputs of libFuzzer go to build/corpus_<target>
+    for target in fuzz_dataframe fuzz_http_request fuzz_websocket; do
+        echo "-----------------------"
+        mkdir -p build/corpus_$target
+        ./build/$target build/corpus_$target ../corpus -runs=${2:-100000}
+    done
+fi
 
-    echo "-----------------------"
-    pkill wsserver
-    ./build/wsserver ../corpus/con_big
-    ./build/wsserver ../corpus/con_small
-    echo ""
+if [ "$1" == "bench" ]; then
+    ./build/echo_bench $2
+    ./build/broadcast_bench $2
+    ./build/transport_bench
+    ./build/load_generator
+    ./build/topic_bench
+    ./build/numa_bench
+    ./build/conformance_bench conformance_baseline.txt
 fi
 
 if [ "$1" == "test" ]; then
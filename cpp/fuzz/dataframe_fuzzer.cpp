@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "websocket/dataframe.h"
+
+// frames back to back, the payload of a frame longer than the first read is
+// added in reads of FUZZ_READ_SIZE bytes like WebSocket::consume() does.
+// Every complete frame has to survive get_raw_frame() and parse_raw_frame().
+
+#define FUZZ_READ_SIZE 61
+
+// the application data of a frame sent by the server, read back
+void check_round_trip(DataFrame & frame) {
+
+    std::vector<uint8_t> raw_frame = frame.get_raw_frame();
+
+    DataFrame parsed;
+    size_t size = parsed.parse_raw_frame(raw_frame.data(), raw_frame.size());
+
+    if (size != raw_frame.size() || parsed.m_fin != frame.m_fin || parsed.m_opcode != frame.m_opcode ||
+        parsed.m_application_data != frame.m_application_data)
+        abort();
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+
+    // the masks are removed in place
+    std::vector<uint8_t> buffer(data, data + size);
+    size_t offset = 0;
+
+    while (offset < size) {
+
+        DataFrame frame;
+
+        size_t end = frame.parse_raw_frame(buffer.data() + offset, size - offset);
+        if (end == 0)
+            break;
+        offset += end;
+
+        while (!frame.payload_full() && offset < size)
+            offset += frame.add_payload_data(buffer.data() + offset, 0, std::min<size_t>(size - offset, FUZZ_READ_SIZE));
+
+        if (!frame.payload_full())
+            break;
+
+        // masked frames of a server are not supported
+        frame.m_mask = false;
+        check_round_trip(frame);
+
+    }
+
+    return 0;
+
+}
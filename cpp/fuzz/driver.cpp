@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+// The main() of a fuzz target for compilers without libFuzzer (GCC), with the
+// same command line for what it supports:
+//
+//   fuzz_websocket [-runs=N] [-seed=S] [-max_len=L] ../corpus file ...
+//
+// runs every file (of a directory) once, then N mutations of them. Nothing
+// is learned from coverage, it finds what the sanitizers see on inputs close
+// to the corpus and measures the execs per second of the target. The input
+// of a crash is written to ./crash-input.
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size);
+
+typedef std::vector<uint8_t> Input;
+
+// the input running right now
+const Input * g_input = nullptr;
+
+void write_crash() {
+
+    if (g_input == nullptr)
+        return;
+
+    int fd = open("crash-input", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (write(fd, g_input->data(), g_input->size()) >= 0)
+        write(STDERR_FILENO, "input written to crash-input\n", 29);
+    close(fd);
+
+}
+
+void on_crash(int signal) {
+
+    write_crash();
+    ::signal(signal, SIG_DFL);
+    raise(signal);
+
+}
+
+void add_inputs(const std::string & path, std::vector<Input> & inputs) {
+
+    struct stat info {};
+    if (stat(path.c_str(), &info) != 0) {
+        printf("Failed to open %s\n", path.c_str());
+        return;
+    }
+
+    if (S_ISDIR(info.st_mode)) {
+        DIR * directory = opendir(path.c_str());
+        while (dirent * entry = readdir(directory))
+            if (entry->d_name[0] != '.')
+                add_inputs(path + "/" + entry->d_name, inputs);
+        closedir(directory);
+        return;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    inputs.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+}
+
+// one of the byte level mutations of libFuzzer
+void mutate(Input & input, const std::vector<Input> & inputs, std::mt19937_64 & random, size_t max_len) {
+
+    auto position = [&](size_t size) { return size == 0 ? 0 : random() % size; };
+    // interesting bytes of the frame header: lengths and flags
+    static const uint8_t bytes[] = { 0x00, 0x01, 0x7d, 0x7e, 0x7f, 0x80, 0x81, 0x88, 0x89, 0x8a, 0xff };
+
+    switch (random() % 6) {
+    case 0:
+        if (!input.empty())
+            input[position(input.size())] ^= 1 << (random() % 8);
+        break;
+    case 1:
+        if (!input.empty())
+            input[position(input.size())] = bytes[random() % sizeof(bytes)];
+        break;
+    case 2:
+        input.insert(input.begin() + position(input.size() + 1), (uint8_t) random());
+        break;
+    case 3:
+        if (!input.empty())
+            input.erase(input.begin() + position(input.size()));
+        break;
+    case 4: {
+        // a part of the input repeated
+        size_t start = position(input.size());
+        size_t length = std::min<size_t>(random() % 64, input.size() - start);
+        Input part(input.begin() + start, input.begin() + start + length);
+        input.insert(input.begin() + position(input.size() + 1), part.begin(), part.end());
+        break;
+    }
+    default: {
+        // the end of another input
+        const Input & other = inputs[random() % inputs.size()];
+        size_t cut = position(input.size() + 1);
+        input.resize(cut);
+        input.insert(input.end(), other.begin() + position(other.size()), other.end());
+        break;
+    }
+    }
+
+    if (input.size() > max_len)
+        input.resize(max_len);
+
+}
+
+int main(int argc, char * argv[]) {
+
+    size_t runs = 0, max_len = 64 * 1024;
+    uint64_t seed = std::random_device()();
+    std::vector<Input> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.starts_with("-runs="))
+            runs = strtoull(arg.c_str() + 6, nullptr, 10);
+        else if (arg.starts_with("-seed="))
+            seed = strtoull(arg.c_str() + 6, nullptr, 10);
+        else if (arg.starts_with("-max_len="))
+            max_len = strtoull(arg.c_str() + 9, nullptr, 10);
+        else if (arg.starts_with("-"))
+            printf("ignored %s (libFuzzer only)\n", arg.c_str());
+        else
+            add_inputs(arg, inputs);
+    }
+
+    if (inputs.empty())
+        inputs.emplace_back();
+
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_set_death_callback(write_crash);
+#endif
+    signal(SIGABRT, on_crash);
+    signal(SIGSEGV, on_crash);
+
+    printf("%zu inputs, %zu runs, seed %llu\n", inputs.size(), runs, (unsigned long long) seed);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (const Input & input : inputs) {
+        g_input = &input;
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+
+    std::mt19937_64 random(seed);
+    Input input;
+
+    for (size_t run = 0; run < runs; run++) {
+
+        // a few mutations stacked on a corpus input
+        input = inputs[random() % inputs.size()];
+        for (int i = 1 + random() % 4; i > 0; i--)
+            mutate(input, inputs, random, max_len);
+
+        g_input = &input;
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t execs = inputs.size() + runs;
+
+    printf("%zu execs in %.1f s: %.0f execs/s\n", execs, seconds, execs / seconds);
+
+    return 0;
+
+}
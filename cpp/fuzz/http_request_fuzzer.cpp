@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <vector>
+#include "http/http_request.h"
+
+// the handshake request, with the lookups the WebSocket does on it
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+
+    HTTP::Request request;
+
+    request.init_from_raw_request(std::vector<uint8_t>(data, data + size));
+    request.get_header("sec-websocket-key");
+    request.header_value_as_array("sec-websocket-extensions");
+    request.header_value_as_array("sec-websocket-protocol", ',');
+    request.url().parameter("since");
+
+    return 0;
+
+}
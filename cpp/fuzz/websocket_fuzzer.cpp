@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "websocket/websocket.h"
+#include "transport/memory_transport.h"
+
+// the input is everything one client sends (like corpus/con_big): the
+// handshake, the frames and the end of the stream. The WebSocket is served in
+// this thread until the stream ends, then reset for the next input like a
+// slot of the ConnectionTable. Built with COMPILE_FOR_FUZZING there is no
+// keep-alive thread.
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+
+    static WebSocket webSocket(-1);
+    static uint64_t id = 0;
+
+    MemoryTransport transport(1);
+    auto [server, client] = transport.pair();
+
+    transport.send(client, { data, size });
+    transport.shutdown(client);
+
+    webSocket.reset(server, ++id);
+    webSocket.set_transport(&transport);
+    webSocket.on_message([](std::string message) {
+        webSocket.send_message(message);
+    });
+
+    webSocket.listen();
+
+    // the transport dies with this input
+    webSocket.reset(-1, id);
+
+    return 0;
+
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "event_loop.h"
+
+EventLoop::EventLoop()
+{
+
+    m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollfd == -1)
+        std::cout << "Failed to create epoll instance. errno: " << errno << std::endl;
+
+    m_wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeupfd == -1)
+        std::cout << "Failed to create eventfd. errno: " << errno << std::endl;
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = m_wakeupfd;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_wakeupfd, &event);
+
+}
+
+EventLoop::~EventLoop() {
+    ::close(m_wakeupfd);
+    ::close(m_epollfd);
+}
+
+bool EventLoop::add(int fd, uint32_t events, fkt_event f) {
+
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        std::cout << "Failed to add fd " << fd << " to epoll. errno: " << errno << std::endl;
+        return false;
+    }
+
+    m_handlers[fd] = std::make_shared<fkt_event>(std::move(f));
+
+    return true;
+
+}
+
+bool EventLoop::modify(int fd, uint32_t events) {
+
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+
+    return epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event) == 0;
+
+}
+
+void EventLoop::remove(int fd) {
+
+    // fails with EBADF if fd was already closed, which removed it anyway
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, nullptr);
+    m_handlers.erase(fd);
+
+}
+
+void EventLoop::post(std::function<void()> f) {
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_posted.push_back(std::move(f));
+    }
+
+    wakeup();
+
+}
+
+void EventLoop::post_after(std::chrono::milliseconds delay, std::function<void()> f) {
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_timers.emplace(std::chrono::steady_clock::now() + delay, std::move(f));
+    }
+
+    // the loop may be sleeping with a later timeout
+    wakeup();
+
+}
+
+void EventLoop::wakeup() {
+
+    uint64_t one = 1;
+    if (write(m_wakeupfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        std::cout << "Failed to wake up event loop. errno: " << errno << std::endl;
+
+}
+
+void EventLoop::run_posted() {
+
+    std::vector<std::function<void()>> posted;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        posted.swap(m_posted);
+    }
+
+    for (auto & f : posted)
+        f();
+
+}
+
+void EventLoop::run_timers() {
+
+    std::vector<std::function<void()>> expired;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto now = std::chrono::steady_clock::now();
+        auto end = m_timers.upper_bound(now);
+
+        for (auto timer = m_timers.begin(); timer != end; timer++)
+            expired.push_back(std::move(timer->second));
+
+        m_timers.erase(m_timers.begin(), end);
+    }
+
+    for (auto & f : expired)
+        f();
+
+}
+
+int EventLoop::next_timeout() {
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_posted.empty())
+        return 0;
+
+    if (m_timers.empty())
+        return -1;
+
+    auto wait = m_timers.begin()->first - std::chrono::steady_clock::now();
+    if (wait <= wait.zero())
+        return 0;
+
+    // rounded up, waking up early would spin until the deadline
+    return std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+
+}
+
+void EventLoop::stop() {
+    m_stopped = true;
+    wakeup();
+}
+
+void EventLoop::run() {
+
+    m_thread_id = std::this_thread::get_id();
+    m_running = true;
+
+    epoll_event events[MAX_EVENTS_PER_WAIT];
+
+    while (!m_stopped) {
+
+        int ready = epoll_wait(m_epollfd, events, MAX_EVENTS_PER_WAIT, next_timeout());
+
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cout << "Failed to wait for events. errno: " << errno << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+
+            int fd = events[i].data.fd;
+
+            if (fd == m_wakeupfd) {
+                uint64_t count;
+                while (read(m_wakeupfd, &count, sizeof(count)) > 0);
+                continue;
+            }
+
+            auto handler = m_handlers.find(fd);
+            if (handler == m_handlers.end())
+                continue; // removed by an earlier handler of this batch
+
+            // keeps the handler alive even if it removes itself
+            std::shared_ptr<fkt_event> f = handler->second;
+            (*f)(events[i].events);
+
+        }
+
+        run_posted();
+        run_timers();
+
+    }
+
+    run_posted();
+
+    m_running = false;
+    m_stopped = false;
+
+}
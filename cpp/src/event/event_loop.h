@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define MAX_EVENTS_PER_WAIT 64
+
+typedef std::function<void(uint32_t)> fkt_event;
+
+class EventLoop {
+public:
+
+    EventLoop();
+    ~EventLoop();
+
+    // calls f with the epoll events whenever fd becomes ready
+    bool add(int fd, uint32_t events, fkt_event f);
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // runs f on the loop thread, can be called from any thread
+    void post(std::function<void()> f);
+
+    // runs f on the loop thread once delay has passed (millisecond precision),
+    // can be called from any thread
+    void post_after(std::chrono::milliseconds delay, std::function<void()> f);
+
+    // dispatches events until stop() is called
+    void run();
+    void stop();
+
+    bool running() const { return m_running; };
+    bool in_loop_thread() const { return m_thread_id == std::this_thread::get_id(); };
+
+private:
+
+    int m_epollfd = -1;
+
+    // wakes up epoll_wait for posted functions and stop()
+    int m_wakeupfd = -1;
+
+    std::atomic<bool> m_running { false };
+    // set by stop(), also before run() was called, cleared when run() returns
+    std::atomic<bool> m_stopped { false };
+    std::thread::id m_thread_id;
+
+    // handlers are only touched from the loop thread (or before run())
+    std::unordered_map<int, std::shared_ptr<fkt_event>> m_handlers;
+
+    std::mutex m_mutex;
+    std::vector<std::function<void()>> m_posted;
+
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    // ordered by deadline, guarded by m_mutex
+    std::multimap<time_point, std::function<void()>> m_timers;
+
+    void wakeup();
+    void run_posted();
+    void run_timers();
+
+    // epoll_wait timeout until the next timer, -1 if there is none
+    int next_timeout();
+
+};
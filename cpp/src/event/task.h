@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <utility>
+
+// return type of a connection handler coroutine:
+//
+//   Task echo(WebSocket & ws) {
+//       while (auto message = co_await ws.receive())
+//           co_await ws.send(message->data());
+//   }
+//
+// The coroutine does not run before start() and frees itself when it is done.
+class Task {
+public:
+
+    struct promise_type {
+
+        // called once the coroutine has finished
+        std::function<void()> m_on_done = nullptr;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept {
+            if (m_on_done != nullptr)
+                m_on_done();
+            return {};
+        }
+
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+    };
+
+    Task(Task && other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    Task(const Task &) = delete;
+    Task & operator=(const Task &) = delete;
+
+    ~Task() {
+        if (m_handle)
+            m_handle.destroy(); // never started
+    }
+
+    // runs the coroutine until its first suspension point
+    void start(std::function<void()> on_done = nullptr) {
+        auto handle = std::exchange(m_handle, nullptr);
+        handle.promise().m_on_done = std::move(on_done);
+        handle.resume();
+    }
+
+private:
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    std::coroutine_handle<promise_type> m_handle;
+
+};
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "executor.h"
+
+// maximum number of tasks a worker runs from one strand before it gives
+// the other strands a chance
+#define STRAND_BATCH_SIZE 16
+
+// the executor and the worker index of the current thread
+thread_local Executor * t_executor = nullptr;
+thread_local size_t t_worker_index = 0;
+
+void Executor::Strand::wait_idle() {
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [&]() { return !m_scheduled && m_tasks.empty(); });
+
+}
+
+Executor::Executor(size_t threads, size_t max_queued, Backpressure policy)
+{
+
+    if (threads == 0)
+        threads = 1;
+
+    m_max_queued = max_queued;
+    m_policy = policy;
+
+    for (size_t i = 0; i < threads; i++)
+        m_workers.push_back(std::unique_ptr<Worker>(new Worker()));
+
+    for (size_t i = 0; i < threads; i++)
+        m_threads.emplace_back([this, i]() { run(i); });
+
+}
+
+Executor::~Executor() {
+    stop();
+}
+
+void Executor::stop() {
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+
+    m_wakeup.notify_all();
+    m_not_full.notify_all();
+
+    for (auto & thread : m_threads)
+        if (thread.joinable())
+            thread.join();
+
+}
+
+bool Executor::reserve() {
+
+    // a worker waiting for itself would never wake up again
+    bool on_worker = t_executor == this;
+
+    size_t queued = m_queued;
+
+    while (true) {
+
+        if (queued < m_max_queued || on_worker) {
+            if (m_queued.compare_exchange_weak(queued, queued + 1))
+                return true;
+            continue;
+        }
+
+        if (m_policy == Backpressure::Drop || !m_running)
+            return false;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(lock, [&]() { return m_queued < m_max_queued || !m_running; });
+        queued = m_queued;
+
+    }
+
+}
+
+void Executor::release() {
+
+    m_queued--;
+
+    if (m_policy == Backpressure::Block) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_not_full.notify_one();
+    }
+
+}
+
+void Executor::schedule(fkt_task task) {
+
+    // tasks posted from a worker stay on that worker, the others are spread
+    size_t index = (t_executor == this) ? t_worker_index : m_next++ % m_workers.size();
+
+    {
+        std::lock_guard<std::mutex> lock(m_workers[index]->mutex);
+        m_workers[index]->tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ready++;
+    }
+
+    m_wakeup.notify_one();
+
+}
+
+bool Executor::post(fkt_task task) {
+
+    if (!m_running || !reserve())
+        return false;
+
+    schedule([this, task]() {
+        release();
+        task();
+    });
+
+    return true;
+
+}
+
+bool Executor::post(Strand & strand, fkt_task task) {
+
+    if (!m_running || !reserve())
+        return false;
+
+    std::lock_guard<std::mutex> lock(strand.m_mutex);
+
+    strand.m_tasks.push_back(std::move(task));
+
+    if (!strand.m_scheduled) {
+        strand.m_scheduled = true;
+        schedule([this, &strand]() { run_strand(strand); });
+    }
+
+    return true;
+
+}
+
+void Executor::run_strand(Strand & strand) {
+
+    for (int i = 0; i < STRAND_BATCH_SIZE; i++) {
+
+        fkt_task task;
+
+        {
+            std::lock_guard<std::mutex> lock(strand.m_mutex);
+            if (strand.m_tasks.empty())
+                break;
+            task = std::move(strand.m_tasks.front());
+            strand.m_tasks.pop_front();
+        }
+
+        release();
+        task();
+
+    }
+
+    std::lock_guard<std::mutex> lock(strand.m_mutex);
+
+    if (strand.m_tasks.empty()) {
+        strand.m_scheduled = false;
+        strand.m_idle.notify_all();
+        return;
+    }
+
+    // still scheduled, continue after the tasks of the other strands
+    schedule([this, &strand]() { run_strand(strand); });
+
+}
+
+bool Executor::pop(size_t index, fkt_task & task) {
+
+    // own tasks are taken from the front ...
+    {
+        Worker & worker = *m_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            m_ready--;
+            return true;
+        }
+    }
+
+    // ... and the tasks of the other workers are stolen from the back
+    for (size_t i = 1; i < m_workers.size(); i++) {
+
+        Worker & victim = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            m_ready--;
+            return true;
+        }
+
+    }
+
+    return false;
+
+}
+
+void Executor::run(size_t index) {
+
+    t_executor = this;
+    t_worker_index = index;
+
+    fkt_task task;
+
+    while (true) {
+
+        if (pop(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        if (!m_running && m_ready == 0)
+            break;
+
+        m_wakeup.wait(lock, [&]() { return m_ready > 0 || !m_running; });
+
+    }
+
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void()> fkt_task;
+
+class Executor {
+public:
+
+    enum Backpressure {
+        Block,  // post() waits until the queue has room again
+        Drop    // post() rejects the task and returns false
+    };
+
+    // runs the posted tasks one after the other in the order they were posted
+    class Strand {
+    public:
+
+        Strand() = default;
+        ~Strand() = default;
+
+        // blocks until every task posted to this strand has been executed
+        void wait_idle();
+
+    private:
+
+        friend class Executor;
+
+        std::mutex m_mutex;
+        std::condition_variable m_idle;
+        // does not allocate while it is empty (one strand per connection)
+        std::list<fkt_task> m_tasks;
+
+        // a worker is currently (or soon) draining this strand
+        bool m_scheduled = false;
+
+    };
+
+    Executor(size_t threads, size_t max_queued, Backpressure policy);
+    ~Executor();
+
+    // runs the task on any worker thread
+    bool post(fkt_task task);
+
+    // runs the task after all tasks previously posted to the strand
+    bool post(Strand & strand, fkt_task task);
+
+    // executes the remaining tasks and joins the worker threads
+    void stop();
+
+    size_t queued() const { return m_queued; };
+    size_t threads() const { return m_threads.size(); };
+    Backpressure policy() const { return m_policy; };
+
+private:
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<fkt_task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_not_full;
+
+    // tasks accepted by post() which have not been started yet
+    std::atomic<size_t> m_queued { 0 };
+    // entries in the worker deques
+    std::atomic<size_t> m_ready { 0 };
+    std::atomic<size_t> m_next { 0 };
+    std::atomic<bool> m_running { true };
+
+    size_t m_max_queued;
+    Backpressure m_policy;
+
+    bool reserve();
+    void release();
+
+    void schedule(fkt_task task);
+    bool pop(size_t index, fkt_task & task);
+    void run(size_t index);
+    void run_strand(Strand & strand);
+
+};
@@ -6,12 +6,23 @@
 #pragma once
 
 // -- compile options
+// set by the CMake of fuzz/, the connections are served in the calling thread
+#ifndef COMPILE_FOR_FUZZING
 #define COMPILE_FOR_FUZZING 0
+#endif
 #define ARTIFICIAL_BUGS     0 // to be sure that the fuzzer can find some bugs :^)
 
 #define NOFORK  (COMPILE_FOR_FUZZING)
 
+// set by CMake when OpenSSL was found
+#ifndef WITH_TLS
+#define WITH_TLS 0
+#endif
+
+// the benchmarks build with 3, nothing is printed per message
+#ifndef DEBUG_LEVEL
 #define DEBUG_LEVEL 7
+#endif
 // --
 
 
@@ -28,7 +39,3 @@ enum DebugLevel {
 };
 
 #define USEFORK (!NOFORK)
-
-#if COMPILE_FOR_FUZZING
-extern char * g_fuzzing_input_file;
-#endif
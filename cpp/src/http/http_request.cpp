@@ -17,27 +17,52 @@ Request::Header Request::get_header (const std::string& name)
     return res;
 }
 
-std::vector<std::string> Request::header_value_as_array(std::string name) {
+std::vector<std::string> Request::header_value_as_array(std::string name, char separator) {
 
     std::string value = get_header(name).value;
     std::string buffer;
     std::vector<std::string> array;
 
+    auto trimmed = [](const std::string & part) {
+        size_t start = part.find_first_not_of(" \t");
+        if (start == std::string::npos)
+            return std::string();
+        return part.substr(start, part.find_last_not_of(" \t") - start + 1);
+    };
+
     for (size_t i = 0; i < value.size(); i++)
     {
-        if (value.at(i) == ';') {
-            array.push_back(buffer);
+        if (value.at(i) == separator) {
+            array.push_back(trimmed(buffer));
             buffer = "";
             continue;
         }
         buffer += value.at(i);
     }
-    array.push_back(buffer);
+    array.push_back(trimmed(buffer));
 
     return array;
 
 }
 
+std::string Request::Url::parameter(std::string_view name) const {
+
+    size_t start = 0;
+
+    while (start < query.size()) {
+        size_t end = query.find('&', start);
+        if (end == std::string::npos)
+            end = query.size();
+        std::string_view pair = std::string_view(query).substr(start, end - start);
+        if (pair.size() > name.size() && pair.starts_with(name) && pair[name.size()] == '=')
+            return std::string(pair.substr(name.size() + 1));
+        start = end + 1;
+    }
+
+    return "";
+
+}
+
 size_t Request::init_from_raw_request(std::vector<uint8_t> raw_request)
 {
 
@@ -140,6 +165,11 @@ size_t Request::init_from_raw_request(std::vector<uint8_t> raw_request)
 
     }
 
+    // the resource is the path with the query
+    size_t question_mark = m_url.query.find('?');
+    m_url.path = m_url.query.substr(0, question_mark);
+    m_url.query = question_mark == std::string::npos ? "" : m_url.query.substr(question_mark + 1);
+
     if (method == "GET")
     {
         m_method = Method::GET;
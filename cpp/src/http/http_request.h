@@ -6,6 +6,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
 #include <algorithm>
@@ -31,7 +32,12 @@ public:
     struct Url {
         std::string host;
         std::string path;
+        // without the '?'
         std::string query;
+
+        // the value of name in the query ("since" in "a=1&since=42"), empty
+        // if it is missing
+        std::string parameter(std::string_view name) const;
     };
 
     Method method() const { return m_method; }
@@ -39,7 +45,9 @@ public:
     std::vector<Header> headers() { return m_headers; };
 
     Header get_header(const std::string& name);
-    std::vector<std::string> header_value_as_array(std::string name);
+    // the parts of a list value ("a; b" or with separator ',' "a, b"), without
+    // the surrounding spaces
+    std::vector<std::string> header_value_as_array(std::string name, char separator = ';');
 
     size_t init_from_raw_request(std::vector<uint8_t> raw_request);
 
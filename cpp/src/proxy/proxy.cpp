@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "proxy.h"
+
+// reads exactly size bytes, false if the connection ended before
+static bool read_all(int fd, uint8_t * buffer, size_t size)
+{
+
+    while (size > 0) {
+        ssize_t bytes = ::read(fd, buffer, size);
+        if (bytes <= 0)
+            return false;
+        buffer += bytes;
+        size -= bytes;
+    }
+
+    return true;
+
+}
+
+Proxy::Proxy(Socket & socket, std::string backend, size_t connections)
+    : m_socket(socket), m_address(std::move(backend))
+{
+
+    for (size_t i = 0; i < std::max<size_t>(connections, 1); i++)
+        m_backends.push_back(std::make_unique<Backend>());
+
+}
+
+Proxy::~Proxy()
+{
+    stop();
+}
+
+void Proxy::encode(uint8_t * header, const Record & record)
+{
+
+    memset(header, 0, PROXY_HEADER_SIZE);
+
+    for (int i = 0; i < 4; i++)
+        header[i] = record.length >> (24 - 8 * i);
+
+    header[4] = record.opcode;
+
+    for (int i = 0; i < 8; i++)
+        header[8 + i] = record.id >> (56 - 8 * i);
+
+}
+
+Proxy::Record Proxy::decode(const uint8_t * header)
+{
+
+    Record record;
+
+    for (int i = 0; i < 4; i++)
+        record.length = (record.length << 8) | header[i];
+
+    record.opcode = (DataFrame::Opcode) header[4];
+
+    for (int i = 0; i < 8; i++)
+        record.id = (record.id << 8) | header[8 + i];
+
+    return record;
+
+}
+
+int Proxy::connect_backend()
+{
+
+    Address::Endpoint endpoint;
+
+    if (!Address::parse(m_address, endpoint)) {
+        std::cout << "Invalid backend address: " << m_address << std::endl;
+        return -1;
+    }
+
+    int fd = socket(endpoint.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        std::cout << "Failed to create socket. errno: " << errno << std::endl;
+        return -1;
+    }
+
+    if (::connect(fd, endpoint.addr(), endpoint.length) < 0) {
+#if DEBUG_LEVEL >= 4
+        std::cout << "[Proxy] Failed to connect to " << m_address << ". errno: " << errno << "\n";
+#endif
+        ::close(fd);
+        return -1;
+    }
+
+    // the records are written whole, they should not wait for more
+    if (endpoint.family() != AF_UNIX) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    return fd;
+
+}
+
+bool Proxy::start()
+{
+
+    if (m_running)
+        return true;
+
+    for (auto & backend : m_backends) {
+
+        backend->fd = connect_backend();
+
+        if (backend->fd < 0 || pipe2(backend->pipe, O_CLOEXEC) < 0) {
+            if (backend->fd >= 0)
+                std::cout << "Failed to create pipe. errno: " << errno << std::endl;
+            stop();
+            return false;
+        }
+
+    }
+
+    m_running = true;
+
+    for (auto & backend : m_backends) {
+        backend->reader = std::thread([this, b = backend.get()]() {
+            read_replies(*b);
+        });
+    }
+
+    m_closer = std::thread([this]() { send_closes(); });
+
+    return true;
+
+}
+
+void Proxy::stop()
+{
+
+    {
+        std::lock_guard<std::mutex> lock(m_close_mutex);
+        m_running = false;
+    }
+
+    m_closing.notify_all();
+
+    if (m_closer.joinable())
+        m_closer.join();
+
+    // the readers see the end of their connection
+    for (auto & backend : m_backends) {
+        std::lock_guard<std::mutex> lock(backend->mutex);
+        if (backend->fd >= 0)
+            ::shutdown(backend->fd, SHUT_RDWR);
+    }
+
+    for (auto & backend : m_backends) {
+
+        if (backend->reader.joinable())
+            backend->reader.join();
+
+        if (backend->fd >= 0)
+            ::close(backend->fd);
+
+        for (int & fd : backend->pipe) {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+        }
+
+        backend->fd = -1;
+
+    }
+
+}
+
+void Proxy::on_open(WebSocket & ws)
+{
+
+    // only a blocking connection waits, the event loop does not
+    timeval timeout { PROXY_SEND_TIMEOUT_MS / 1000, (PROXY_SEND_TIMEOUT_MS % 1000) * 1000 };
+
+    if (setsockopt(ws.connection(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+        std::cout << "Failed to set the send timeout. errno: " << errno << std::endl;
+
+}
+
+void Proxy::on_message(WebSocket & ws, const WebSocket::Message & message)
+{
+
+    Backend & backend = *m_backends[ws.id() % m_backends.size()];
+
+    Record record { (uint32_t) message.payload.size(), message.opcode, ws.id() };
+
+    if (!forward(backend, record, message.payload)) {
+        // 1014: bad gateway
+        ws.shutdown(1014);
+        return;
+    }
+
+    m_forwarded++;
+
+}
+
+void Proxy::on_close(WebSocket & ws)
+{
+
+    {
+        std::lock_guard<std::mutex> lock(m_close_mutex);
+        if (!m_running)
+            return;
+        m_closed.push_back(ws.id());
+    }
+
+    m_closing.notify_one();
+
+}
+
+void Proxy::send_closes()
+{
+
+    std::vector<uint64_t> closed;
+
+    while (true) {
+
+        {
+            std::unique_lock<std::mutex> lock(m_close_mutex);
+            m_closing.wait(lock, [&]() { return !m_running || !m_closed.empty(); });
+            if (!m_running)
+                return;
+            closed.swap(m_closed);
+        }
+
+        // the backend drops the replies to them from now on
+        for (uint64_t id : closed)
+            forward(*m_backends[id % m_backends.size()], { 0, DataFrame::ConectionClose, id }, {});
+
+        closed.clear();
+
+    }
+
+}
+
+bool Proxy::forward(Backend & backend, const Record & record, std::span<const uint8_t> payload)
+{
+
+    uint8_t header[PROXY_HEADER_SIZE];
+    encode(header, record);
+
+    iovec iov[2] = {
+        { header, PROXY_HEADER_SIZE },
+        { (void *) payload.data(), payload.size() },
+    };
+
+    msghdr msg {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = payload.empty() ? 1 : 2;
+
+    // the records of the clients on this connection do not interleave
+    std::lock_guard<std::mutex> lock(backend.mutex);
+
+    if (backend.fd < 0)
+        return false;
+
+    size_t remaining = PROXY_HEADER_SIZE + payload.size();
+
+    while (remaining > 0) {
+
+        ssize_t sent = sendmsg(backend.fd, &msg, MSG_NOSIGNAL);
+
+        if (sent <= 0) {
+            // the reader notices it as well and connects again
+            ::shutdown(backend.fd, SHUT_RDWR);
+            return false;
+        }
+
+        remaining -= sent;
+
+        while (msg.msg_iovlen > 0 && (size_t) sent >= msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (uint8_t *) msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
+
+    }
+
+    return true;
+
+}
+
+void Proxy::read_replies(Backend & backend)
+{
+
+    uint8_t header[PROXY_HEADER_SIZE];
+
+    while (m_running) {
+
+        if (read_all(backend.fd, header, PROXY_HEADER_SIZE) &&
+            handle_reply(backend, decode(header)))
+            continue;
+
+        if (!m_running)
+            break;
+
+        {
+            std::lock_guard<std::mutex> lock(backend.mutex);
+            ::close(backend.fd);
+            backend.fd = -1;
+        }
+
+#if DEBUG_LEVEL >= 4
+        std::cout << "[Proxy] lost a backend connection\n";
+#endif
+
+        // the clients of this connection get 1014 until it is back
+        while (m_running) {
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(PROXY_RECONNECT_MS));
+
+            int fd = connect_backend();
+            if (fd < 0)
+                continue;
+
+            std::lock_guard<std::mutex> lock(backend.mutex);
+            backend.fd = fd;
+            // stop() did not see this one
+            if (!m_running)
+                ::shutdown(fd, SHUT_RDWR);
+            break;
+
+        }
+
+    }
+
+}
+
+bool Proxy::handle_reply(Backend & backend, const Record & record)
+{
+
+    if (record.length > MAX_MESSAGE_SIZE)
+        return false;
+
+    if (record.opcode == DataFrame::ConectionClose) {
+
+        uint8_t payload[125];
+
+        if (record.length > sizeof(payload) || !read_all(backend.fd, payload, record.length))
+            return false;
+
+        uint16_t statuscode = (record.length >= 2) ? (payload[0] << 8) | payload[1] : 1000;
+
+        m_socket.with(record.id, [&](WebSocket * ws) {
+            ws->shutdown(statuscode);
+        });
+
+        return true;
+
+    }
+
+    if (record.opcode != DataFrame::TextFrame && record.opcode != DataFrame::BinaryFrame)
+        return false;
+
+    // the slot of the client is not reused while the reply is sent
+    bool sent = false;
+    bool open = m_socket.with(record.id, [&](WebSocket * ws) {
+        sent = ws->send_from(backend.fd, record.length, record.opcode, backend.pipe,
+                             std::chrono::milliseconds(PROXY_SEND_TIMEOUT_MS));
+    });
+
+    // the client is gone, the reply is read and dropped
+    if (!open) {
+        uint8_t discard[4096];
+        for (size_t remaining = record.length; remaining > 0;) {
+            size_t size = std::min(remaining, sizeof(discard));
+            if (!read_all(backend.fd, discard, size))
+                return false;
+            remaining -= size;
+        }
+        return true;
+    }
+
+    if (!sent)
+        return false;
+
+    m_replied++;
+    return true;
+
+}
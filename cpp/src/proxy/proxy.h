@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "socket.h"
+#include "protocol.h"
+
+// connections to the backend, a client always uses the same one
+#define PROXY_CONNECTIONS 4
+
+// header of a record: u32 payload length, u8 opcode, 3 bytes zero,
+// u64 connection id, big endian
+#define PROXY_HEADER_SIZE 16
+
+// a lost backend connection is opened again after this delay
+#define PROXY_RECONNECT_MS 100
+
+// a client taking longer for a reply is closed, the reader of its backend
+// connection serves the other clients meanwhile
+#define PROXY_SEND_TIMEOUT_MS 1000
+
+// Proxy mode: after the handshake the messages of the clients are forwarded
+// to a backend (Unix or TCP), the replies of the backend go back to them:
+//
+//   Proxy proxy(socket, "unix:/tmp/backend.sock");
+//   proxy.start();
+//   Protocols protocols;
+//   protocols.set_default(proxy);
+//   socket.set_protocols(&protocols);
+//
+// Both directions carry records, a header of PROXY_HEADER_SIZE bytes followed
+// by the payload. A text or binary record is a message of the connection
+// with the id, a close record (opcode 8) tells the backend that the client
+// is gone, or the proxy to close the client with the status code in its
+// payload.
+//
+// The messages of the clients arrive unmasked from WebSocket. The replies
+// need no masking, their payload is spliced from the backend connection to
+// the client without passing userspace (see WebSocket::send_from()). The
+// reader of a backend connection serves all clients hashed to it, so the
+// sends to a client are bounded by PROXY_SEND_TIMEOUT_MS.
+//
+// The proxy has to be stopped (or destroyed) before its socket.
+class Proxy {
+public:
+
+    struct Record {
+        uint32_t length = 0;
+        DataFrame::Opcode opcode = DataFrame::TextFrame;
+        uint64_t id = 0;
+    };
+
+    Proxy(Socket & socket, std::string backend, size_t connections = PROXY_CONNECTIONS);
+    ~Proxy();
+
+    Proxy(const Proxy &) = delete;
+    Proxy & operator=(const Proxy &) = delete;
+
+    // connects the pool, false if the backend is not reachable
+    bool start();
+    void stop();
+
+    // handler of the connections (see protocol.h)
+    void on_open(WebSocket & ws);
+    void on_message(WebSocket & ws, const WebSocket::Message & message);
+    // only queues the close record, it may be called by the event loop
+    void on_close(WebSocket & ws);
+
+    // messages sent to the backend and replies sent to the clients
+    uint64_t forwarded() const { return m_forwarded; };
+    uint64_t replied() const { return m_replied; };
+
+    static void encode(uint8_t * header, const Record & record);
+    static Record decode(const uint8_t * header);
+
+private:
+
+    struct Backend {
+        // -1 while the reader connects again
+        int fd = -1;
+        // splices the replies to the clients
+        int pipe[2] = { -1, -1 };
+        // records of the clients, from their reading threads
+        std::mutex mutex;
+        std::thread reader;
+    };
+
+    Socket & m_socket;
+    std::string m_address;
+    std::vector<std::unique_ptr<Backend>> m_backends;
+    std::atomic<bool> m_running { false };
+
+    std::atomic<uint64_t> m_forwarded { 0 };
+    std::atomic<uint64_t> m_replied { 0 };
+
+    // ids of the closed clients, their close records are written by
+    // m_closer
+    std::mutex m_close_mutex;
+    std::condition_variable m_closing;
+    std::vector<uint64_t> m_closed;
+    std::thread m_closer;
+
+    int connect_backend();
+
+    // false once the backend connection is broken
+    bool forward(Backend & backend, const Record & record, std::span<const uint8_t> payload);
+
+    // the replies of one backend connection, opens it again if it is lost
+    void read_replies(Backend & backend);
+    bool handle_reply(Backend & backend, const Record & record);
+
+    // writes the queued close records until stop()
+    void send_closes();
+
+};
@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <algorithm>
+
+#include "broker.h"
+
+Broker::~Broker()
+{
+
+    m_bus.close();
+
+    if (m_bus_thread.joinable())
+        m_bus_thread.join();
+
+    // a writer stops after its current send
+    std::unique_lock<std::mutex> lock(m_unsent_mutex);
+    m_running = false;
+    m_writers_done.wait(lock, [&]() { return m_writers == 0; });
+
+}
+
+bool Broker::join(const std::string & path, size_t slots)
+{
+
+    if (!m_bus.open(path, slots))
+        return false;
+
+    // the frames of the other processes are forwarded as they are
+    m_bus_thread = std::thread([this]() {
+        std::vector<uint8_t> frame;
+        m_bus.run([&](std::string_view topic, std::span<const uint8_t> raw_frame) {
+            frame.assign(raw_frame.begin(), raw_frame.end());
+            deliver(topic, frame);
+        });
+    });
+
+    return true;
+
+}
+
+void Broker::subscribe(WebSocket * webSocket, const std::string & pattern)
+{
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    add_subscriber(webSocket, pattern);
+
+}
+
+bool Broker::subscribe(WebSocket * webSocket, const std::string & topic, uint64_t since)
+{
+
+    std::vector<std::span<const uint8_t>> parts;
+    bool complete = false;
+
+    {
+        // a message published meanwhile is either replayed or delivered,
+        // the delivered ones are queued behind the replayed ones
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_histories.find(topic);
+        if (it != m_histories.end()) {
+            complete = it->second.since(since, parts);
+            if (!parts.empty())
+                webSocket->queue_raw(parts);
+        }
+
+        add_subscriber(webSocket, topic);
+    }
+
+    // written without m_mutex, a slow client does not hold up publish()
+    if (!parts.empty())
+        webSocket->send_queued();
+
+    return complete;
+
+}
+
+bool Broker::subscribe(WebSocket * webSocket, const std::string & pattern, const std::string & filter)
+{
+
+    std::string error;
+    uint32_t number = m_filters.add(filter, &error);
+
+    if (number == 0) {
+        std::cout << "Invalid filter: " << filter << " (" << error << ")" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return add_subscriber(webSocket, pattern, number);
+
+}
+
+bool Broker::add_subscriber(WebSocket * webSocket, const std::string & pattern, uint32_t filter)
+{
+
+    if (!m_index.subscribe(pattern, webSocket->id(), filter)) {
+        std::cout << "Invalid topic pattern: " << pattern << std::endl;
+        if (filter != 0)
+            m_filters.remove(filter);
+        return false;
+    }
+
+    // written by send_unsent(), a stalled client is shut down (see flush())
+    if (!webSocket->attached()) {
+        timeval timeout { BROKER_SEND_TIMEOUT_MS / 1000, (BROKER_SEND_TIMEOUT_MS % 1000) * 1000 };
+        if (setsockopt(webSocket->connection(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+            std::cout << "Failed to set the send timeout. errno: " << errno << std::endl;
+    }
+
+    auto & patterns = m_patterns[webSocket->id()];
+    auto it = std::find_if(patterns.begin(), patterns.end(), [&](const auto & p) { return p.first == pattern; });
+
+    // subscribing again replaces the filter
+    if (it == patterns.end()) {
+        patterns.emplace_back(pattern, filter);
+    } else {
+        if (it->second != 0)
+            m_filters.remove(it->second);
+        it->second = filter;
+    }
+
+    return true;
+
+}
+
+void Broker::remove_subscriber(uint64_t id, const std::string & pattern)
+{
+
+    m_index.unsubscribe(pattern, id);
+
+    auto it = m_patterns.find(id);
+    if (it == m_patterns.end())
+        return;
+
+    auto & patterns = it->second;
+    auto p = std::find_if(patterns.begin(), patterns.end(), [&](const auto & p) { return p.first == pattern; });
+    if (p == patterns.end())
+        return;
+
+    if (p->second != 0)
+        m_filters.remove(p->second);
+
+    patterns.erase(p);
+    if (patterns.empty())
+        m_patterns.erase(it);
+
+}
+
+void Broker::keep_history(const std::string & topic, size_t frames, size_t bytes)
+{
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_histories.try_emplace(topic, frames, bytes).second)
+        m_history_topics++;
+
+}
+
+uint64_t Broker::sequence(const std::string & topic)
+{
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_histories.find(topic);
+    return it == m_histories.end() ? 0 : it->second.sequence();
+
+}
+
+void Broker::unsubscribe(WebSocket * webSocket, const std::string & pattern)
+{
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    remove_subscriber(webSocket->id(), pattern);
+
+}
+
+size_t Broker::subscribers(const std::string & pattern)
+{
+
+    return m_index.subscribers(pattern);
+
+}
+
+uint64_t Broker::publish(const std::string & topic, std::string_view message, DataFrame::Opcode opcode)
+{
+
+    return deliver(topic, encode(topic, message, opcode));
+
+}
+
+uint64_t Broker::publish_latest(const std::string & topic, const std::string & key, std::string_view message, DataFrame::Opcode opcode)
+{
+
+    return deliver(topic, encode(topic, message, opcode), &key);
+
+}
+
+std::vector<uint8_t> Broker::encode(const std::string & topic, std::string_view message, DataFrame::Opcode opcode)
+{
+
+    DataFrame frame;
+    frame.m_opcode = opcode;
+    frame.m_application_data.assign(message.begin(), message.end());
+    frame.m_payload_len_bytes = message.size();
+
+    // encoded once for all subscribers in all processes
+    std::vector<uint8_t> raw_frame = frame.get_raw_frame();
+
+    if (m_bus_thread.joinable() && !m_bus.publish(topic, raw_frame))
+        std::cout << "Message to " << topic << " is too large for the bus" << std::endl;
+
+    return raw_frame;
+
+}
+
+uint64_t Broker::deliver(std::string_view topic, const std::vector<uint8_t> & frame, const std::string * key)
+{
+
+    std::vector<TopicIndex::Subscription> subscriptions;
+    uint64_t sequence = 0;
+
+    if (m_history_topics > 0) {
+
+        // the frame is either replayed or delivered to a subscribe() with
+        // since, see there
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto history = m_histories.find(std::string(topic));
+        if (history != m_histories.end())
+            sequence = history->second.append(frame);
+
+        m_index.match(topic, subscriptions);
+
+    } else {
+        m_index.match(topic, subscriptions);
+    }
+
+    // each distinct filter once, whatever the number of its subscribers
+    std::vector<uint32_t> filters;
+    std::vector<uint32_t> passed;
+
+    for (const auto & subscription : subscriptions)
+        if (subscription.filter != 0)
+            filters.push_back(subscription.filter);
+
+    if (!filters.empty()) {
+
+        std::sort(filters.begin(), filters.end());
+        filters.erase(std::unique(filters.begin(), filters.end()), filters.end());
+
+        // the payload behind the header of the (unmasked) frame
+        size_t length = frame.size() > 1 ? frame[1] & 0x7f : 0;
+        size_t header = (length < 126) ? 2 : (length == 126) ? 4 : 10;
+        std::string_view payload;
+        if (frame.size() >= header)
+            payload = std::string_view((const char *) frame.data() + header, frame.size() - header);
+
+        m_filters.evaluate(payload, filters, passed);
+
+    }
+
+    std::vector<uint64_t> gone;
+    std::vector<uint64_t> blocking;
+    std::vector<uint64_t> behind;
+
+    for (size_t i = 0; i < subscriptions.size(); i++) {
+
+        uint64_t id = subscriptions[i].id;
+
+        // sorted by id, the id is sent to with its last subscription
+        if (i + 1 < subscriptions.size() && subscriptions[i + 1].id == id)
+            continue;
+
+        bool wanted = false;
+        for (size_t j = i + 1; j-- > 0 && subscriptions[j].id == id && !wanted;)
+            wanted = subscriptions[j].filter == 0 ||
+                     std::binary_search(passed.begin(), passed.end(), subscriptions[j].filter);
+
+        bool open = m_socket.with(id, [&](WebSocket * webSocket) {
+            if (!wanted || webSocket->state() < WebSocket::Connected)
+                return;
+            if (!webSocket->attached())
+                blocking.push_back(id);
+            else if (key != nullptr)
+                webSocket->send_latest(*key, frame);
+            else
+                webSocket->send_raw(frame);
+        });
+
+        if (!open)
+            gone.push_back(id);
+
+    }
+
+    if (!blocking.empty()) {
+
+        // one copy for all of them, without touching the connections
+        auto shared = std::make_shared<const std::vector<uint8_t>>(frame);
+
+        {
+            std::lock_guard<std::mutex> lock(m_unsent_mutex);
+
+            for (uint64_t id : blocking) {
+
+                auto [it, added] = m_unsent.try_emplace(id);
+                it->second.frames.push_back(shared);
+                it->second.bytes += shared->size();
+
+                if (it->second.bytes > BROKER_MAX_UNSENT) {
+                    it->second.frames.clear();
+                    it->second.bytes = 0;
+                    behind.push_back(id);
+                }
+
+                if (added && m_running) {
+                    m_writers++;
+                    std::thread([this, id]() { send_unsent(id); }).detach();
+                } else if (added) {
+                    m_unsent.erase(it);
+                }
+
+            }
+        }
+
+        // fails the send the sender may be stuck in, the reading thread
+        // closes the connection
+        for (uint64_t id : behind)
+            m_socket.with(id, [](WebSocket * webSocket) { ::shutdown(webSocket->connection(), SHUT_RDWR); });
+
+    }
+
+    if (gone.empty())
+        return sequence;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // all patterns of the closed connections, not only the matching ones
+    for (uint64_t id : gone) {
+        auto it = m_patterns.find(id);
+        if (it == m_patterns.end())
+            continue;
+        for (const auto & pattern : std::vector<std::pair<std::string, uint32_t>>(it->second))
+            remove_subscriber(id, pattern.first);
+    }
+
+    return sequence;
+
+}
+
+void Broker::send_unsent(uint64_t id)
+{
+
+    std::vector<std::shared_ptr<const std::vector<uint8_t>>> frames;
+    std::vector<std::span<const uint8_t>> parts;
+
+    while (true) {
+
+        {
+            std::lock_guard<std::mutex> lock(m_unsent_mutex);
+            auto it = m_unsent.find(id);
+            if (!m_running || it->second.frames.empty()) {
+                m_unsent.erase(it);
+                if (--m_writers == 0)
+                    m_writers_done.notify_all();
+                return;
+            }
+            frames.swap(it->second.frames);
+            it->second.bytes = 0;
+        }
+
+        // the frames queued meanwhile leave together, like the ones of a batch
+        parts.clear();
+        for (const auto & frame : frames)
+            parts.emplace_back(*frame);
+
+        m_socket.with(id, [&](WebSocket * webSocket) {
+            if (webSocket->state() >= WebSocket::Connected)
+                webSocket->send_raw(parts);
+        });
+
+        frames.clear();
+
+    }
+
+}
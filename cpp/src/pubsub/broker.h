@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "socket.h"
+#include "bus.h"
+#include "history.h"
+#include "topic_index.h"
+#include "filter.h"
+
+// a blocking subscriber is closed when a send to it stalls that long, or
+// when that many bytes wait for it
+#define BROKER_SEND_TIMEOUT_MS 1000
+#define BROKER_MAX_UNSENT (4 * 1024 * 1024)
+
+// Topics the connections of a Socket subscribe to. A message is encoded once
+// and the frame is sent to every subscriber, with join() also to the
+// subscribers of the other processes on the same bus (see bus.h):
+//
+//   Broker broker(socket);
+//   broker.join("/tmp/wsserver.bus");
+//   socket.on_open([&](WebSocket * ws) { broker.subscribe(ws, "news"); });
+//   broker.publish("news", "...");
+//
+// With keep_history() a topic numbers its messages and keeps the last ones,
+// a reconnecting client names the last one it got (like ?since=42) and gets
+// the missed frames replayed behind the handshake response:
+//
+//   broker.keep_history("news", 1024, 1024 * 1024);
+//   ws->on_handshake([&broker, ws]() {
+//       std::string since = ws->url().parameter("since");
+//       broker.subscribe(ws, "news", strtoull(since.c_str(), nullptr, 10));
+//   });
+//
+// A subscription can be a pattern of the topics (see topic_index.h), like
+// "prices.EU.*" or "orders.#", a connection gets a message once even if
+// several of its patterns match. The history belongs to a topic.
+//
+// A subscription with a filter (see filter.h) only gets the messages whose
+// fields match it:
+//
+//   broker.subscribe(ws, "trades.#", "symbol in {SAP, BMW} && qty > 1000");
+//
+// Each distinct filter is evaluated once per message, not once per
+// subscriber.
+//
+// The sequence numbers belong to the process, the frames of the other
+// processes on the bus are numbered as they arrive.
+//
+// A connection served by the event loop is sent to right away (a congested
+// one queues the frame). The frames of a blocking connection are kept by the
+// broker and written by a thread of the connection while there are any, so
+// a client that does not read does not hold up publish(), the bus or the
+// other subscribers. It is closed, see BROKER_SEND_TIMEOUT_MS (set as
+// SO_SNDTIMEO of the connection) and BROKER_MAX_UNSENT.
+//
+// The broker has to be destroyed before its socket.
+class Broker {
+public:
+
+    explicit Broker(Socket & socket) : m_socket(socket) {};
+    ~Broker();
+
+    // links this broker with the brokers of the other processes joining
+    // the bus at path
+    bool join(const std::string & path, size_t slots = BUS_SLOTS);
+
+    // closed connections are removed with the next message to a topic
+    // their patterns match
+    void subscribe(WebSocket * webSocket, const std::string & pattern);
+    void unsubscribe(WebSocket * webSocket, const std::string & pattern);
+
+    // with a filter, false if it is not valid (then nothing is subscribed)
+    bool subscribe(WebSocket * webSocket, const std::string & pattern, const std::string & filter);
+
+    // subscribes after sending the messages following since, no message is
+    // lost or sent twice in between. False if the history of the topic does
+    // not reach back to since, the client has to fetch the state elsewhere
+    // (it is subscribed nevertheless).
+    bool subscribe(WebSocket * webSocket, const std::string & topic, uint64_t since);
+
+    // numbers the messages of the topic from now on and keeps the last ones,
+    // up to frames messages or bytes encoded bytes
+    void keep_history(const std::string & topic, size_t frames, size_t bytes);
+
+    // sends the message to the subscribers of the topic in all processes,
+    // returns its sequence (0 for a topic without history)
+    uint64_t publish(const std::string & topic, std::string_view message, DataFrame::Opcode opcode = DataFrame::TextFrame);
+
+    // like publish(), a subscriber that does not keep up only gets the
+    // latest message of each key (see WebSocket::send_latest()). The other
+    // processes on the bus send every message.
+    uint64_t publish_latest(const std::string & topic, const std::string & key, std::string_view message, DataFrame::Opcode opcode = DataFrame::TextFrame);
+
+    // sequence of the last message of the topic, 0 without history
+    uint64_t sequence(const std::string & topic);
+
+    // subscribers of exactly this pattern (or topic)
+    size_t subscribers(const std::string & pattern);
+
+    // the filters of the subscriptions, see Filters::size() and evaluations()
+    const Filters & filters() const { return m_filters; };
+
+    // the bus (nullptr before join()), see Bus::lost()
+    const Bus * bus() const { return m_bus_thread.joinable() ? &m_bus : nullptr; };
+
+private:
+
+    Socket & m_socket;
+
+    // pattern -> WebSocket::id() of the subscribers and their filters, read
+    // by publish() without m_mutex
+    TopicIndex m_index;
+    Filters m_filters;
+
+    std::mutex m_mutex;
+    // WebSocket::id() -> its patterns with their filters, to remove a closed
+    // connection
+    std::unordered_map<uint64_t, std::vector<std::pair<std::string, uint32_t>>> m_patterns;
+    std::unordered_map<std::string, History> m_histories;
+    // topics with a history, publish() takes m_mutex only for them
+    std::atomic<size_t> m_history_topics { 0 };
+
+    Bus m_bus;
+    std::thread m_bus_thread;
+
+    // frames for a blocking connection, shared by its subscribers
+    struct Unsent {
+        std::vector<std::shared_ptr<const std::vector<uint8_t>>> frames;
+        size_t bytes = 0;
+    };
+
+    // WebSocket::id() -> the frames its writer has not taken yet, there is
+    // an entry as long as the writer runs
+    std::mutex m_unsent_mutex;
+    std::condition_variable m_writers_done;
+    std::unordered_map<uint64_t, Unsent> m_unsent;
+    size_t m_writers = 0;
+    bool m_running = true;
+
+    // the writer of the connection, returns when m_unsent has nothing left
+    // for it
+    void send_unsent(uint64_t id);
+
+    // encodes the message and publishes it on the bus
+    std::vector<uint8_t> encode(const std::string & topic, std::string_view message, DataFrame::Opcode opcode);
+
+    // adds the frame to the history of the topic and sends it to the local
+    // subscribers (with send_latest() if there is a key), returns its
+    // sequence
+    uint64_t deliver(std::string_view topic, const std::vector<uint8_t> & frame, const std::string * key = nullptr);
+
+    // with m_mutex held, the subscription takes the reference of the filter
+    bool add_subscriber(WebSocket * webSocket, const std::string & pattern, uint32_t filter = 0);
+    void remove_subscriber(uint64_t id, const std::string & pattern);
+
+};
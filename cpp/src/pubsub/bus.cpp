@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "bus.h"
+
+#include <bit>
+#include <climits>
+#include <random>
+#include <thread>
+
+#define BUS_MAGIC 0x75627377 // "wsbu"
+#define BUS_HEADER_SIZE 4096
+
+Bus::~Bus()
+{
+
+    close();
+
+    if (m_header != nullptr) {
+        // nobody left to serve the ring to, the next process creates a new one
+        int lock = this->lock(true);
+        if (m_header->processes.fetch_sub(1) == 1)
+            unlink(m_path.c_str());
+        if (lock != -1)
+            ::close(lock);
+        munmap(m_header, m_size);
+    }
+
+    if (m_listen_fd != -1)
+        ::close(m_listen_fd);
+    if (m_fd != -1)
+        ::close(m_fd);
+
+}
+
+bool Bus::map(size_t size)
+{
+
+    void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (memory == MAP_FAILED) {
+        std::cout << "Failed to map the bus. errno: " << errno << std::endl;
+        return false;
+    }
+
+    m_size = size;
+    m_header = (Header *) memory;
+    m_slots = (Slot *) ((uint8_t *) memory + BUS_HEADER_SIZE);
+
+    return true;
+
+}
+
+int Bus::lock(bool wait)
+{
+
+    std::string lock_path = m_path + ".lock";
+
+    int fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        std::cout << "Failed to open " << lock_path << ". errno: " << errno << std::endl;
+        return -1;
+    }
+
+    if (flock(fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) < 0) {
+        if (errno != EWOULDBLOCK)
+            std::cout << "Failed to lock " << lock_path << ". errno: " << errno << std::endl;
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+
+}
+
+bool Bus::open(const std::string & path, size_t slots)
+{
+
+    static_assert(sizeof(Header) <= BUS_HEADER_SIZE);
+
+    m_path = path;
+
+    std::random_device random;
+    m_origin = ((uint64_t) random() << 32) | random();
+
+    // one process at a time decides whether the ring has to be created
+    int lock = -1;
+    std::vector<int> fds;
+
+    for (int waited = 0;; waited += 100) {
+
+        lock = this->lock(true);
+        if (lock == -1)
+            return false;
+
+        fds = Handoff::take_over(path);
+
+        if (!fds.empty() || access(path.c_str(), F_OK) != 0 || waited >= 2 * BUS_TAKEOVER_MS)
+            break;
+
+        // a stale socket, the serving process is gone and one of the others
+        // takes over (or there are no others), it needs the lock for that
+        ::close(lock);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    }
+
+    bool mapped = false;
+
+    if (!fds.empty()) {
+
+        for (size_t i = 1; i < fds.size(); i++)
+            ::close(fds[i]);
+        m_fd = fds[0];
+
+        struct stat status {};
+        fstat(m_fd, &status);
+
+        mapped = status.st_size > BUS_HEADER_SIZE && map(status.st_size) && m_header->magic == BUS_MAGIC;
+
+    } else {
+
+        slots = std::bit_ceil(std::max<size_t>(slots, 16));
+
+        m_fd = memfd_create("wsserver-bus", MFD_CLOEXEC);
+        size_t size = BUS_HEADER_SIZE + slots * sizeof(Slot);
+
+        // the memory is zeroed, no slot is published
+        if (m_fd != -1 && ftruncate(m_fd, size) == 0 && map(size)) {
+            m_header->slots = slots;
+            m_header->magic = BUS_MAGIC;
+            m_listen_fd = Handoff::listen(path);
+            mapped = m_listen_fd != -1;
+        } else {
+            std::cout << "Failed to create the bus. errno: " << errno << std::endl;
+        }
+
+    }
+
+    if (mapped)
+        m_header->processes++;
+
+    ::close(lock);
+
+    if (!mapped) {
+        if (m_header != nullptr)
+            munmap(m_header, m_size);
+        m_header = nullptr;
+        return false;
+    }
+
+    // records published from now on
+    m_position = m_header->head.load();
+    m_running = true;
+
+    return true;
+
+}
+
+bool Bus::publish(std::string_view topic, std::span<const uint8_t> frame)
+{
+
+    if (m_header == nullptr)
+        return false;
+
+    constexpr size_t slot_size = sizeof(Slot::data);
+    size_t length = sizeof(Record) + topic.size() + frame.size();
+    size_t slots = (length + slot_size - 1) / slot_size;
+
+    if (slots > m_header->slots / 2 || topic.size() > UINT16_MAX)
+        return false;
+
+    uint64_t position = m_header->head.fetch_add(slots, std::memory_order_relaxed);
+
+    // a writer that stalled for a whole lap must not overwrite (or hide)
+    // the newer records in its slots, the readers skip its record as one
+    // of a dead writer
+    for (size_t i = 0; i < slots; i++) {
+        uint64_t writing = 2 * (position + i) + 1;
+        uint64_t sequence = slot(position + i).sequence.load(std::memory_order_relaxed);
+        while (sequence < writing && !slot(position + i).sequence.compare_exchange_weak(sequence, writing, std::memory_order_relaxed));
+        if (sequence > writing)
+            return false;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Record record { m_origin, (uint32_t) length, (uint16_t) topic.size(), (uint16_t) slots };
+
+    size_t offset = 0;
+    auto write = [&](const void * data, size_t size) {
+        const uint8_t * bytes = (const uint8_t *) data;
+        while (size > 0) {
+            size_t part = std::min(size, slot_size - offset % slot_size);
+            memcpy(slot(position + offset / slot_size).data + offset % slot_size, bytes, part);
+            offset += part;
+            bytes += part;
+            size -= part;
+        }
+    };
+
+    write(&record, sizeof(record));
+    write(topic.data(), topic.size());
+    write(frame.data(), frame.size());
+
+    // the first slot last, a reader seeing it published sees the whole
+    // record. A slot taken by the next lap meanwhile stays with it.
+    for (size_t i = slots; i-- > 0;) {
+        uint64_t writing = 2 * (position + i) + 1;
+        slot(position + i).sequence.compare_exchange_strong(writing, writing + 1, std::memory_order_release, std::memory_order_relaxed);
+    }
+
+    m_header->signal.fetch_add(1);
+
+    if (m_header->waiters.load() > 0)
+        syscall(SYS_futex, (uint32_t *) &m_header->signal, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+
+    return true;
+
+}
+
+Bus::Read Bus::read_record(uint64_t position, size_t & slots)
+{
+
+    constexpr size_t slot_size = sizeof(Slot::data);
+
+    uint64_t sequence = slot(position).sequence.load(std::memory_order_acquire);
+
+    if (sequence < 2 * position + 2)
+        return Pending;
+    if (sequence > 2 * position + 2)
+        return Lapped;
+
+    Record record;
+    memcpy(&record, slot(position).data, sizeof(record));
+
+    // torn by a writer of the next lap
+    if (record.slots == 0 || record.slots > m_header->slots / 2 ||
+        record.length > record.slots * slot_size || record.length < sizeof(Record) + record.topic_length)
+    {
+        return Lapped;
+    }
+
+    m_record.resize(record.length);
+
+    for (size_t offset = 0; offset < record.length;) {
+        size_t part = std::min<size_t>(record.length - offset, slot_size - offset % slot_size);
+        memcpy(m_record.data() + offset, slot(position + offset / slot_size).data + offset % slot_size, part);
+        offset += part;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    for (size_t i = 0; i < record.slots; i++)
+        if (slot(position + i).sequence.load(std::memory_order_relaxed) != 2 * (position + i) + 2)
+            return Lapped;
+
+    slots = record.slots;
+    return Ready;
+
+}
+
+void Bus::run(const fkt_record & f)
+{
+
+    auto now = std::chrono::steady_clock::now();
+    auto last_served = now;
+    auto stalled_since = now;
+    bool stalled = false;
+
+    while (m_running) {
+
+        uint32_t signal = m_header->signal.load();
+
+        size_t slots = 0;
+        Read result = read_record(m_position, slots);
+
+        if (result == Ready) {
+
+            Record record;
+            memcpy(&record, m_record.data(), sizeof(record));
+
+            if (record.origin != m_origin) {
+                const char * topic = (const char *) m_record.data() + sizeof(Record);
+                size_t frame_offset = sizeof(Record) + record.topic_length;
+                f(std::string_view(topic, record.topic_length),
+                  std::span<const uint8_t>(m_record.data() + frame_offset, record.length - frame_offset));
+            }
+
+            m_position += slots;
+            stalled = false;
+
+        }
+
+        now = std::chrono::steady_clock::now();
+
+        if (result == Pending && m_header->head.load() > m_position) {
+            // claimed but not published, the writer may have died
+            if (!stalled) {
+                stalled = true;
+                stalled_since = now;
+            } else if (now - stalled_since > std::chrono::milliseconds(BUS_STALL_MS)) {
+                result = Lapped;
+            }
+        }
+
+        if (result == Lapped) {
+            // continues with the next record, the older ones are gone
+            uint64_t head = m_header->head.load();
+            m_lost += head - m_position;
+            m_position = head;
+            stalled = false;
+        }
+
+        auto serve_interval = std::chrono::milliseconds(m_listen_fd != -1 ? 50 : BUS_TAKEOVER_MS);
+        if (now - last_served > serve_interval) {
+            last_served = now;
+            serve();
+        }
+
+        if (result != Pending)
+            continue;
+
+        // sleeps until the next record is published, the timeout serves
+        // joining processes and notices close()
+        timespec timeout { 0, 50 * 1000 * 1000 };
+        m_header->waiters++;
+        syscall(SYS_futex, (uint32_t *) &m_header->signal, FUTEX_WAIT, signal, &timeout, nullptr, 0);
+        m_header->waiters--;
+
+    }
+
+}
+
+void Bus::close()
+{
+    m_running = false;
+}
+
+void Bus::serve()
+{
+
+    if (m_listen_fd != -1) {
+
+        int connection;
+        while ((connection = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+            Handoff::send_fds(connection, { m_fd });
+            ::close(connection);
+        }
+
+        return;
+
+    }
+
+    // another process is taking over (or joining), tried again next time
+    int lock = this->lock(false);
+    if (lock == -1)
+        return;
+
+    // somebody serves the ring
+    std::vector<int> fds = Handoff::take_over(m_path);
+    if (!fds.empty()) {
+        for (int fd : fds)
+            ::close(fd);
+        ::close(lock);
+        return;
+    }
+
+    // listen() replaces the stale socket, nobody else does meanwhile
+    m_listen_fd = Handoff::listen(m_path);
+    ::close(lock);
+
+#if DEBUG_LEVEL >= 5
+    if (m_listen_fd != -1)
+        std::cout << "Serving the bus at " << m_path << "\n";
+#endif
+
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "handoff.h"
+
+// default number of slots, a power of two
+#define BUS_SLOTS 4096
+// a record (topic and frame) takes as many slots as it needs
+#define BUS_SLOT_SIZE 256
+// the reader skips a record whose writer did not finish within this time
+#define BUS_STALL_MS 100
+// a process takes over serving the ring within this time if the serving
+// one is gone, joining processes wait twice as long for it
+#define BUS_TAKEOVER_MS 1000
+
+typedef std::function<void(std::string_view topic, std::span<const uint8_t> frame)> fkt_record;
+
+// Shared memory ring linking the wsserver processes of a host. Every process
+// writes its records (a topic with an already encoded frame) into the ring
+// and reads the records of all others, nothing passes the network stack.
+//
+// The ring lives in a memfd, the first process serves it to the others over
+// the Unix socket at path (SCM_RIGHTS, see handoff.h), one of the remaining
+// processes takes over if it exits. Creating, joining and taking over hold
+// the lock file path.lock, so only one process at a time replaces the
+// socket. Writers claim slots with one atomic add, every slot has a
+// sequence number telling the readers whether it is written, published or
+// already overwritten by the next lap (it only grows, a writer lapped
+// before it wrote its record gives it up):
+//
+//     2 * position + 1   being written
+//     2 * position + 2   published
+//
+// Readers never hold back writers, a reader that is lapped loses the
+// overwritten records (lost()). A waiting reader sleeps on a futex in the
+// ring, writers only wake it if somebody sleeps.
+class Bus {
+public:
+
+    Bus() = default;
+    ~Bus();
+
+    // joins the ring served at path or creates it, slots only matters for
+    // the first process
+    bool open(const std::string & path, size_t slots = BUS_SLOTS);
+
+    // false if the record does not fit into half of the ring, or the writers
+    // of the next lap took its slots before it was written
+    bool publish(std::string_view topic, std::span<const uint8_t> frame);
+
+    // calls f for the records of the other processes until close()
+    void run(const fkt_record & f);
+    void close();
+
+    // slots this process skipped, their records were overwritten (or their
+    // writer died) before it read them
+    uint64_t lost() const { return m_lost; };
+
+private:
+
+    struct Header {
+        uint32_t magic;
+        uint32_t slots;
+        // processes using the ring, the last one removes the socket at path
+        std::atomic<uint32_t> processes;
+        alignas(64) std::atomic<uint64_t> head;
+        // futex word, incremented for every published record
+        alignas(64) std::atomic<uint32_t> signal;
+        std::atomic<uint32_t> waiters;
+    };
+
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        uint8_t data[BUS_SLOT_SIZE - sizeof(uint64_t)];
+    };
+
+    // at the start of the first slot of a record
+    struct Record {
+        uint64_t origin;
+        uint32_t length;
+        uint16_t topic_length;
+        uint16_t slots;
+    };
+
+    static_assert(sizeof(Slot) == BUS_SLOT_SIZE);
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring is shared between processes");
+
+    enum Read {
+        Ready,
+        Pending,
+        Lapped
+    };
+
+    int m_fd = -1;
+    int m_listen_fd = -1;
+    std::string m_path;
+
+    Header * m_header = nullptr;
+    Slot * m_slots = nullptr;
+    size_t m_size = 0;
+
+    // tells the records of this process apart
+    uint64_t m_origin = 0;
+
+    // next slot to read
+    uint64_t m_position = 0;
+
+    std::atomic<bool> m_running { false };
+    std::atomic<uint64_t> m_lost { 0 };
+
+    // the record read by read_record()
+    std::vector<uint8_t> m_record;
+
+    bool map(size_t size);
+
+    // flock() of path.lock, -1 if it failed (or is held with wait = false)
+    int lock(bool wait);
+    Slot & slot(uint64_t position) { return m_slots[position & (m_header->slots - 1)]; };
+
+    // copies the record at position into m_record
+    Read read_record(uint64_t position, size_t & slots);
+
+    // hands the memfd to joining processes, takes over a dead rendezvous
+    void serve();
+
+};
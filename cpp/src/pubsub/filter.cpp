@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <mutex>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "filter.h"
+
+// -- scanning
+
+static size_t skip_space(std::string_view json, size_t i)
+{
+    while (i < json.size() && (json[i] == ' ' || json[i] == '\t' || json[i] == '\n' || json[i] == '\r'))
+        i++;
+    return i;
+}
+
+// the closing quote of the string starting at i (behind the opening one)
+static size_t string_end(std::string_view json, size_t i)
+{
+
+    const char * data = json.data();
+
+    while (i < json.size()) {
+
+#if defined(__SSE2__)
+        // 16 bytes at a time up to the next quote or backslash
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+
+        while (i + 16 <= json.size()) {
+            __m128i chunk = _mm_loadu_si128((const __m128i *) (data + i));
+            int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+            if (mask != 0) {
+                i += __builtin_ctz(mask);
+                break;
+            }
+            i += 16;
+        }
+#endif
+
+        while (i < json.size() && data[i] != '"' && data[i] != '\\')
+            i++;
+
+        if (i >= json.size())
+            break;
+
+        if (data[i] == '"')
+            return i;
+
+        // the escaped byte
+        i += 2;
+
+    }
+
+    return std::string_view::npos;
+
+}
+
+// behind the object or array starting at i
+static size_t skip_nested(std::string_view json, size_t i)
+{
+
+    int depth = 0;
+
+    for (; i < json.size(); i++) {
+
+        char c = json[i];
+
+        if (c == '"') {
+            i = string_end(json, i + 1);
+            if (i == std::string_view::npos)
+                return i;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if ((c == '}' || c == ']') && --depth == 0) {
+            return i + 1;
+        }
+
+    }
+
+    return std::string_view::npos;
+
+}
+
+bool Filters::scan(std::string_view json, std::span<const std::string> names, std::vector<Field> & fields)
+{
+
+    fields.assign(names.size(), Field());
+
+    size_t i = skip_space(json, 0);
+    if (i == json.size() || json[i] != '{')
+        return false;
+
+    i = skip_space(json, i + 1);
+    if (i < json.size() && json[i] == '}')
+        return true;
+
+    while (i < json.size() && json[i] == '"') {
+
+        size_t end = string_end(json, i + 1);
+        if (end == std::string_view::npos)
+            return false;
+
+        std::string_view name = json.substr(i + 1, end - i - 1);
+
+        i = skip_space(json, end + 1);
+        if (i == json.size() || json[i] != ':')
+            return false;
+
+        i = skip_space(json, i + 1);
+        if (i == json.size())
+            return false;
+
+        Field field;
+        field.found = true;
+
+        if (json[i] == '"') {
+            end = string_end(json, i + 1);
+            if (end == std::string_view::npos)
+                return false;
+            field.value = json.substr(i + 1, end - i - 1);
+            field.string = true;
+            i = end + 1;
+        } else if (json[i] == '{' || json[i] == '[') {
+            end = skip_nested(json, i);
+            if (end == std::string_view::npos)
+                return false;
+            field.value = json.substr(i, end - i);
+            i = end;
+        } else {
+            size_t start = i;
+            while (i < json.size() && json[i] != ',' && json[i] != '}' && json[i] != ' ' &&
+                   json[i] != '\t' && json[i] != '\n' && json[i] != '\r')
+                i++;
+            field.value = json.substr(start, i - start);
+        }
+
+        auto it = std::lower_bound(names.begin(), names.end(), name,
+            [](const std::string & a, std::string_view b) { return a < b; });
+        if (it != names.end() && *it == name)
+            fields[it - names.begin()] = field;
+
+        i = skip_space(json, i);
+        if (i < json.size() && json[i] == '}')
+            return true;
+        if (i == json.size() || json[i] != ',')
+            return false;
+
+        i = skip_space(json, i + 1);
+
+    }
+
+    return false;
+
+}
+
+// -- compiling
+
+namespace {
+
+struct Parser {
+
+    std::string_view text;
+    size_t pos = 0;
+
+    void skip() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n'))
+            pos++;
+    }
+
+    bool done() {
+        skip();
+        return pos == text.size();
+    }
+
+    bool eat(std::string_view token) {
+        skip();
+        if (!text.substr(pos).starts_with(token))
+            return false;
+        pos += token.size();
+        return true;
+    }
+
+    // a bare word, up to an operator or a separator
+    std::string_view word() {
+        skip();
+        size_t start = pos;
+        while (pos < text.size() && std::string_view(" \t\n,{}&|=!<>\"").find(text[pos]) == std::string_view::npos)
+            pos++;
+        return text.substr(start, pos - start);
+    }
+
+};
+
+} // namespace
+
+bool Filters::compile(std::string_view filter, Predicate & predicate, std::string & error)
+{
+
+    Parser parser { filter };
+
+    auto value = [&](Value & value) {
+
+        parser.skip();
+
+        if (parser.eat("\"")) {
+            size_t end = string_end(filter, parser.pos);
+            if (end == std::string_view::npos)
+                return false;
+            value.text = filter.substr(parser.pos, end - parser.pos);
+            parser.pos = end + 1;
+            return true;
+        }
+
+        std::string_view word = parser.word();
+        if (word.empty())
+            return false;
+
+        auto [end, ec] = std::from_chars(word.data(), word.data() + word.size(), value.numeric);
+        value.number = ec == std::errc() && end == word.data() + word.size();
+        if (!value.number)
+            value.text = word;
+
+        return true;
+
+    };
+
+    do {
+
+        Term term;
+        term.field = parser.word();
+
+        if (term.field.empty()) {
+            error = "field name expected at " + std::to_string(parser.pos);
+            return false;
+        }
+
+        if (parser.eat("=="))
+            term.op = Equal;
+        else if (parser.eat("!="))
+            term.op = NotEqual;
+        else if (parser.eat("<="))
+            term.op = LessEqual;
+        else if (parser.eat(">="))
+            term.op = GreaterEqual;
+        else if (parser.eat("<"))
+            term.op = Less;
+        else if (parser.eat(">"))
+            term.op = Greater;
+        else if (parser.word() == "in")
+            term.op = In;
+        else {
+            error = "operator expected behind " + term.field;
+            return false;
+        }
+
+        if (term.op == In) {
+
+            if (!parser.eat("{")) {
+                error = "{ expected behind in";
+                return false;
+            }
+
+            do {
+                Value v;
+                if (!value(v)) {
+                    error = "value expected in the set of " + term.field;
+                    return false;
+                }
+                term.values.push_back(std::move(v));
+            } while (parser.eat(","));
+
+            if (!parser.eat("}")) {
+                error = "} expected behind the set of " + term.field;
+                return false;
+            }
+
+        } else {
+
+            Value v;
+            if (!value(v)) {
+                error = "value expected behind " + term.field;
+                return false;
+            }
+            term.values.push_back(std::move(v));
+
+        }
+
+        predicate.terms.push_back(std::move(term));
+
+    } while (parser.eat("&&"));
+
+    if (!parser.done()) {
+        error = "unexpected " + std::string(filter.substr(parser.pos));
+        return false;
+    }
+
+    // the same filter written differently has the same canonical form
+    auto canonical = [](const Value & value) {
+        if (!value.number)
+            return "\"" + value.text + "\"";
+        char number[32];
+        snprintf(number, sizeof(number), "%.17g", value.numeric);
+        return std::string(number);
+    };
+
+    static const char * ops[] = { "==", "!=", "<", "<=", ">", ">=", "in" };
+    std::vector<std::string> terms;
+
+    for (Term & term : predicate.terms) {
+
+        std::vector<std::string> values;
+        for (const Value & value : term.values)
+            values.push_back(canonical(value));
+
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+
+        std::string text = term.field + " " + ops[term.op] + " ";
+        for (size_t i = 0; i < values.size(); i++)
+            text += (i > 0 ? "," : "") + values[i];
+        terms.push_back(text);
+
+    }
+
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+    for (size_t i = 0; i < terms.size(); i++)
+        predicate.canonical += (i > 0 ? " && " : "") + terms[i];
+
+    return true;
+
+}
+
+// -- evaluating
+
+bool Filters::matches(const Term & term, const Field & field)
+{
+
+    if (!field.found)
+        return false;
+
+    double number = 0;
+    bool numeric = false;
+
+    if (!field.string) {
+        const char * end = field.value.data() + field.value.size();
+        auto result = std::from_chars(field.value.data(), end, number);
+        numeric = result.ec == std::errc() && result.ptr == end;
+    }
+
+    for (const Value & value : term.values) {
+
+        int order;
+
+        if (value.number && numeric)
+            order = (number < value.numeric) ? -1 : (number > value.numeric) ? 1 : 0;
+        else if (!value.number && field.string)
+            order = field.value.compare(value.text);
+        else
+            continue; // of another type
+
+        switch (term.op) {
+        case Equal:
+        case In:            if (order == 0) return true; break;
+        case NotEqual:      return order != 0;
+        case Less:          return order < 0;
+        case LessEqual:     return order <= 0;
+        case Greater:       return order > 0;
+        case GreaterEqual:  return order >= 0;
+        }
+
+    }
+
+    return false;
+
+}
+
+uint32_t Filters::add(std::string_view filter, std::string * error)
+{
+
+    Predicate predicate;
+    std::string reason;
+
+    if (!compile(filter, predicate, reason)) {
+        if (error != nullptr)
+            *error = reason;
+        return 0;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+    auto it = m_numbers.find(predicate.canonical);
+    if (it != m_numbers.end()) {
+        m_predicates[it->second].references++;
+        return it->second;
+    }
+
+    uint32_t number = m_next++;
+    predicate.references = 1;
+    m_numbers[predicate.canonical] = number;
+    m_predicates[number] = std::move(predicate);
+
+    return number;
+
+}
+
+void Filters::remove(uint32_t filter)
+{
+
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+    auto it = m_predicates.find(filter);
+    if (it == m_predicates.end() || --it->second.references > 0)
+        return;
+
+    m_numbers.erase(it->second.canonical);
+    m_predicates.erase(it);
+
+}
+
+size_t Filters::size() const
+{
+
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_predicates.size();
+
+}
+
+void Filters::evaluate(std::string_view message, std::span<const uint32_t> filters, std::vector<uint32_t> & passed) const
+{
+
+    passed.clear();
+
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+
+    std::vector<const Predicate *> predicates;
+    std::vector<std::string> names;
+
+    for (uint32_t filter : filters) {
+        auto it = m_predicates.find(filter);
+        predicates.push_back(it == m_predicates.end() ? nullptr : &it->second);
+        if (predicates.back() != nullptr)
+            for (const Term & term : it->second.terms)
+                names.push_back(term.field);
+    }
+
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+
+    // one pass over the message for the fields of all filters
+    std::vector<Field> fields;
+    if (!scan(message, names, fields))
+        return;
+
+    for (size_t i = 0; i < predicates.size(); i++) {
+
+        if (predicates[i] == nullptr)
+            continue;
+
+        m_evaluations++;
+
+        bool match = std::all_of(predicates[i]->terms.begin(), predicates[i]->terms.end(), [&](const Term & term) {
+            size_t index = std::lower_bound(names.begin(), names.end(), term.field) - names.begin();
+            return matches(term, fields[index]);
+        });
+
+        if (match)
+            passed.push_back(filters[i]);
+
+    }
+
+}
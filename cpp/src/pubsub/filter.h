@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Filters on the fields of JSON messages, a subscriber of a broker gets only
+// the messages matching its filter (see Broker::subscribe()):
+//
+//   symbol in {SAP, BMW} && qty > 1000
+//   side == "buy" && price <= 99.5
+//
+// A filter is a conjunction of comparisons of a top-level field of the
+// message (an object) with a number or a string: == != < <= > >= and "in"
+// with a set. Strings can be quoted, numbers are compared as numbers. A
+// missing field, or one of the wrong type, does not match.
+//
+// The filters are compiled once, the same filter of many connections (also
+// written differently, with other spaces or another order) is one filter.
+// The message is scanned once for the fields of all filters asked for,
+// without building a tree of it, and each filter is evaluated once.
+class Filters {
+public:
+
+    // a top-level field of a message, the bytes of the string without the
+    // quotes (escapes are not decoded) or the number
+    struct Field {
+        std::string_view value;
+        bool string = false;
+        bool found = false;
+    };
+
+    // compiles the filter, or takes one more reference of the same one.
+    // Its number (> 0), 0 if it is not valid (error says why).
+    uint32_t add(std::string_view filter, std::string * error = nullptr);
+
+    // drops a reference, the filter is gone with the last one
+    void remove(uint32_t filter);
+
+    // the filters (sorted) the message matches, in passed (sorted as well)
+    void evaluate(std::string_view message, std::span<const uint32_t> filters, std::vector<uint32_t> & passed) const;
+
+    // distinct filters
+    size_t size() const;
+
+    // filters evaluated so far
+    uint64_t evaluations() const { return m_evaluations; };
+
+    // the values of the top-level fields of a JSON object, false if it is
+    // not one. Nested objects and arrays are skipped, not looked into.
+    static bool scan(std::string_view json, std::span<const std::string> names, std::vector<Field> & fields);
+
+private:
+
+    struct Value {
+        bool number = false;
+        double numeric = 0;
+        std::string text;
+    };
+
+    enum Op { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, In };
+
+    struct Term {
+        std::string field;
+        Op op;
+        // one value, the set of In
+        std::vector<Value> values;
+    };
+
+    struct Predicate {
+        std::vector<Term> terms;
+        std::string canonical;
+        size_t references = 0;
+    };
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<uint32_t, Predicate> m_predicates;
+    std::unordered_map<std::string, uint32_t> m_numbers;
+    uint32_t m_next = 1;
+
+    mutable std::atomic<uint64_t> m_evaluations { 0 };
+
+    static bool compile(std::string_view filter, Predicate & predicate, std::string & error);
+    static bool matches(const Term & term, const Field & field);
+
+};
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <cstring>
+
+#include "history.h"
+
+History::History(size_t frames, size_t bytes)
+    : m_frames(frames), m_buffer(bytes)
+{
+}
+
+uint64_t History::append(std::span<const uint8_t> frame)
+{
+
+    m_sequence++;
+
+    if (m_frames == 0 || frame.size() > m_buffer.size() || frame.empty()) {
+        m_entries.clear();
+        m_end = 0;
+        return m_sequence;
+    }
+
+    size_t offset = m_end;
+
+    if (offset + frame.size() > m_buffer.size()) {
+        // the frames behind the end are the oldest ones
+        while (!m_entries.empty() && m_entries.front().offset >= m_end)
+            m_entries.pop_front();
+        offset = 0;
+    }
+
+    // the oldest frames are the ones in front of the new one
+    while (!m_entries.empty() &&
+           m_entries.front().offset < offset + frame.size() &&
+           m_entries.front().offset + m_entries.front().length > offset)
+        m_entries.pop_front();
+
+    if (m_entries.size() == m_frames)
+        m_entries.pop_front();
+
+    memcpy(m_buffer.data() + offset, frame.data(), frame.size());
+    m_entries.push_back({ offset, frame.size() });
+    m_end = offset + frame.size();
+
+    return m_sequence;
+
+}
+
+bool History::since(uint64_t sequence, std::vector<std::span<const uint8_t>> & parts) const
+{
+
+    parts.clear();
+
+    if (sequence > m_sequence || m_sequence - sequence > m_entries.size())
+        return false;
+
+    size_t start = m_entries.size() - (m_sequence - sequence);
+    size_t offset = 0;
+    size_t length = 0;
+
+    for (size_t i = start; i < m_entries.size(); i++) {
+        const Entry & entry = m_entries[i];
+        if (length > 0 && entry.offset != offset + length) {
+            parts.emplace_back(m_buffer.data() + offset, length);
+            length = 0;
+        }
+        if (length == 0)
+            offset = entry.offset;
+        length += entry.length;
+    }
+
+    if (length > 0)
+        parts.emplace_back(m_buffer.data() + offset, length);
+
+    return true;
+
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <vector>
+
+// The last encoded frames of a topic, numbered from 1. The frames lie back to
+// back in one buffer, when one does not fit at its end it starts over at the
+// front and the oldest frames make room. The frames after any sequence are
+// therefore at most two parts of the buffer, which a reconnecting client gets
+// with one write.
+class History {
+public:
+
+    // keeps up to frames frames and bytes bytes, the older ones are dropped
+    History(size_t frames, size_t bytes);
+
+    // the sequence of the frame, a frame larger than the buffer is numbered
+    // but clears the history
+    uint64_t append(std::span<const uint8_t> frame);
+
+    // false if some frame after sequence was already dropped (or sequence is
+    // in the future), otherwise parts holds the frames after it
+    bool since(uint64_t sequence, std::vector<std::span<const uint8_t>> & parts) const;
+
+    // sequence of the last frame, 0 before the first
+    uint64_t sequence() const { return m_sequence; };
+
+    size_t size() const { return m_entries.size(); };
+
+private:
+
+    struct Entry {
+        size_t offset;
+        size_t length;
+    };
+
+    size_t m_frames;
+    std::vector<uint8_t> m_buffer;
+
+    // oldest first, the sequence of m_entries[i] is m_sequence - size() + 1 + i
+    std::deque<Entry> m_entries;
+
+    // the next frame starts here unless it does not fit
+    size_t m_end = 0;
+
+    uint64_t m_sequence = 0;
+
+};
@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <algorithm>
+
+#include "topic_index.h"
+
+TopicIndex::TopicIndex() : m_root(std::make_shared<const Node>())
+{
+}
+
+bool TopicIndex::parse(std::string_view pattern, Key & key)
+{
+
+    key.clear();
+
+    if (pattern.empty())
+        return false;
+
+    while (true) {
+
+        size_t dot = pattern.find('.');
+        std::string_view word = pattern.substr(0, dot);
+
+        if (word.empty())
+            return false;
+
+        if (word == "*" || word == "#")
+            key.emplace_back(word);
+        else if (key.empty() || key.back() == "*" || key.back() == "#")
+            key.push_back("." + std::string(word));
+        else
+            key.back() += "." + std::string(word);
+
+        if (dot == std::string_view::npos)
+            return true;
+
+        pattern.remove_prefix(dot + 1);
+
+    }
+
+}
+
+// a literal part of the key, not a wildcard
+static bool literal(const std::vector<std::string> & key, size_t part)
+{
+    return part < key.size() && key[part] != "*" && key[part] != "#";
+}
+
+bool TopicIndex::subscribe(std::string_view pattern, uint64_t id, uint32_t filter)
+{
+
+    Key key;
+    if (!parse(pattern, key))
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+
+    bool changed = false;
+    NodePtr root = modify(*m_root.load(), key, 0, 0, { id, filter }, true, changed, true);
+
+    if (changed)
+        m_root.store(std::move(root));
+
+    return true;
+
+}
+
+bool TopicIndex::unsubscribe(std::string_view pattern, uint64_t id)
+{
+
+    Key key;
+    if (!parse(pattern, key))
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+
+    bool changed = false;
+    NodePtr root = modify(*m_root.load(), key, 0, 0, { id }, false, changed, true);
+
+    if (changed)
+        m_root.store(std::move(root));
+
+    return changed;
+
+}
+
+TopicIndex::NodePtr TopicIndex::modify(const Node & node, const Key & key, size_t part, size_t offset,
+                                       Subscription subscription, bool add, bool & changed, bool root)
+{
+
+    auto copy = std::make_shared<Node>(node);
+
+    if (part == key.size()) {
+
+        copy->subscribers = change(node.subscribers, subscription, add, changed);
+
+    } else if (key[part] == "*") {
+
+        copy->one = descend(node.one, key, part + 1, 0, subscription, add, changed);
+
+    } else if (key[part] == "#") {
+
+        copy->any = descend(node.any, key, part + 1, 0, subscription, add, changed);
+
+    } else {
+
+        char byte = key[part][offset];
+        auto it = std::lower_bound(copy->children.begin(), copy->children.end(), byte,
+            [](const NodePtr & child, char byte) { return child->label[0] < byte; });
+
+        bool found = it != copy->children.end() && (*it)->label[0] == byte;
+        NodePtr next = descend(found ? *it : nullptr, key, part, offset, subscription, add, changed);
+
+        if (found && next != nullptr)
+            *it = std::move(next);
+        else if (found)
+            copy->children.erase(it);
+        else if (next != nullptr)
+            copy->children.insert(it, std::move(next));
+
+    }
+
+    if (root || copy->subscribers != nullptr || copy->one != nullptr || copy->any != nullptr)
+        return copy;
+
+    // nothing ends here anymore, the node goes or joins its only child
+    if (copy->children.empty())
+        return nullptr;
+
+    if (copy->children.size() == 1) {
+        auto merged = std::make_shared<Node>(*copy->children[0]);
+        merged->label.insert(0, copy->label);
+        return merged;
+    }
+
+    return copy;
+
+}
+
+std::shared_ptr<const TopicIndex::Subscribers> TopicIndex::change(const std::shared_ptr<const Subscribers> & subscribers,
+                                                                  Subscription subscription, bool add, bool & changed)
+{
+
+    if (subscribers == nullptr) {
+
+        if (!add)
+            return nullptr;
+
+        auto first = std::make_shared<Subscribers>();
+        first->chunks.push_back(std::make_shared<const std::vector<Subscription>>(1, subscription));
+        first->size = 1;
+        changed = true;
+        return first;
+
+    }
+
+    // the first chunk reaching up to the id, a larger id goes to the last
+    const std::vector<ChunkPtr> & chunks = subscribers->chunks;
+    auto chunk = std::lower_bound(chunks.begin(), chunks.end(), subscription.id,
+        [](const ChunkPtr & chunk, uint64_t id) { return chunk->back().id < id; });
+    if (chunk == chunks.end())
+        chunk--;
+
+    auto it = std::lower_bound((*chunk)->begin(), (*chunk)->end(), subscription.id,
+        [](const Subscription & s, uint64_t id) { return s.id < id; });
+    bool subscribed = it != (*chunk)->end() && it->id == subscription.id;
+
+    if (add ? (subscribed && it->filter == subscription.filter) : !subscribed)
+        return subscribers;
+
+    changed = true;
+
+    // only this chunk and the list of the chunks are copied
+    std::vector<Subscription> copy(**chunk);
+    size_t offset = it - (*chunk)->begin();
+    size_t size = subscribers->size;
+
+    if (add && subscribed) {
+        copy[offset].filter = subscription.filter;
+    } else if (add) {
+        copy.insert(copy.begin() + offset, subscription);
+        size++;
+    } else {
+        copy.erase(copy.begin() + offset);
+        size--;
+    }
+
+    if (size == 0)
+        return nullptr;
+
+    auto result = std::make_shared<Subscribers>();
+    result->size = size;
+    result->chunks.reserve(chunks.size() + 1);
+    result->chunks.insert(result->chunks.end(), chunks.begin(), chunk);
+
+    // a full chunk is split in halves, an empty one goes
+    if (copy.size() > TOPIC_CHUNK_SIZE) {
+        auto half = copy.begin() + copy.size() / 2;
+        result->chunks.push_back(std::make_shared<const std::vector<Subscription>>(copy.begin(), half));
+        result->chunks.push_back(std::make_shared<const std::vector<Subscription>>(half, copy.end()));
+    } else if (!copy.empty()) {
+        result->chunks.push_back(std::make_shared<const std::vector<Subscription>>(std::move(copy)));
+    }
+
+    result->chunks.insert(result->chunks.end(), chunk + 1, chunks.end());
+
+    return result;
+
+}
+
+TopicIndex::NodePtr TopicIndex::descend(const NodePtr & child, const Key & key, size_t part, size_t offset,
+                                        Subscription subscription, bool add, bool & changed)
+{
+
+    if (child == nullptr) {
+
+        if (!add)
+            return nullptr;
+
+        // a new edge takes the literal bytes up to the next wildcard
+        Node leaf;
+        if (literal(key, part)) {
+            leaf.label = key[part].substr(offset);
+            part++;
+            offset = 0;
+        }
+
+        return modify(leaf, key, part, offset, subscription, add, changed, false);
+
+    }
+
+    size_t common = 0;
+    if (literal(key, part))
+        while (common < child->label.size() && offset + common < key[part].size() &&
+               child->label[common] == key[part][offset + common])
+            common++;
+
+    size_t next_part = part;
+    size_t next_offset = offset + common;
+    if (literal(key, part) && next_offset == key[part].size()) {
+        next_part++;
+        next_offset = 0;
+    }
+
+    if (common == child->label.size())
+        return modify(*child, key, next_part, next_offset, subscription, add, changed, false);
+
+    // the pattern is not in the trie
+    if (!add)
+        return child;
+
+    // the pattern leaves the label in the middle, the edge is split there
+    auto rest = std::make_shared<Node>(*child);
+    rest->label.erase(0, common);
+
+    Node middle;
+    middle.label = child->label.substr(0, common);
+    middle.children.push_back(std::move(rest));
+
+    return modify(middle, key, next_part, next_offset, subscription, add, changed, false);
+
+}
+
+void TopicIndex::match(std::string_view topic, std::vector<uint64_t> & ids) const
+{
+
+    std::vector<Subscription> subscriptions;
+    match(topic, subscriptions);
+
+    ids.clear();
+    for (const Subscription & subscription : subscriptions)
+        if (ids.empty() || ids.back() != subscription.id)
+            ids.push_back(subscription.id);
+
+}
+
+void TopicIndex::match(std::string_view topic, std::vector<Subscription> & subscriptions) const
+{
+
+    subscriptions.clear();
+
+    // a topic has no empty words
+    if (topic.empty() || topic.front() == '.' || topic.back() == '.' || topic.find("..") != std::string_view::npos)
+        return;
+
+    // like a key, every word with a leading dot
+    std::string key = "." + std::string(topic);
+
+    // the snapshot stays alive while it is walked
+    NodePtr root = m_root.load();
+    collect(*root, key, 0, subscriptions);
+
+    // a connection matching with several patterns gets the message once
+    std::sort(subscriptions.begin(), subscriptions.end());
+    subscriptions.erase(std::unique(subscriptions.begin(), subscriptions.end()), subscriptions.end());
+
+}
+
+void TopicIndex::visit(const Node & node, std::string_view topic, size_t pos, std::vector<Subscription> & subscriptions)
+{
+
+    if (topic.size() - pos < node.label.size() || topic.compare(pos, node.label.size(), node.label) != 0)
+        return;
+
+    collect(node, topic, pos + node.label.size(), subscriptions);
+
+}
+
+void TopicIndex::collect(const Node & node, std::string_view topic, size_t pos, std::vector<Subscription> & subscriptions)
+{
+
+    if (pos == topic.size()) {
+
+        if (node.subscribers != nullptr)
+            for (const ChunkPtr & chunk : node.subscribers->chunks)
+                subscriptions.insert(subscriptions.end(), chunk->begin(), chunk->end());
+
+    } else {
+
+        auto it = std::lower_bound(node.children.begin(), node.children.end(), topic[pos],
+            [](const NodePtr & child, char byte) { return child->label[0] < byte; });
+
+        if (it != node.children.end() && (*it)->label[0] == topic[pos])
+            visit(**it, topic, pos, subscriptions);
+
+    }
+
+    // the wildcards take whole words, the node has to end one
+    if (pos < topic.size() && topic[pos] != '.')
+        return;
+
+    if (node.one != nullptr && pos < topic.size())
+        visit(*node.one, topic, std::min(topic.find('.', pos + 1), topic.size()), subscriptions);
+
+    // "#" takes none up to all of the remaining words
+    if (node.any != nullptr) {
+        for (size_t next = pos; next < topic.size(); next = topic.find('.', next + 1))
+            visit(*node.any, topic, next, subscriptions);
+        visit(*node.any, topic, topic.size(), subscriptions);
+    }
+
+}
+
+size_t TopicIndex::subscribers(std::string_view pattern) const
+{
+
+    Key key;
+    if (!parse(pattern, key))
+        return 0;
+
+    NodePtr root = m_root.load();
+    const Node * node = root.get();
+    size_t part = 0;
+    size_t offset = 0;
+
+    while (part < key.size()) {
+
+        const Node * next = nullptr;
+
+        if (key[part] == "*" || key[part] == "#") {
+            next = (key[part] == "*") ? node->one.get() : node->any.get();
+            part++;
+        } else {
+            for (const NodePtr & child : node->children)
+                if (child->label[0] == key[part][offset])
+                    next = child.get();
+        }
+
+        if (next == nullptr)
+            return 0;
+
+        // the label continues the key
+        if (!next->label.empty()) {
+
+            if (!literal(key, part) || key[part].compare(offset, next->label.size(), next->label) != 0)
+                return 0;
+
+            offset += next->label.size();
+            if (offset == key[part].size()) {
+                part++;
+                offset = 0;
+            }
+
+        }
+
+        node = next;
+
+    }
+
+    return node->subscribers != nullptr ? node->subscribers->size : 0;
+
+}
+
+size_t TopicIndex::nodes() const
+{
+
+    NodePtr root = m_root.load();
+    return count(*root);
+
+}
+
+size_t TopicIndex::count(const Node & node)
+{
+
+    size_t nodes = 1;
+
+    for (const NodePtr & child : node.children)
+        nodes += count(*child);
+    if (node.one != nullptr)
+        nodes += count(*node.one);
+    if (node.any != nullptr)
+        nodes += count(*node.any);
+
+    return nodes;
+
+}
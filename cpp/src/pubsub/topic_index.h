@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// the subscribers of a pattern are kept in chunks of up to this many, a
+// change copies one of them
+#define TOPIC_CHUNK_SIZE 256
+
+// The subscriptions of a broker: patterns of words separated by dots, where
+// a word "*" matches exactly one word of a topic and "#" any number of words
+// (also none):
+//
+//   prices.EU.*     prices.EU.SAP, not prices.EU or prices.EU.SAP.bid
+//   orders.#        orders, orders.new, orders.new.42
+//
+// The patterns form a radix trie over their bytes: an edge carries the bytes
+// the patterns below it share (like ".prices.EU."), so a node has at most
+// one literal edge per byte and a chain without subscribers is one edge. The
+// wildcards are extra edges of the nodes ending a word. Each pattern keeps
+// its subscribers (WebSocket::id() and a filter, see filter.h) sorted by id,
+// in chunks of TOPIC_CHUNK_SIZE.
+// A topic is matched by walking its bytes, the cost depends on the topic and
+// the wildcards on the way, not on the number of subscriptions.
+//
+// The trie is never changed in place. subscribe() and unsubscribe() copy the
+// nodes on the path of the pattern and swap the root, so match() works on a
+// snapshot without waiting for them (read-copy-update). The writers take a
+// lock among themselves. A copied node shares the subscribers with the old
+// one, except the chunk that changed, so a pattern with a hundred thousand
+// subscribers costs its chunk list and one chunk per change, not all of them.
+class TopicIndex {
+public:
+
+    struct Subscription {
+        uint64_t id;
+        // 0 for every message, see Filters::add()
+        uint32_t filter = 0;
+
+        bool operator==(const Subscription &) const = default;
+        bool operator<(const Subscription & other) const {
+            return id < other.id || (id == other.id && filter < other.filter);
+        };
+    };
+
+    TopicIndex();
+
+    // false for an empty pattern or an empty word (like "a..b"), an id
+    // subscribed to the pattern gets the new filter
+    bool subscribe(std::string_view pattern, uint64_t id, uint32_t filter = 0);
+
+    // false if the id was not subscribed to the pattern
+    bool unsubscribe(std::string_view pattern, uint64_t id);
+
+    // the ids subscribed to a pattern matching the topic, sorted and each
+    // once (ids holds the result, it is cleared first)
+    void match(std::string_view topic, std::vector<uint64_t> & ids) const;
+
+    // the same with the filters, an id matching with several patterns is
+    // there once per distinct filter (sorted by id and filter)
+    void match(std::string_view topic, std::vector<Subscription> & subscriptions) const;
+
+    // subscribers of exactly this pattern
+    size_t subscribers(std::string_view pattern) const;
+
+    // nodes of the trie including the root
+    size_t nodes() const;
+
+private:
+
+    struct Node;
+    typedef std::shared_ptr<const Node> NodePtr;
+
+    typedef std::shared_ptr<const std::vector<Subscription>> ChunkPtr;
+
+    // sorted by id across the chunks, none of them is empty
+    struct Subscribers {
+        std::vector<ChunkPtr> chunks;
+        size_t size = 0;
+    };
+
+    struct Node {
+        // bytes of the edge into the node
+        std::string label;
+        // literal edges, sorted by the first byte of their label
+        std::vector<NodePtr> children;
+        // the "*" and "#" edges
+        NodePtr one;
+        NodePtr any;
+        // subscribers of the pattern ending here, nullptr for none
+        std::shared_ptr<const Subscribers> subscribers;
+    };
+
+    // a pattern as runs of literal words, each word with a leading dot, and
+    // the wildcards between them: "a.b.*.c" -> ".a.b", "*", ".c"
+    typedef std::vector<std::string> Key;
+
+    std::atomic<NodePtr> m_root;
+    std::mutex m_write_mutex;
+
+    static bool parse(std::string_view pattern, Key & key);
+
+    // the copy of node with the id added to / removed from the rest of the
+    // key (byte offset of part), nullptr if the node is left without any
+    // content
+    static NodePtr modify(const Node & node, const Key & key, size_t part, size_t offset,
+                          Subscription subscription, bool add, bool & changed, bool root);
+
+    // the subscribers with the id added or removed, the same pointer if
+    // nothing changed and nullptr if none are left
+    static std::shared_ptr<const Subscribers> change(const std::shared_ptr<const Subscribers> & subscribers,
+                                                     Subscription subscription, bool add, bool & changed);
+
+    // the same for the node behind an edge, whose label continues the key
+    static NodePtr descend(const NodePtr & child, const Key & key, size_t part, size_t offset,
+                           Subscription subscription, bool add, bool & changed);
+
+    // with a topic (".a.b.c") from pos on
+    static void visit(const Node & node, std::string_view topic, size_t pos, std::vector<Subscription> & subscriptions);
+    static void collect(const Node & node, std::string_view topic, size_t pos, std::vector<Subscription> & subscriptions);
+
+    static size_t count(const Node & node);
+
+};
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "frame_rate.h"
+
+#include <algorithm>
+
+void FrameRate::set_rate(double frames, double bytes, double control_frames) {
+
+    m_frames.set_rate(frames, frames);
+    m_bytes.set_rate(bytes, bytes);
+    m_control.set_rate(control_frames, control_frames);
+    m_bytes_burst = std::max(bytes, 1.0);
+
+}
+
+std::chrono::nanoseconds FrameRate::take(bool control, uint64_t bytes, time_point now) {
+
+    double size = std::min<double>(bytes, m_bytes_burst);
+
+    std::chrono::nanoseconds wait = std::max(m_frames.wait_time(1, now), m_bytes.wait_time(size, now));
+    if (control)
+        wait = std::max(wait, m_control.wait_time(1, now));
+
+    if (wait.count() > 0)
+        return wait;
+
+    m_frames.try_take(1, now);
+    m_bytes.try_take(size, now);
+    if (control)
+        m_control.try_take(1, now);
+
+    return std::chrono::nanoseconds(0);
+
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "token_bucket.h"
+
+// The frames, bytes and control frames (ping and pong, a close frame is
+// never held back, see WebSocket::admit()) one connection may send per
+// second, checked with the header of every frame before its payload is
+// copied. Bursts of one second. Not thread safe, it belongs to the thread
+// reading the connection.
+class FrameRate {
+public:
+
+    typedef TokenBucket::time_point time_point;
+
+    // 0 -> unlimited
+    void set_rate(double frames, double bytes, double control_frames);
+    bool unlimited() const { return m_frames.unlimited() && m_bytes.unlimited() && m_control.unlimited(); };
+
+    // takes the tokens of the frame, or nothing and the time until there
+    // are enough of them. A frame larger than the burst of bytes waits for
+    // a full bucket.
+    std::chrono::nanoseconds take(bool control, uint64_t bytes, time_point now = std::chrono::steady_clock::now());
+
+private:
+
+    TokenBucket m_frames;
+    TokenBucket m_bytes;
+    TokenBucket m_control;
+    double m_bytes_burst = 1;
+
+};
+
+// What the rate limits did to the connections of a Socket, shared by all
+// threads.
+struct Throttling {
+    // reads held back until the tokens of a frame were there
+    std::atomic<uint64_t> delayed { 0 };
+    // frames skipped without being handled
+    std::atomic<uint64_t> dropped { 0 };
+    // connections closed with 1008 (policy violation)
+    std::atomic<uint64_t> closed { 0 };
+};
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "memory_budget.h"
+
+bool MemoryBudget::reserve(size_t bytes) {
+
+    size_t used = m_used.load(std::memory_order_relaxed);
+
+    do {
+        if (used + bytes > m_limit || used + bytes < used)
+            return false;
+    } while (!m_used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+
+    return true;
+
+}
+
+void MemoryBudget::release(size_t bytes) {
+    m_used.fetch_sub(bytes, std::memory_order_relaxed);
+}
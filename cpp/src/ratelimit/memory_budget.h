@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Upper bound for the userspace memory all connections of a Socket may use
+// for buffers and incomplete messages, shared by all threads.
+class MemoryBudget {
+public:
+
+    explicit MemoryBudget(size_t limit) : m_limit(limit) {};
+
+    // takes bytes from the budget, false (and nothing taken) if that
+    // would exceed the limit
+    bool reserve(size_t bytes);
+    void release(size_t bytes);
+
+    size_t used() const { return m_used; };
+    size_t limit() const { return m_limit; };
+
+    // less than headroom bytes left
+    bool exhausted(size_t headroom = 0) const { return m_used + headroom > m_limit; };
+
+private:
+
+    std::atomic<size_t> m_used { 0 };
+    size_t m_limit;
+
+};
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "token_bucket.h"
+
+#include <algorithm>
+
+TokenBucket::TokenBucket(double rate, double burst)
+{
+    set_rate(rate, burst);
+}
+
+void TokenBucket::set_rate(double rate, double burst) {
+
+    m_rate = rate;
+    m_burst = std::max(burst, 1.0);
+    m_tokens = m_burst;
+    m_last_refill = std::chrono::steady_clock::now();
+
+}
+
+void TokenBucket::refill(time_point now) {
+
+    if (now <= m_last_refill)
+        return;
+
+    std::chrono::duration<double> elapsed = now - m_last_refill;
+    m_tokens = std::min(m_burst, m_tokens + elapsed.count() * m_rate);
+    m_last_refill = now;
+
+}
+
+bool TokenBucket::try_take(double tokens, time_point now) {
+
+    if (unlimited())
+        return true;
+
+    refill(now);
+
+    if (m_tokens < tokens)
+        return false;
+
+    m_tokens -= tokens;
+    return true;
+
+}
+
+std::chrono::nanoseconds TokenBucket::wait_time(double tokens, time_point now) {
+
+    if (unlimited())
+        return std::chrono::nanoseconds(0);
+
+    refill(now);
+
+    if (m_tokens >= tokens)
+        return std::chrono::nanoseconds(0);
+
+    std::chrono::duration<double> missing((tokens - m_tokens) / m_rate);
+    return std::chrono::ceil<std::chrono::nanoseconds>(missing);
+
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// Allows `rate` operations per second on average and bursts of up to
+// `burst` operations. Not thread safe, every bucket belongs to one thread
+// (the event loop or a connection).
+class TokenBucket {
+public:
+
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    // rate 0 -> unlimited
+    TokenBucket(double rate = 0, double burst = 1);
+
+    void set_rate(double rate, double burst);
+    bool unlimited() const { return m_rate <= 0; };
+
+    // takes the tokens if there are enough of them
+    bool try_take(double tokens = 1, time_point now = std::chrono::steady_clock::now());
+
+    // time until try_take(tokens) will succeed, zero if it does now
+    std::chrono::nanoseconds wait_time(double tokens = 1, time_point now = std::chrono::steady_clock::now());
+
+private:
+
+    double m_rate = 0;
+    double m_burst = 1;
+    double m_tokens = 1;
+    time_point m_last_refill;
+
+    void refill(time_point now);
+
+};
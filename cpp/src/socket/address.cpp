@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "address.h"
+
+namespace Address {
+
+bool parse_port(const std::string & text, in_port_t & port) {
+
+    if (text.empty() || text.size() > 5 || text.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+
+    int value = atoi(text.c_str());
+    if (value > 65535)
+        return false;
+
+    port = htons(value);
+    return true;
+
+}
+
+bool parse(const std::string & address, Endpoint & endpoint) {
+
+    endpoint = Endpoint();
+
+    if (address.rfind("unix:", 0) == 0) {
+
+        std::string path = address.substr(5);
+        sockaddr_un * addr = (sockaddr_un *) &endpoint.storage;
+
+        if (path.empty() || path.size() >= sizeof(addr->sun_path))
+            return false;
+
+        addr->sun_family = AF_UNIX;
+        strncpy(addr->sun_path, path.c_str(), sizeof(addr->sun_path) - 1);
+        endpoint.length = sizeof(sockaddr_un);
+        return true;
+
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+        return false;
+
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+
+    if (host == "*") {
+
+        sockaddr_in6 * addr = (sockaddr_in6 *) &endpoint.storage;
+        addr->sin6_family = AF_INET6;
+        addr->sin6_addr = in6addr_any;
+        endpoint.length = sizeof(sockaddr_in6);
+        endpoint.dual_stack = true;
+        return parse_port(port, addr->sin6_port);
+
+    }
+
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+
+        sockaddr_in6 * addr = (sockaddr_in6 *) &endpoint.storage;
+        addr->sin6_family = AF_INET6;
+        endpoint.length = sizeof(sockaddr_in6);
+        return inet_pton(AF_INET6, host.substr(1, host.size() - 2).c_str(), &addr->sin6_addr) == 1 &&
+               parse_port(port, addr->sin6_port);
+
+    }
+
+    sockaddr_in * addr = (sockaddr_in *) &endpoint.storage;
+    addr->sin_family = AF_INET;
+    endpoint.length = sizeof(sockaddr_in);
+    return inet_pton(AF_INET, host.c_str(), &addr->sin_addr) == 1 &&
+           parse_port(port, addr->sin_port);
+
+}
+
+bool from_socket(int fd, Endpoint & endpoint) {
+
+    endpoint = Endpoint();
+    endpoint.length = sizeof(endpoint.storage);
+
+    if (getsockname(fd, endpoint.addr(), &endpoint.length) < 0)
+        return false;
+
+    if (endpoint.family() == AF_INET6) {
+        int v6only = 1;
+        socklen_t size = sizeof(v6only);
+        getsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, &size);
+        endpoint.dual_stack = v6only == 0;
+    }
+
+    return true;
+
+}
+
+int port(const Endpoint & endpoint) {
+
+    switch (endpoint.family()) {
+    case AF_INET:
+        return ntohs(((const sockaddr_in *) &endpoint.storage)->sin_port);
+    case AF_INET6:
+        return ntohs(((const sockaddr_in6 *) &endpoint.storage)->sin6_port);
+    default:
+        return -1;
+    }
+
+}
+
+std::string path(const Endpoint & endpoint) {
+
+    if (endpoint.family() != AF_UNIX)
+        return "";
+
+    return ((const sockaddr_un *) &endpoint.storage)->sun_path;
+
+}
+
+std::string to_string(const Endpoint & endpoint) {
+
+    char host[INET6_ADDRSTRLEN]{};
+
+    switch (endpoint.family()) {
+    case AF_INET:
+        inet_ntop(AF_INET, &((const sockaddr_in *) &endpoint.storage)->sin_addr, host, sizeof(host));
+        return std::string(host) + ":" + std::to_string(port(endpoint));
+    case AF_INET6:
+        if (endpoint.dual_stack)
+            return "*:" + std::to_string(port(endpoint));
+        inet_ntop(AF_INET6, &((const sockaddr_in6 *) &endpoint.storage)->sin6_addr, host, sizeof(host));
+        return "[" + std::string(host) + "]:" + std::to_string(port(endpoint));
+    case AF_UNIX:
+        return "unix:" + path(endpoint);
+    default:
+        return "?";
+    }
+
+}
+
+} // namespace Address
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Addresses a Socket can listen on:
+//
+//   "0.0.0.0:3000"         IPv4
+//   "[::1]:3000"           IPv6 only
+//   "*:3000"               dual-stack, IPv6 socket accepting IPv4 as well
+//   "unix:/tmp/ws.sock"    Unix domain socket (local proxies)
+namespace Address {
+
+    struct Endpoint {
+        sockaddr_storage storage {};
+        socklen_t length = 0;
+        bool dual_stack = false;
+
+        int family() const { return storage.ss_family; };
+        sockaddr * addr() { return (sockaddr *) &storage; };
+        const sockaddr * addr() const { return (const sockaddr *) &storage; };
+    };
+
+    // false if the address has none of the forms above
+    bool parse(const std::string & address, Endpoint & endpoint);
+
+    // the address a listening socket is bound to (inherited sockets)
+    bool from_socket(int fd, Endpoint & endpoint);
+
+    // TCP port, -1 for Unix sockets
+    int port(const Endpoint & endpoint);
+
+    // path of a Unix socket, empty for TCP
+    std::string path(const Endpoint & endpoint);
+
+    std::string to_string(const Endpoint & endpoint);
+
+} // namespace Address
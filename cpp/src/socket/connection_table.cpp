@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <new>
+
+#include "connection_table.h"
+
+ConnectionTable::ConnectionTable(size_t capacity, int node, bool huge_pages)
+{
+
+    m_capacity = capacity;
+
+    m_region = Placement::allocate(capacity * sizeof(WebSocket), node, huge_pages);
+    if (m_region.data == nullptr)
+        throw std::bad_alloc();
+
+    // the first touch, the pages are placed on the node now
+    m_slots = (WebSocket *) m_region.data;
+    for (size_t i = 0; i < capacity; i++)
+        new (&m_slots[i]) WebSocket();
+    m_generations.resize(capacity, 0);
+    m_pins.resize(capacity, 0);
+    m_active_index.resize(capacity, 0);
+    m_active.reserve(capacity);
+    m_free.reserve(capacity);
+
+    for (size_t i = capacity; i > 0; i--)
+        m_free.push_back(i - 1);
+
+}
+
+ConnectionTable::~ConnectionTable()
+{
+
+    for (size_t i = 0; i < m_capacity; i++)
+        m_slots[i].~WebSocket();
+
+    Placement::release(m_region);
+
+}
+
+WebSocket * ConnectionTable::acquire(int connection) {
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_free.empty())
+        return nullptr;
+
+    uint32_t slot = m_free.back();
+    m_free.pop_back();
+
+    m_active_index[slot] = m_active.size();
+    m_active.push_back(slot);
+
+    uint64_t id = ((uint64_t) m_generations[slot] << 32) | slot;
+
+    WebSocket * webSocket = &m_slots[slot];
+    webSocket->reset(connection, id);
+
+    return webSocket;
+
+}
+
+void ConnectionTable::release(WebSocket * webSocket) {
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    uint32_t slot = webSocket - m_slots;
+
+    // no new with() from now on, the running ones finish with this connection
+    m_generations[slot]++;
+    m_unpinned.wait(lock, [&]() { return m_pins[slot] == 0; });
+
+    // swap the last active slot into the gap
+    uint32_t last = m_active.back();
+    m_active[m_active_index[slot]] = last;
+    m_active_index[last] = m_active_index[slot];
+    m_active.pop_back();
+
+    webSocket->reset(-1, ((uint64_t) m_generations[slot] << 32) | slot);
+
+    m_free.push_back(slot);
+
+}
+
+WebSocket * ConnectionTable::find(uint64_t id) {
+
+    uint32_t slot = id & 0xffffffff;
+
+    if (slot >= m_capacity)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_generations[slot] != (id >> 32) || m_slots[slot].connection() == -1)
+        return nullptr;
+
+    return &m_slots[slot];
+
+}
+
+bool ConnectionTable::with(uint64_t id, const std::function<void(WebSocket *)> & f) {
+
+    uint32_t slot = id & 0xffffffff;
+
+    if (slot >= m_capacity)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_generations[slot] != (id >> 32) || m_slots[slot].connection() == -1)
+            return false;
+
+        m_pins[slot]++;
+    }
+
+    f(&m_slots[slot]);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_pins[slot] == 0)
+        m_unpinned.notify_all();
+
+    return true;
+
+}
+
+void ConnectionTable::for_each(const std::function<void(WebSocket *)> & f) {
+
+    std::vector<uint64_t> ids;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        ids.reserve(m_active.size());
+        for (uint32_t slot : m_active)
+            ids.push_back(((uint64_t) m_generations[slot] << 32) | slot);
+    }
+
+    // f may block (a send) or use the table itself
+    for (uint64_t id : ids)
+        with(id, f);
+
+}
+
+size_t ConnectionTable::size() {
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_active.size();
+
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "websocket.h"
+#include "placement.h"
+
+// Preallocated pool of WebSockets, sized once with the maximum number of
+// connections. Every connection is addressed by a generation tagged id
+//
+//     id = generation << 32 | slot
+//
+// so a stale id never resolves to the next connection using the same slot.
+// Other threads use a connection with with(), which pins its slot so that
+// it is not released and taken by the next connection meanwhile.
+//
+// The slots lie in one region (see placement.h), on the NUMA node of the
+// loop serving them and with huge pages if it is large enough.
+class ConnectionTable {
+public:
+
+    explicit ConnectionTable(size_t capacity, int node = -1, bool huge_pages = true);
+    ~ConnectionTable();
+
+    ConnectionTable(const ConnectionTable &) = delete;
+    ConnectionTable & operator=(const ConnectionTable &) = delete;
+
+    // takes a reset WebSocket from the pool, nullptr if the table is full
+    WebSocket * acquire(int connection);
+
+    // returns the WebSocket to the pool, its id becomes invalid, waits
+    // for the with() calls using it
+    void release(WebSocket * webSocket);
+
+    // O(1), nullptr if the connection is already gone. The pointer is only
+    // valid on the thread releasing the connection, use with() elsewhere.
+    WebSocket * find(uint64_t id);
+
+    // calls f with the connection while its slot is pinned, release() waits
+    // until f returned. False if the connection is already gone. f must not
+    // release the connection itself.
+    bool with(uint64_t id, const std::function<void(WebSocket *)> & f);
+
+    // calls f for every connection in the table, each one pinned as by
+    // with(). The table is not locked meanwhile, connections acquired
+    // during the call are not visited.
+    void for_each(const std::function<void(WebSocket *)> & f);
+
+    size_t size();
+    size_t capacity() const { return m_capacity; };
+
+    // the memory of the slots
+    const Placement::Region & region() const { return m_region; };
+
+private:
+
+    size_t m_capacity;
+
+    Placement::Region m_region;
+    WebSocket * m_slots = nullptr;
+    std::vector<uint32_t> m_generations;
+
+    // with() calls using each slot, release() waits for m_unpinned
+    std::vector<uint32_t> m_pins;
+    std::condition_variable m_unpinned;
+
+    // unused slots, the most recently released one is reused first
+    std::vector<uint32_t> m_free;
+
+    // slots in use and the position of each slot in m_active
+    std::vector<uint32_t> m_active;
+    std::vector<uint32_t> m_active_index;
+
+    std::mutex m_mutex;
+
+};
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "handoff.h"
+
+namespace Handoff {
+
+bool set_path(sockaddr_un & addr, const std::string & path) {
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cout << "Handoff path too long: " << path << std::endl;
+        return false;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    return true;
+
+}
+
+int listen(const std::string & path) {
+
+    sockaddr_un addr{};
+    if (!set_path(addr, path))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        std::cout << "Failed to create handoff socket. errno: " << errno << std::endl;
+        return -1;
+    }
+
+    // the predecessor keeps its (now unlinked) socket until it is gone
+    unlink(path.c_str());
+
+    // the file is created with the mode of the socket, not of the umask
+    if (fchmod(fd, 0600) < 0) {
+        std::cout << "Failed to restrict handoff socket. errno: " << errno << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0 || ::listen(fd, 1) < 0) {
+        std::cout << "Failed to bind handoff socket " << path << ". errno: " << errno << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+
+}
+
+std::vector<int> take_over(const std::string & path) {
+
+    sockaddr_un addr{};
+    if (!set_path(addr, path))
+        return {};
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return {};
+
+    if (connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd); // first process, nothing to take over
+        return {};
+    }
+
+    std::vector<int> fds = receive_fds(fd);
+    close(fd);
+
+    return fds;
+
+}
+
+bool trusted(int connection) {
+
+    ucred credentials{};
+    socklen_t length = sizeof(credentials);
+
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0) {
+        std::cout << "Failed to get the handoff peer. errno: " << errno << std::endl;
+        return false;
+    }
+
+    if (credentials.uid != getuid()) {
+        std::cout << "Handoff refused to uid " << credentials.uid << " (pid " << credentials.pid << ")" << std::endl;
+        return false;
+    }
+
+    return true;
+
+}
+
+bool send_fds(int connection, const std::vector<int> & fds) {
+
+    if (fds.empty() || fds.size() > HANDOFF_MAX_FDS)
+        return false;
+
+    uint8_t count = fds.size();
+    iovec iov { &count, sizeof(count) };
+
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)]{};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+    cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    if (sendmsg(connection, &msg, MSG_NOSIGNAL) < 0) {
+        std::cout << "Failed to hand over the listening sockets. errno: " << errno << std::endl;
+        return false;
+    }
+
+    return true;
+
+}
+
+std::vector<int> receive_fds(int connection) {
+
+    uint8_t count = 0;
+    iovec iov { &count, sizeof(count) };
+
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)]{};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(connection, &msg, MSG_CMSG_CLOEXEC) <= 0)
+        return {};
+
+    std::vector<int> fds;
+
+    for (cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        fds.resize(received);
+        memcpy(fds.data(), CMSG_DATA(cmsg), sizeof(int) * received);
+
+    }
+
+    if (fds.size() != count)
+        std::cout << "Handoff expected " << (int) count << " sockets, got " << fds.size() << std::endl;
+
+    return fds;
+
+}
+
+} // namespace Handoff
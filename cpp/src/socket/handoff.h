@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Passes listening sockets from a running wsserver to its successor over a
+// Unix domain socket (SCM_RIGHTS), so a restart never closes the port:
+//
+//   old process: Handoff::listen(path) ... accept() -> send_fds()
+//   new process: take_over(path) -> listening sockets of the old process
+//
+// Only the owner can connect to the socket (mode 0600), and the sockets are
+// only handed to a process of the same user (see trusted()).
+namespace Handoff {
+
+#define HANDOFF_MAX_FDS 16
+
+    // binds a Unix socket at path (replacing a stale one) that only the
+    // user can connect to, -1 on error
+    int listen(const std::string & path);
+
+    // connects to a running process at path and receives its listening
+    // sockets, empty if nobody is listening there
+    std::vector<int> take_over(const std::string & path);
+
+    // the peer of the connection runs as the same user as this process
+    bool trusted(int connection);
+
+    bool send_fds(int connection, const std::vector<int> & fds);
+    std::vector<int> receive_fds(int connection);
+
+} // namespace Handoff
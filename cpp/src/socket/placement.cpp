@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+
+#include "flags.h"
+#include "placement.h"
+
+namespace Placement {
+
+int node_of(int cpu) {
+
+    // the directory of the cpu links its node as "node<N>"
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/node";
+
+    for (int node = 0, count = nodes(); node < count; node++)
+        if (access((path + std::to_string(node)).c_str(), F_OK) == 0)
+            return node;
+
+    return -1;
+
+}
+
+// a list like "0-3,8-11"
+static std::vector<int> parse_list(const std::string & list) {
+
+    std::vector<int> values;
+    size_t pos = 0;
+
+    while (pos < list.size()) {
+
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+
+        int first = atoi(range.c_str());
+        int last = (dash == std::string::npos) ? first : atoi(range.c_str() + dash + 1);
+        for (int value = first; value <= last; value++)
+            values.push_back(value);
+
+        pos = end + 1;
+
+    }
+
+    return values;
+
+}
+
+std::vector<int> cpus_of(int node) {
+
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+
+    std::string list;
+    if (!std::getline(file, list))
+        return {};
+
+    return parse_list(list);
+
+}
+
+int nodes() {
+
+    std::ifstream file("/sys/devices/system/node/has_memory");
+
+    std::string list;
+    if (!std::getline(file, list))
+        return 1;
+
+    std::vector<int> nodes = parse_list(list);
+    return nodes.empty() ? 1 : nodes.back() + 1;
+
+}
+
+bool pin(const std::vector<int> & cpus) {
+
+    if (cpus.empty())
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        std::cout << "Failed to pin the thread. errno: " << errno << std::endl;
+        return false;
+    }
+
+    return true;
+
+}
+
+Region allocate(size_t bytes, int node, bool huge_pages) {
+
+    Region region;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+
+    if (bytes == 0)
+        bytes = page_size;
+
+    if (huge_pages && bytes >= HUGE_PAGE_SIZE) {
+
+        region.size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+        // the reserved pool is usually empty, then this fails at once
+        region.data = mmap(nullptr, region.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (region.data != MAP_FAILED) {
+            region.pages = Huge;
+        } else {
+
+            // aligned to a huge page, so the kernel can back all of it
+            size_t mapped = region.size + HUGE_PAGE_SIZE;
+            uint8_t * data = (uint8_t *) mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (data == MAP_FAILED) {
+                region.data = nullptr;
+                return region;
+            }
+
+            uint8_t * aligned = (uint8_t *) (((uintptr_t) data + HUGE_PAGE_SIZE - 1) & ~(uintptr_t) (HUGE_PAGE_SIZE - 1));
+            if (aligned > data)
+                munmap(data, aligned - data);
+            if (aligned + region.size < data + mapped)
+                munmap(aligned + region.size, data + mapped - aligned - region.size);
+
+            region.data = aligned;
+            region.pages = (madvise(aligned, region.size, MADV_HUGEPAGE) == 0) ? Transparent : Small;
+
+        }
+
+    } else {
+
+        region.size = (bytes + page_size - 1) / page_size * page_size;
+        region.data = mmap(nullptr, region.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (region.data == MAP_FAILED) {
+            region.data = nullptr;
+            return region;
+        }
+
+    }
+
+    // before the first touch, the pages are placed when they are touched
+    if (node >= 0 && node < 64 && nodes() > 1) {
+
+        unsigned long mask = 1UL << node;
+        if (syscall(SYS_mbind, region.data, region.size, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0) == 0)
+            region.node = node;
+        else
+            std::cout << "Failed to bind memory to node " << node << ". errno: " << errno << std::endl;
+
+    }
+
+#if DEBUG_LEVEL >= 5
+    std::cout << "Allocated " << region.size << " bytes with " << (region.pages == Huge ? "huge" :
+        region.pages == Transparent ? "transparent huge" : "small") << " pages\n";
+#endif
+
+    return region;
+
+}
+
+void release(Region & region) {
+
+    if (region.data != nullptr)
+        munmap(region.data, region.size);
+
+    region = Region();
+
+}
+
+} // namespace Placement
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Where the memory and the threads of a reactor (a Socket with its event
+// loop) live. On a host with several NUMA nodes the connection table of a
+// socket is placed on the node of the CPU its loop runs on, so the loop
+// does not reach across the interconnect for every connection:
+//
+//   socket.set_cpu(12);   // loop on CPU 12, table on its node
+//
+// Large regions are backed by 2 MiB pages (one TLB entry instead of 512),
+// from the reserved pool of the kernel (vm.nr_hugepages) or else as
+// transparent huge pages, with normal pages as the fallback.
+namespace Placement {
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+    enum Pages {
+        Small,          // 4 KiB pages
+        Transparent,    // madvise(MADV_HUGEPAGE), the kernel may merge them
+        Huge            // MAP_HUGETLB from the reserved pool
+    };
+
+    struct Region {
+        void * data = nullptr;
+        size_t size = 0;
+        Pages pages = Small;
+        // node the pages were bound to, -1 -> where the first touch was
+        int node = -1;
+    };
+
+    // the NUMA node of the cpu, -1 if it is not known
+    int node_of(int cpu);
+
+    // the CPUs of the node, empty if it is not known
+    std::vector<int> cpus_of(int node);
+
+    // NUMA nodes with memory (at least 1)
+    int nodes();
+
+    // restricts the calling thread to the cpus, false if not possible
+    bool pin(const std::vector<int> & cpus);
+
+    // zeroed anonymous memory of at least bytes. Regions of a huge page or
+    // more get huge pages if huge_pages is set, node >= 0 -> preferably on
+    // that node (mbind(), another node once it is full). nullptr data if
+    // there is no memory left.
+    Region allocate(size_t bytes, int node = -1, bool huge_pages = true);
+    void release(Region & region);
+
+} // namespace Placement
@@ -1,11 +1,20 @@
 /*
  * Copyright (c) 2022, Tobias <git@tsmr.eu>
- * 
+ *
  */
 
 #include "socket.h"
+#include "protocol.h"
+
+Socket::~Socket() {
+
+    if (m_loop_thread.joinable()) {
+        m_loop.stop();
+        m_loop_thread.join();
+    }
+
+}
 
-Socket::~Socket() = default;
 Socket::Socket(int port) {
     m_port = port;
 }
@@ -17,89 +26,565 @@ Socket::Socket(int port, bool use_tls, int max_connections) {
 
 void Socket::stop() {
 
-#if !COMPILE_FOR_FUZZING
+    if (m_state == State::Stopping || m_state == State::Stopped || m_connections == nullptr)
+        return;
+
+    m_state = State::Stopping;
+
+    m_loop.post([this]() {
+
+        // stop accepting, the backlog is dropped with the listening sockets
+        close_listeners(true);
+        close_pending();
 
-    m_state = Socket::Stopping;
+        if (m_handoff_fd != -1) {
+            m_loop.remove(m_handoff_fd);
+            close(m_handoff_fd);
+            m_handoff_fd = -1;
+        }
+
+        std::vector<uint64_t> ids;
+        m_connections->for_each([&](WebSocket * webSocket) {
+            ids.push_back(webSocket->id());
+        });
 
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0); 
+        close_connections(std::move(ids), 0);
 
-    sockaddr_in sockaddr{};
-    sockaddr.sin_family = AF_INET;
-    sockaddr.sin_addr.s_addr = INADDR_ANY;
-    sockaddr.sin_port = htons(m_port); 
+    });
 
-    int close_thread = connect(sockfd, (struct sockaddr*)& sockaddr, sizeof(sockaddr));
+    auto deadline = std::chrono::steady_clock::now() + m_drain_timeout;
 
-    while (m_state != State::Stopped)
-        sleep(1);
+    {
+        std::unique_lock<std::mutex> lock(m_drain_mutex);
+        m_drained.wait_until(lock, deadline, [&]() { return connections() == 0; });
+    }
 
-    close(close_thread);
-    close(m_sockfd);
+    if (connections() > 0) {
 
+#if DEBUG_LEVEL >= 5
+        std::cout << connections() << " connections did not close in time\n";
 #endif
 
+        // unblocks the reading threads and the loop of the remaining clients
+        m_connections->for_each([](WebSocket * webSocket) {
+            webSocket->transport()->shutdown(webSocket->connection());
+        });
+
+        std::unique_lock<std::mutex> lock(m_drain_mutex);
+        m_drained.wait_for(lock, std::chrono::seconds(1), [&]() { return connections() == 0; });
+
+    }
+
+    m_loop.stop();
+
+    if (m_loop_thread.joinable())
+        m_loop_thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(m_drain_mutex);
+        m_state = State::Stopped;
+        m_drained.notify_all();
+    }
+
 }
 
-void Socket::wait_for_connection () {
+void Socket::wait() {
 
-    auto addrlen = sizeof(m_sockaddr);
+    std::unique_lock<std::mutex> lock(m_drain_mutex);
+    m_drained.wait(lock, [&]() { return m_state == State::Stopped; });
+
+}
+
+void Socket::hand_over() {
+
+    int connection = accept4(m_handoff_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (connection < 0)
+        return;
+
+    std::vector<int> fds;
+    for (Listener & listener : m_listeners)
+        fds.push_back(listener.fd);
+
+    // another user must not take the port away
+    bool handed_over = m_state == State::Running && Handoff::trusted(connection) &&
+                       Handoff::send_fds(connection, fds);
+    close(connection);
+
+    if (!handed_over)
+        return;
+
+#if DEBUG_LEVEL >= 5
+    std::cout << "Handed over " << m_listeners.size() << " listeners, draining " << connections() << " connections\n";
+#endif
+
+    // the successor accepts the new connections from now on
+    m_state = State::Draining;
+
+    close_listeners(false);
+
+    m_loop.remove(m_handoff_fd);
+    close(m_handoff_fd);
+    m_handoff_fd = -1;
+
+    // existing clients may finish on their own before they are closed
+    std::thread([this]() {
+        {
+            std::unique_lock<std::mutex> lock(m_drain_mutex);
+            m_drained.wait_for(lock, m_handoff_grace, [&]() { return connections() == 0; });
+        }
+        stop();
+    }).detach();
+
+}
+
+void Socket::close_connections(std::vector<uint64_t> ids, size_t offset) {
+
+    size_t end = std::min(offset + SHUTDOWN_BATCH_SIZE, ids.size());
+
+    for (size_t i = offset; i < end; i++) {
+        m_connections->with(ids[i], [](WebSocket * webSocket) {
+            webSocket->shutdown(1001); // going away
+        });
+    }
+
+    if (end == ids.size())
+        return;
+
+    // the loop handles the answers of this batch before the next one is sent
+    m_loop.post([this, ids = std::move(ids), end]() mutable {
+        close_connections(std::move(ids), end);
+    });
+
+}
+
+void Socket::release(WebSocket * webSocket) {
+
+    // the handler forgets the connection while its id is still valid
+    const Protocol * protocol = webSocket->protocol();
+    if (protocol != nullptr)
+        protocol->on_close(protocol->handler, *webSocket);
+
+    m_connections->release(webSocket);
+
+    // a pending connection may take the free slot
+    if (m_pending_count > 0)
+        m_loop.post([this]() { admit_pending(); });
+
+    if (m_state != State::Running) {
+        std::lock_guard<std::mutex> lock(m_drain_mutex);
+        m_drained.notify_all();
+    }
+
+}
+
+bool Socket::set_tuning(const std::string & preset) {
+
+    Tuning::Options tuning;
+
+    if (!Tuning::preset(preset, tuning)) {
+        std::cout << "Unknown tuning preset: " << preset << std::endl;
+        return false;
+    }
+
+    m_tuning = tuning;
+    return true;
+
+}
+
+void Socket::accept_connection (int listener, int family) {
+
+    // drains the backlog in batches, the loop calls again while it is not empty
+    for (int i = 0; i < ACCEPT_BATCH_SIZE; i++) {
+
+        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
 
-#if COMPILE_FOR_FUZZING
-    for (int i = 0; i < 1; i++) {
-        printf("open %s\n", g_fuzzing_input_file);
-        auto connection = open(g_fuzzing_input_file, O_RDONLY);
-#else
-    while (true) {
-        auto connection = accept(m_sockfd, (struct sockaddr*)&m_sockaddr, (socklen_t*)&addrlen);
-#endif 
         if (connection < 0) {
-            std::cout << "Failed to grab connection. errno: " << errno << std::endl;
-            return;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+                std::cout << "Failed to grab connection. errno: " << errno << std::endl;
+            break;
         }
 
-        if (m_state != Socket::Running) {
-            // TODO: close websockets?
-            m_state = State::Stopped;
-            return;
+        if (m_state != State::Running) {
+            close(connection);
+            continue;
         }
 
-        if (m_max_connections <= m_current_connections) {
-            std::cout << "Maximum number of connections reached.\n";
+        Tuning::apply_connection(connection, family, m_tuning);
+
+        if (m_pending.size() >= m_max_pending) {
+            // shedding the newest keeps the queue moving for the older ones
+            m_rejected++;
             close(connection);
             continue;
         }
 
-        auto webSocketConnection = [&]() {
+        m_pending.push_back({ connection, std::chrono::steady_clock::now() });
+        m_pending_count = m_pending.size();
+
+    }
+
+    admit_pending();
 
-            m_current_connections++;
+}
+
+void Socket::admit_pending() {
 
-            WebSocket webSocket(connection);
+    auto now = std::chrono::steady_clock::now();
 
-            if (m_on_open != nullptr)
-                m_on_open(&webSocket);
+    while (!m_pending.empty()) {
 
-            webSocket.listen();
+        Pending & pending = m_pending.front();
+
+        if (now - pending.accepted > m_handshake_timeout) {
+            m_rejected++;
+            close(pending.fd);
+            m_pending.pop_front();
+            continue;
+        }
 
-            m_current_connections--;
+        // shedding load, the existing connections keep their memory
+        if (m_budget != nullptr && m_budget->exhausted(m_limits.read_buffer_min)) {
+            m_rejected++;
+            close(pending.fd);
+            m_pending.pop_front();
+            continue;
+        }
 
-        };
+        // called again by release(), the next token or the deadline
+        auto expires = pending.accepted + m_handshake_timeout - now;
+
+        if (m_connections->size() >= m_connections->capacity()) {
+            schedule_admit(expires);
+            break;
+        }
+
+        if (!m_handshake_bucket.try_take(1, now)) {
+            schedule_admit(std::min<std::chrono::nanoseconds>(expires, m_handshake_bucket.wait_time(1, now)));
+            break;
+        }
+
+        int connection = pending.fd;
+        m_pending.pop_front();
+
+        open_connection(connection, m_transport);
+
+    }
+
+    m_pending_count = m_pending.size();
+
+}
+
+void Socket::schedule_admit(std::chrono::nanoseconds delay) {
+
+    if (m_admit_scheduled)
+        return;
+
+    m_admit_scheduled = true;
+
+    m_loop.post_after(std::chrono::ceil<std::chrono::milliseconds>(delay), [this]() {
+        m_admit_scheduled = false;
+        admit_pending();
+    });
+
+}
+
+void Socket::close_pending() {
+
+    for (Pending & pending : m_pending)
+        close(pending.fd);
+
+    m_pending.clear();
+    m_pending_count = 0;
+
+}
+
+void Socket::serve(Transport * transport, int connection) {
+
+    if (m_connections == nullptr)
+        m_connections = std::make_unique<ConnectionTable>(m_max_connections, m_node);
+
+    open_connection(connection, transport);
+
+}
+
+void Socket::open_connection (int connection, Transport * transport) {
+
+    WebSocket * webSocket = m_connections->acquire(connection);
+
+    if (webSocket == nullptr) {
+        std::cout << "Maximum number of connections reached.\n";
+        transport->close(connection);
+        return;
+    }
+
+    webSocket->set_transport(transport);
+
+    webSocket->set_executor(m_executor);
+    webSocket->set_protocols(m_protocols);
+    webSocket->set_limits(&m_limits);
+    webSocket->set_throttling(&m_throttling);
+    webSocket->set_memory_budget(m_budget.get());
+
+    // slow or idle clients do not keep their slot
+    m_loop.post_after(m_handshake_timeout, [this, id = webSocket->id()]() {
+        with(id, [](WebSocket * webSocket) {
+            if (webSocket->state() == WebSocket::WaitingForHandshake)
+                webSocket->shutdown(1002);
+        });
+    });
+
+    // the event loop drives the handshake of the non-blocking connection
+    bool pollable = transport->pollable();
+
+    if (m_use_tls && pollable && m_on_connection != nullptr)
+        webSocket->set_tls(std::make_unique<TLS::Session>(*m_tls_context, connection));
+
+    if (pollable && m_on_connection != nullptr) {
+        open_event_connection(webSocket);
+        return;
+    }
+
+    auto webSocketConnection = [this, webSocket]() {
+
+        if (m_on_open != nullptr)
+            m_on_open(webSocket);
+
+        webSocket->listen();
+
+        release(webSocket);
+
+    };
 
 #if USEFORK
-        std::thread([&](){
+    std::thread([this, webSocket, webSocketConnection, pollable](){
+        // not only the CPU of the loop this thread was started from
+        if (m_cpu >= 0)
+            Placement::pin(m_node_cpus);
 #endif
-            if (m_use_tls) {
-                std::cout << "TLS Handshake, ..." << std::endl;
-                // TLSWrapper tlsWrapper;
-                // tlsWrapper.listen_to_socket(socket, [&]);
-            } else {
+        if (m_use_tls && pollable) {
+            if (open_tls_connection(webSocket))
                 webSocketConnection();
-            }
+        } else {
+            webSocketConnection();
+        }
 #if USEFORK
-        }).detach();
+    }).detach();
 #endif
 
+}
+
+bool Socket::open_tls_connection(WebSocket * webSocket) {
+
+    // blocking socket, SSL_accept() returns once the handshake is done or
+    // the client was silent for the handshake timeout
+    timeval timeout {};
+    timeout.tv_sec = m_handshake_timeout.count() / 1000;
+    timeout.tv_usec = (m_handshake_timeout.count() % 1000) * 1000;
+    setsockopt(webSocket->connection(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    auto tls = std::make_unique<TLS::Session>(*m_tls_context, webSocket->connection());
+    TLS::Session::Handshake result = tls->handshake();
+
+    timeout = {};
+    setsockopt(webSocket->connection(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (result != TLS::Session::Done) {
+        close(webSocket->connection());
+        release(webSocket);
+        return false;
+    }
+
+    webSocket->set_tls(std::move(tls));
+    return true;
+
+}
+
+void Socket::open_event_connection(WebSocket * webSocket) {
+
+    if (m_on_open != nullptr)
+        m_on_open(webSocket);
+
+    webSocket->attach(&m_loop, [this, webSocket]() {
+        release(webSocket);
+    });
+
+    m_on_connection(*webSocket).start([webSocket]() {
+        // the handler is done, nobody is listening anymore
+        webSocket->close(true);
+    });
+
+}
+
+bool Socket::with(uint64_t id, const fkt_ws & f) {
+
+    if (m_connections == nullptr)
+        return false;
+
+    return m_connections->with(id, f);
+
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> Socket::throttled() {
+
+    std::vector<std::pair<uint64_t, uint64_t>> throttled;
+
+    if (m_connections == nullptr)
+        return throttled;
+
+    m_connections->for_each([&](WebSocket * webSocket) {
+        if (webSocket->throttled() > 0)
+            throttled.emplace_back(webSocket->id(), webSocket->throttled());
+    });
+
+    return throttled;
+
+}
+
+size_t Socket::connections() {
+
+    if (m_connections == nullptr)
+        return 0;
+
+    return m_connections->size();
+
+}
+
+void Socket::broadcast(std::string message) {
+
+    if (m_connections == nullptr)
+        return;
+
+    // encoded once for all connections
+    std::vector<uint8_t> raw_frame = DataFrame::get_text_frame(message).get_raw_frame();
+
+    // each connection is pinned while it is sent to, a blocking send does
+    // not hold up accepting or releasing the others
+    m_connections->for_each([&](WebSocket * webSocket) {
+        if (webSocket->state() >= WebSocket::Connected)
+            webSocket->send_raw(raw_frame);
+    });
+
+}
+
+void Socket::set_cpu(int cpu) {
+
+    m_cpu = cpu;
+    m_node = (cpu >= 0) ? Placement::node_of(cpu) : -1;
+    m_node_cpus = Placement::cpus_of(m_node);
+
+    // without NUMA information every CPU is as near as any other
+    if (m_node_cpus.empty())
+        for (unsigned i = 0; i < std::thread::hardware_concurrency(); i++)
+            m_node_cpus.push_back(i);
+
+}
+
+bool Socket::add_address(const std::string & address) {
+
+    Address::Endpoint endpoint;
+
+    if (!Address::parse(address, endpoint)) {
+        std::cout << "Invalid listen address: " << address << std::endl;
+        return false;
     }
 
+    m_addresses.push_back(endpoint);
+    return true;
+
+}
+
+void Socket::add_listener(int fd, const Address::Endpoint & endpoint) {
+
+    m_listeners.push_back({ fd, endpoint });
+
+    // inherited listeners get the options of this process as well
+    Tuning::apply_listener(fd, endpoint.family(), m_tuning);
+
+    if (m_listeners.size() == 1 || (Address::port(m_listeners[0].endpoint) == -1 && Address::port(endpoint) != -1))
+        m_port = Address::port(endpoint);
+
+    m_loop.add(fd, EPOLLIN, [this, fd, family = endpoint.family()](uint32_t) {
+        accept_connection(fd, family);
+    });
+
+}
+
+void Socket::close_listeners(bool unlink_paths) {
+
+    for (Listener & listener : m_listeners) {
+
+        m_loop.remove(listener.fd);
+        close(listener.fd);
+
+        if (unlink_paths && listener.endpoint.family() == AF_UNIX)
+            unlink(Address::path(listener.endpoint).c_str());
+
+    }
+
+    m_listeners.clear();
+
+}
+
+bool Socket::open_listener(const Address::Endpoint & endpoint) {
+
+    int fd = socket(endpoint.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        std::cout << "Failed to create socket for " << Address::to_string(endpoint) << ". errno: " << errno << std::endl;
+        return false;
+    }
+
+    int reuse = 1;
+
+    if (endpoint.family() == AF_UNIX) {
+
+        // a socket file nobody accepts on is left over from a crash
+        std::string path = Address::path(endpoint);
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(probe, endpoint.addr(), endpoint.length) < 0 && errno == ECONNREFUSED)
+            unlink(path.c_str());
+        close(probe);
+
+    } else {
+
+        // connections closed by stop() must not block the next listen()
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        // accept() returns once the client has sent its request, idle
+        // connections stay in the kernel
+        int defer = std::max<int>(1, m_handshake_timeout.count() / 1000);
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer));
+
+        // a successor can bind the port as well while it is taking over
+        if (!m_handoff_path.empty())
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
+    }
+
+    if (endpoint.family() == AF_INET6) {
+        int v6only = endpoint.dual_stack ? 0 : 1;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    }
+
+    if (bind(fd, endpoint.addr(), endpoint.length) < 0) {
+        std::cout << "Failed to bind to " << Address::to_string(endpoint) << ". errno: " << errno << std::endl;
+        close(fd);
+        return false;
+    }
+
+    if (::listen(fd, m_max_connections) < 0) {
+        std::cout << "Failed to listen on socket. errno: " << errno << std::endl;
+        close(fd);
+        return false;
+    }
+
+    // port 0 -> the port the kernel has chosen
+    Address::Endpoint bound;
+    Address::from_socket(fd, bound);
+
+    add_listener(fd, bound);
+
+    return true;
+
 }
 
 #if USEFORK
@@ -108,43 +593,87 @@ bool Socket::listen (bool async) {
 bool Socket::listen () {
 #endif
 
-#if !COMPILE_FOR_FUZZING
+    if (m_use_tls) {
+        m_tls_context = std::make_unique<TLS::Context>();
+        if (!m_tls_context->init(m_certificate_file, m_key_file))
+            return false;
+    }
+
+    // every connection gets a pooled WebSocket from this table
+    if (m_connections == nullptr)
+        m_connections = std::make_unique<ConnectionTable>(m_max_connections, m_node);
+
+
+    std::vector<int> inherited;
+    if (!m_handoff_path.empty())
+        inherited = Handoff::take_over(m_handoff_path);
+
+    if (!inherited.empty()) {
+
+        // the predecessor drains its connections, we accept the new ones
+        for (int fd : inherited) {
+
+            Address::Endpoint endpoint;
+            Address::from_socket(fd, endpoint);
+            add_listener(fd, endpoint);
+
+#if DEBUG_LEVEL >= 5
+            std::cout << "Took over " << Address::to_string(endpoint) << " from " << m_handoff_path << "\n";
+#endif
+
+        }
+
+    } else if (m_addresses.empty()) {
+
+        // dual-stack, IPv4 only if the kernel has no IPv6
+        int probe = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        std::string any = (probe == -1) ? "0.0.0.0:" : "*:";
+        if (probe != -1)
+            close(probe);
+
+        Address::Endpoint endpoint;
+        Address::parse(any + std::to_string(m_port), endpoint);
+
+        if (!open_listener(endpoint))
+            return false;
+
+    } else {
+
+        for (const Address::Endpoint & endpoint : m_addresses) {
+            if (!open_listener(endpoint)) {
+                close_listeners(false);
+                return false;
+            }
+        }
 
-    // TODO: AF_INET6 -> own thread?
-    m_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (m_sockfd == -1) {
-        std::cout << "Failed to create socket. errno: " << errno << std::endl;
-        return false;
-    } 
-
-    m_sockaddr.sin_family = AF_INET;
-    m_sockaddr.sin_addr.s_addr = INADDR_ANY;
-    m_sockaddr.sin_port = htons(m_port); 
-    
-    if (bind(m_sockfd, (struct sockaddr*)&m_sockaddr, sizeof(m_sockaddr)) < 0) {
-        std::cout << "Failed to bind to port " << m_port << ". errno: " << errno << std::endl;
-        return false;
     }
 
-    if (::listen(m_sockfd, m_max_connections) < 0) {
-        std::cout << "Failed to listen on socket. errno: " << errno << std::endl;
-        return false;
+    if (!m_handoff_path.empty()) {
+        m_handoff_fd = Handoff::listen(m_handoff_path);
+        if (m_handoff_fd != -1) {
+            m_loop.add(m_handoff_fd, EPOLLIN, [this](uint32_t) {
+                hand_over();
+            });
+        }
     }
 
-#endif 
+    auto run = [this]() {
+        // the buffers the loop allocates are touched first on its node
+        if (m_cpu >= 0)
+            Placement::pin({ m_cpu });
+        m_loop.run();
+    };
 
 #if USEFORK
     if (async) {
-        std::thread ([&]() {
-            wait_for_connection();
-        }).detach();
+        m_loop_thread = std::thread(run);
     } else {
-        wait_for_connection();
+        run();
     }
 #else
-    wait_for_connection();
+    run();
 #endif
 
     return true;
 
-}
\ No newline at end of file
+}
@@ -14,16 +14,32 @@
 #include <atomic>
 #include <thread>
 #include <functional>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <deque>
+#include <netinet/tcp.h>
 
 #include "flags.h"
 
-#if COMPILE_FOR_FUZZING
-#include <fcntl.h>
-#endif 
-
 #include "websocket.h"
+#include "connection_table.h"
+#include "handoff.h"
+#include "address.h"
+#include "event_loop.h"
+#include "task.h"
+#include "tls.h"
+#include "token_bucket.h"
+#include "tuning.h"
+#include "placement.h"
+
+#define SHUTDOWN_BATCH_SIZE 256
+#define ACCEPT_BATCH_SIZE 64
 
 typedef std::function<void(WebSocket *)> fkt_ws;
+typedef std::function<Task(WebSocket &)> fkt_ws_task;
 
 
 class Socket {
@@ -35,6 +51,7 @@ public:
 
     enum State {
         Running,
+        Draining,   // handed over, waiting for the connections to finish
         Stopping,
         Stopped
     };
@@ -45,25 +62,194 @@ public:
     bool listen();
 #endif
 
+    // stops accepting, sends a close frame (1001) to every connection and
+    // waits until the clients answered or the drain timeout expired
     void stop();
 
+    // how long stop() waits for the close frames of the clients
+    void set_drain_timeout(std::chrono::milliseconds timeout) { m_drain_timeout = timeout; };
+
+    State state() const { return m_state; };
+
+    // blocks until the socket was stopped (by stop() or a successor)
+    void wait();
+
+    // hot restart: listen() takes over the listening socket of the process
+    // serving this Unix socket path, and hands its own over to the next one
+    void set_handoff_path(std::string path) { m_handoff_path = std::move(path); };
+
+    // how long the connections may stay after a handoff before stop()
+    void set_handoff_grace(std::chrono::milliseconds grace) { m_handoff_grace = grace; };
+
+    // at most per_second new connections (on average) start their handshake,
+    // the others wait in a queue of max_pending, 0 -> no limit
+    void set_handshake_rate(double per_second, size_t burst) { m_handshake_bucket.set_rate(per_second, burst); };
+    void set_max_pending(size_t max_pending) { m_max_pending = max_pending; };
+
+    // a connection that was not upgraded in time (queue + handshake) is closed
+    void set_handshake_timeout(std::chrono::milliseconds timeout) { m_handshake_timeout = timeout; };
+
+    // buffer, message size and rate limits of the connections, set before
+    // listen()
+    void set_limits(const WebSocket::Limits & limits) { m_limits = limits; };
+
+    // what the rate limits did to the connections so far
+    const Throttling & throttling() const { return m_throttling; };
+
+    // the open connections that sent frames over the rate limits, with the
+    // number of those frames (see WebSocket::throttled())
+    std::vector<std::pair<uint64_t, uint64_t>> throttled();
+
+    // all connections together buffer at most bytes, new connections are
+    // rejected while it is exhausted
+    void set_memory_budget(size_t bytes) { m_budget = std::make_unique<MemoryBudget>(bytes); };
+    const MemoryBudget * memory_budget() const { return m_budget.get(); };
+
+    // socket options of the listeners and the accepted connections, set
+    // before listen() (see tuning.h)
+    void set_tuning(const Tuning::Options & tuning) { m_tuning = tuning; };
+    // false if there is no preset with this name
+    bool set_tuning(const std::string & preset);
+    const Tuning::Options & tuning() const { return m_tuning; };
+
+    // the event loop runs on this CPU (the thread calling listen() without
+    // async), the threads of the connections on the CPUs of its NUMA node.
+    // The connection table is placed on that node. Set before listen(),
+    // with several sockets on SO_REUSEPORT one per CPU (see incoming_cpu of
+    // the tuning), -1 -> anywhere.
+    void set_cpu(int cpu);
+
+    // connections closed because the pending queue was full or too slow
+    size_t rejected() const { return m_rejected; };
+
+    // PEM certificate and key for the TLS handshake (use_tls)
+    void set_certificate(std::string certificate_file, std::string key_file) {
+        m_certificate_file = std::move(certificate_file);
+        m_key_file = std::move(key_file);
+    };
+
+    // listens on this address (see address.h) instead of "*:port", can be
+    // called for several addresses, all of them are served by the same loop
+    bool add_address(const std::string & address);
+
+    // port of the first TCP listener (the bound one for port 0)
     int port() const { return m_port; };
 
+    // calls f with the connection with this WebSocket::id(), which is not
+    // released before f returned, false if it is gone (see
+    // ConnectionTable::with())
+    bool with(uint64_t id, const fkt_ws & f);
+
+    // number of open connections
+    size_t connections();
+
+    // sends the message to every connected client
+    void broadcast(std::string message);
+
     void on_open(fkt_ws f) { m_on_open = f; };
 
+    // the transport of the accepted connections, a pollable one wrapping
+    // the kernel (see capture.h), set before listen()
+    void set_transport(Transport * transport) { m_transport = transport; };
+
+    // serves a connection of another transport (see memory_transport.h)
+    // like an accepted one, with a thread and listen() also if there is an
+    // on_connection() handler, inline without USEFORK. Works without
+    // listen(), the socket then serves only these connections.
+    void serve(Transport * transport, int connection);
+
+    // serves every connection with a coroutine on the event loop of this
+    // socket instead of a thread per connection
+    void on_connection(fkt_ws_task f) { m_on_connection = f; };
+
+    // subprotocols of new connections, negotiated in their handshake (see
+    // protocol.h), must outlive the socket
+    void set_protocols(const Protocols * protocols) { m_protocols = protocols; };
+
+    // message handlers of new connections run on this executor
+    void set_executor(Executor * executor) { m_executor = executor; };
+
 private:
 
     fkt_ws m_on_open = nullptr;
+    Executor * m_executor = nullptr;
+    fkt_ws_task m_on_connection = nullptr;
+    const Protocols * m_protocols = nullptr;
+
+    // accepts connections and serves the ones of m_on_connection
+    EventLoop m_loop;
+    std::thread m_loop_thread;
+
+    // sized with m_max_connections when listen() is called
+    std::unique_ptr<ConnectionTable> m_connections;
     
-    State m_state { State::Running };
-    sockaddr_in m_sockaddr{};
+    std::atomic<State> m_state { State::Running };
+
+    std::chrono::milliseconds m_drain_timeout { CONNECTION_TIMEOUT_SECONDS * 1000 };
+    std::mutex m_drain_mutex;
+    std::condition_variable m_drained;
+
+    std::string m_handoff_path;
+    std::chrono::milliseconds m_handoff_grace { 30000 };
+    int m_handoff_fd = -1;
+
+    struct Listener {
+        int fd;
+        Address::Endpoint endpoint;
+    };
+
+    std::vector<Address::Endpoint> m_addresses;
+    std::vector<Listener> m_listeners;
+
+    // accepted connections waiting for a token or a free slot, only
+    // touched on the loop thread
+    struct Pending {
+        int fd;
+        std::chrono::steady_clock::time_point accepted;
+    };
+
+    std::deque<Pending> m_pending;
+    std::atomic<size_t> m_pending_count { 0 };
+    size_t m_max_pending = 1024;
+    bool m_admit_scheduled = false;
+    TokenBucket m_handshake_bucket;
+    std::chrono::milliseconds m_handshake_timeout { CONNECTION_TIMEOUT_SECONDS * 1000 };
+    std::atomic<size_t> m_rejected { 0 };
+
+    WebSocket::Limits m_limits;
+    Throttling m_throttling;
+    std::unique_ptr<MemoryBudget> m_budget;
+
+    Tuning::Options m_tuning;
+    Transport * m_transport = Transport::kernel();
+
+    int m_cpu = -1;
+    int m_node = -1;
+    std::vector<int> m_node_cpus;
 
     bool m_use_tls = false;
+    std::string m_certificate_file;
+    std::string m_key_file;
+    std::unique_ptr<TLS::Context> m_tls_context;
+
     int m_max_connections = 10000;
-    int m_current_connections = 0;
-    int m_sockfd = -1;
     int m_port = 9090;
 
-    void wait_for_connection();
+    bool open_listener(const Address::Endpoint & endpoint);
+    void add_listener(int fd, const Address::Endpoint & endpoint);
+    // the paths of Unix sockets stay for a successor after a handoff
+    void close_listeners(bool unlink_paths);
+    void hand_over();
+    void accept_connection(int listener, int family);
+    void admit_pending();
+    void schedule_admit(std::chrono::nanoseconds delay);
+    void close_pending();
+    void open_connection(int connection, Transport * transport = Transport::kernel());
+    void open_event_connection(WebSocket * webSocket);
+    bool open_tls_connection(WebSocket * webSocket);
+    void release(WebSocket * webSocket);
+
+    // sends the close frames in batches of SHUTDOWN_BATCH_SIZE
+    void close_connections(std::vector<uint64_t> ids, size_t offset);
 
 };
\ No newline at end of file
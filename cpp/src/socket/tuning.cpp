@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "tuning.h"
+
+namespace Tuning {
+
+bool preset(const std::string & name, Options & options) {
+
+    options = Options();
+
+    if (name == "default")
+        return true;
+
+    if (name == "low-latency") {
+        options.no_delay = true;
+        options.quick_ack = true;
+        options.not_sent_lowat = 16 * 1024;
+        options.busy_poll = 50;
+        options.keepalive_idle = 60;
+        options.keepalive_interval = 10;
+        options.keepalive_count = 6;
+        return true;
+    }
+
+    if (name == "bulk-throughput") {
+        options.send_buffer = 4 * 1024 * 1024;
+        options.receive_buffer = 4 * 1024 * 1024;
+        options.keepalive_idle = 60;
+        options.keepalive_interval = 10;
+        options.keepalive_count = 6;
+        return true;
+    }
+
+    return false;
+
+}
+
+bool set_option(int fd, int level, int name, int value, const char * label) {
+
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+        std::cout << "Failed to set " << label << ". errno: " << errno << std::endl;
+        return false;
+    }
+
+    return true;
+
+}
+
+bool apply_listener(int fd, int family, const Options & options) {
+
+    bool ok = true;
+
+    if (options.send_buffer > 0)
+        ok &= set_option(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer, "SO_SNDBUF");
+    if (options.receive_buffer > 0)
+        ok &= set_option(fd, SOL_SOCKET, SO_RCVBUF, options.receive_buffer, "SO_RCVBUF");
+
+    if (family == AF_UNIX)
+        return ok;
+
+    if (options.no_delay)
+        ok &= set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (options.not_sent_lowat > 0)
+        ok &= set_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, options.not_sent_lowat, "TCP_NOTSENT_LOWAT");
+    // raising it above net.core.busy_poll needs CAP_NET_ADMIN
+    if (options.busy_poll > 0)
+        ok &= set_option(fd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll, "SO_BUSY_POLL");
+    if (options.incoming_cpu >= 0)
+        ok &= set_option(fd, SOL_SOCKET, SO_INCOMING_CPU, options.incoming_cpu, "SO_INCOMING_CPU");
+
+    if (options.keepalive_idle > 0) {
+        ok &= set_option(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+        ok &= set_option(fd, IPPROTO_TCP, TCP_KEEPIDLE, options.keepalive_idle, "TCP_KEEPIDLE");
+        if (options.keepalive_interval > 0)
+            ok &= set_option(fd, IPPROTO_TCP, TCP_KEEPINTVL, options.keepalive_interval, "TCP_KEEPINTVL");
+        if (options.keepalive_count > 0)
+            ok &= set_option(fd, IPPROTO_TCP, TCP_KEEPCNT, options.keepalive_count, "TCP_KEEPCNT");
+    }
+
+    return ok;
+
+}
+
+void apply_connection(int fd, int family, const Options & options) {
+
+    // a Unix connection is created by the client, not cloned from the listener
+    if (family == AF_UNIX) {
+        if (options.send_buffer > 0)
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options.send_buffer, sizeof(int));
+        if (options.receive_buffer > 0)
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options.receive_buffer, sizeof(int));
+        return;
+    }
+
+    // the ACK mode is reset for every new connection
+    if (options.quick_ack) {
+        int quick_ack = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &quick_ack, sizeof(quick_ack));
+    }
+
+}
+
+} // namespace Tuning
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <iostream>
+#include <string>
+
+// Socket options of the listening sockets. The kernel copies them to every
+// accepted connection, only the ones it does not copy are set per connection.
+// TCP options are skipped for Unix sockets.
+namespace Tuning {
+
+    struct Options {
+        // TCP_NODELAY, small frames are sent at once instead of being coalesced
+        bool no_delay = false;
+
+        // SO_SNDBUF / SO_RCVBUF in bytes, 0 -> autotuned by the kernel
+        int send_buffer = 0;
+        int receive_buffer = 0;
+
+        // TCP_NOTSENT_LOWAT, unsent bytes before the socket stops being
+        // writable, 0 -> kernel default
+        int not_sent_lowat = 0;
+
+        // SO_BUSY_POLL, microseconds a read polls the device, 0 -> off
+        int busy_poll = 0;
+
+        // TCP_QUICKACK, no delayed ACKs at the start of a connection
+        bool quick_ack = false;
+
+        // SO_INCOMING_CPU, with SO_REUSEPORT (handoff) the listener of this
+        // CPU gets the connections it received, -1 -> any
+        int incoming_cpu = -1;
+
+        // SO_KEEPALIVE with TCP_KEEPIDLE / TCP_KEEPINTVL in seconds and
+        // TCP_KEEPCNT probes, idle 0 -> off
+        int keepalive_idle = 0;
+        int keepalive_interval = 0;
+        int keepalive_count = 0;
+    };
+
+    // "default"          kernel defaults
+    // "low-latency"      interactive messages: no Nagle, quick ACKs, a small
+    //                    unsent queue and busy polling
+    // "bulk-throughput"  large messages: big fixed buffers, Nagle coalesces
+    //                    small writes
+    // false if there is no preset with this name
+    bool preset(const std::string & name, Options & options);
+
+    // on a listening socket, errors are printed, the socket is usable anyway
+    bool apply_listener(int fd, int family, const Options & options);
+
+    // after accept()
+    void apply_connection(int fd, int family, const Options & options);
+
+} // namespace Tuning
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "tls.h"
+
+#include <cerrno>
+#include <sys/socket.h>
+
+namespace TLS {
+
+#if WITH_TLS
+
+void print_errors(const char * what) {
+
+    std::cout << what;
+
+    unsigned long error;
+    while ((error = ERR_get_error()) != 0)
+        std::cout << " - " << ERR_error_string(error, nullptr);
+
+    std::cout << std::endl;
+
+}
+
+Context::~Context() {
+    SSL_CTX_free(m_ctx);
+}
+
+bool Context::init(const std::string & certificate_file, const std::string & key_file) {
+
+    m_ctx = SSL_CTX_new(TLS_server_method());
+
+    if (m_ctx == nullptr) {
+        print_errors("Failed to create TLS context.");
+        return false;
+    }
+
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_3_VERSION);
+
+    // the AEAD ciphers the kernel can take over
+    SSL_CTX_set_ciphersuites(m_ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256");
+
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+    // non-blocking writes continue with a grown outbox, idle sessions free
+    // their record buffers
+    SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                            SSL_MODE_RELEASE_BUFFERS);
+
+    // resumption with TLS 1.3 session tickets makes reconnects cheap
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(m_ctx, (const unsigned char *) "wsserver", 8);
+    SSL_CTX_set_num_tickets(m_ctx, 2);
+
+    if (SSL_CTX_use_certificate_chain_file(m_ctx, certificate_file.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(m_ctx, key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(m_ctx) != 1)
+    {
+        print_errors("Failed to load the TLS certificate or key.");
+        return false;
+    }
+
+    return true;
+
+}
+
+Session::Session(Context & context, int connection)
+{
+    m_connection = connection;
+    m_ssl = SSL_new(context.ctx());
+    SSL_set_fd(m_ssl, connection);
+}
+
+Session::~Session() {
+    SSL_free(m_ssl);
+}
+
+Session::Handshake Session::handshake() {
+
+    int result = SSL_accept(m_ssl);
+
+    if (result == 1) {
+
+        m_established = true;
+
+#ifndef OPENSSL_NO_KTLS
+        m_kernel_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+        m_kernel_recv = BIO_get_ktls_recv(SSL_get_rbio(m_ssl));
+#endif
+
+#if DEBUG_LEVEL >= 7
+        std::cout << "[TLS " << m_connection << "] " << SSL_get_cipher(m_ssl)
+                  << (SSL_session_reused(m_ssl) ? " resumed" : "")
+                  << " kTLS send: " << m_kernel_send << " recv: " << m_kernel_recv << "\n";
+#endif
+
+        return Handshake::Done;
+
+    }
+
+    switch (SSL_get_error(m_ssl, result)) {
+    case SSL_ERROR_WANT_READ:
+        return Handshake::WantRead;
+    case SSL_ERROR_WANT_WRITE:
+        return Handshake::WantWrite;
+    default:
+#if DEBUG_LEVEL >= 5
+        print_errors("TLS handshake failed.");
+#else
+        ERR_clear_error();
+#endif
+        return Handshake::Failed;
+    }
+
+}
+
+ssize_t Session::read(void * buffer, size_t size) {
+
+    // with kTLS receive, OpenSSL reads the decrypted records from the kernel
+    int bytes_read = SSL_read(m_ssl, buffer, size);
+
+    if (bytes_read > 0)
+        return bytes_read;
+
+    switch (SSL_get_error(m_ssl, bytes_read)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0; // close_notify
+    case SSL_ERROR_SYSCALL:
+        ERR_clear_error();
+        return -1;
+    default:
+        ERR_clear_error();
+        errno = EPROTO;
+        return -1;
+    }
+
+}
+
+ssize_t Session::write(const void * buffer, size_t size) {
+
+    // the kernel encrypts, no copy into an OpenSSL record buffer
+    if (m_kernel_send)
+        return ::send(m_connection, buffer, size, MSG_NOSIGNAL);
+
+    int sent = SSL_write(m_ssl, buffer, size);
+
+    if (sent > 0)
+        return sent;
+
+    switch (SSL_get_error(m_ssl, sent)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    default:
+        ERR_clear_error();
+        if (errno == 0)
+            errno = EPIPE;
+        return -1;
+    }
+
+}
+
+void Session::shutdown() {
+
+    if (m_established)
+        SSL_shutdown(m_ssl);
+
+    ERR_clear_error();
+
+}
+
+#else
+
+Context::~Context() = default;
+
+bool Context::init(const std::string &, const std::string &) {
+    std::cout << "TLS support was not compiled in (WITH_TLS)." << std::endl;
+    return false;
+}
+
+Session::Session(Context &, int connection) { m_connection = connection; }
+Session::~Session() = default;
+Session::Handshake Session::handshake() { return Handshake::Failed; }
+ssize_t Session::read(void *, size_t) { errno = EPROTO; return -1; }
+ssize_t Session::write(const void *, size_t) { errno = EPROTO; return -1; }
+void Session::shutdown() {}
+
+#endif
+
+} // namespace TLS
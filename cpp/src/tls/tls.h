@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "flags.h"
+
+#if WITH_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+// TLS 1.3 termination (OpenSSL). After the handshake the records are handed
+// to the kernel (kTLS) when the kernel supports it, then the WebSocket reads
+// and writes the plain socket and the kernel encrypts in send()/sendmsg().
+// Without kTLS everything goes through SSL_read() and SSL_write().
+namespace TLS {
+
+class Context {
+public:
+
+    Context() = default;
+    ~Context();
+
+    // loads a PEM certificate (chain) and private key, for a self-signed
+    // one see ./build.sh cert
+    bool init(const std::string & certificate_file, const std::string & key_file);
+
+#if WITH_TLS
+    SSL_CTX * ctx() const { return m_ctx; };
+#endif
+
+private:
+
+#if WITH_TLS
+    SSL_CTX * m_ctx = nullptr;
+#endif
+
+};
+
+class Session {
+public:
+
+    enum Handshake {
+        Done,
+        WantRead,
+        WantWrite,
+        Failed
+    };
+
+    Session(Context & context, int connection);
+    ~Session();
+
+    // drives the server handshake, blocking sockets always finish it
+    Handshake handshake();
+    bool established() const { return m_established; };
+
+    // the kernel encrypts / decrypts the records of this connection
+    bool kernel_send() const { return m_kernel_send; };
+    bool kernel_recv() const { return m_kernel_recv; };
+
+    // like read()/send(), -1 with errno EAGAIN if the socket would block
+    ssize_t read(void * buffer, size_t size);
+    ssize_t write(const void * buffer, size_t size);
+
+    // sends close_notify
+    void shutdown();
+
+private:
+
+#if WITH_TLS
+    SSL * m_ssl = nullptr;
+#endif
+
+    int m_connection = -1;
+    bool m_established = false;
+    bool m_kernel_send = false;
+    bool m_kernel_recv = false;
+
+};
+
+} // namespace TLS
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include "capture.h"
+
+namespace Capture {
+
+static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+Recorder::~Recorder()
+{
+
+    flush();
+
+    if (m_fd != -1)
+        ::close(m_fd);
+
+}
+
+bool Recorder::open(const std::string & path)
+{
+
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        std::cout << "Failed to open " << path << ". errno: " << errno << std::endl;
+        return false;
+    }
+
+    // an existing capture keeps its start, the times continue
+    Header header {};
+    if (pread(m_fd, &header, sizeof(header), 0) == sizeof(header) && header.magic == CAPTURE_MAGIC) {
+        m_start = header.start;
+        File file;
+        Record record;
+        std::span<const uint8_t> bytes;
+        if (file.open(path))
+            while (file.next(record, bytes))
+                m_next = std::max(m_next, record.connection + 1);
+        return true;
+    }
+
+    struct stat info {};
+    if (fstat(m_fd, &info) == 0 && info.st_size > 0) {
+        std::cout << path << " is not a capture" << std::endl;
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    header = { CAPTURE_MAGIC, now() };
+    m_start = header.start;
+
+    if (::write(m_fd, &header, sizeof(header)) != sizeof(header)) {
+        std::cout << "Failed to write " << path << ". errno: " << errno << std::endl;
+        return false;
+    }
+
+    return true;
+
+}
+
+ssize_t Recorder::read(int connection, const iovec * iov, int count)
+{
+
+    ssize_t bytes_read = m_transport->read(connection, iov, count);
+
+    if (bytes_read > 0 && m_fd != -1) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        record(connection, iov, count, bytes_read);
+    }
+
+    return bytes_read;
+
+}
+
+ssize_t Recorder::write(int connection, const iovec * iov, int count)
+{
+    return m_transport->write(connection, iov, count);
+}
+
+void Recorder::shutdown(int connection)
+{
+    m_transport->shutdown(connection);
+}
+
+void Recorder::close(int connection)
+{
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_connections.contains(connection)) {
+            record(connection, nullptr, 0, 0);
+            m_connections.erase(connection);
+            // the capture is complete while the server is idle
+            if (m_connections.empty())
+                write_buffer();
+        }
+    }
+
+    m_transport->close(connection);
+
+}
+
+void Recorder::record(int connection, const iovec * iov, int count, size_t length)
+{
+
+    // the descriptor is reused by later connections, the number is not
+    auto [it, inserted] = m_connections.try_emplace(connection, m_next);
+    if (inserted)
+        m_next++;
+
+    Record record { now() - m_start, it->second, (uint32_t) length };
+
+    size_t offset = m_buffer.size();
+    m_buffer.resize(offset + sizeof(Record) + padded(length));
+    memcpy(m_buffer.data() + offset, &record, sizeof(Record));
+    offset += sizeof(Record);
+
+    // the first length bytes of the buffers were read
+    for (int i = 0; i < count && length > 0; i++) {
+        size_t part = std::min(length, iov[i].iov_len);
+        memcpy(m_buffer.data() + offset, iov[i].iov_base, part);
+        offset += part;
+        length -= part;
+    }
+
+    if (m_buffer.size() >= CAPTURE_BUFFER_SIZE)
+        write_buffer();
+
+}
+
+void Recorder::write_buffer()
+{
+
+    // whole records only, a reader never sees half of one
+    if (m_fd != -1 && !m_buffer.empty())
+        if (::write(m_fd, m_buffer.data(), m_buffer.size()) != (ssize_t) m_buffer.size())
+            std::cout << "Failed to write the capture. errno: " << errno << std::endl;
+
+    m_buffer.clear();
+
+}
+
+void Recorder::flush()
+{
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_buffer();
+
+}
+
+File::~File()
+{
+
+    if (m_data != nullptr)
+        munmap((void *) m_data, m_size);
+
+}
+
+bool File::open(const std::string & path)
+{
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        std::cout << "Failed to open " << path << ". errno: " << errno << std::endl;
+        return false;
+    }
+
+    struct stat info {};
+    fstat(fd, &info);
+    m_size = info.st_size;
+
+    if (m_size > 0) {
+        void * data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            std::cout << "Failed to map " << path << ". errno: " << errno << std::endl;
+            ::close(fd);
+            return false;
+        }
+        m_data = (const uint8_t *) data;
+        madvise(data, m_size, MADV_SEQUENTIAL);
+    }
+
+    ::close(fd);
+
+    Header header {};
+    if (m_size >= sizeof(Header))
+        memcpy(&header, m_data, sizeof(Header));
+
+    m_raw = header.magic != CAPTURE_MAGIC;
+    m_offset = m_raw ? 0 : sizeof(Header);
+
+    return true;
+
+}
+
+bool File::next(Record & record, std::span<const uint8_t> & bytes)
+{
+
+    if (m_raw) {
+        if (m_offset > 0 || m_size == 0)
+            return false;
+        record = { 0, 0, (uint32_t) m_size };
+        bytes = { m_data, m_size };
+        m_offset = m_size;
+        return true;
+    }
+
+    if (m_offset + sizeof(Record) > m_size)
+        return false;
+
+    memcpy(&record, m_data + m_offset, sizeof(Record));
+
+    // cut off
+    if (m_offset + sizeof(Record) + record.length > m_size)
+        return false;
+
+    bytes = { m_data + m_offset + sizeof(Record), record.length };
+    m_offset += sizeof(Record) + padded(record.length);
+
+    return true;
+
+}
+
+} // namespace Capture
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <algorithm>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "transport.h"
+
+// "WSCAP\0\0\1", a file without it is the raw stream of one connection (like
+// corpus/con_big)
+#define CAPTURE_MAGIC 0x0100005041435357ULL
+
+// records are written in batches of this size
+#define CAPTURE_BUFFER_SIZE (64 * 1024)
+
+// A capture is a header followed by records, each one 8 byte aligned so the
+// file can be read in place once it is mapped:
+//
+//     Header   magic, start (unix time in ns)
+//     Record   time (ns since start), connection, length, bytes (padded)
+//
+// connection numbers the connections of the capture, a record without bytes
+// marks the end of its connection. The file is only appended to, a capture
+// cut off by a crash is complete up to its last whole record.
+namespace Capture {
+
+struct Header {
+    uint64_t magic;
+    uint64_t start;
+};
+
+struct Record {
+    uint64_t time;
+    uint32_t connection;
+    uint32_t length;
+};
+
+static_assert(sizeof(Header) == 16 && sizeof(Record) == 16);
+
+inline size_t padded(size_t length) { return (length + 7) & ~(size_t) 7; }
+
+// Records what the clients send while passing everything to the transport
+// below (the kernel): wsserver --capture file. TLS sessions read the socket
+// themselves, their connections are not recorded.
+class Recorder : public Transport {
+public:
+
+    explicit Recorder(Transport * transport = Transport::kernel()) : m_transport(transport) {};
+    ~Recorder();
+
+    // appends to path, a new file starts with the header
+    bool open(const std::string & path);
+
+    ssize_t read(int connection, const iovec * iov, int count) override;
+    ssize_t write(int connection, const iovec * iov, int count) override;
+    void shutdown(int connection) override;
+    void close(int connection) override;
+    bool pollable() const override { return m_transport->pollable(); };
+
+    // writes the buffered records
+    void flush();
+
+private:
+
+    Transport * m_transport;
+    int m_fd = -1;
+
+    // Header::start of the file
+    uint64_t m_start = 0;
+
+    std::mutex m_mutex;
+    std::vector<uint8_t> m_buffer;
+
+    // open connection -> number in the capture
+    std::unordered_map<int, uint32_t> m_connections;
+    uint32_t m_next = 0;
+
+    // with m_mutex held
+    void record(int connection, const iovec * iov, int count, size_t length);
+    void write_buffer();
+
+};
+
+// A capture mapped for reading
+class File {
+public:
+
+    File() = default;
+    ~File();
+
+    bool open(const std::string & path);
+
+    // the next record, its bytes point into the mapping, false at the end
+    bool next(Record & record, std::span<const uint8_t> & bytes);
+
+    // the file was a raw stream, returned as one record of connection 0
+    bool raw() const { return m_raw; };
+
+private:
+
+    const uint8_t * m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_offset = 0;
+    bool m_raw = false;
+
+};
+
+} // namespace Capture
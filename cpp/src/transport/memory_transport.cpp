@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include "memory_transport.h"
+
+MemoryTransport::MemoryTransport(size_t pairs, bool blocking)
+    : m_blocking(blocking), m_count(pairs * 2), m_pipes(std::make_unique<Pipe[]>(pairs * 2))
+{
+}
+
+std::pair<int, int> MemoryTransport::pair()
+{
+
+    size_t first = m_used.fetch_add(2);
+
+    if (first + 2 > m_count) {
+        m_used = m_count;
+        return { -1, -1 };
+    }
+
+    return { (int) first, (int) first + 1 };
+
+}
+
+ssize_t MemoryTransport::read(int connection, const iovec * iov, int count)
+{
+
+    Pipe * in = pipe(connection);
+    if (in == nullptr) {
+        errno = EBADF;
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock(in->mutex);
+
+    if (m_blocking)
+        in->readable.wait(lock, [&]() { return in->offset < in->bytes.size() || in->closed; });
+
+    size_t available = in->bytes.size() - in->offset;
+
+    if (available == 0) {
+        if (in->closed)
+            return 0;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    size_t copied = 0;
+
+    for (int i = 0; i < count && copied < available; i++) {
+        size_t length = std::min(iov[i].iov_len, available - copied);
+        memcpy(iov[i].iov_base, in->bytes.data() + in->offset + copied, length);
+        copied += length;
+    }
+
+    in->offset += copied;
+
+    // the buffer is reused once everything is read
+    if (in->offset == in->bytes.size()) {
+        in->bytes.clear();
+        in->offset = 0;
+    }
+
+    return copied;
+
+}
+
+ssize_t MemoryTransport::write(int connection, const iovec * iov, int count)
+{
+
+    Pipe * out = peer(connection);
+    if (out == nullptr) {
+        errno = EBADF;
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(out->mutex);
+
+    if (out->broken) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    size_t written = 0;
+
+    for (int i = 0; i < count; i++) {
+        const uint8_t * data = (const uint8_t *) iov[i].iov_base;
+        out->bytes.insert(out->bytes.end(), data, data + iov[i].iov_len);
+        written += iov[i].iov_len;
+    }
+
+    out->readable.notify_all();
+
+    return written;
+
+}
+
+ssize_t MemoryTransport::send(int connection, std::span<const uint8_t> bytes)
+{
+
+    iovec iov { (void *) bytes.data(), bytes.size() };
+    return write(connection, &iov, 1);
+
+}
+
+size_t MemoryTransport::available(int connection)
+{
+
+    Pipe * in = pipe(connection);
+    if (in == nullptr)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(in->mutex);
+    return in->bytes.size() - in->offset;
+
+}
+
+void MemoryTransport::shutdown(int connection)
+{
+
+    for (Pipe * end : { pipe(connection), peer(connection) }) {
+        if (end == nullptr)
+            continue;
+        std::lock_guard<std::mutex> lock(end->mutex);
+        end->closed = true;
+        end->readable.notify_all();
+    }
+
+}
+
+void MemoryTransport::close(int connection)
+{
+
+    shutdown(connection);
+
+    // nobody reads the bytes written to this end anymore
+    Pipe * in = pipe(connection);
+    if (in == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(in->mutex);
+    in->broken = true;
+    in->bytes = std::vector<uint8_t>();
+    in->offset = 0;
+
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "transport.h"
+
+// Connected pairs of in-memory pipes, like socketpair() without the kernel.
+// What is written to one end is read from the other:
+//
+//   MemoryTransport transport;
+//   auto [server, client] = transport.pair();
+//   socket.serve(&transport, server);
+//   transport.send(client, request);
+//
+// Writes never block, a pipe grows with the bytes nobody read yet. A read
+// waits for bytes or the closed other end, without blocking it fails with
+// EAGAIN instead.
+class MemoryTransport : public Transport {
+public:
+
+    // up to pairs connected pairs
+    explicit MemoryTransport(size_t pairs = 64, bool blocking = true);
+
+    // the two ends of a new pair, -1 if all are used
+    std::pair<int, int> pair();
+
+    ssize_t read(int connection, const iovec * iov, int count) override;
+    ssize_t write(int connection, const iovec * iov, int count) override;
+    void shutdown(int connection) override;
+    void close(int connection) override;
+
+    // write() of one buffer
+    ssize_t send(int connection, std::span<const uint8_t> bytes);
+
+    // bytes waiting to be read at this end
+    size_t available(int connection);
+
+private:
+
+    // one direction of a pair, read by connection i from m_pipes[i]
+    struct Pipe {
+        std::mutex mutex;
+        std::condition_variable readable;
+        std::vector<uint8_t> bytes;
+        // the bytes before this offset are read
+        size_t offset = 0;
+        // the reader sees the end of the stream once bytes are read
+        bool closed = false;
+        // the reader is closed, writes fail with EPIPE
+        bool broken = false;
+    };
+
+    bool m_blocking;
+    size_t m_count;
+    std::unique_ptr<Pipe[]> m_pipes;
+    std::atomic<size_t> m_used { 0 };
+
+    // connection i writes to the pipe the other end reads
+    Pipe * pipe(int connection) { return (connection >= 0 && (size_t) connection < m_used) ? &m_pipes[connection] : nullptr; };
+    Pipe * peer(int connection) { return pipe(connection ^ 1); };
+
+};
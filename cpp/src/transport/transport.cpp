@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "transport.h"
+
+class KernelTransport : public Transport {
+public:
+
+    ssize_t read(int connection, const iovec * iov, int count) override {
+        if (count == 1)
+            return ::read(connection, iov[0].iov_base, iov[0].iov_len);
+        return ::readv(connection, iov, count);
+    };
+
+    ssize_t write(int connection, const iovec * iov, int count) override {
+        msghdr message {};
+        message.msg_iov = const_cast<iovec *>(iov);
+        message.msg_iovlen = count;
+        return sendmsg(connection, &message, MSG_NOSIGNAL);
+    };
+
+    void shutdown(int connection) override {
+        ::shutdown(connection, SHUT_RDWR);
+    };
+
+    void close(int connection) override {
+        ::close(connection);
+    };
+
+    bool pollable() const override { return true; };
+
+};
+
+Transport * Transport::kernel() {
+
+    static KernelTransport transport;
+    return &transport;
+
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// How a connection moves its bytes. WebSocket and Socket do their I/O only
+// through a transport, so the same protocol stack (handshake, parsing,
+// handlers, outbound batches) runs on kernel sockets or on the in-memory
+// pipes of memory_transport.h, which benchmarks, replays and fuzzers use to
+// leave the kernel out.
+//
+// A connection is an int for every transport, a file descriptor for the
+// kernel.
+class Transport {
+public:
+
+    virtual ~Transport() = default;
+
+    // like readv(), 0 once the other end is closed, otherwise -1 with errno
+    // (EAGAIN for a non-blocking connection without bytes)
+    virtual ssize_t read(int connection, const iovec * iov, int count) = 0;
+
+    // like writev(), without SIGPIPE
+    virtual ssize_t write(int connection, const iovec * iov, int count) = 0;
+
+    // both ends read the end of the stream, the connection stays open
+    virtual void shutdown(int connection) = 0;
+    virtual void close(int connection) = 0;
+
+    // the connections are file descriptors an event loop can poll and TLS
+    // can use, the other transports are served by blocking reads
+    virtual bool pollable() const { return false; };
+
+    // the sockets of the kernel, the transport of every accepted connection
+    static Transport * kernel();
+
+};
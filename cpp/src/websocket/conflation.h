@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Encoded frames waiting for a congested connection, at most one per key. A
+// newer frame replaces the pending one of its key in place, so a slow client
+// gets the latest value at the position of the first one and the queue holds
+// no more frames than there are keys (see WebSocket::send_latest()).
+class Conflation {
+public:
+
+    void put(const std::string & key, const std::vector<uint8_t> & frame) {
+        auto [it, inserted] = m_index.try_emplace(key, m_frames.size());
+        if (inserted) {
+            m_frames.push_back(frame);
+        } else {
+            m_bytes -= m_frames[it->second].size();
+            m_frames[it->second] = frame;
+            m_replaced++;
+        }
+        m_bytes += frame.size();
+    };
+
+    // appends the frames in the order of their keys and empties the queue
+    void take(std::vector<std::vector<uint8_t>> & frames) {
+        for (std::vector<uint8_t> & frame : m_frames)
+            frames.push_back(std::move(frame));
+        m_frames.clear();
+        m_index.clear();
+        m_bytes = 0;
+    };
+
+    // also gives the memory back
+    void clear() {
+        m_frames = std::vector<std::vector<uint8_t>>();
+        m_index = std::unordered_map<std::string, size_t>();
+        m_bytes = 0;
+    };
+
+    bool empty() const { return m_frames.empty(); };
+    size_t size() const { return m_frames.size(); };
+    // of all frames in the queue
+    size_t bytes() const { return m_bytes; };
+
+    // frames that never reached the client because a newer one replaced them
+    uint64_t replaced() const { return m_replaced; };
+
+private:
+
+    std::vector<std::vector<uint8_t>> m_frames;
+
+    // key -> index in m_frames
+    std::unordered_map<std::string, size_t> m_index;
+
+    size_t m_bytes = 0;
+
+    uint64_t m_replaced = 0;
+
+};
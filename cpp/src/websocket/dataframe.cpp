@@ -12,62 +12,123 @@ size_t DataFrame::add_payload_data(uint8_t buffer[MAX_PACKET_SIZE], int offset,
     if (copybytes > buffer_size)
         copybytes = (uint64_t) buffer_size;
 
-    uint64_t index = m_application_data.size();
+    if (copybytes <= (uint64_t) offset)
+        return (size_t) copybytes;
 
-    for (auto i = (uint64_t) offset; i < copybytes; i++) {
+    uint8_t * data = buffer + offset;
+    size_t size = copybytes - offset;
 
-        if (m_mask) {
-            buffer[i] = buffer[i] ^ m_masking_key[(index + i - (uint64_t) offset) % 4];
-        }
-
-        m_application_data.push_back(buffer[i]);
+    if (m_mask)
+        mask(data, size, m_masking_key, m_application_data.size());
 
-    }
+    m_application_data.insert(m_application_data.end(), data, data + size);
 
     return (size_t) copybytes;
 
 }
 
-std::vector<uint8_t> DataFrame::get_raw_frame() {
+void DataFrame::mask(uint8_t * data, size_t size, const uint8_t key[4], uint64_t position) {
 
-    uint8_t tmp;
-    size_t size = m_application_data.size();
-    std::vector<uint8_t> raw_frame;
+    // the key as it lines up with data, repeated to a word
+    uint8_t rotated[4];
+    for (int i = 0; i < 4; i++)
+        rotated[i] = key[(position + i) % 4];
 
-    tmp  = m_fin << 7;
-    tmp |= m_rsv << 4;
-    tmp |= m_opcode;
+    uint64_t word_key;
+    memcpy(&word_key, rotated, 4);
+    memcpy((uint8_t *) &word_key + 4, rotated, 4);
 
-    raw_frame.push_back(tmp);
+    // 8 bytes at a time, the compiler turns this into vector instructions
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        word ^= word_key;
+        memcpy(data + i, &word, 8);
+    }
 
-    tmp = m_mask << 7;
+    for (; i < size; i++)
+        data[i] ^= rotated[i % 4];
 
-    if (size > 0xffff) {
-        tmp |= 127;
-        raw_frame.push_back(tmp);
+}
 
-        for (int i = 7; i >= 0; i--) {
-            raw_frame.push_back(size >> (i*8));
-        }
+void DataFrame::append_header(std::vector<uint8_t> & out, bool fin, Opcode opcode, uint64_t size, const uint8_t * key) {
 
-    } else if (size > 126) {
-        tmp |= 126;
-        raw_frame.push_back(tmp);
+    out.push_back((fin << 7) | opcode);
 
-        raw_frame.push_back(size >> (1*8));
-        raw_frame.push_back(size);
+    uint8_t mask_bit = (key != nullptr) << 7;
+
+    if (size > 0xffff) {
+        out.push_back(mask_bit | 127);
+        for (int i = 7; i >= 0; i--)
+            out.push_back(size >> (i*8));
+    } else if (size > 125) {
+        out.push_back(mask_bit | 126);
+        out.push_back(size >> 8);
+        out.push_back(size);
     } else {
-        raw_frame.push_back(tmp | size);
+        out.push_back(mask_bit | size);
     }
 
-    for (uint8_t& byte : m_application_data)
-        raw_frame.push_back(byte);
-    
+    if (key != nullptr)
+        out.insert(out.end(), key, key + 4);
+
+}
+
+std::vector<uint8_t> DataFrame::get_raw_frame() {
+
+    std::vector<uint8_t> raw_frame;
+    raw_frame.reserve(14 + m_application_data.size());
+
+    append_header(raw_frame, m_fin, m_opcode, m_application_data.size(), m_mask ? m_masking_key : nullptr);
+    raw_frame[0] |= m_rsv << 4;
+
+    size_t header_end = raw_frame.size();
+    raw_frame.insert(raw_frame.end(), m_application_data.begin(), m_application_data.end());
+
+    if (m_mask)
+        mask(raw_frame.data() + header_end, m_application_data.size(), m_masking_key);
+
     return raw_frame;
 
 }
 
 size_t DataFrame::parse_raw_frame(uint8_t buffer[MAX_PACKET_SIZE], size_t buffer_size) {
+
+    size_t header_end = parse_header(buffer, buffer_size);
+
+    if (header_end == 0)
+        return 0;
+
+    return add_payload_data(buffer, header_end, buffer_size);
+
+}
+
+size_t DataFrame::header_size(const uint8_t * buffer, size_t buffer_size) {
+
+    if (buffer_size < 2)
+        return 0;
+
+    size_t size = 2;
+
+    if ((buffer[1] & 0b1111111) == 126)
+        size += 2;
+    else if ((buffer[1] & 0b1111111) == 127)
+        size += 8;
+
+    if (buffer[1] >> 7)
+        size += 4;
+
+    return size;
+
+}
+
+size_t DataFrame::parse_header(uint8_t * buffer, size_t buffer_size) {
+
+    // the rest of the header has not been received yet
+    size_t size = header_size(buffer, buffer_size);
+    if (size == 0 || size > buffer_size)
+        return 0;
     
     /*
       0               1               2               3
@@ -115,9 +176,7 @@ size_t DataFrame::parse_raw_frame(uint8_t buffer[MAX_PACKET_SIZE], size_t buffer
 
         header_end += 2;
 
-    }
-
-    if (m_payload_len_bytes == 127) {
+    } else if (m_payload_len_bytes == 127) {
 
         if (buffer[header_end] >> 7) {
 #if DEBUG_LEVEL >= 4
@@ -145,7 +204,7 @@ size_t DataFrame::parse_raw_frame(uint8_t buffer[MAX_PACKET_SIZE], size_t buffer
 
     }
 
-    return add_payload_data(buffer, header_end, buffer_size);
+    return header_end;
 
 }
 
@@ -61,6 +61,22 @@ public:
     bool payload_full() const { return ((m_payload_len_bytes - m_application_data.size()) == 0); }
     size_t add_payload_data (uint8_t buffer[MAX_PACKET_SIZE], int offset, size_t buffer_size);
     size_t parse_raw_frame (uint8_t buffer[MAX_PACKET_SIZE], size_t buffer_size);
+
+    // parses the header only, returns its size or 0 if it is incomplete
+    size_t parse_header (uint8_t * buffer, size_t buffer_size);
+
+    // size of the header starting at buffer, 0 if not even 2 bytes are there
+    static size_t header_size (const uint8_t * buffer, size_t buffer_size);
+
+    // the frame as it is sent, masked with m_masking_key if m_mask is set
     std::vector<uint8_t> get_raw_frame();
+
+    // appends the header of a frame with size bytes of payload, with the
+    // masking key if key is not nullptr (frames of a client)
+    static void append_header (std::vector<uint8_t> & out, bool fin, Opcode opcode, uint64_t size, const uint8_t * key = nullptr);
+
+    // masks or unmasks size bytes in place, position is the offset of data
+    // in the payload (the key starts over every 4 bytes)
+    static void mask (uint8_t * data, size_t size, const uint8_t key[4], uint64_t position = 0);
     
 };
\ No newline at end of file
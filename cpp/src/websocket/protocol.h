@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "websocket.h"
+
+// A subprotocol (rfc6455 section-1.9) with the handler serving it. The
+// functions are instantiated for the type of the handler, so a message is
+// one call into its on_message(), which the compiler can inline.
+struct Protocol {
+    std::string name;
+    void * handler;
+    void (*on_open)(void * handler, WebSocket & ws);
+    void (*on_message)(void * handler, WebSocket & ws, const WebSocket::Message & message);
+    void (*on_close)(void * handler, WebSocket & ws);
+};
+
+// Protocols the server speaks, chosen once per connection in the handshake
+// (Sec-WebSocket-Protocol):
+//
+//   struct Json {
+//       void on_open(WebSocket & ws);  // optional, after the handshake
+//       void on_message(WebSocket & ws, const WebSocket::Message & message);
+//       void on_close(WebSocket & ws); // optional, before the slot is reused
+//   };
+//
+//   Json json;
+//   Protocols protocols;
+//   protocols.add("json.v1", json);
+//   socket.set_protocols(&protocols);
+//
+// The messages of a connection with a protocol go to its handler instead of
+// on_message() or receive(). Without a match the connection has the default
+// protocol (set_default(), no header in the response) or none.
+class Protocols {
+public:
+
+    // the handler is shared by all connections and must outlive them,
+    // protocols are added before the socket listens
+    template <typename Handler>
+    void add(std::string name, Handler & handler) {
+        m_protocols.push_back({ std::move(name), &handler, &open<Handler>, &message<Handler>, &close<Handler> });
+    };
+
+    // serves the clients offering none of the protocols (or no header at
+    // all), like the backend of a proxy (see proxy.h)
+    template <typename Handler>
+    void set_default(Handler & handler) {
+        m_default = { "", &handler, &open<Handler>, &message<Handler>, &close<Handler> };
+    };
+
+    // the first protocol of the client (its order is its preference) we
+    // speak, nullptr if there is none
+    const Protocol * select(const std::vector<std::string> & offered) const {
+        for (const std::string & name : offered)
+            for (const Protocol & protocol : m_protocols)
+                if (protocol.name == name)
+                    return &protocol;
+        return (m_default.handler != nullptr) ? &m_default : nullptr;
+    };
+
+    bool empty() const { return m_protocols.empty() && m_default.handler == nullptr; };
+
+private:
+
+    // keeps the addresses handed to the connections
+    std::deque<Protocol> m_protocols;
+    Protocol m_default { "", nullptr, nullptr, nullptr, nullptr };
+
+    template <typename Handler>
+    static void open(void * handler, WebSocket & ws) {
+        if constexpr (requires(Handler & h) { h.on_open(ws); })
+            static_cast<Handler *>(handler)->on_open(ws);
+    };
+
+    template <typename Handler>
+    static void message(void * handler, WebSocket & ws, const WebSocket::Message & message) {
+        static_cast<Handler *>(handler)->on_message(ws, message);
+    };
+
+    template <typename Handler>
+    static void close(void * handler, WebSocket & ws) {
+        if constexpr (requires(Handler & h) { h.on_close(ws); })
+            static_cast<Handler *>(handler)->on_close(ws);
+    };
+
+};
@@ -4,25 +4,303 @@
  */
 
 #include "websocket.h"
+#include "protocol.h"
+
+const WebSocket::Limits WebSocket::default_limits;
 
 WebSocket::WebSocket(int connection)
 {
     m_connection = connection;
 }
 
+WebSocket::~WebSocket()
+{
+    if (m_reserved > 0)
+        unreserve(m_reserved);
+}
+
+void WebSocket::reset(int connection, uint64_t id)
+{
+
+    m_connection = connection;
+    m_id = id;
+    m_state = State::Disconnected;
+    m_close_statuscode = 1000;
+    m_extensions = NoExtensions;
+    m_waiting_for_pong = false;
+    m_executor = nullptr;
+    m_loop = nullptr;
+    m_tls = nullptr;
+    m_transport = Transport::kernel();
+    m_protocol = nullptr;
+    m_protocols = nullptr;
+
+    // the buffers go back to the budget, pooled slots hold nothing
+    m_read_size = 0;
+    m_read_buffer = std::vector<uint8_t>();
+    if (m_reserved > 0)
+        unreserve(m_reserved);
+    m_message_size = 0;
+    drop_queued();
+    m_budget = nullptr;
+    set_limits(nullptr);
+    m_throttling = nullptr;
+    m_paused = false;
+
+    m_framequeue.clear();
+    m_last_frame = DataFrame();
+    m_on_message = nullptr;
+    m_on_handshake = nullptr;
+    m_on_disconnected = nullptr;
+    m_url = HTTP::Request::Url();
+    m_outbox = std::vector<std::vector<uint8_t>>();
+    m_outbox_offset = 0;
+    m_conflated = nullptr;
+    m_want_write = false;
+    m_batching = false;
+    m_inbox.clear();
+    m_inbox_taken = false;
+    m_receiver = nullptr;
+    m_sender = nullptr;
+
+}
+
+void WebSocket::set_executor(Executor * executor)
+{
+
+    m_executor = executor;
+
+    // kept for the next connection of the pooled slot
+    if (executor != nullptr && m_strand == nullptr)
+        m_strand = std::make_unique<Executor::Strand>();
+
+}
+
+void WebSocket::set_limits(const Limits * limits)
+{
+
+    m_limits = (limits != nullptr) ? limits : &default_limits;
+    m_rate = nullptr;
+
+    if (m_limits->frames_per_second > 0 || m_limits->bytes_per_second > 0 || m_limits->control_frames_per_second > 0) {
+        m_rate = std::make_unique<Rate>();
+        m_rate->buckets.set_rate(m_limits->frames_per_second, m_limits->bytes_per_second, m_limits->control_frames_per_second);
+    }
+
+}
+
 void WebSocket::send_message(std::string message) {
 
-    std::vector<uint8_t> raw_frame = DataFrame::get_text_frame(message).get_raw_frame();
+    send_raw(DataFrame::get_text_frame(message).get_raw_frame());
 
-#if !COMPILE_FOR_FUZZING
-    send(m_connection, raw_frame.data(), raw_frame.size(), 0);
-#endif
+}
+
+ssize_t WebSocket::read_bytes(uint8_t * buffer, size_t size) {
+
+    if (m_tls != nullptr)
+        return m_tls->read(buffer, size);
+
+    iovec iov { buffer, size };
+    return m_transport->read(m_connection, &iov, 1);
+
+}
+
+ssize_t WebSocket::write_bytes(const uint8_t * data, size_t size) {
+
+    if (m_tls != nullptr)
+        return m_tls->write(data, size);
+
+    iovec iov { (void *) data, size };
+    return m_transport->write(m_connection, &iov, 1);
+
+}
+
+void WebSocket::send_raw(const std::vector<uint8_t> & raw) {
+
+    send_raw(std::vector<uint8_t>(raw));
+
+}
+
+void WebSocket::send_raw(std::vector<uint8_t> && raw) {
+
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+
+    queue(std::move(raw));
+
+    if (!m_batching)
+        flush();
+
+}
+
+void WebSocket::send_raw(std::span<const std::span<const uint8_t>> parts) {
+
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+
+    for (std::span<const uint8_t> part : parts)
+        queue(std::vector<uint8_t>(part.begin(), part.end()));
+
+    if (!m_batching)
+        flush();
+
+}
+
+void WebSocket::queue_raw(std::span<const std::span<const uint8_t>> parts) {
+
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+
+    for (std::span<const uint8_t> part : parts)
+        queue(std::vector<uint8_t>(part.begin(), part.end()));
+
+}
+
+void WebSocket::send_queued() {
+
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+
+    // a batch writes them at its end
+    if (!m_batching && !m_outbox.empty())
+        flush();
+
+}
+
+void WebSocket::send_latest(const std::string & key, const std::vector<uint8_t> & raw) {
+
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+
+    // the client keeps up, there is nothing to replace
+    if (!m_want_write) {
+        queue(std::vector<uint8_t>(raw));
+        if (!m_batching)
+            flush();
+        return;
+    }
+
+    // most connections never congest, they do not carry the queue
+    if (m_conflated == nullptr)
+        m_conflated = std::make_unique<Conflation>();
+
+    m_conflated->put(key, raw);
+
+    if (!charge_queued())
+        drop_slow_client();
+
+}
+
+uint64_t WebSocket::conflated() {
+
+    // the queue is created and replaced under the lock of the senders
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+    return m_conflated != nullptr ? m_conflated->replaced() : 0;
+
+}
+
+bool WebSocket::send_from(int fd, size_t length, DataFrame::Opcode opcode, const int pipe[2],
+                          std::chrono::milliseconds timeout) {
+
+    std::vector<uint8_t> frame;
+    DataFrame::append_header(frame, true, opcode, length);
+
+    if (m_tls != nullptr || m_loop != nullptr || m_transport != Transport::kernel()) {
+
+        size_t header_size = frame.size();
+        frame.resize(header_size + length);
+
+        for (size_t offset = header_size; offset < frame.size();) {
+            ssize_t bytes = ::read(fd, frame.data() + offset, frame.size() - offset);
+            if (bytes <= 0)
+                return false;
+            offset += bytes;
+        }
+
+        if (m_state >= State::Connected)
+            send_raw(std::move(frame));
+
+        return true;
+
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+
+    // the frames queued before go first, blocking until the kernel took them
+    flush();
+
+    bool sending = m_state >= State::Connected;
+
+    // a broken or stalled client got part of a frame at most, it is closed
+    // and the reading thread notices
+    auto stop_sending = [&]() {
+        if (sending)
+            ::shutdown(m_connection, SHUT_RDWR);
+        sending = false;
+    };
+
+    auto stalled = [&]() {
+        return timeout.count() > 0 && std::chrono::steady_clock::now() >= deadline;
+    };
+
+    for (size_t offset = 0; sending && offset < frame.size();) {
+        ssize_t bytes = ::send(m_connection, frame.data() + offset, frame.size() - offset,
+                               MSG_NOSIGNAL | ((length > 0) ? MSG_MORE : 0));
+        if (bytes <= 0 || stalled())
+            stop_sending();
+        else
+            offset += bytes;
+    }
+
+    uint8_t discard[4096];
+
+    for (size_t remaining = length; remaining > 0;) {
+
+        ssize_t moved = splice(fd, nullptr, pipe[1], nullptr, remaining, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (moved <= 0) {
+            // a truncated frame, the client cannot read the next one
+            stop_sending();
+            return false;
+        }
+
+        remaining -= moved;
+
+        // the pipe is emptied before the next splice, to the client or
+        // thrown away if it is gone
+        while (moved > 0) {
+
+            ssize_t out = -1;
+
+            if (sending && stalled())
+                stop_sending();
+
+            if (sending)
+                out = splice(pipe[0], nullptr, m_connection, nullptr, moved,
+                             SPLICE_F_MOVE | ((remaining > 0) ? SPLICE_F_MORE : 0));
+
+            if (out <= 0) {
+                stop_sending();
+                out = ::read(pipe[0], discard, std::min<size_t>(moved, sizeof(discard)));
+                if (out <= 0)
+                    return false;
+            }
+
+            moved -= out;
+
+        }
+
+    }
+
+    return true;
 
 }
 
 void WebSocket::handle_frame(DataFrame frame)
 {
 
+    // reserved by check_frame() until the frame is handled
+    uint64_t control_size = (frame.m_opcode == DataFrame::TextFrame ||
+                             frame.m_opcode == DataFrame::BinaryFrame ||
+                             frame.m_opcode == DataFrame::ContinuationFrame) ? 0 : frame.m_payload_len_bytes;
+
     switch (frame.m_opcode)
     {
 
@@ -39,17 +317,23 @@ void WebSocket::handle_frame(DataFrame frame)
         break;
 
     case DataFrame::Ping:
-        send_pong_frame();
+        send_pong_frame(std::move(frame.m_application_data));
         break;
 
-    // case DataFrame::BinaryFrame:
+    case DataFrame::ContinuationFrame:
+    case DataFrame::BinaryFrame:
     case DataFrame::TextFrame:
 
-        
+        // a continuation belongs to a started message, a new message waits
+        // for the last frame of the one before
+        if ((frame.m_opcode == DataFrame::ContinuationFrame) == m_framequeue.empty()) {
+            fail(1002);
+            return;
+        }
 
-        m_framequeue.push_back(frame);
+        m_framequeue.push_back(std::move(frame));
 
-        if (!frame.m_fin)
+        if (!m_framequeue.back().m_fin)
             return;
 
         handle_text_frame();
@@ -66,10 +350,71 @@ void WebSocket::handle_frame(DataFrame frame)
         break;
     }
 
+    if (control_size > 0)
+        unreserve(control_size);
+
+    // the message was handed over (or dropped), see check_frame()
+    if (m_framequeue.empty() && m_message_size > 0) {
+        unreserve(m_message_size);
+        m_message_size = 0;
+    }
+
+}
+
+WebSocket::Message WebSocket::take_message () {
+
+    Message message;
+    message.opcode = m_framequeue.front().m_opcode;
+
+    if (m_framequeue.size() == 1) {
+        message.payload = std::move(m_framequeue.front().m_application_data);
+    } else {
+        for (DataFrame& f : m_framequeue)
+            message.payload.insert(message.payload.end(),
+                                   f.m_application_data.begin(), f.m_application_data.end());
+    }
+
+    return message;
+
 }
 
 void WebSocket::handle_text_frame () {
 
+    if (m_protocol != nullptr) {
+
+        Message message = take_message();
+
+        if (m_executor == nullptr) {
+            m_protocol->on_message(m_protocol->handler, *this, message);
+            return;
+        }
+
+        bool queued = m_executor->post(*m_strand, [this, protocol = m_protocol, message = std::move(message)]() {
+            protocol->on_message(protocol->handler, *this, message);
+        });
+
+        if (!queued) {
+#if DEBUG_LEVEL >= 4
+            std::cout << "[WebSocket " << m_connection << "] executor is full, message dropped\n";
+#endif
+        }
+
+        return;
+
+    }
+
+    if (m_loop != nullptr && m_on_message == nullptr) {
+
+        // the message is picked up by receive()
+        m_inbox.push_back(take_message());
+
+        if (m_receiver)
+            std::exchange(m_receiver, nullptr).resume();
+
+        return;
+
+    }
+
     std::string message;
 
     for (DataFrame& f : m_framequeue)
@@ -77,9 +422,6 @@ void WebSocket::handle_text_frame () {
 
     // message = m_framequeue[0].get_utf8_string();
 
-    if (m_on_message != nullptr)
-        m_on_message(message);
-
 #if DEBUG_LEVEL >= 7
 
     std::string msg;
@@ -97,9 +439,27 @@ void WebSocket::handle_text_frame () {
 
 #endif
 
+    if (m_on_message == nullptr)
+        return;
+
+    if (m_executor == nullptr) {
+        m_on_message(message);
+        return;
+    }
+
+    bool queued = m_executor->post(*m_strand, [this, message]() {
+        m_on_message(message);
+    });
+
+    if (!queued) {
+#if DEBUG_LEVEL >= 4
+        std::cout << "[WebSocket " << m_connection << "] executor is full, message dropped\n";
+#endif
+    }
+
 }
 
-void WebSocket::send_pong_frame() {
+void WebSocket::send_pong_frame(std::vector<uint8_t> application_data) {
 
     DataFrame pong_frame;
 
@@ -107,36 +467,36 @@ void WebSocket::send_pong_frame() {
     pong_frame.m_mask = false;
     pong_frame.m_rsv = 0;
     pong_frame.m_opcode = DataFrame::Pong;
-    pong_frame.m_payload_len_bytes = 0;
+    pong_frame.m_payload_len_bytes = application_data.size();
+    pong_frame.m_application_data = std::move(application_data);
 
-    std::vector<uint8_t> raw_frame = pong_frame.get_raw_frame();
-
-#if !COMPILE_FOR_FUZZING
-    send(m_connection, raw_frame.data(), raw_frame.size(), 0);
-#endif
+    send_raw(pong_frame.get_raw_frame());
 
 }
 
 void WebSocket::check_for_keep_alive() {
 
-    // check if the client is alive
-    std::thread ([&]() {
+    // the WebSocket is pooled, stop as soon as it serves another connection
+    uint64_t id = m_id;
 
-        std::vector<uint8_t> raw_frame;
+    // check if the client is alive
+    std::thread ([this, id]() {
 
-        while (m_state > State::WaitingForHandshake)
+        while (m_state > State::WaitingForHandshake && m_id == id)
         {
 
             std::this_thread::sleep_for(std::chrono::seconds(20));
 
-            raw_frame = DataFrame::get_ping_frame().get_raw_frame();
-            send(m_connection, raw_frame.data(), raw_frame.size(), 0);
+            if (m_id != id || m_state <= State::WaitingForHandshake)
+                break;
+
+            send_raw(DataFrame::get_ping_frame().get_raw_frame());
 
             m_waiting_for_pong = true;
 
             std::this_thread::sleep_for(std::chrono::seconds(CONNECTION_TIMEOUT_SECONDS));
 
-            if (m_waiting_for_pong) {
+            if (m_waiting_for_pong && m_id == id) {
                 std::cout << "[WebSocket " << m_connection << "] no pong\n";
                 m_close_statuscode = 1002;
                 close(0);
@@ -157,193 +517,1010 @@ void WebSocket::listen()
     check_for_keep_alive();
 #endif
 
-    uint8_t buffer[MAX_PACKET_SIZE];
-    DataFrame last_frame;
-
-    size_t offset;
-    int bytes_read;
-
-    while (0 < (bytes_read = read(m_connection, buffer, MAX_PACKET_SIZE)))
+    while (true)
     {
+        // a throttled client is not read from meanwhile, see admit()
+        if (delayed())
+            pause();
+        else if (read_some() <= 0)
+            break;
 
-        offset = 0;
+        // the answers to all frames of this read leave with one write
+        begin_batch();
+        bool reading = consume();
+        end_batch();
 
-        if (bytes_read == 0)
-        {
-            close(true);
+        if (!reading)
             break;
-        }
+    }
 
-        if (m_state < State::WaitingForHandshake)
-        {
-            break;
-        }
+    // the queued handlers still use this connection
+    if (m_strand != nullptr)
+        m_strand->wait_idle();
 
-        if (m_state == State::WaitingForHandshake)
-        {
+    m_read_size = 0;
+    resize_read_buffer(0);
 
-            offset = handshake(buffer, bytes_read);
+    // the client went away without a close frame
+    if (m_state != State::Disconnected) {
+        // before close(), the fd number may be reused right after it
+        m_state = State::Disconnected;
+        m_transport->close(m_connection);
+    }
+    
+}
 
-            if (m_state != State::Connected)
-            {
-                close(true);
-                return;
-            }
+ssize_t WebSocket::read_some()
+{
 
-#if !COMPILE_FOR_FUZZING
-            continue; // the websocket handshake has no body data
-#else
-            if (offset >= bytes_read) {
-                continue;
-            }
-#endif
-            
-        }
+    // an idle connection of the event loop has no buffer at all
+    if (m_read_buffer.empty() && !resize_read_buffer(m_limits->read_buffer_min)) {
+        fail(1013);
+        errno = ENOMEM;
+        return -1;
+    }
 
-        if (m_state == State::InDataPayload) {
+    // a split handshake request filled the buffer
+    if (m_read_size == m_read_buffer.size() &&
+        !resize_read_buffer(std::min(m_read_buffer.size() * 2, m_limits->read_buffer_max)))
+    {
+        fail(1013);
+        errno = ENOMEM;
+        return -1;
+    }
 
-            offset = last_frame.add_payload_data(buffer, 0, bytes_read);
+    size_t space = m_read_buffer.size() - m_read_size;
+
+    // what does not fit into the buffer lands on the stack, but never more
+    // than the buffer may grow
+    uint8_t spill[READ_SPILL_SIZE];
+    size_t spill_size = 0;
+    if (m_tls == nullptr && m_read_buffer.size() < m_limits->read_buffer_max)
+        spill_size = std::min<size_t>(READ_SPILL_SIZE, m_limits->read_buffer_max - m_read_buffer.size());
+
+    ssize_t bytes_read;
+
+    if (spill_size > 0) {
+        iovec iov[2] = {
+            { m_read_buffer.data() + m_read_size, space },
+            { spill, spill_size }
+        };
+        bytes_read = m_transport->read(m_connection, iov, 2);
+    } else {
+        bytes_read = read_bytes(m_read_buffer.data() + m_read_size, space);
+    }
 
-            if (!last_frame.payload_full())
-                continue;
+    if (bytes_read <= 0)
+        return bytes_read;
 
-            m_state = State::Connected;
-            handle_frame(last_frame);
+    if ((size_t) bytes_read <= space) {
+        m_read_size += bytes_read;
+        adapt_read_buffer(bytes_read, space);
+        return bytes_read;
+    }
 
-            if (offset == bytes_read)
-                continue; // No more data available
-    
-        }
+    // the kernel had more than the buffer could take, a bulk sender
+    size_t spilled = bytes_read - space;
+    m_read_size += space;
 
-        DataFrame frame;
+    size_t size = std::max(m_read_buffer.size() * 2, m_read_size + spilled);
+    if (!resize_read_buffer(std::min(size, m_limits->read_buffer_max))) {
+        fail(1013);
+        errno = ENOMEM;
+        return -1;
+    }
 
-        while (offset < bytes_read) {
+    memcpy(m_read_buffer.data() + m_read_size, spill, spilled);
+    m_read_size += spilled;
 
-            DataFrame current_frame;
-            offset += current_frame.parse_raw_frame(buffer+offset, bytes_read-offset);
-            frame = current_frame;
+    return bytes_read;
 
-            if (!frame.payload_full())
-                break;
+}
 
-        }
-        
-        if (frame.payload_full() == 0) {
-            last_frame = frame;
-            m_state = State::InDataPayload;
-            continue;
-        }
+void WebSocket::adapt_read_buffer(size_t bytes_read, size_t space)
+{
 
-        handle_frame(frame);
-        
+    size_t size = m_read_buffer.size();
+
+    // the kernel had more, a bulk sender
+    if (bytes_read == space && size < m_limits->read_buffer_max) {
+        resize_read_buffer(std::min(size * 2, m_limits->read_buffer_max));
+        return;
     }
-    
+
+    if (bytes_read < size / 4 && m_read_size < size / 4 && size > m_limits->read_buffer_min)
+        resize_read_buffer(std::max(size / 2, m_limits->read_buffer_min));
+
 }
 
-size_t WebSocket::handshake(uint8_t * buffer, size_t bytes_read) {
+bool WebSocket::resize_read_buffer(size_t size)
+{
 
-    std::vector<uint8_t> raw_data(buffer, buffer+bytes_read);
+    size = std::max(size, m_read_size);
 
-    HTTP::Request request;
-    size_t header_offset = request.init_from_raw_request(raw_data);
+    if (size > m_read_buffer.size() && !reserve(size - m_read_buffer.size()))
+        return false;
 
-    /* The value of this header field MUST be a
-     * nonce consisting of a randomly selected 16-byte value that has
-     * been base64-encoded.
-     */
-    char sec_key[24+37]{};
-    std::string sec_websocket_key = request.get_header("sec-websocket-key").value;
-    if (sec_websocket_key.size() != 24) {
-        return 0;
-    }
-    strncpy(sec_key, sec_websocket_key.c_str(), 24);
-    strncpy(sec_key+24, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11\00", 37);
+    if (size < m_read_buffer.size())
+        unreserve(m_read_buffer.size() - size);
 
-    uint8_t sha1_hash[20];
-    Hash::sha1((uint8_t *) sec_key, sha1_hash, 24+36);
+    // exactly size bytes, a shrinking vector would keep its capacity
+    std::vector<uint8_t> buffer(size);
+    if (m_read_size > 0)
+        memcpy(buffer.data(), m_read_buffer.data(), m_read_size);
+    m_read_buffer.swap(buffer);
 
-    char b64_output[29]{};
-    Base64::encode(sha1_hash, b64_output, 20);
+    return true;
 
-    auto extensions = request.header_value_as_array("sec-websocket-extensions");
+}
 
-    for (auto & extension : extensions) {   
-        if (extension == "permessage-deflate") {
-            m_extensions |= PermessageDeflate;
-        }
-    }
+bool WebSocket::reserve(size_t bytes)
+{
 
-    HTTP::Response response;
+    if (m_budget != nullptr && !m_budget->reserve(bytes))
+        return false;
 
-    response.set_header("Upgrade", "websocket");
-    response.set_header("Connection", "Upgrade");
-    response.set_header("Sec-WebSocket-Accept", b64_output);
-    // response.set_header("Sec-WebSocket-Protocol", "");
-    response.set_header("Sec-WebSocket-Version", "13");
+    m_reserved += bytes;
+    return true;
 
-    std::vector<uint8_t> raw = response.get_raw_response();
+}
 
-#if !COMPILE_FOR_FUZZING
-    send(m_connection, raw.data(), raw.size(), 0);
-#endif
+void WebSocket::unreserve(size_t bytes)
+{
 
-    m_state = State::Connected;
+    if (m_budget != nullptr)
+        m_budget->release(bytes);
 
-    return header_offset;
+    m_reserved -= bytes;
 
 }
 
-void WebSocket::close(bool close_frame_received) {
+bool WebSocket::check_frame(const DataFrame & frame)
+{
 
-    if (m_state == State::Disconnected)
-        return;
+    if (frame.m_payload_len_bytes > m_limits->max_frame_size) {
+        fail(1009);
+        return false;
+    }
 
-    if (m_state != State::Closing) {
+    // control frames are not fragmented and carry at most 125 bytes
+    // (rfc6455 section-5.5)
+    if ((frame.m_opcode & 0x8) && (!frame.m_fin || frame.m_payload_len_bytes > 125)) {
+        fail(1002);
+        return false;
+    }
 
-        m_state = State::Closing;
+    bool message = frame.m_opcode == DataFrame::TextFrame ||
+                   frame.m_opcode == DataFrame::BinaryFrame ||
+                   frame.m_opcode == DataFrame::ContinuationFrame;
 
-        DataFrame frame;
+    if (message && m_message_size + frame.m_payload_len_bytes > m_limits->max_message_size) {
+        fail(1009);
+        return false;
+    }
 
-        frame.m_fin = true;
-        frame.m_mask = false;
-        frame.m_rsv = 0;
-        frame.m_opcode = DataFrame::ConectionClose;
-        frame.m_payload_len_bytes = 2;
+    // the payload is copied into the frame before it is handled, any
+    // other frame gives it back in handle_frame()
+    if (!reserve(frame.m_payload_len_bytes)) {
+        fail(1013);
+        return false;
+    }
 
-        uint16_t statuscode = m_close_statuscode;
-        if (close_frame_received)
-            statuscode = 1000;
+    if (message)
+        m_message_size += frame.m_payload_len_bytes;
+
+    return true;
+
+}
+
+WebSocket::Admission WebSocket::admit(const DataFrame & frame)
+{
+
+    if (m_rate == nullptr || frame.m_opcode == DataFrame::ConectionClose)
+        return Admitted;
+
+    // the rest of a dropped message, it takes no tokens from the next one
+    if (m_rate->dropping && frame.m_opcode == DataFrame::ContinuationFrame) {
+        m_rate->dropping = !frame.m_fin;
+        if (m_throttling != nullptr)
+            m_throttling->dropped++;
+        return Skipped;
+    }
+
+    bool control = frame.m_opcode == DataFrame::Ping || frame.m_opcode == DataFrame::Pong;
+    std::chrono::nanoseconds wait = m_rate->buckets.take(control, frame.m_payload_len_bytes);
+
+    if (!control)
+        m_rate->dropping = false;
+
+    if (wait.count() == 0)
+        return Admitted;
+
+    m_rate->throttled++;
+
+#if DEBUG_LEVEL >= 5
+    std::cout << "[WebSocket " << m_connection << "] frame over the rate limits\n";
+#endif
+
+    switch (m_limits->rate_action) {
+
+    case Delay:
+        if (m_throttling != nullptr)
+            m_throttling->delayed++;
+        m_rate->delay = wait;
+        return Delayed;
+
+    case Drop:
+        if (m_throttling != nullptr)
+            m_throttling->dropped++;
+        if (control)
+            return Skipped;
+        // the started message goes as well
+        if (!m_framequeue.empty()) {
+            m_framequeue.clear();
+            unreserve(m_message_size);
+            m_message_size = 0;
+        }
+        m_rate->dropping = !frame.m_fin;
+        return Skipped;
+
+    case Close:
+        if (m_throttling != nullptr)
+            m_throttling->closed++;
+        fail(1008);
+        return Closed;
+
+    }
+
+    return Admitted;
+
+}
+
+void WebSocket::pause()
+{
+
+    // the kernel buffers fill up meanwhile and TCP slows the client down
+    std::chrono::nanoseconds delay = std::exchange(m_rate->delay, std::chrono::nanoseconds(0));
+
+    if (m_loop == nullptr) {
+        std::this_thread::sleep_for(delay);
+        return;
+    }
+
+    m_paused = true;
+
+    {
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        m_loop->modify(m_connection, m_want_write ? (uint32_t) EPOLLOUT : 0u);
+    }
+
+    auto milliseconds = std::chrono::ceil<std::chrono::milliseconds>(delay);
+    m_loop->post_after(milliseconds, [this, id = m_id]() {
+        // the WebSocket is pooled, it may serve another connection by now
+        if (m_id == id)
+            resume();
+    });
+
+}
+
+void WebSocket::resume()
+{
+
+    if (!m_paused || m_state == State::Disconnected)
+        return;
+
+    m_paused = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        m_loop->modify(m_connection, EPOLLIN | (m_want_write ? (uint32_t) EPOLLOUT : 0u));
+    }
+
+    if (m_read_size == 0)
+        return;
+
+    // the frames read before the pause
+    begin_batch();
+    if (consume() && delayed())
+        pause();
+    end_batch();
+
+}
+
+void WebSocket::fail(uint16_t statuscode)
+{
+
+#if DEBUG_LEVEL >= 5
+    std::cout << "[WebSocket " << m_connection << "] closing with " << statuscode << "\n";
+#endif
+
+    m_close_statuscode = statuscode;
+
+    if (m_state >= State::Connected) {
+        m_state = State::Closing;
+        send_close_frame(statuscode);
+    }
+
+    m_state = State::Closing;
+    close(true);
+
+}
+
+bool WebSocket::consume()
+{
+
+    uint8_t * buffer = m_read_buffer.data();
+    size_t bytes_read = m_read_size;
+    size_t offset = 0;
+
+    // State::Closing still reads the answer to our close frame
+    if (m_state == State::Disconnected)
+    {
+        return false;
+    }
+
+    if (m_state == State::WaitingForHandshake)
+    {
+
+        // the request can arrive in several reads
+        std::string_view request((const char *) buffer, bytes_read);
+        size_t request_end = request.find("\r\n\r\n");
+        if (request_end == std::string_view::npos) {
+
+            if (bytes_read < m_limits->read_buffer_max)
+                return true;
+
+            fail(1009);
+            return false;
+
+        }
+
+        offset = request_end + 4;
+        handshake(buffer, offset);
+
+        // shutdown() may already be closing the upgraded connection
+        if (m_state == State::WaitingForHandshake)
+        {
+            close(true);
+            return false;
+        }
+
+        // a client may send its first frames right after the request
+        if (offset >= bytes_read) {
+            m_read_size = 0;
+            return true;
+        }
+
+    }
+
+    if (m_state == State::InDataPayload) {
+
+        offset = m_last_frame.add_payload_data(buffer, 0, bytes_read);
+
+        if (!m_last_frame.payload_full()) {
+            m_read_size = 0;
+            return true;
+        }
+
+        m_state = State::Connected;
+        handle_frame(std::move(m_last_frame));
+
+    }
+
+    // the payload of a dropped frame, see admit()
+    if (m_rate != nullptr && m_rate->skip > 0) {
+
+        uint64_t skipped = std::min<uint64_t>(m_rate->skip, bytes_read - offset);
+        offset += skipped;
+        m_rate->skip -= skipped;
+
+        if (m_rate->skip > 0) {
+            m_read_size = 0;
+            return true;
+        }
+
+    }
+
+    // a single read can contain several frames
+    while (offset < bytes_read && m_state != State::Disconnected) {
+
+        DataFrame frame;
+        size_t header_end = frame.parse_header(buffer + offset, bytes_read - offset);
+
+        // the rest of the header comes with the next read
+        if (header_end == 0)
+            break;
+
+        Admission admission = admit(frame);
+        if (admission == Closed)
+            return false;
+
+        // parsed again after the pause
+        if (admission == Delayed)
+            break;
+
+        if (admission == Skipped) {
+            uint64_t skipped = std::min<uint64_t>(frame.m_payload_len_bytes, bytes_read - offset - header_end);
+            offset += header_end + skipped;
+            m_rate->skip = frame.m_payload_len_bytes - skipped;
+            if (m_rate->skip > 0)
+                break;
+            continue;
+        }
+
+        if (!check_frame(frame))
+            return false;
+
+        offset += frame.add_payload_data(buffer + offset, header_end, bytes_read - offset);
+
+        if (!frame.payload_full()) {
+            m_last_frame = std::move(frame);
+            m_state = State::InDataPayload;
+            break;
+        }
+
+        handle_frame(std::move(frame));
+
+    }
+
+    if (m_state == State::Disconnected)
+        return false;
+
+    // keeps a split header for the next read
+    m_read_size = bytes_read - offset;
+    memmove(buffer, buffer + offset, m_read_size);
+
+    return true;
+
+}
+
+void WebSocket::attach(EventLoop * loop, fkt_task on_disconnected)
+{
+
+    m_loop = loop;
+    m_on_disconnected = std::move(on_disconnected);
+    m_state = State::WaitingForHandshake;
+
+    fcntl(m_connection, F_SETFL, fcntl(m_connection, F_GETFL) | O_NONBLOCK);
+
+    m_loop->add(m_connection, EPOLLIN, [this](uint32_t events) {
+        on_event(events);
+    });
+
+}
+
+void WebSocket::on_event(uint32_t events)
+{
+
+    if (m_tls != nullptr && !m_tls->established()) {
+
+        TLS::Session::Handshake result = m_tls->handshake();
+
+        if (result == TLS::Session::Failed) {
+            // without a TLS session there is nobody to send a close frame to
+            m_state = State::Closing;
+            close(true);
+            return;
+        }
+
+        m_loop->modify(m_connection, (result == TLS::Session::WantWrite) ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+
+        if (result != TLS::Session::Done)
+            return;
+
+    }
+
+    if (events & EPOLLOUT) {
+
+        bool flushed;
+        {
+            std::lock_guard<std::mutex> lock(m_send_mutex);
+            flushed = flush();
+        }
+
+        if (flushed && m_sender)
+            std::exchange(m_sender, nullptr).resume();
+
+    }
+
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        return;
+
+    // throttled, polled again by resume()
+    if (m_paused) {
+
+        // the client is gone, its frames will not be handled anymore
+        if (events & (EPOLLHUP | EPOLLERR)) {
+            m_close_statuscode = 1006;
+            close(true);
+            return;
+        }
+
+        // EPOLLIN was set again by flush() meanwhile
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        m_loop->modify(m_connection, read_events() | (m_want_write ? (uint32_t) EPOLLOUT : 0u));
+        return;
+
+    }
+
+    // the frames of all coroutines resumed by these reads leave together
+    begin_batch();
+
+    bool idle = false;
+
+    while (m_state != State::Disconnected) {
+
+        ssize_t bytes_read = read_some();
+
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // idle, the buffers are allocated again with the next message
+            if (m_read_size == 0)
+                resize_read_buffer(0);
+            idle = true;
+            break;
+        }
+
+        if (m_state == State::Disconnected)
+            break; // failed in read_some()
+
+        if (bytes_read <= 0) {
+            m_close_statuscode = 1006;
+            close(true);
+            break;
+        }
+
+        if (!consume())
+            break;
+
+        if (delayed()) {
+            pause();
+            break;
+        }
+
+    }
+
+    end_batch();
+
+    if (idle) {
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        if (m_outbox.empty())
+            m_outbox = std::vector<std::vector<uint8_t>>();
+    }
+
+}
+
+void WebSocket::begin_batch()
+{
+
+    std::lock_guard<std::mutex> lock(m_send_mutex);
+    m_batching = true;
+
+}
+
+void WebSocket::end_batch()
+{
+
+    bool flushed;
+    {
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        m_batching = false;
+        flushed = flush();
+    }
+
+    if (flushed && m_sender)
+        std::exchange(m_sender, nullptr).resume();
+
+}
+
+bool WebSocket::flush()
+{
+
+    while (!m_outbox.empty() || (m_conflated != nullptr && !m_conflated->empty())) {
+
+        // the kernel took everything before them, the latest values of a
+        // congested connection leave as one batch
+        if (m_outbox.empty()) {
+            m_queued += m_conflated->bytes();
+            m_conflated->take(m_outbox);
+        }
+
+        ssize_t sent = write_frames();
+
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && m_loop != nullptr) {
+            if (!m_want_write) {
+                m_want_write = true;
+                m_loop->modify(m_connection, read_events() | EPOLLOUT);
+            }
+            if (charge_queued())
+                return false;
+            drop_slow_client();
+            break;
+        }
+
+        if (sent <= 0) {
+            // the connection is broken, or the send of a blocking one timed
+            // out (SO_SNDTIMEO, see Proxy) in the middle of a frame, the next
+            // read will notice
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                ::shutdown(m_connection, SHUT_RDWR);
+            break;
+        }
+
+        // drops the frames the kernel took completely
+        m_outbox_offset += sent;
 
-        frame.m_application_data.push_back((statuscode >> 8));
-        frame.m_application_data.push_back((statuscode & 0xff));
+        size_t done = 0;
+        while (done < m_outbox.size() && m_outbox_offset >= m_outbox[done].size()) {
+            m_queued -= m_outbox[done].size();
+            m_outbox_offset -= m_outbox[done++].size();
+        }
+
+        m_outbox.erase(m_outbox.begin(), m_outbox.begin() + done);
+
+    }
+
+    drop_queued();
+
+    if (m_want_write) {
+        m_want_write = false;
+        m_loop->modify(m_connection, read_events());
+    }
 
-        std::vector<uint8_t> raw_res = frame.get_raw_frame();
+    return true;
 
-#if !COMPILE_FOR_FUZZING
-        send(m_connection, raw_res.data(), raw_res.size(), 0);
+}
+
+void WebSocket::queue(std::vector<uint8_t> && frame)
+{
+
+    m_queued += frame.size();
+    m_outbox.push_back(std::move(frame));
+
+}
+
+void WebSocket::drop_queued()
+{
+
+    m_outbox.clear();
+    m_outbox_offset = 0;
+    m_queued = 0;
+    if (m_conflated != nullptr)
+        m_conflated->clear();
+
+    if (m_budget != nullptr && m_charged > 0)
+        m_budget->release(m_charged);
+    m_charged = 0;
+
+}
+
+bool WebSocket::charge_queued()
+{
+
+    // only a congested connection holds its frames, the others do not pay
+    // for each send
+    size_t queued = m_queued + ((m_conflated != nullptr) ? m_conflated->bytes() : 0);
+
+    if (m_budget == nullptr)
+        return true;
+
+    if (queued > m_charged && !m_budget->reserve(queued - m_charged))
+        return false;
+
+    if (queued < m_charged)
+        m_budget->release(m_charged - queued);
+
+    m_charged = queued;
+    return true;
+
+}
+
+void WebSocket::drop_slow_client()
+{
+
+#if DEBUG_LEVEL >= 5
+    std::cout << "[WebSocket " << m_connection << "] client does not read, closing with 1013\n";
 #endif
 
+    // the close frame takes the place of the queued ones, unless the
+    // client got part of a frame already
+    bool in_frame = m_outbox_offset > 0;
+    drop_queued();
+
+    m_close_statuscode = 1013;
+
+    if (!in_frame) {
+        uint8_t close_frame[] = { 0x88, 0x02, 1013 >> 8, 1013 & 0xff };
+        write_bytes(close_frame, sizeof(close_frame));
+    }
+
+    // the loop reads the EOF and closes the connection
+    ::shutdown(m_connection, SHUT_RDWR);
+
+}
+
+ssize_t WebSocket::write_frames()
+{
+
+    // SSL_write() encrypts one buffer at a time
+    if (m_tls != nullptr && !m_tls->kernel_send()) {
+        std::vector<uint8_t> & frame = m_outbox.front();
+        return write_bytes(frame.data() + m_outbox_offset, frame.size() - m_outbox_offset);
+    }
+
+    iovec iov[WRITE_BATCH_FRAMES];
+    size_t count = std::min<size_t>(m_outbox.size(), WRITE_BATCH_FRAMES);
+
+    for (size_t i = 0; i < count; i++)
+        iov[i] = { m_outbox[i].data(), m_outbox[i].size() };
+
+    iov[0].iov_base = m_outbox[0].data() + m_outbox_offset;
+    iov[0].iov_len -= m_outbox_offset;
+
+    return m_transport->write(m_connection, iov, count);
+
+}
+
+void WebSocket::disconnected()
+{
+
+    // waiting coroutines see the closed connection before it is released
+    if (m_receiver)
+        std::exchange(m_receiver, nullptr).resume();
+    if (m_sender)
+        std::exchange(m_sender, nullptr).resume();
+
+    fkt_task on_disconnected = std::move(m_on_disconnected);
+    if (on_disconnected == nullptr)
+        return;
+
+    // the handlers queued on the executor still use this connection, it is
+    // released behind them on the loop (which does not wait for them)
+    if (m_strand != nullptr && m_executor != nullptr) {
+
+        EventLoop * loop = m_loop;
+        bool queued = m_executor->post(*m_strand, [loop, on_disconnected]() {
+            loop->post(on_disconnected);
+        });
+
+        if (queued)
+            return;
+
+        m_strand->wait_idle();
+
+    }
+
+    on_disconnected(); // may delete this
+
+}
+
+WebSocket::ReceiveAwaiter WebSocket::receive()
+{
+    return ReceiveAwaiter { *this };
+}
+
+bool WebSocket::ReceiveAwaiter::await_ready()
+{
+
+    if (ws.m_inbox_taken) {
+        ws.m_inbox.pop_front();
+        ws.m_inbox_taken = false;
+    }
+
+    return !ws.m_inbox.empty() || ws.m_state < State::WaitingForHandshake;
+
+}
+
+const WebSocket::Message * WebSocket::ReceiveAwaiter::await_resume()
+{
+
+    if (ws.m_inbox.empty())
+        return nullptr;
+
+    ws.m_inbox_taken = true;
+    return &ws.m_inbox.front();
+
+}
+
+WebSocket::SendAwaiter WebSocket::send(std::span<const uint8_t> payload, DataFrame::Opcode opcode)
+{
+
+    if (m_state >= State::Connected) {
+
+        DataFrame frame;
+        frame.m_opcode = opcode;
+        frame.m_application_data.assign(payload.begin(), payload.end());
+        frame.m_payload_len_bytes = payload.size();
+
+        send_raw(frame.get_raw_frame());
+
+    }
+
+    return SendAwaiter { *this };
+
+}
+
+WebSocket::SendAwaiter WebSocket::send(std::string_view text)
+{
+    return send(std::span<const uint8_t>((const uint8_t *) text.data(), text.size()));
+}
+
+bool WebSocket::SendAwaiter::await_ready()
+{
+    std::lock_guard<std::mutex> lock(ws.m_send_mutex);
+    // frames of a batch are written before the loop waits again
+    return ws.m_outbox.empty() || (ws.m_batching && !ws.m_want_write) ||
+           ws.m_state < State::WaitingForHandshake;
+}
+
+size_t WebSocket::handshake(uint8_t * buffer, size_t bytes_read) {
+
+    std::vector<uint8_t> raw_data(buffer, buffer+bytes_read);
+
+    HTTP::Request request;
+    size_t header_offset = request.init_from_raw_request(raw_data);
+    m_url = request.url();
+
+    /* The value of this header field MUST be a
+     * nonce consisting of a randomly selected 16-byte value that has
+     * been base64-encoded.
+     */
+    char sec_key[24+37]{};
+    std::string sec_websocket_key = request.get_header("sec-websocket-key").value;
+    if (sec_websocket_key.size() != 24) {
+        return 0;
+    }
+    strncpy(sec_key, sec_websocket_key.c_str(), 24);
+    strncpy(sec_key+24, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11\00", 37);
+
+    uint8_t sha1_hash[20];
+    Hash::sha1((uint8_t *) sec_key, sha1_hash, 24+36);
+
+    char b64_output[29]{};
+    Base64::encode(sha1_hash, b64_output, 20);
+
+    auto extensions = request.header_value_as_array("sec-websocket-extensions");
+
+    for (auto & extension : extensions) {   
+        if (extension == "permessage-deflate") {
+            m_extensions |= PermessageDeflate;
+        }
+    }
+
+    // the client lists the protocols it speaks, we answer with one of them
+    // or without the header (rfc6455 section-4.2.2)
+    if (m_protocols != nullptr)
+        m_protocol = m_protocols->select(request.header_value_as_array("sec-websocket-protocol", ','));
+
+    HTTP::Response response;
+
+    response.set_header("Upgrade", "websocket");
+    response.set_header("Connection", "Upgrade");
+    response.set_header("Sec-WebSocket-Accept", b64_output);
+    if (m_protocol != nullptr && !m_protocol->name.empty())
+        response.set_header("Sec-WebSocket-Protocol", m_protocol->name);
+    response.set_header("Sec-WebSocket-Version", "13");
+
+    // before the response, a shutdown() racing with the client must
+    // already send a close frame
+    m_state = State::Connected;
+
+    send_raw(response.get_raw_response());
+
+    if (m_protocol != nullptr)
+        m_protocol->on_open(m_protocol->handler, *this);
+
+    if (m_on_handshake != nullptr)
+        m_on_handshake();
+
+    return header_offset;
+
+}
+
+void WebSocket::send_close_frame(uint16_t statuscode) {
+
+    DataFrame frame;
+
+    frame.m_fin = true;
+    frame.m_mask = false;
+    frame.m_rsv = 0;
+    frame.m_opcode = DataFrame::ConectionClose;
+    frame.m_payload_len_bytes = 2;
+
+    frame.m_application_data.push_back((statuscode >> 8));
+    frame.m_application_data.push_back((statuscode & 0xff));
+
+    send_raw(frame.get_raw_frame());
+
+}
+
+void WebSocket::shutdown(uint16_t statuscode) {
+
+    if (m_state == State::WaitingForHandshake) {
+        // nothing to say to the client yet, the reader sees the EOF
+        m_transport->shutdown(m_connection);
+        return;
+    }
+
+    if (m_state < State::Connected)
+        return;
+
+    // the answer of the client is handled by handle_frame() -> close(true)
+    m_close_statuscode = statuscode;
+    m_state = State::Closing;
+    send_close_frame(statuscode);
+
+}
+
+void WebSocket::close(bool close_frame_received) {
+
+    if (m_state == State::Disconnected)
+        return;
+
+    if (m_state != State::Closing) {
+
+        m_state = State::Closing;
+
+        uint16_t statuscode = m_close_statuscode;
+        if (close_frame_received)
+            statuscode = 1000;
+
+        send_close_frame(statuscode);
+
     }
 
     if (!close_frame_received) { 
 
-        for (size_t i = 0; i < CONNECTION_TIMEOUT_SECONDS; i++)
+        // the client answers only what it has received
         {
-            if (m_state == State::Disconnected)
-                return; // thread -> close_frame_received = 1
-            sleep(1);
+            std::lock_guard<std::mutex> lock(m_send_mutex);
+            m_batching = false;
+            flush();
         }
+
+        // the answer of the client arrives through the loop, see handle_frame()
+        if (m_loop != nullptr)
+            return;
+
+        std::unique_lock<std::mutex> lock(m_send_mutex);
+        bool answered = m_disconnected.wait_for(lock, std::chrono::seconds(CONNECTION_TIMEOUT_SECONDS), [&]() {
+            return m_state == State::Disconnected;
+        });
+
+        if (answered)
+            return; // thread -> close_frame_received = 1
+
 #if DEBUG_LEVEL >= 6
         std::cout << "[WebSocket " << m_connection << "] closing with timeout\n";
 #endif
 
     }
 
+    // the queued frames (our close frame) go out before the fd is closed,
+    // it may be reused by the next connection right after
+    {
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        m_batching = false;
+        flush();
+        drop_queued();
+        m_want_write = false;
+    }
+
     // Close WebSocket  ...
 #if DEBUG_LEVEL >= 6
     std::cout << "[WebSocket " << m_connection << "] closed (" << m_close_statuscode << ")\n";
 #endif
-    ::close(m_connection);
-    m_state = State::Disconnected;
+    if (m_tls != nullptr)
+        m_tls->shutdown();
+    if (m_loop != nullptr) {
+        m_loop->remove(m_connection);
+        m_loop->post([this]() { disconnected(); });
+    }
+    m_transport->close(m_connection);
+
+    {
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        m_state = State::Disconnected;
+    }
+    m_disconnected.notify_all();
 
-}
\ No newline at end of file
+}
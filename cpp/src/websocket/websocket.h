@@ -6,7 +6,9 @@
 #pragma once
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <iostream>
 #include <utility>
 #include <vector>
@@ -15,6 +17,12 @@
 #include <thread>
 #include <fstream>
 #include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+#include <span>
+#include <string_view>
+#include <coroutine>
 
 #include "http_response.h"
 #include "http_request.h"
@@ -22,19 +30,45 @@
 #include "base64.h"
 #include "flags.h"
 #include "dataframe.h"
+#include "executor.h"
+#include "event_loop.h"
+#include "tls.h"
+#include "memory_budget.h"
+#include "frame_rate.h"
+#include "conflation.h"
+#include "transport.h"
 
 #define MAX_PACKET_SIZE 4096
 #define CONNECTION_TIMEOUT_SECONDS 5
 
+// the read buffer of a connection grows for bulk senders and shrinks back
+#define READ_BUFFER_MIN 512
+#define READ_BUFFER_MAX (256 * 1024)
+
+// a read also fills a buffer on the stack, what does not fit into the read
+// buffer grows it, so a bulk sender needs one read instead of several
+#define READ_SPILL_SIZE (64 * 1024)
+
+// frames written with one sendmsg() at the end of a batch
+#define WRITE_BATCH_FRAMES 64
+
+// larger frames or messages are closed with 1009 (message too big)
+#define MAX_FRAME_SIZE (16 * 1024 * 1024)
+#define MAX_MESSAGE_SIZE (16 * 1024 * 1024)
+
 class WebSocket;
+struct Protocol;
+class Protocols;
 
 typedef std::function<void(std::string)> fkt_string;
 
-class WebSocket {
+// aligned so that the hot fields at the start share one cache line
+class alignas(64) WebSocket {
 public:
 
+    WebSocket() = default;
     explicit WebSocket(int connection);
-    ~WebSocket() = default;
+    ~WebSocket();
 
     enum State {
         Disconnected,
@@ -49,22 +83,171 @@ public:
         PermessageDeflate = 0b1
     };
 
+    // a received message, valid until the next receive()
+    struct Message {
+        DataFrame::Opcode opcode = DataFrame::TextFrame;
+        std::vector<uint8_t> payload;
+
+        std::span<const uint8_t> data() const { return payload; };
+        std::string_view text() const { return { (const char *) payload.data(), payload.size() }; };
+    };
+
+    // what happens to a frame over the rates of the Limits
+    enum RateAction {
+        Delay,  // the connection is not read until there are tokens again
+        Drop,   // the frame is skipped, with the rest of its message
+        Close   // the connection is closed with 1008
+    };
+
+    // what a client can make this connection buffer, and how fast it may
+    // send (0 -> unlimited, checked with the header of every frame before
+    // its payload is copied or handled)
+    struct Limits {
+        size_t read_buffer_min = READ_BUFFER_MIN;
+        size_t read_buffer_max = READ_BUFFER_MAX;
+        uint64_t max_frame_size = MAX_FRAME_SIZE;
+        uint64_t max_message_size = MAX_MESSAGE_SIZE;
+        double frames_per_second = 0;
+        double bytes_per_second = 0;
+        // pings and pongs, a close frame is never held back
+        double control_frames_per_second = 0;
+        RateAction rate_action = Delay;
+    };
+
+    struct ReceiveAwaiter {
+        WebSocket & ws;
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> handle) { ws.m_receiver = handle; };
+        const Message * await_resume();
+    };
+
+    struct SendAwaiter {
+        WebSocket & ws;
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> handle) { ws.m_sender = handle; };
+        bool await_resume() const { return ws.m_state >= State::Connected; };
+    };
+
     // listens on the socket for messages from the client
     void listen();
 
+    // serves the connection from the event loop instead of a blocking listen(),
+    // on_disconnected is called on the loop thread once the connection is closed
+    void attach(EventLoop * loop, fkt_task on_disconnected);
+
+    // waits for the next message, nullptr once the connection is closed
+    ReceiveAwaiter receive();
+
+    // queues a message and waits until it has been handed to the kernel
+    SendAwaiter send(std::span<const uint8_t> payload, DataFrame::Opcode opcode = DataFrame::TextFrame);
+    SendAwaiter send(std::string_view text);
+
     // closes the connection with the client
     void close(bool close_frame_received);
+
+    // starts the closing handshake without waiting for the answer
+    void shutdown(uint16_t statuscode);
     
     // sends a text message to the client
     void send_message(std::string message);
 
+    // sends an already encoded frame (or handshake response) to the client,
+    // frames of the handlers of a read are sent together after the read
+    void send_raw(const std::vector<uint8_t> & raw);
+    void send_raw(std::vector<uint8_t> && raw);
+
+    // sends encoded frames lying back to back in the parts, they are copied
+    // and leave with one sendmsg() like the frames of a batch
+    void send_raw(std::span<const std::span<const uint8_t>> parts);
+
+    // queues the frames like send_raw() without writing them, so a caller
+    // holding its own lock does not wait for the client. send_queued()
+    // writes them later, before anything sent after them.
+    void queue_raw(std::span<const std::span<const uint8_t>> parts);
+    void send_queued();
+
+    // sends an encoded frame carrying the latest value for key (a symbol of
+    // a market data feed). While the client does not keep up, it replaces
+    // the frame of the key still waiting, the waiting ones are sent together
+    // behind the other frames once the kernel took those. Only the event
+    // loop notices a slow client, a blocking connection sends every frame.
+    void send_latest(const std::string & key, const std::vector<uint8_t> & raw);
+
+    // sends the next length bytes of fd (a blocking socket, like the
+    // connection to a backend) as one frame. The payload is moved by the
+    // kernel with splice() through the pipe if the connection is a kernel
+    // socket served by listen() without TLS, otherwise it is read into a
+    // frame. The bytes are consumed also if the client is gone, false if fd
+    // ended before. A client that does not take the frame within timeout
+    // (0: no limit) is closed, the rest of the bytes is thrown away.
+    bool send_from(int fd, size_t length, DataFrame::Opcode opcode, const int pipe[2],
+                   std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+
+    // frames send_latest() replaced before the client got them
+    uint64_t conflated();
+
+    // the connection is encrypted, the TLS handshake is done by the caller
+    // (blocking listen()) or by the event loop (attach())
+    void set_tls(std::unique_ptr<TLS::Session> tls) { m_tls = std::move(tls); };
+
+    // the connection is not a kernel socket (see memory_transport.h), it is
+    // served by listen(), attach() and TLS need a pollable transport
+    void set_transport(Transport * transport) { m_transport = transport; };
+    Transport * transport() const { return m_transport; };
+
+    // shared by the connections of a socket, must outlive the connection,
+    // nullptr -> the defaults
+    void set_limits(const Limits * limits);
+
+    // counts what the rates of the limits did, shared with other connections
+    void set_throttling(Throttling * throttling) { m_throttling = throttling; };
+
+    // frames of this connection over the rates of the limits
+    uint64_t throttled() const { return m_rate != nullptr ? m_rate->throttled.load() : 0; };
+
+    // read buffers, incomplete messages and the frames waiting for a
+    // congested client are taken from the budget, if it is exhausted the
+    // connection is closed with 1013 (try again later)
+    void set_memory_budget(MemoryBudget * budget) { m_budget = budget; };
+
+    // userspace bytes held by the read buffer and the incomplete message,
+    // zero for an idle connection served by the event loop
+    size_t buffered() const { return m_reserved; };
+
+    // subprotocols offered in the handshake (see protocol.h)
+    void set_protocols(const Protocols * protocols) { m_protocols = protocols; };
+
+    // the negotiated subprotocol, nullptr if there is none
+    const Protocol * protocol() const { return m_protocol; };
+
+    // the requested url, known once the handshake is done
+    const HTTP::Request::Url & url() const { return m_url; };
+
+    // called on the reading thread once the handshake response is queued,
+    // frames sent from f follow the response in the same write
+    void on_handshake(fkt_task f) { m_on_handshake = std::move(f); };
+
+    // prepares a pooled WebSocket for a new connection
+    void reset(int connection, uint64_t id);
+
     State state () const { return m_state; };
+
+    // served by an event loop (attach()), its sends never block
+    bool attached() const { return m_loop != nullptr; };
     int connection () const { return m_connection; };
+    uint64_t id () const { return m_id; };
     void on_message(fkt_string f) { m_on_message = std::move(f); };
 
+    // runs the message handler on the executor instead of the reading thread
+    void set_executor(Executor * executor);
+
 private:
 
-    // file descriptor on the open socket
+    static const Limits default_limits;
+
+    // -- hot fields, touched for every frame
+
+    // file descriptor on the open socket (or connection of m_transport)
     int m_connection = -1;
 
     // state of the current connection
@@ -78,12 +261,122 @@ private:
 
     // ping was sent, waiting for pong from client
     bool m_waiting_for_pong = false;
+
+    // the flags share the padding of the fields above
+
+    // throttled, the connection of the event loop is not polled for EPOLLIN
+    std::atomic<bool> m_paused { false };
+
+    // m_outbox waits for EPOLLOUT
+    bool m_want_write = false;
+
+    // the frames of the handlers are queued until the bytes of a read are
+    // handled, then flushed together (see begin_batch())
+    bool m_batching = false;
+
+    // the front message of m_inbox was returned by receive()
+    bool m_inbox_taken = false;
+
+    // moves the bytes of m_connection, the kernel unless set_transport()
+    Transport * m_transport = Transport::kernel();
+
+    // generation tagged slot in the ConnectionTable (see connection_table.h)
+    uint64_t m_id = 0;
+
+    // optional worker pool for m_on_message, nullptr -> called inline
+    Executor * m_executor = nullptr;
+
+    // set by attach(), the connection is non-blocking and served by the loop
+    EventLoop * m_loop = nullptr;
+
+    // TLS session of the connection, nullptr -> plain TCP
+    std::unique_ptr<TLS::Session> m_tls;
+
+    // chosen in the handshake, gets every message of the connection
+    const Protocol * m_protocol = nullptr;
+    const Protocols * m_protocols = nullptr;
+
+    // --
     
     // State::InDataPayload -> merge fragmented frames
     std::vector<DataFrame> m_framequeue;
 
     // function pointer called when a message is received from the client
     fkt_string m_on_message = nullptr;
+    fkt_task m_on_handshake = nullptr;
+
+    HTTP::Request::Url m_url;
+
+    // keeps the messages of this connection in order on the executor, only
+    // allocated for connections with one
+    std::unique_ptr<Executor::Strand> m_strand;
+
+    // frames can be sent from the reading, keep alive and executor threads
+    std::mutex m_send_mutex;
+
+    // close() waits for the reading thread to receive the close frame, with
+    // m_send_mutex
+    std::condition_variable m_disconnected;
+
+    // State::InDataPayload -> frame waiting for the rest of its payload
+    DataFrame m_last_frame;
+
+    // called on the loop thread once the connection is closed (with m_loop)
+    fkt_task m_on_disconnected = nullptr;
+
+    // received bytes, the first m_read_size are not consumed yet (a split
+    // frame header or handshake request)
+    std::vector<uint8_t> m_read_buffer;
+    size_t m_read_size = 0;
+
+    const Limits * m_limits = &default_limits;
+    MemoryBudget * m_budget = nullptr;
+
+    // bytes taken from m_budget
+    size_t m_reserved = 0;
+
+    // payload of the message in m_framequeue and m_last_frame
+    uint64_t m_message_size = 0;
+
+    // the inbound rates of m_limits and what they did to the connection,
+    // allocated by set_limits() only if there are any (see admit())
+    struct Rate {
+        FrameRate buckets;
+        // frames over the rates, read by other threads
+        std::atomic<uint64_t> throttled { 0 };
+        // RateAction::Delay -> the reads wait this long (set by consume()),
+        // the connection of the event loop is not polled for EPOLLIN meanwhile
+        std::chrono::nanoseconds delay { 0 };
+        // RateAction::Drop -> payload bytes of the dropped frame still to skip
+        uint64_t skip = 0;
+        // the continuations of a dropped message are skipped as well
+        bool dropping = false;
+    };
+
+    std::unique_ptr<Rate> m_rate;
+    Throttling * m_throttling = nullptr;
+
+    // frames the kernel did not accept yet, m_outbox_offset bytes of the
+    // first one are sent
+    std::vector<std::vector<uint8_t>> m_outbox;
+    size_t m_outbox_offset = 0;
+
+    // bytes of m_outbox, and those of them (and of m_conflated) taken from
+    // m_budget while the connection is congested (see charge_queued())
+    size_t m_queued = 0;
+    size_t m_charged = 0;
+
+    // frames of send_latest() waiting behind m_outbox, one per key (created
+    // once the connection congested)
+    std::unique_ptr<Conflation> m_conflated;
+
+    // messages for receive(), the front one was returned if m_inbox_taken
+    // (a list does not allocate while it is empty, idle connections stay small)
+    std::list<Message> m_inbox;
+
+    // coroutines waiting in receive() and send()
+    std::coroutine_handle<> m_receiver = nullptr;
+    std::coroutine_handle<> m_sender = nullptr;
 
     // open handshake with client  (rfc6455 section-4.2.2)
     size_t handshake(uint8_t * buffer, size_t bytes_read);
@@ -91,8 +384,68 @@ private:
     // sends a ping to the client every 20s
     void check_for_keep_alive();
 
+    // processes the bytes in m_read_buffer, false -> stop reading
+    bool consume();
+
+    // reads into the free part of m_read_buffer, like read()
+    ssize_t read_some();
+
+    // grows the buffer of a bulk sender, shrinks it for small messages
+    void adapt_read_buffer(size_t bytes_read, size_t space);
+    bool resize_read_buffer(size_t size);
+
+    // the header of a frame was parsed, false -> the connection was closed
+    bool check_frame(const DataFrame & frame);
+
+    // the rates of the limits for a parsed frame header, before check_frame()
+    enum Admission { Admitted, Skipped, Delayed, Closed };
+    Admission admit(const DataFrame & frame);
+
+    // holds back the reads for Rate::delay, sleeps in listen() and stops
+    // polling on the event loop until resume()
+    void pause();
+    void resume();
+    bool delayed() const { return m_rate != nullptr && m_rate->delay.count() > 0; };
+    uint32_t read_events() const { return m_paused ? 0u : (uint32_t) EPOLLIN; };
+
+    bool reserve(size_t bytes);
+    void unreserve(size_t bytes);
+
+    // closes the connection after a protocol violation without waiting
+    // for the close frame of the client
+    void fail(uint16_t statuscode);
+
+    // read() / send() on the connection, through m_tls if encrypted
+    ssize_t read_bytes(uint8_t * buffer, size_t size);
+    ssize_t write_bytes(const uint8_t * data, size_t size);
+
+    void on_event(uint32_t events);
+
+    // queues the frames sent from now on, end_batch() writes all of them
+    void begin_batch();
+    void end_batch();
+
+    // writes the outbox, false if the kernel did not take all of it (only
+    // with m_loop, the connection waits for EPOLLOUT)
+    bool flush();
+    void queue(std::vector<uint8_t> && frame);
+    // empties the outbox and m_conflated, their bytes go back to the budget
+    void drop_queued();
+    // the bytes waiting for EPOLLOUT are taken from the budget, false if it
+    // is used up
+    bool charge_queued();
+    // the client does not take its frames, they are dropped and it with them
+    void drop_slow_client();
+    // one sendmsg() for up to WRITE_BATCH_FRAMES frames
+    ssize_t write_frames();
+    void disconnected();
+
     void handle_frame(DataFrame frame);
     void handle_text_frame();
-    void send_pong_frame();
+    // the payload of the frames in m_framequeue
+    Message take_message();
+    // the pong carries the application data of the ping
+    void send_pong_frame(std::vector<uint8_t> application_data);
+    void send_close_frame(uint16_t statuscode);
 
 };
\ No newline at end of file
@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "websocket_client.h"
+
+WebSocketClient::~WebSocketClient()
+{
+    if (m_fd != -1) {
+        m_loop->remove(m_fd);
+        ::close(m_fd);
+    }
+}
+
+uint32_t WebSocketClient::masking_key()
+{
+
+    // seeded once per thread, never zero
+    thread_local uint64_t state = (((uint64_t) std::random_device()() << 32) ^
+        std::chrono::steady_clock::now().time_since_epoch().count()) | 1;
+
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+
+    return (state * 0x2545F4914F6CDD1DULL) >> 32;
+
+}
+
+bool WebSocketClient::connect(const std::string & address, const std::string & path)
+{
+
+    Address::Endpoint endpoint;
+
+    if (m_state != Disconnected || !Address::parse(address, endpoint))
+        return false;
+
+    m_fd = socket(endpoint.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (m_fd < 0) {
+        std::cout << "Failed to create socket. errno: " << errno << std::endl;
+        return false;
+    }
+
+    if (endpoint.family() != AF_UNIX) {
+        int one = 1;
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    if (::connect(m_fd, endpoint.addr(), endpoint.length) < 0 && errno != EINPROGRESS) {
+        std::cout << "Failed to connect to " << address << ". errno: " << errno << std::endl;
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    // a nonce of 16 random bytes, the server answers with its hash
+    uint32_t nonce[4] = { masking_key(), masking_key(), masking_key(), masking_key() };
+    char key[24+37] {};
+    Base64::encode((uint8_t *) nonce, key, 16);
+    strncpy(key+24, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 37);
+
+    uint8_t sha1_hash[20];
+    Hash::sha1((uint8_t *) key, sha1_hash, 24+36);
+    Base64::encode(sha1_hash, m_accept, 20);
+
+    std::string request =
+        "GET " + path + " HTTP/1.1\r\n"
+        "Host: " + address + "\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: " + std::string(key, 24) + "\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+
+    m_state = Connecting;
+    m_connected = false;
+    m_close_after_flush = false;
+    m_close_statuscode = 1006;
+    m_in_message = false;
+    m_outbox.assign(request.begin(), request.end());
+    m_written = 0;
+    m_read_size = 0;
+
+    // EPOLLOUT reports the finished connect, then writes the request
+    m_want_write = true;
+    m_loop->add(m_fd, EPOLLIN | EPOLLOUT, [this](uint32_t events) {
+        on_event(events);
+    });
+
+    return true;
+
+}
+
+bool WebSocketClient::send(std::span<const uint8_t> payload, DataFrame::Opcode opcode)
+{
+
+    if (m_state != Connecting && m_state != Open)
+        return false;
+
+    queue_frame(payload, opcode);
+    return true;
+
+}
+
+bool WebSocketClient::send(std::string_view text)
+{
+    return send({ (const uint8_t *) text.data(), text.size() }, DataFrame::TextFrame);
+}
+
+void WebSocketClient::close(uint16_t statuscode)
+{
+
+    if (m_state == Connecting) {
+        disconnected(statuscode);
+        return;
+    }
+
+    if (m_state != Open)
+        return;
+
+    uint8_t payload[2] = { (uint8_t) (statuscode >> 8), (uint8_t) statuscode };
+    queue_frame(payload, DataFrame::ConectionClose);
+    m_state = Closing;
+
+}
+
+void WebSocketClient::queue_frame(std::span<const uint8_t> payload, DataFrame::Opcode opcode)
+{
+
+    uint32_t key = masking_key();
+    DataFrame::append_header(m_outbox, true, opcode, payload.size(), (const uint8_t *) &key);
+
+    size_t start = m_outbox.size();
+    m_outbox.insert(m_outbox.end(), payload.begin(), payload.end());
+    DataFrame::mask(m_outbox.data() + start, payload.size(), (const uint8_t *) &key);
+
+    // the frames queued until the loop comes back leave with one write
+    if (!m_want_write) {
+        m_want_write = true;
+        m_loop->modify(m_fd, EPOLLIN | EPOLLOUT);
+    }
+
+}
+
+void WebSocketClient::on_event(uint32_t events)
+{
+
+    if (!m_connected && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &length);
+
+        if (error != 0) {
+#if DEBUG_LEVEL >= 4
+            std::cout << "[WebSocketClient " << m_fd << "] connect failed. errno: " << error << "\n";
+#endif
+            disconnected(1006);
+            return;
+        }
+
+        m_connected = true;
+
+    }
+
+    if (events & EPOLLOUT)
+        flush();
+
+    if (m_fd != -1 && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        read();
+
+}
+
+void WebSocketClient::flush()
+{
+
+    while (m_written < m_outbox.size()) {
+
+        ssize_t bytes = ::send(m_fd, m_outbox.data() + m_written, m_outbox.size() - m_written, MSG_NOSIGNAL);
+
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+
+        if (bytes <= 0) {
+            disconnected(1006);
+            return;
+        }
+
+        m_written += bytes;
+
+    }
+
+    m_outbox.clear();
+    m_written = 0;
+
+    if (m_close_after_flush) {
+        disconnected(m_close_statuscode);
+        return;
+    }
+
+    m_want_write = false;
+    m_loop->modify(m_fd, EPOLLIN);
+
+}
+
+void WebSocketClient::read()
+{
+
+    while (m_fd != -1) {
+
+        size_t limit = (m_state == Connecting) ? CLIENT_RESPONSE_MAX : MAX_FRAME_SIZE + 14;
+
+        if (m_read_buffer.size() - m_read_size < CLIENT_READ_SIZE)
+            m_read_buffer.resize(std::min(m_read_size + CLIENT_READ_SIZE, limit));
+
+        if (m_read_size == m_read_buffer.size()) {
+            fail(1009);
+            return;
+        }
+
+        ssize_t bytes_read = recv(m_fd, m_read_buffer.data() + m_read_size, m_read_buffer.size() - m_read_size, 0);
+
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        if (bytes_read <= 0) {
+            disconnected(m_close_statuscode);
+            return;
+        }
+
+        m_read_size += bytes_read;
+
+        if (m_state == Connecting && !consume_response())
+            return;
+
+        if (m_state != Connecting && !consume_frames())
+            return;
+
+    }
+
+    // an idle connection holds no read buffer
+    if (m_fd != -1 && m_read_size == 0)
+        m_read_buffer = std::vector<uint8_t>();
+
+}
+
+bool WebSocketClient::consume_response()
+{
+
+    std::string_view response((const char *) m_read_buffer.data(), m_read_size);
+    size_t response_end = response.find("\r\n\r\n");
+
+    if (response_end == std::string_view::npos)
+        return true;
+
+    response = response.substr(0, response_end + 2);
+
+    // the header names are case-insensitive
+    std::string lower(response);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    size_t accept = lower.find("\r\nsec-websocket-accept:");
+    bool upgraded = response.starts_with("HTTP/1.1 101") && accept != std::string::npos;
+
+    if (upgraded) {
+        std::string_view value = response.substr(accept + 23);
+        value = value.substr(0, value.find("\r\n"));
+        while (value.starts_with(' '))
+            value.remove_prefix(1);
+        upgraded = value == std::string_view(m_accept, 28);
+    }
+
+    if (!upgraded) {
+#if DEBUG_LEVEL >= 4
+        std::cout << "[WebSocketClient " << m_fd << "] upgrade refused\n";
+#endif
+        disconnected(1002);
+        return false;
+    }
+
+    // the first frames may follow the response
+    m_read_size -= response_end + 4;
+    memmove(m_read_buffer.data(), m_read_buffer.data() + response_end + 4, m_read_size);
+
+    m_state = Open;
+
+    if (m_on_open != nullptr)
+        m_on_open();
+
+    return m_fd != -1;
+
+}
+
+bool WebSocketClient::consume_frames()
+{
+
+    uint8_t * buffer = m_read_buffer.data();
+    size_t offset = 0;
+
+    while (offset < m_read_size) {
+
+        DataFrame frame;
+        size_t header_end = frame.parse_header(buffer + offset, m_read_size - offset);
+
+        // the rest of the header comes with the next read
+        if (header_end == 0)
+            break;
+
+        if (frame.m_payload_len_bytes > MAX_FRAME_SIZE) {
+            fail(1009);
+            return false;
+        }
+
+        // a server never masks, control frames are not fragmented and carry
+        // at most 125 bytes (rfc6455 section-5.1 and 5.5)
+        if (frame.m_mask || ((frame.m_opcode & 0x8) && (!frame.m_fin || frame.m_payload_len_bytes > 125))) {
+            fail(1002);
+            return false;
+        }
+
+        // only whole frames are handled
+        if (m_read_size - offset - header_end < frame.m_payload_len_bytes)
+            break;
+
+        offset += frame.add_payload_data(buffer + offset, header_end, m_read_size - offset);
+
+        if (!handle_frame(frame))
+            return false;
+
+    }
+
+    m_read_size -= offset;
+    memmove(buffer, buffer + offset, m_read_size);
+
+    return true;
+
+}
+
+bool WebSocketClient::handle_frame(DataFrame & frame)
+{
+
+    switch (frame.m_opcode)
+    {
+
+    case DataFrame::ConectionClose:
+
+        if (frame.m_application_data.size() >= 2)
+            m_close_statuscode = (frame.m_application_data[0] << 8) | frame.m_application_data[1];
+        else
+            m_close_statuscode = 1005;
+
+        // our close frame was answered
+        if (m_state == Closing) {
+            disconnected(m_close_statuscode);
+            return false;
+        }
+
+        // answered with the same status, closed once it is written
+        queue_frame({ frame.m_application_data.data(), std::min<size_t>(frame.m_application_data.size(), 2) },
+            DataFrame::ConectionClose);
+        m_state = Closing;
+        m_close_after_flush = true;
+        return true;
+
+    case DataFrame::Ping:
+        if (m_state == Open)
+            queue_frame(frame.m_application_data, DataFrame::Pong);
+        return true;
+
+    case DataFrame::Pong:
+        return true;
+
+    case DataFrame::ContinuationFrame:
+    case DataFrame::BinaryFrame:
+    case DataFrame::TextFrame:
+
+        // a continuation belongs to a started message
+        if ((frame.m_opcode == DataFrame::ContinuationFrame) != m_in_message) {
+            fail(1002);
+            return false;
+        }
+
+        // checked before the fragment is appended, a server sending
+        // endless continuations does not grow the message beyond the limit
+        if ((m_in_message ? m_message.payload.size() : 0) + frame.m_application_data.size() > MAX_MESSAGE_SIZE) {
+            fail(1009);
+            return false;
+        }
+
+        if (m_in_message) {
+            m_message.payload.insert(m_message.payload.end(),
+                frame.m_application_data.begin(), frame.m_application_data.end());
+        } else {
+            m_message.opcode = frame.m_opcode;
+            m_message.payload = std::move(frame.m_application_data);
+        }
+
+        m_in_message = !frame.m_fin;
+
+        if (m_in_message)
+            return true;
+
+        if (m_on_message != nullptr && m_state == Open)
+            m_on_message(m_message);
+
+        m_message.payload.clear();
+        return m_fd != -1;
+
+    default:
+        fail(1002);
+        return false;
+
+    }
+
+}
+
+void WebSocketClient::fail(uint16_t statuscode)
+{
+
+#if DEBUG_LEVEL >= 5
+    std::cout << "[WebSocketClient " << m_fd << "] closing with " << statuscode << "\n";
+#endif
+
+    if (m_state == Open) {
+        uint8_t payload[2] = { (uint8_t) (statuscode >> 8), (uint8_t) statuscode };
+        queue_frame(payload, DataFrame::ConectionClose);
+        // a best effort, the connection is gone either way
+        m_close_after_flush = true;
+        m_close_statuscode = statuscode;
+        flush();
+        if (m_fd == -1)
+            return;
+    }
+
+    disconnected(statuscode);
+
+}
+
+void WebSocketClient::disconnected(uint16_t statuscode)
+{
+
+    if (m_fd == -1)
+        return;
+
+    m_loop->remove(m_fd);
+    ::close(m_fd);
+    m_fd = -1;
+
+    m_state = Disconnected;
+    m_outbox = std::vector<uint8_t>();
+    m_written = 0;
+    m_read_buffer = std::vector<uint8_t>();
+    m_read_size = 0;
+    m_message = WebSocket::Message();
+    m_in_message = false;
+
+#if DEBUG_LEVEL >= 6
+    std::cout << "[WebSocketClient] closed (" << statuscode << ")\n";
+#endif
+
+    if (m_on_close != nullptr)
+        m_on_close(statuscode);
+
+}
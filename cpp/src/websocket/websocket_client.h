@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <netinet/tcp.h>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "websocket.h"
+#include "address.h"
+
+// the handshake response of the server may not be larger
+#define CLIENT_RESPONSE_MAX 8192
+
+// a read takes at least this much free space in the read buffer
+#define CLIENT_READ_SIZE (16 * 1024)
+
+// An outbound connection to a WebSocket server, served by an event loop
+// together with thousands of others (one thread, no blocking calls):
+//
+//   EventLoop loop;
+//   WebSocketClient client(&loop);
+//   client.on_open([&]() { client.send("hello"); });
+//   client.on_message([](const WebSocket::Message & message) { ... });
+//   client.connect("127.0.0.1:3000", "/feed");
+//   loop.run();
+//
+// The frames are encoded by DataFrame and masked with a key of a per-thread
+// PRNG. The upgrade request is pipelined: frames sent before the server
+// answered follow the request in the same write, a feed subscription leaves
+// with the handshake. The frames of one loop iteration are written together.
+//
+// Everything is called on the loop thread (before run() or from a handler),
+// other threads post() to the loop.
+class WebSocketClient {
+public:
+
+    enum State {
+        Disconnected,
+        Connecting,     // TCP connect and upgrade until the 101
+        Open,
+        Closing,        // our close frame is sent, waiting for the server
+    };
+
+    explicit WebSocketClient(EventLoop * loop) : m_loop(loop) {};
+    ~WebSocketClient();
+
+    WebSocketClient(const WebSocketClient &) = delete;
+    WebSocketClient & operator=(const WebSocketClient &) = delete;
+
+    // starts connecting to the address (see address.h, "127.0.0.1:3000" or
+    // "unix:/tmp/ws.sock") and queues the upgrade request for path. False if
+    // it failed right away, otherwise on_open or on_close follow.
+    bool connect(const std::string & address, const std::string & path = "/");
+
+    // queues a frame, from connect() on, false if the connection is closing
+    bool send(std::span<const uint8_t> payload, DataFrame::Opcode opcode = DataFrame::BinaryFrame);
+    bool send(std::string_view text);
+
+    // starts the closing handshake, on_close follows once the server answered
+    void close(uint16_t statuscode = 1000);
+
+    // the server accepted the upgrade
+    void on_open(fkt_task f) { m_on_open = std::move(f); };
+    void on_message(std::function<void(const WebSocket::Message &)> f) { m_on_message = std::move(f); };
+    // the connection is gone, with the status code of the close frame or
+    // 1006 if there was none. A new connect() may follow right away.
+    void on_close(std::function<void(uint16_t)> f) { m_on_close = std::move(f); };
+
+    State state() const { return m_state; };
+    int connection() const { return m_fd; };
+
+    // bytes waiting for the kernel to take them
+    size_t pending() const { return m_outbox.size() - m_written; };
+
+    // a masking key of the per-thread PRNG (xorshift64*, no syscall)
+    static uint32_t masking_key();
+
+private:
+
+    EventLoop * m_loop;
+    int m_fd = -1;
+    State m_state = Disconnected;
+
+    // the TCP connect finished
+    bool m_connected = false;
+    // EPOLLOUT is requested for the outbox
+    bool m_want_write = false;
+    // the close frame of the server is answered, closing once it is written
+    bool m_close_after_flush = false;
+    uint16_t m_close_statuscode = 1006;
+
+    // Sec-WebSocket-Accept the server has to answer with
+    char m_accept[29] {};
+
+    std::vector<uint8_t> m_outbox;
+    size_t m_written = 0;
+
+    std::vector<uint8_t> m_read_buffer;
+    size_t m_read_size = 0;
+
+    // the frames of a fragmented message so far
+    WebSocket::Message m_message;
+    bool m_in_message = false;
+
+    fkt_task m_on_open = nullptr;
+    std::function<void(const WebSocket::Message &)> m_on_message = nullptr;
+    std::function<void(uint16_t)> m_on_close = nullptr;
+
+    void on_event(uint32_t events);
+    void queue_frame(std::span<const uint8_t> payload, DataFrame::Opcode opcode);
+    void flush();
+    void read();
+
+    // false once the connection is gone
+    bool consume_response();
+    bool consume_frames();
+    bool handle_frame(DataFrame & frame);
+
+    void fail(uint16_t statuscode);
+    void disconnected(uint16_t statuscode);
+
+};
@@ -8,11 +8,18 @@
 #include <iostream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "socket.h"
+#include "executor.h"
+#include "broker.h"
+#include "capture.h"
+#include "proxy.h"
 
 #if COMPILE_FOR_FUZZING
-char * g_fuzzing_input_file;
+#include <fstream>
+#include <iterator>
+#include "memory_transport.h"
 #endif
 
 
@@ -20,24 +27,160 @@ int main (int argc, char *argv[])
 {
 
 #if COMPILE_FOR_FUZZING
-    g_fuzzing_input_file = argv[argc-1];
+    // the bytes of one client, see SECURITY.md
+    const char * input_file = argv[argc-1];
     int ports[] =  {3000, -1};
 #else
     int ports[] =  {3000, 3001, 8080, 9090, -1}; // errno: 98 - Address already in use
 #endif
 
+    // wsserver --handoff /tmp/wsserver.sock: a second instance started with
+    // the same path takes over the port, the first one drains and exits
+    std::string handoff_path;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--handoff")
+            handoff_path = argv[i + 1];
+
+    // wsserver --listen 127.0.0.1:3000 --listen unix:/tmp/ws.sock, all on
+    // one socket (see socket/address.h), instead of the first free port
+    std::vector<std::string> addresses;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--listen")
+            addresses.push_back(argv[i + 1]);
+
+    // wsserver --tls cert.pem key.pem: wss://, see ./build.sh cert
+    std::string certificate_file, key_file;
+    for (int i = 1; i + 2 < argc; i++) {
+        if (std::string(argv[i]) == "--tls") {
+            certificate_file = argv[i + 1];
+            key_file = argv[i + 2];
+        }
+    }
+
+    // wsserver --tuning low-latency|bulk-throughput, see socket/tuning.h
+    std::string tuning = "default";
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--tuning")
+            tuning = argv[i + 1];
+
+    // wsserver --bus /tmp/wsserver.bus: the processes started with the same
+    // path form one chat, every message goes to all clients of all of them
+    std::string bus_path;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--bus")
+            bus_path = argv[i + 1];
+
+    // wsserver --history 1000: the chat keeps its last messages, a client
+    // connecting to /?since=<n> gets the ones after its n-th message first
+    size_t history = 0;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--history")
+            history = strtoul(argv[i + 1], nullptr, 10);
+
+    bool chat = !bus_path.empty() || history > 0;
+
+    // wsserver --capture /tmp/wsserver.cap: appends what the clients send,
+    // bench/replay plays it back
+    std::string capture_path;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--capture")
+            capture_path = argv[i + 1];
+
+    // wsserver --proxy unix:/tmp/backend.sock: the messages of the clients
+    // go to the backend, its replies back to them (see proxy/proxy.h)
+    std::string backend;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--proxy")
+            backend = argv[i + 1];
+
+    // wsserver --frame-rate 100: a client sending more frames per second (or
+    // more than 10 pings) is read more slowly, its kernel buffers fill up
+    double frame_rate = 0;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--frame-rate")
+            frame_rate = strtod(argv[i + 1], nullptr);
+
+    // wsserver --cpu 2: the event loop runs on CPU 2, the connection table
+    // lies on its NUMA node (see socket/placement.h)
+    int cpu = -1;
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--cpu")
+            cpu = atoi(argv[i + 1]);
+
+    Capture::Recorder recorder;
+    if (!capture_path.empty() && !recorder.open(capture_path))
+        return 1;
+
+#if USEFORK
+    // message handlers run on a worker pool, so a slow handler does not
+    // block the reading thread of its connection
+    Executor executor(std::thread::hardware_concurrency(), 1024, Executor::Block);
+#endif
+
     int p = 0;
 
     while (ports[p] != -1)
     {
         
         char option = 0;
-        Socket socket(ports[p]);
+        Socket socket(ports[p], !certificate_file.empty(), 10000);
+        socket.set_certificate(certificate_file, key_file);
+        if (!socket.set_tuning(tuning))
+            break;
+#if USEFORK
+        socket.set_executor(&executor);
+#endif
+        if (!handoff_path.empty())
+            socket.set_handoff_path(handoff_path);
+        if (!capture_path.empty())
+            socket.set_transport(&recorder);
+        if (cpu >= 0)
+            socket.set_cpu(cpu);
+        if (frame_rate > 0) {
+            WebSocket::Limits limits;
+            limits.frames_per_second = frame_rate;
+            limits.control_frames_per_second = std::min(frame_rate, 10.0);
+            socket.set_limits(limits);
+        }
+
+        for (auto & address : addresses)
+            socket.add_address(address);
+
+        Broker broker(socket);
+        if (!bus_path.empty() && !broker.join(bus_path))
+            break;
+        if (history > 0)
+            broker.keep_history("chat", history, history * 1024);
+
+        Proxy proxy(socket, backend);
+        Protocols protocols;
+        if (!backend.empty()) {
+            if (!proxy.start()) {
+                std::cout << "Backend " << backend << " is not reachable\n";
+                break;
+            }
+            protocols.set_default(proxy);
+            socket.set_protocols(&protocols);
+        }
 
-        socket.on_open([](auto * ws) {
+        socket.on_open([&](auto * ws) {
 
             std::cout << "[WebSocket " << ws->connection() << "] connected\n";
 
+            if (chat) {
+                ws->on_handshake([&broker, ws]() {
+                    std::string since = ws->url().parameter("since");
+                    if (since.empty())
+                        broker.subscribe(ws, "chat");
+                    else if (!broker.subscribe(ws, "chat", strtoull(since.c_str(), nullptr, 10)))
+                        std::cout << "[WebSocket " << ws->connection() << "] missed messages are gone\n";
+                });
+                ws->on_message([&](std::string message) {
+                    broker.publish("chat", message);
+                });
+                return;
+            }
+
 #if ARTIFICIAL_BUGS
             ws->on_message([&](std::string message) {
 #else
@@ -52,28 +195,44 @@ int main (int argc, char *argv[])
         });
 
 #if NOFORK
-        
-        std::cout << "Port: " << socket.port() << "\n";
-        socket.listen();
+
+        // the input is served over a memory transport, without a listener
+        std::ifstream file(input_file, std::ios::binary);
+        std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        MemoryTransport transport(1);
+        auto [server, client] = transport.pair();
+        transport.send(client, input);
+        transport.shutdown(client);
+
+        printf("serve %s\n", input_file);
+        socket.serve(&transport, server);
 
 #else
         if (socket.listen(true)) {
       
             std::cout << "Port: " << socket.port() << "\n";
 
-            while (option != 's') {
+            std::thread([&]() {
+                while (option != 's' && std::cin >> option) {
 
-                std::cin >> option;
+                    if (option == 's')
+                        socket.stop();
+                    else
+                        std::cout << "Option nicht bekannt.\n";
 
-                if (option == 's')
-                    socket.stop();
-                else
-                    std::cout << "Option nicht bekannt.\n";
-                
-            }
+                }
+            }).detach();
+
+            // stopped with 's' or by a successor taking over the port
+            socket.wait();
 
             break; 
         }
+
+        // the given addresses are not free, no other port to try
+        if (!addresses.empty())
+            break;
 #endif
         p++;
 
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "transport/capture.h"
+#include "transport/memory_transport.h"
+#include "test_helpers.h"
+
+const char * capture_path = "/tmp/wsserver_capture_test.cap";
+
+// what the server reads through the recorder
+std::string receive(Transport & transport, int connection, size_t size) {
+
+    std::string data(size, 0);
+    iovec iov[2] = { { data.data(), 2 }, { data.data() + 2, size - 2 } };
+    ssize_t bytes_read = transport.read(connection, iov, 2);
+    data.resize(std::max<ssize_t>(bytes_read, 0));
+    return data;
+
+}
+
+void record_session(MemoryTransport & memory, const std::vector<std::string> & messages) {
+
+    Capture::Recorder recorder(&memory);
+    if (!recorder.open(capture_path)) {
+        printf("FAILED open the capture\n");
+        return;
+    }
+
+    auto [server, client] = memory.pair();
+    auto [other_server, other_client] = memory.pair();
+
+    for (const std::string & message : messages) {
+        memory.send(client, bytes(message));
+        if (receive(recorder, server, message.size()) != message)
+            printf("FAILED read through the recorder\n");
+    }
+
+    // the bytes the server writes are not recorded
+    std::string answer = "answer";
+    iovec iov { answer.data(), answer.size() };
+    recorder.write(server, &iov, 1);
+    memory.send(other_client, bytes("other"));
+    receive(recorder, other_server, 5);
+
+    recorder.close(server);
+    recorder.close(other_server);
+
+}
+
+void test_capture() {
+
+    unlink(capture_path);
+
+    MemoryTransport memory(8);
+
+    record_session(memory, { "GET / HTTP/1.1\r\n\r\n", "abc" });
+    // appended, with new connection numbers
+    record_session(memory, { "again" });
+
+    Capture::File file;
+    if (!file.open(capture_path) || file.raw()) {
+        printf("FAILED open the capture for reading\n");
+        return;
+    }
+
+    std::vector<std::pair<uint32_t, std::string>> records;
+    Capture::Record record;
+    std::span<const uint8_t> data;
+    uint64_t time = 0;
+
+    while (file.next(record, data)) {
+        records.emplace_back(record.connection, std::string(data.begin(), data.end()));
+        if (record.time < time)
+            printf("FAILED time goes back\n");
+        time = record.time;
+    }
+
+    std::vector<std::pair<uint32_t, std::string>> expected = {
+        { 0, "GET / HTTP/1.1\r\n\r\n" }, { 0, "abc" }, { 1, "other" }, { 0, "" }, { 1, "" },
+        { 2, "again" }, { 3, "other" }, { 2, "" }, { 3, "" }
+    };
+
+    if (records != expected) {
+        printf("FAILED %zu records:\n", records.size());
+        for (auto & [connection, text] : records)
+            printf("  %u %s\n", connection, text.c_str());
+    }
+
+    unlink(capture_path);
+
+}
+
+// a file without the header is the stream of one connection
+void test_raw() {
+
+    FILE * raw = fopen(capture_path, "w");
+    fputs("GET / HTTP/1.1\r\n", raw);
+    fclose(raw);
+
+    Capture::File file;
+    Capture::Record record;
+    std::span<const uint8_t> data;
+
+    if (!file.open(capture_path) || !file.raw() || !file.next(record, data) ||
+        std::string(data.begin(), data.end()) != "GET / HTTP/1.1\r\n" || file.next(record, data))
+        printf("FAILED raw stream\n");
+
+    unlink(capture_path);
+
+}
+
+int main() {
+
+    test_capture();
+    test_raw();
+
+    return 0;
+
+}
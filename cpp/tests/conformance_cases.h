@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "socket/socket.h"
+#include "websocket/protocol.h"
+#include "transport/memory_transport.h"
+#include "test_helpers.h"
+
+// The cases of the Autobahn testsuite (tests/fuzzingclient.json) the server
+// has to pass, played by a client in this process over memory pipes against
+// an echo server. Mostly section 9 (performance): large messages, fragmented
+// messages, messages in small writes and many small messages.
+//
+// conformance_test checks that every case passes, conformance_bench (see
+// bench/) compares their timings to a baseline.
+
+// answers every message with the same opcode and payload
+struct Echo {
+    void on_message(WebSocket & ws, const WebSocket::Message & message) {
+        DataFrame frame;
+        frame.m_opcode = message.opcode;
+        frame.m_application_data = message.payload;
+        ws.send_raw(frame.get_raw_frame());
+    };
+};
+
+struct Frame {
+    uint8_t opcode = 0;
+    bool fin = true;
+    std::vector<uint8_t> payload;
+};
+
+// the client side of one connection
+class Client {
+public:
+
+    Client(Socket & server, MemoryTransport & transport) : m_transport(transport) {
+
+        auto [server_end, client_end] = transport.pair();
+        m_connection = client_end;
+        if (m_connection == -1)
+            return;
+
+        server.serve(&transport, server_end);
+        std::string request = handshake_request_with("echo");
+        send_bytes((const uint8_t *) request.data(), request.size());
+
+        std::string response;
+        while (!response.ends_with("\r\n\r\n") && fill())
+            response += (char) m_buffer[m_offset++];
+
+        m_connected = response.rfind("HTTP/1.1 101", 0) == 0;
+
+    };
+
+    ~Client() {
+        if (m_connection != -1)
+            m_transport.close(m_connection);
+    };
+
+    bool connected() const { return m_connected; };
+
+    // the server sent its close frame
+    bool closed() const { return m_closed; };
+
+    // a masked frame, written in pieces of chop bytes (0: at once)
+    void send(uint8_t opcode, bool fin, const uint8_t * payload, size_t size, size_t chop = 0) {
+
+        static const uint8_t key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+        std::vector<uint8_t> frame;
+
+        frame.push_back((fin ? 0x80 : 0) | opcode);
+        if (size < 126) {
+            frame.push_back(0x80 | size);
+        } else if (size <= 0xffff) {
+            frame.push_back(0x80 | 126);
+            frame.push_back(size >> 8);
+            frame.push_back(size);
+        } else {
+            frame.push_back(0x80 | 127);
+            for (int i = 7; i >= 0; i--)
+                frame.push_back(size >> (i * 8));
+        }
+        frame.insert(frame.end(), key, key + 4);
+
+        size_t header = frame.size();
+        frame.resize(header + size);
+        for (size_t i = 0; i < size; i++)
+            frame[header + i] = payload[i] ^ key[i % 4];
+
+        if (chop == 0)
+            chop = frame.size();
+        for (size_t offset = 0; offset < frame.size(); offset += chop)
+            send_bytes(frame.data() + offset, std::min(chop, frame.size() - offset));
+
+    };
+
+    void send(uint8_t opcode, const std::vector<uint8_t> & payload, size_t chop = 0) {
+        send(opcode, true, payload.data(), payload.size(), chop);
+    };
+
+    // the next frame of the server, opcode 0xff if the connection ended
+    Frame receive() {
+
+        Frame frame;
+        frame.opcode = 0xff;
+
+        if (!fill(2))
+            return frame;
+
+        uint8_t length = m_buffer[m_offset + 1] & 0x7f;
+        size_t header = 2 + (length == 126 ? 2 : length == 127 ? 8 : 0);
+        if (!fill(header))
+            return frame;
+
+        uint64_t size = length;
+        if (length >= 126) {
+            size = 0;
+            for (size_t i = 2; i < header; i++)
+                size = (size << 8) | m_buffer[m_offset + i];
+        }
+        if (!fill(header + size))
+            return frame;
+
+        frame.opcode = m_buffer[m_offset] & 0x0f;
+        m_closed = frame.opcode == DataFrame::ConectionClose;
+        frame.fin = m_buffer[m_offset] & 0x80;
+        frame.payload.assign(m_buffer.begin() + m_offset + header, m_buffer.begin() + m_offset + header + size);
+        m_offset += header + size;
+
+        return frame;
+
+    };
+
+    // the closing handshake started by the client
+    bool close() {
+        std::vector<uint8_t> code = { 0x03, 0xe8 };
+        send(DataFrame::ConectionClose, code);
+        Frame frame = receive();
+        return frame.opcode == DataFrame::ConectionClose && receive().opcode == 0xff;
+    };
+
+private:
+
+    MemoryTransport & m_transport;
+    int m_connection;
+    bool m_connected = false;
+    bool m_closed = false;
+
+    // received, the bytes before m_offset are consumed
+    std::vector<uint8_t> m_buffer;
+    size_t m_offset = 0;
+
+    void send_bytes(const uint8_t * data, size_t size) {
+        m_transport.send(m_connection, { data, size });
+    };
+
+    // reads until size bytes behind m_offset are there
+    bool fill(size_t size = 1) {
+
+        if (m_offset > 0 && m_offset == m_buffer.size()) {
+            m_buffer.clear();
+            m_offset = 0;
+        }
+
+        while (m_buffer.size() - m_offset < size) {
+            size_t used = m_buffer.size();
+            m_buffer.resize(used + std::max<size_t>(64 * 1024, size - (used - m_offset)));
+            iovec iov { m_buffer.data() + used, m_buffer.size() - used };
+            ssize_t bytes_read = m_transport.read(m_connection, &iov, 1);
+            m_buffer.resize(used + std::max<ssize_t>(bytes_read, 0));
+            if (bytes_read <= 0)
+                return false;
+        }
+
+        return true;
+
+    };
+
+};
+
+inline std::vector<uint8_t> payload(size_t size, uint8_t opcode) {
+
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++)
+        data[i] = opcode == DataFrame::TextFrame ? 'a' + i % 26 : i * 7;
+    return data;
+
+}
+
+// the echo of one message, which may come in several frames
+inline bool echoed(Client & client, uint8_t opcode, const std::vector<uint8_t> & data) {
+
+    Frame frame = client.receive();
+    if (frame.opcode != opcode)
+        return false;
+
+    std::vector<uint8_t> message = std::move(frame.payload);
+    while (!frame.fin) {
+        frame = client.receive();
+        if (frame.opcode != DataFrame::ContinuationFrame)
+            return false;
+        message.insert(message.end(), frame.payload.begin(), frame.payload.end());
+    }
+
+    return message == data;
+
+}
+
+struct Case {
+    std::string id;
+    std::string description;
+    std::function<bool(Client &)> play;
+};
+
+// without full the 8 and 16 MB messages of 9.1 and 9.2 are skipped
+inline void add_cases(std::vector<Case> & cases, bool full) {
+
+    const size_t B = 1, KB = 1024, MB = 1024 * 1024;
+
+    // 1.1 / 1.2 messages around the lengths of the header
+    int number = 1;
+    for (size_t size : { 0, 125, 126, 127, 128, 65535, 65536 }) {
+        for (uint8_t opcode : { DataFrame::TextFrame, DataFrame::BinaryFrame }) {
+            cases.push_back({ (opcode == DataFrame::TextFrame ? "1.1." : "1.2.") + std::to_string(number),
+                std::to_string(size) + " bytes", [=](Client & client) {
+                    std::vector<uint8_t> data = payload(size, opcode);
+                    client.send(opcode, data);
+                    return echoed(client, opcode, data);
+                } });
+        }
+        number++;
+    }
+
+    // 2.x a ping is answered with its payload
+    cases.push_back({ "2.2", "ping with payload", [](Client & client) {
+        std::vector<uint8_t> data = { 'H', 'e', 'l', 'l', 'o' };
+        client.send(DataFrame::Ping, data);
+        Frame pong = client.receive();
+        return pong.opcode == DataFrame::Pong && pong.payload == data;
+    } });
+
+    // 5.x fragmentation
+    cases.push_back({ "5.6", "fragmented text with a ping in between", [](Client & client) {
+        std::vector<uint8_t> data = payload(10, DataFrame::TextFrame);
+        client.send(DataFrame::TextFrame, false, data.data(), 5);
+        client.send(DataFrame::Ping, true, data.data(), 3);
+        client.send(DataFrame::ContinuationFrame, true, data.data() + 5, 5);
+        Frame pong = client.receive();
+        return pong.opcode == DataFrame::Pong && echoed(client, DataFrame::TextFrame, data);
+    } });
+
+    cases.push_back({ "5.9", "continuation without a message", [](Client & client) {
+        client.send(DataFrame::ContinuationFrame, true, nullptr, 0);
+        Frame close = client.receive();
+        return close.opcode == DataFrame::ConectionClose && close.payload == std::vector<uint8_t> { 0x03, 0xea };
+    } });
+
+    cases.push_back({ "5.18", "new message before the last frame", [](Client & client) {
+        client.send(DataFrame::TextFrame, false, nullptr, 0);
+        client.send(DataFrame::TextFrame, true, nullptr, 0);
+        Frame close = client.receive();
+        return close.opcode == DataFrame::ConectionClose && close.payload == std::vector<uint8_t> { 0x03, 0xea };
+    } });
+
+    // 9.1 / 9.2 one large message
+    number = 1;
+    for (size_t size : { 64 * KB, 256 * KB, 1 * MB, 4 * MB, 8 * MB, 16 * MB }) {
+        if (size > 4 * MB && !full)
+            break;
+        for (uint8_t opcode : { DataFrame::TextFrame, DataFrame::BinaryFrame }) {
+            cases.push_back({ (opcode == DataFrame::TextFrame ? "9.1." : "9.2.") + std::to_string(number),
+                std::to_string(size / KB) + " KB in one frame", [=](Client & client) {
+                    std::vector<uint8_t> data = payload(size, opcode);
+                    client.send(opcode, data);
+                    return echoed(client, opcode, data);
+                } });
+        }
+        number++;
+    }
+
+    // 9.3 / 9.4 4 MB in fragments
+    number = 1;
+    for (size_t fragment : { 64 * B, 256 * B, 1 * KB, 4 * KB, 16 * KB, 64 * KB, 256 * KB, 1 * MB, 4 * MB }) {
+        for (uint8_t opcode : { DataFrame::TextFrame, DataFrame::BinaryFrame }) {
+            cases.push_back({ (opcode == DataFrame::TextFrame ? "9.3." : "9.4.") + std::to_string(number),
+                "4 MB in fragments of " + std::to_string(fragment) + " bytes", [=](Client & client) {
+                    std::vector<uint8_t> data = payload(4 * MB, opcode);
+                    for (size_t offset = 0; offset < data.size(); offset += fragment)
+                        client.send(offset == 0 ? (DataFrame::Opcode) opcode : DataFrame::ContinuationFrame,
+                            offset + fragment >= data.size(), data.data() + offset,
+                            std::min(fragment, data.size() - offset));
+                    return echoed(client, opcode, data);
+                } });
+        }
+        number++;
+    }
+
+    // 9.5 / 9.6 1 MB in writes of a few bytes
+    number = 1;
+    for (size_t chop : { 64 * B, 128 * B, 256 * B, 512 * B, 1 * KB, 2 * KB }) {
+        for (uint8_t opcode : { DataFrame::TextFrame, DataFrame::BinaryFrame }) {
+            cases.push_back({ (opcode == DataFrame::TextFrame ? "9.5." : "9.6.") + std::to_string(number),
+                "1 MB in writes of " + std::to_string(chop) + " bytes", [=](Client & client) {
+                    std::vector<uint8_t> data = payload(1 * MB, opcode);
+                    client.send(opcode, data, chop);
+                    return echoed(client, opcode, data);
+                } });
+        }
+        number++;
+    }
+
+    // 9.7 / 9.8 1000 small messages, one at a time
+    number = 1;
+    for (size_t size : { 0 * B, 16 * B, 64 * B, 256 * B, 1 * KB, 4 * KB }) {
+        for (uint8_t opcode : { DataFrame::TextFrame, DataFrame::BinaryFrame }) {
+            cases.push_back({ (opcode == DataFrame::TextFrame ? "9.7." : "9.8.") + std::to_string(number),
+                "1000 round trips of " + std::to_string(size) + " bytes", [=](Client & client) {
+                    std::vector<uint8_t> data = payload(size, opcode);
+                    for (int i = 0; i < 1000; i++) {
+                        client.send(opcode, data);
+                        if (!echoed(client, opcode, data))
+                            return false;
+                    }
+                    return true;
+                } });
+        }
+        number++;
+    }
+
+}
+
+// plays the case on a new connection, ms is the time play() took
+inline bool run_case(Socket & server, const Case & c, double * ms = nullptr) {
+
+    // a pair for every connection
+    MemoryTransport transport(1);
+    Client client(server, transport);
+
+    if (!client.connected())
+        return false;
+
+    auto start = std::chrono::steady_clock::now();
+    bool passed = c.play(client);
+    if (ms != nullptr)
+        *ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // the cases failing the connection already got the close frame
+    if (passed && !client.closed())
+        passed = client.close();
+
+    while (server.connections() != 0)
+        std::this_thread::yield();
+
+    return passed;
+
+}
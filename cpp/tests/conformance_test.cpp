@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "conformance_cases.h"
+
+// conformance_test [--full] [case prefix]
+//
+// Plays the Autobahn cases of conformance_cases.h once each against an echo
+// server, a case fails if the echo (or the closing handshake) is wrong. How
+// fast they are is measured by bench/conformance_bench.
+
+int main(int argc, char * argv[]) {
+
+    std::string prefix;
+    bool full = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--full")
+            full = true;
+        else
+            prefix = arg;
+    }
+
+    Echo echo;
+    Protocols protocols;
+    protocols.add("echo", echo);
+
+    Socket server(0, false, 4);
+    server.set_protocols(&protocols);
+    server.set_drain_timeout(std::chrono::milliseconds(100));
+
+    std::vector<Case> cases;
+    add_cases(cases, full);
+
+    for (const Case & c : cases) {
+
+        if (!c.id.starts_with(prefix))
+            continue;
+
+        if (!run_case(server, c))
+            printf("FAILED %-7s %s\n", c.id.c_str(), c.description.c_str());
+
+    }
+
+    server.stop();
+
+    return 0;
+
+}
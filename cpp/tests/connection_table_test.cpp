@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <thread>
+#include "socket/connection_table.h"
+
+void test_slots() {
+
+    ConnectionTable table(3);
+
+    WebSocket * a = table.acquire(10);
+    WebSocket * b = table.acquire(11);
+    WebSocket * c = table.acquire(12);
+
+    if (a == nullptr || b == nullptr || c == nullptr)
+        printf("FAILED acquire below the capacity\n");
+
+    if (table.acquire(13) != nullptr)
+        printf("FAILED acquire above the capacity\n");
+
+    if (table.size() != 3)
+        printf("FAILED size %zu != 3\n", table.size());
+
+    if (table.find(b->id()) != b || b->connection() != 11)
+        printf("FAILED find by id\n");
+
+    uint64_t stale_id = b->id();
+    table.release(b);
+
+    if (table.find(stale_id) != nullptr)
+        printf("FAILED stale id still resolves\n");
+
+    // the released slot is reused with a new generation
+    WebSocket * d = table.acquire(14);
+    if (d != b || d->id() == stale_id || table.find(stale_id) != nullptr)
+        printf("FAILED slot reuse\n");
+
+    if (table.find(d->id()) != d)
+        printf("FAILED find after reuse\n");
+
+    int sum = 0;
+    table.for_each([&](WebSocket * ws) {
+        // the table is not locked while f runs
+        if (table.find(ws->id()) == ws)
+            sum += ws->connection();
+    });
+    if (sum != 10 + 12 + 14)
+        printf("FAILED for_each visited %d\n", sum);
+
+    table.release(a);
+    table.release(c);
+    table.release(d);
+
+    if (table.size() != 0)
+        printf("FAILED size %zu != 0\n", table.size());
+
+    if (table.find(123456789) != nullptr)
+        printf("FAILED find of an invalid slot\n");
+
+}
+
+// release() waits for a with() using the connection
+void test_pinning() {
+
+    ConnectionTable table(2);
+
+    WebSocket * a = table.acquire(10);
+    uint64_t id = a->id();
+    std::thread releasing;
+
+    bool found = table.with(id, [&](WebSocket * ws) {
+
+        releasing = std::thread([&]() { table.release(a); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        if (ws->id() != id || ws->connection() != 10)
+            printf("FAILED pinned connection released\n");
+
+    });
+
+    releasing.join();
+
+    if (!found)
+        printf("FAILED with an open connection\n");
+
+    if (table.with(id, [](WebSocket *) { printf("FAILED with a released connection\n"); }) || table.size() != 0)
+        printf("FAILED stale id after the pin\n");
+
+}
+
+// a table of a few huge pages on the node of CPU 0
+void test_placement() {
+
+    int node = Placement::node_of(0);
+    size_t capacity = 4 * HUGE_PAGE_SIZE / sizeof(WebSocket);
+
+    ConnectionTable table(capacity, node);
+    const Placement::Region & region = table.region();
+
+    if (region.size < capacity * sizeof(WebSocket) || (uintptr_t) region.data % HUGE_PAGE_SIZE != 0)
+        printf("FAILED region of %zu bytes at %p\n", region.size, region.data);
+
+    WebSocket * last = nullptr;
+    for (size_t i = 0; i < capacity; i++)
+        last = table.acquire(i);
+
+    if (last == nullptr || table.find(last->id()) != last || table.acquire(0) != nullptr)
+        printf("FAILED slots of a placed table\n");
+
+    // small tables keep small pages
+    ConnectionTable small(3, node);
+    if (small.region().pages != Placement::Small)
+        printf("FAILED huge pages for a small table\n");
+
+    if (node >= 0 && !Placement::pin(Placement::cpus_of(node)))
+        printf("FAILED pin to the CPUs of node %d\n", node);
+
+}
+
+int main() {
+
+    test_slots();
+    test_pinning();
+    test_placement();
+
+    return 0;
+
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <atomic>
+#include <string>
+#include "websocket/websocket.h"
+#include "event/task.h"
+#include "executor/executor.h"
+#include "test_helpers.h"
+
+void test_coroutine_echo() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    EventLoop loop;
+    WebSocket ws(fds[0]);
+
+    int received = 0;
+    bool closed = false;
+    bool disconnected = false;
+
+    ws.attach(&loop, [&]() {
+        disconnected = true;
+        loop.stop();
+    });
+    echo_messages(ws, &received, &closed).start();
+
+    std::thread loop_thread([&]() { loop.run(); });
+
+    write(fds[1], handshake_request, strlen(handshake_request));
+
+    std::string response = read_available(fds[1]);
+    if (response.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == std::string::npos)
+        printf("FAILED handshake response: %s\n", response.c_str());
+
+    // two masked frames "Hello" in a single write
+    uint8_t frames[] = {
+        0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58,
+        0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58
+    };
+    write(fds[1], frames, sizeof(frames));
+
+    std::string echoed = read_available(fds[1]);
+    std::string expected = std::string("\x81\x05Hello", 7) + std::string("\x81\x05Hello", 7);
+    if (echoed != expected)
+        printf("FAILED echo (%zu bytes)\n", echoed.size());
+
+    // masked close frame with status 1000
+    uint8_t close_frame[] = { 0x88, 0x82, 0x37, 0xfa, 0x21, 0x3d, 0x34, 0x12 };
+    write(fds[1], close_frame, sizeof(close_frame));
+
+    loop_thread.join();
+
+    if (received != 2)
+        printf("FAILED received %d messages\n", received);
+
+    if (!closed || !disconnected)
+        printf("FAILED coroutine was not resumed after the close\n");
+
+    close(fds[1]);
+
+}
+
+void test_release_behind_queued_messages() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    EventLoop loop;
+    Executor executor(1, 64, Executor::Block);
+    WebSocket ws(fds[0]);
+
+    std::atomic<int> handled = 0;
+    int at_release = -1;
+
+    ws.set_executor(&executor);
+    ws.on_message([&](std::string) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        handled++;
+    });
+    ws.attach(&loop, [&]() {
+        at_release = handled;
+        loop.stop();
+    });
+
+    std::thread loop_thread([&]() { loop.run(); });
+
+    write(fds[1], handshake_request, strlen(handshake_request));
+    read_available(fds[1]);
+
+    // three messages and the close frame, the handlers are still queued
+    // when the close is read
+    std::string frames;
+    for (int i = 0; i < 3; i++)
+        frames += client_frame(0x1, "Hello");
+    write(fds[1], frames.data(), frames.size());
+
+    uint8_t close_frame[] = { 0x88, 0x82, 0x37, 0xfa, 0x21, 0x3d, 0x34, 0x12 };
+    write(fds[1], close_frame, sizeof(close_frame));
+
+    loop_thread.join();
+    executor.stop();
+
+    if (at_release != 3)
+        printf("FAILED connection released after %d of 3 handlers\n", at_release);
+
+    close(fds[1]);
+
+}
+
+void test_stop_before_run() {
+
+    EventLoop loop;
+    bool posted = false;
+
+    loop.post([&]() { posted = true; });
+    loop.stop();
+
+    // returns right away instead of waiting for the next stop()
+    loop.run();
+
+    if (!posted)
+        printf("FAILED posted function did not run before the loop stopped\n");
+
+}
+
+int main() {
+
+    test_stop_before_run();
+    test_coroutine_echo();
+    test_release_behind_queued_messages();
+
+}
@@ -54,6 +54,56 @@ void test_parse_data_frame (uint8_t * data, int len, Expected expected) {
 
 }
 
+// the length field of get_raw_frame() read back by parse_raw_frame()
+void test_round_trip (size_t size) {
+
+    DataFrame frame = DataFrame::get_text_frame(std::string(size, 'x'));
+    std::vector<uint8_t> raw_frame = frame.get_raw_frame();
+
+    DataFrame parsed;
+    if (parsed.parse_raw_frame(raw_frame.data(), raw_frame.size()) != raw_frame.size() ||
+        parsed.m_payload_len_bytes != size || parsed.get_utf8_string() != std::string(size, 'x'))
+    {
+        printf("FAILED round trip of %zu bytes\n", size);
+    }
+
+}
+
+// the word at a time masking against the definition (rfc6455 section-5.3)
+void test_mask () {
+
+    const uint8_t key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+    for (size_t size = 0; size < 40; size++) {
+        for (uint64_t position = 0; position < 8; position++) {
+
+            std::vector<uint8_t> data(size);
+            for (size_t i = 0; i < size; i++)
+                data[i] = i * 13;
+
+            std::vector<uint8_t> masked = data;
+            DataFrame::mask(masked.data(), size, key, position);
+
+            for (size_t i = 0; i < size; i++)
+                if (masked[i] != (data[i] ^ key[(position + i) % 4]))
+                    printf("FAILED mask of %zu bytes at %llu\n", size, (unsigned long long) position);
+
+        }
+    }
+
+    // a masked frame of a client, parsed like a server does
+    DataFrame frame = DataFrame::get_text_frame("Hello, masked world");
+    frame.m_mask = true;
+    memcpy(frame.m_masking_key, key, 4);
+    std::vector<uint8_t> raw_frame = frame.get_raw_frame();
+
+    DataFrame parsed;
+    parsed.parse_raw_frame(raw_frame.data(), raw_frame.size());
+    if (!parsed.m_mask || parsed.get_utf8_string() != "Hello, masked world")
+        printf("FAILED masked round trip\n");
+
+}
+
 int main() {
     
 
@@ -103,4 +153,11 @@ int main() {
         "Hello"
     });
 
-}
\ No newline at end of file
+
+    // the lengths around the 7 bit and the 16 bit length field
+    for (size_t size : { 0, 125, 126, 127, 0xffff, 0x10000 })
+        test_round_trip(size);
+
+    test_mask();
+
+}
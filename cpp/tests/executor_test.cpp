@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "executor/executor.h"
+
+void test_strand_order() {
+
+    Executor executor(4, 10000, Executor::Block);
+
+    Executor::Strand strands[3];
+    std::vector<int> received[3];
+
+    for (int i = 0; i < 1000; i++)
+        for (int s = 0; s < 3; s++)
+            executor.post(strands[s], [&, s, i]() { received[s].push_back(i); });
+
+    for (auto & strand : strands)
+        strand.wait_idle();
+
+    for (int s = 0; s < 3; s++) {
+        if (received[s].size() != 1000) {
+            printf("FAILED strand %d received %zu tasks\n", s, received[s].size());
+            continue;
+        }
+        for (int i = 0; i < 1000; i++)
+            if (received[s][i] != i) {
+                printf("FAILED strand %d out of order at %d\n", s, i);
+                break;
+            }
+    }
+
+}
+
+void test_all_tasks_run() {
+
+    std::atomic<int> counter { 0 };
+
+    {
+        Executor executor(3, 100, Executor::Block);
+        for (int i = 0; i < 5000; i++)
+            executor.post([&]() { counter++; });
+    }
+
+    if (counter != 5000)
+        printf("FAILED only %d of 5000 tasks were executed\n", (int) counter);
+
+}
+
+void test_drop_policy() {
+
+    Executor executor(1, 2, Executor::Drop);
+
+    std::atomic<bool> started { false };
+    std::atomic<bool> release { false };
+
+    executor.post([&]() {
+        started = true;
+        while (!release)
+            std::this_thread::yield();
+    });
+
+    while (!started)
+        std::this_thread::yield();
+
+    if (!executor.post([]() {}) || !executor.post([]() {}))
+        printf("FAILED tasks rejected below the limit\n");
+
+    if (executor.post([]() {}))
+        printf("FAILED task accepted above the limit\n");
+
+    release = true;
+
+}
+
+void test_block_policy() {
+
+    Executor executor(1, 1, Executor::Block);
+
+    std::atomic<bool> started { false };
+    std::atomic<bool> release { false };
+    std::atomic<bool> posted { false };
+
+    executor.post([&]() {
+        started = true;
+        while (!release)
+            std::this_thread::yield();
+    });
+
+    while (!started)
+        std::this_thread::yield();
+
+    executor.post([]() {});
+
+    std::thread producer([&]() {
+        executor.post([]() {});
+        posted = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    if (posted)
+        printf("FAILED producer was not blocked by a full queue\n");
+
+    release = true;
+    producer.join();
+
+    if (!posted)
+        printf("FAILED producer was not released\n");
+
+}
+
+int main() {
+
+    test_strand_order();
+    test_all_tasks_run();
+    test_drop_policy();
+    test_block_policy();
+
+}
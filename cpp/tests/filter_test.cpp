@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "pubsub/filter.h"
+
+bool passes(Filters & filters, uint32_t filter, const char * message) {
+
+    std::vector<uint32_t> passed;
+    uint32_t list[] = { filter };
+    filters.evaluate(message, list, passed);
+    return !passed.empty();
+
+}
+
+void test_syntax() {
+
+    Filters filters;
+    std::string error;
+
+    const char * invalid[] = { "", "qty", "qty >", "qty ~ 1", "symbol in SAP", "symbol in {SAP", "a == 1 &&", "a == 1 b == 2" };
+    for (const char * filter : invalid)
+        if (filters.add(filter, &error) != 0 || error.empty())
+            printf("FAILED invalid filter accepted: %s\n", filter);
+
+    // spaces, order of the terms and of the sets, quotes and number formats
+    uint32_t a = filters.add("symbol in {SAP, BMW} && qty > 1000");
+    uint32_t b = filters.add("qty>1e3 && symbol in {\"BMW\",SAP,BMW}");
+    uint32_t c = filters.add("qty > 1000");
+
+    if (a == 0 || a != b || c == a || filters.size() != 2)
+        printf("FAILED same filters not merged\n");
+
+    // a reference per add()
+    filters.remove(a);
+    if (filters.size() != 2)
+        printf("FAILED filter removed with a reference left\n");
+    filters.remove(b);
+    if (filters.size() != 1)
+        printf("FAILED filter kept without a reference\n");
+
+}
+
+void test_scan() {
+
+    std::vector<std::string> names = { "a", "b", "c", "d" };
+    std::vector<Filters::Field> fields;
+
+    // escapes and nested values longer than a vector of bytes
+    std::string json = "{ \"x\": \"a string with \\\"quotes\\\" and \\\\ longer than 16\", "
+                       "\"a\" : 42, \"n\": {\"b\": 1, \"s\": \"}]\"}, \"l\": [1, [2, {\"c\": 3}]], "
+                       "\"b\": \"v\\\"al\", \"c\": true }";
+
+    if (!Filters::scan(json, names, fields))
+        printf("FAILED scan of an object\n");
+
+    if (!fields[0].found || fields[0].string || fields[0].value != "42")
+        printf("FAILED number field\n");
+    if (!fields[1].found || !fields[1].string || fields[1].value != "v\\\"al")
+        printf("FAILED string field, %.*s\n", (int) fields[1].value.size(), fields[1].value.data());
+    if (!fields[2].found || fields[2].value != "true")
+        printf("FAILED field behind nested values\n");
+    if (fields[3].found)
+        printf("FAILED missing field found\n");
+
+    if (Filters::scan("[1, 2]", names, fields) || Filters::scan("{\"a\": \"open", names, fields) ||
+        Filters::scan("{\"a\": 1", names, fields) || Filters::scan("", names, fields))
+        printf("FAILED scan of no or a broken object\n");
+
+    if (!Filters::scan(" {} ", names, fields))
+        printf("FAILED scan of an empty object\n");
+
+}
+
+void test_evaluate() {
+
+    Filters filters;
+
+    uint32_t trades = filters.add("symbol in {SAP, BMW} && qty > 1000");
+    uint32_t cheap = filters.add("side == buy && price <= 99.5");
+    uint32_t other = filters.add("symbol != SAP");
+
+    if (!passes(filters, trades, "{\"symbol\": \"SAP\", \"qty\": 1001}") ||
+        passes(filters, trades, "{\"symbol\": \"SAP\", \"qty\": 1000}") ||
+        passes(filters, trades, "{\"symbol\": \"VOW\", \"qty\": 5000}") ||
+        passes(filters, trades, "{\"symbol\": \"SAP\"}") ||
+        passes(filters, trades, "{\"symbol\": \"SAP\", \"qty\": \"5000\"}"))
+        printf("FAILED set and comparison\n");
+
+    if (!passes(filters, cheap, "{\"side\": \"buy\", \"price\": 99.5}") ||
+        passes(filters, cheap, "{\"side\": \"buy\", \"price\": 99.51}") ||
+        passes(filters, cheap, "{\"side\": \"sell\", \"price\": 1}"))
+        printf("FAILED string and decimal comparison\n");
+
+    if (!passes(filters, other, "{\"symbol\": \"BMW\"}") || passes(filters, other, "{\"symbol\": \"SAP\"}") ||
+        passes(filters, other, "{}") || passes(filters, other, "not json"))
+        printf("FAILED not equal\n");
+
+    // all filters with one scan, each evaluated once
+    std::vector<uint32_t> list = { trades, cheap, other };
+    std::vector<uint32_t> passed;
+    uint64_t evaluations = filters.evaluations();
+
+    filters.evaluate("{\"symbol\": \"BMW\", \"qty\": 2000, \"side\": \"buy\", \"price\": 10}", list, passed);
+
+    if (passed != list)
+        printf("FAILED %zu of 3 filters passed\n", passed.size());
+    if (filters.evaluations() - evaluations != 3)
+        printf("FAILED %llu evaluations of 3 filters\n", (unsigned long long) (filters.evaluations() - evaluations));
+
+}
+
+int main() {
+
+    test_syntax();
+    test_scan();
+    test_evaluate();
+
+    return 0;
+
+}
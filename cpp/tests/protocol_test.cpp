@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <string>
+#include "websocket/websocket.h"
+#include "websocket/protocol.h"
+#include "event/task.h"
+#include "test_helpers.h"
+
+struct Json {
+
+    int opened = 0;
+
+    void on_open(WebSocket & ws) {
+        opened++;
+        ws.send_message("{\"hello\":1}");
+    }
+
+    void on_message(WebSocket & ws, const WebSocket::Message & message) {
+        ws.send_message("{\"echo\":" + std::string(message.text()) + "}");
+    }
+
+};
+
+// no on_open()
+struct Binary {
+
+    void on_message(WebSocket & ws, const WebSocket::Message & message) {
+        std::vector<uint8_t> reversed(message.payload.rbegin(), message.payload.rend());
+        ws.send(reversed, DataFrame::BinaryFrame);
+    }
+
+};
+
+Json json;
+Binary binary;
+Protocols protocols;
+
+// serves one connection with listen(), returns what the server answered
+std::string serve(const std::string & offered, const std::string & frames, std::string * fallback = nullptr) {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    WebSocket ws;
+    ws.reset(fds[0], 1);
+    ws.set_protocols(&protocols);
+    ws.on_message([&](std::string message) {
+        if (fallback != nullptr)
+            *fallback = message;
+        ws.send_message("fallback");
+    });
+
+    std::thread reader([&]() { ws.listen(); });
+
+    std::string message = handshake_request_with(offered);
+    write(fds[1], message.data(), message.size());
+    std::string answer = read_available(fds[1]);
+
+    write(fds[1], frames.data(), frames.size());
+    answer += read_available(fds[1]);
+
+    ::shutdown(fds[1], SHUT_RDWR);
+    reader.join();
+    close(fds[1]);
+
+    return answer;
+
+}
+
+void test_negotiation() {
+
+    // the first one the server knows
+    std::string answer = serve("mqtt, json.v1, binary.v1", client_frame(DataFrame::TextFrame, "[1]"));
+
+    if (answer.find("Sec-WebSocket-Protocol: json.v1\r\n") == std::string::npos)
+        printf("FAILED json.v1 not selected\n");
+
+    if (json.opened != 1 || answer.find(server_frame(DataFrame::TextFrame, "{\"hello\":1}")) == std::string::npos)
+        printf("FAILED on_open of the protocol not called\n");
+
+    if (answer.find(server_frame(DataFrame::TextFrame, "{\"echo\":[1]}")) == std::string::npos)
+        printf("FAILED message not handled by json.v1\n");
+
+    answer = serve("binary.v1", client_frame(DataFrame::BinaryFrame, "abc"));
+
+    if (answer.find("Sec-WebSocket-Protocol: binary.v1\r\n") == std::string::npos ||
+        answer.find(server_frame(DataFrame::BinaryFrame, "cba")) == std::string::npos)
+        printf("FAILED binary frame not handled by binary.v1\n");
+
+    // nothing in common, on_message() gets the messages
+    std::string fallback;
+    answer = serve("mqtt", client_frame(DataFrame::TextFrame, "hi"), &fallback);
+
+    if (answer.find("Sec-WebSocket-Protocol") != std::string::npos || fallback != "hi")
+        printf("FAILED connection without a common protocol\n");
+
+    answer = serve("", client_frame(DataFrame::TextFrame, "hi"), &fallback);
+
+    if (answer.find("Sec-WebSocket-Protocol") != std::string::npos ||
+        answer.find(server_frame(DataFrame::TextFrame, "fallback")) == std::string::npos)
+        printf("FAILED connection without protocols\n");
+
+}
+
+Task receive_nothing(WebSocket & ws, bool & received) {
+
+    while (co_await ws.receive())
+        received = true;
+
+}
+
+void test_event_loop() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    EventLoop loop;
+    WebSocket ws(fds[0]);
+    ws.set_protocols(&protocols);
+
+    bool received = false;
+    ws.attach(&loop, [&]() { loop.stop(); });
+    receive_nothing(ws, received).start();
+
+    std::thread loop_thread([&]() { loop.run(); });
+
+    std::string message = handshake_request_with("binary.v1") + client_frame(DataFrame::BinaryFrame, "xyz");
+    write(fds[1], message.data(), message.size());
+
+    std::string answer = read_available(fds[1]);
+    if (answer.find(server_frame(DataFrame::BinaryFrame, "zyx")) == std::string::npos)
+        printf("FAILED protocol handler not called on the event loop\n");
+
+    std::string close_frame = client_frame(DataFrame::ConectionClose, "\x03\xe8");
+    write(fds[1], close_frame.data(), close_frame.size());
+
+    loop_thread.join();
+    close(fds[1]);
+
+    if (received)
+        printf("FAILED receive() got a message of the protocol\n");
+
+}
+
+int main() {
+
+    protocols.add("json.v1", json);
+    protocols.add("binary.v1", binary);
+
+    test_negotiation();
+    test_event_loop();
+
+    return 0;
+
+}
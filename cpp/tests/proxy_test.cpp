@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include "socket/socket.h"
+#include "proxy/proxy.h"
+#include "event/task.h"
+#include "websocket/websocket_client.h"
+#include "test_helpers.h"
+
+#define TEST_PORT 39590
+
+const char * backend_path = "/tmp/wsserver_proxy_test.sock";
+
+static bool read_all(int fd, uint8_t * buffer, size_t size) {
+
+    while (size > 0) {
+        ssize_t bytes = read(fd, buffer, size);
+        if (bytes <= 0)
+            return false;
+        buffer += bytes;
+        size -= bytes;
+    }
+    return true;
+
+}
+
+// stands in for the backend: answers every message with the same payload,
+// "close" with a close record (4000)
+struct Backend {
+
+    int listener = -1;
+    std::vector<int> connections;
+    std::vector<std::thread> threads;
+    std::thread acceptor;
+    std::mutex mutex;
+    std::atomic<int> messages = 0;
+    std::atomic<int> closed = 0;
+
+    bool start() {
+
+        Address::Endpoint endpoint;
+        Address::parse(std::string("unix:") + backend_path, endpoint);
+        unlink(backend_path);
+
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (bind(listener, endpoint.addr(), endpoint.length) < 0 || ::listen(listener, 16) < 0)
+            return false;
+
+        acceptor = std::thread([this]() {
+            int fd;
+            while ((fd = accept(listener, nullptr, nullptr)) >= 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                connections.push_back(fd);
+                threads.emplace_back([this, fd]() { serve(fd); });
+            }
+        });
+
+        return true;
+
+    }
+
+    void serve(int fd) {
+
+        uint8_t header[PROXY_HEADER_SIZE];
+
+        while (read_all(fd, header, PROXY_HEADER_SIZE)) {
+
+            Proxy::Record record = Proxy::decode(header);
+            std::vector<uint8_t> payload(record.length);
+
+            if (!read_all(fd, payload.data(), payload.size()))
+                break;
+
+            if (record.opcode == DataFrame::ConectionClose) {
+                closed++;
+                continue;
+            }
+
+            messages++;
+
+            if (std::string(payload.begin(), payload.end()) == "close") {
+                record.opcode = DataFrame::ConectionClose;
+                payload = { 4000 >> 8, 4000 & 0xff };
+            }
+
+            record.length = payload.size();
+            Proxy::encode(header, record);
+
+            // the header and the payload in two writes, the proxy waits
+            // for the rest
+            if (write(fd, header, sizeof(header)) < 0 ||
+                (!payload.empty() && write(fd, payload.data(), payload.size()) < 0))
+                break;
+
+        }
+
+    }
+
+    void stop() {
+
+        ::shutdown(listener, SHUT_RDWR);
+        acceptor.join();
+        close(listener);
+        unlink(backend_path);
+
+        for (int fd : connections)
+            ::shutdown(fd, SHUT_RDWR);
+        for (auto & thread : threads)
+            thread.join();
+        for (int fd : connections)
+            close(fd);
+
+    }
+
+};
+
+void test_records() {
+
+    Proxy::Record record { 0x01020304, DataFrame::BinaryFrame, 0x1122334455667788 };
+
+    uint8_t header[PROXY_HEADER_SIZE];
+    Proxy::encode(header, record);
+
+    if (header[0] != 0x01 || header[3] != 0x04 || header[4] != DataFrame::BinaryFrame || header[8] != 0x11 || header[15] != 0x88)
+        printf("FAILED record header is not big endian\n");
+
+    Proxy::Record decoded = Proxy::decode(header);
+
+    if (decoded.length != record.length || decoded.opcode != record.opcode || decoded.id != record.id)
+        printf("FAILED record round trip\n");
+
+}
+
+// with a thread per connection the replies are spliced, on the event loop
+// they are copied into frames
+void test_proxy(int port, bool event_loop) {
+
+    const char * mode = event_loop ? "event loop" : "threads";
+
+    Backend backend;
+    if (!backend.start()) {
+        printf("FAILED backend (%s)\n", mode);
+        return;
+    }
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(500));
+
+    if (event_loop) {
+        socket.on_connection([](WebSocket & ws) -> Task {
+            // the messages go to the proxy
+            while (co_await ws.receive());
+        });
+    }
+
+    Proxy proxy(socket, std::string("unix:") + backend_path, 2);
+    if (!proxy.start()) {
+        printf("FAILED proxy start (%s)\n", mode);
+        backend.stop();
+        return;
+    }
+
+    Protocols protocols;
+    protocols.set_default(proxy);
+    socket.set_protocols(&protocols);
+
+    if (!socket.listen(true)) {
+        printf("FAILED listen (%s)\n", mode);
+        proxy.stop();
+        backend.stop();
+        return;
+    }
+
+    EventLoop loop;
+    WebSocketClient client(&loop);
+    WebSocketClient closing(&loop);
+
+    std::mutex mutex;
+    std::vector<WebSocket::Message> replies;
+    std::atomic<int> client_closed = 0;
+    std::atomic<int> closing_closed = 0;
+
+    std::vector<uint8_t> large(1024 * 1024);
+    for (size_t i = 0; i < large.size(); i++)
+        large[i] = i * 7;
+
+    client.on_message([&](const WebSocket::Message & message) {
+        std::lock_guard<std::mutex> lock(mutex);
+        replies.push_back(message);
+        if (replies.size() == 3)
+            client.close(1000);
+    });
+    client.on_close([&](uint16_t statuscode) { client_closed = statuscode; });
+
+    closing.on_open([&]() { closing.send("close"); });
+    closing.on_close([&](uint16_t statuscode) { closing_closed = statuscode; });
+
+    std::string address = "127.0.0.1:" + std::to_string(port);
+    client.connect(address);
+    client.send("hello backend");
+    client.send(large, DataFrame::BinaryFrame);
+    client.send("");
+    closing.connect(address);
+
+    std::thread thread([&]() { loop.run(); });
+
+    if (!wait_for([&]() { return client_closed != 0 && closing_closed != 0; }))
+        printf("FAILED clients not closed (%s)\n", mode);
+
+    loop.stop();
+    thread.join();
+
+    if (client_closed != 1000)
+        printf("FAILED client closed with %d (%s)\n", client_closed.load(), mode);
+
+    if (closing_closed != 4000)
+        printf("FAILED close record of the backend answered with %d (%s)\n", closing_closed.load(), mode);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (replies.size() != 3 || replies[0].text() != "hello backend" || replies[0].opcode != DataFrame::TextFrame ||
+            replies[1].payload != large || replies[1].opcode != DataFrame::BinaryFrame || !replies[2].payload.empty())
+            printf("FAILED %zu replies (%s)\n", replies.size(), mode);
+    }
+
+    // both connections are released, the backend hears about it
+    if (!wait_for([&]() { return backend.closed == 2; }))
+        printf("FAILED backend got %d close records instead of 2 (%s)\n", backend.closed.load(), mode);
+
+    if (proxy.forwarded() != 4 || proxy.replied() != 3)
+        printf("FAILED forwarded %lu, replied %lu (%s)\n", proxy.forwarded(), proxy.replied(), mode);
+
+    socket.stop();
+    proxy.stop();
+    backend.stop();
+
+}
+
+// a client not reading its reply is closed after PROXY_SEND_TIMEOUT_MS, the
+// other clients of the same backend connection get theirs meanwhile
+void test_stalled_client(int port) {
+
+    Backend backend;
+    if (!backend.start()) {
+        printf("FAILED backend\n");
+        return;
+    }
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(500));
+
+    Proxy proxy(socket, std::string("unix:") + backend_path, 1);
+    if (!proxy.start()) {
+        printf("FAILED proxy start\n");
+        backend.stop();
+        return;
+    }
+
+    Protocols protocols;
+    protocols.set_default(proxy);
+    socket.set_protocols(&protocols);
+    socket.listen(true);
+
+    Address::Endpoint endpoint;
+    Address::parse("127.0.0.1:" + std::to_string(port), endpoint);
+
+    // a small window, the reply stays in the kernel buffers
+    int stalled = ::socket(AF_INET, SOCK_STREAM, 0);
+    int size = 4096;
+    setsockopt(stalled, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    connect(stalled, endpoint.addr(), endpoint.length);
+    write(stalled, handshake_request, strlen(handshake_request));
+    read_available(stalled, 1);
+
+    std::string frame = client_frame(DataFrame::BinaryFrame, std::string(8 * 1024 * 1024, 'x'));
+    for (size_t sent = 0; sent < frame.size();) {
+        ssize_t bytes = write(stalled, frame.data() + sent, frame.size() - sent);
+        if (bytes <= 0)
+            break;
+        sent += bytes;
+    }
+
+    if (!wait_for([&]() { return proxy.forwarded() == 1; }))
+        printf("FAILED message of the stalled client not forwarded\n");
+
+    EventLoop loop;
+    WebSocketClient client(&loop);
+    std::atomic<bool> replied = false;
+
+    client.on_message([&](const WebSocket::Message & message) { replied = message.text() == "hello"; });
+    client.connect("127.0.0.1:" + std::to_string(port));
+    client.send("hello");
+
+    std::thread thread([&]() { loop.run(); });
+
+    if (!wait_for([&]() { return replied.load(); }, std::chrono::milliseconds(PROXY_SEND_TIMEOUT_MS + 2000)))
+        printf("FAILED reply held up by a stalled client\n");
+
+    if (!wait_for([&]() { return socket.connections() == 1; }))
+        printf("FAILED stalled client not closed, %zu connections\n", socket.connections());
+
+    client.close(1000);
+    wait_for([&]() { return client.state() == WebSocketClient::Disconnected; });
+
+    loop.stop();
+    thread.join();
+
+    close(stalled);
+
+    socket.stop();
+    proxy.stop();
+    backend.stop();
+
+}
+
+// without a backend the clients are closed with 1014 (bad gateway)
+void test_lost_backend(int port) {
+
+    Backend backend;
+    if (!backend.start()) {
+        printf("FAILED backend\n");
+        return;
+    }
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(500));
+
+    Proxy proxy(socket, std::string("unix:") + backend_path, 1);
+    if (!proxy.start()) {
+        printf("FAILED proxy start\n");
+        backend.stop();
+        return;
+    }
+
+    Protocols protocols;
+    protocols.set_default(proxy);
+    socket.set_protocols(&protocols);
+    socket.listen(true);
+
+    backend.stop();
+
+    EventLoop loop;
+    WebSocketClient client(&loop);
+    std::atomic<int> closed = 0;
+
+    client.on_close([&](uint16_t statuscode) { closed = statuscode; });
+    client.connect("127.0.0.1:" + std::to_string(port));
+    client.send("nobody is listening");
+
+    std::thread thread([&]() { loop.run(); });
+
+    if (!wait_for([&]() { return closed != 0; }) || closed != 1014)
+        printf("FAILED closed with %d instead of 1014\n", closed.load());
+
+    loop.stop();
+    thread.join();
+
+    socket.stop();
+    proxy.stop();
+
+}
+
+int main() {
+
+    test_records();
+    test_proxy(TEST_PORT, false);
+    test_proxy(TEST_PORT + 1, true);
+    test_lost_backend(TEST_PORT + 2);
+    test_stalled_client(TEST_PORT + 3);
+
+    return 0;
+
+}
@@ -0,0 +1,559 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <string>
+#include "pubsub/bus.h"
+#include "pubsub/broker.h"
+#include "test_helpers.h"
+
+#define TEST_PORT 39540
+
+const char * bus_path = "/tmp/wsserver_pubsub_test.bus";
+
+struct Received {
+    std::mutex mutex;
+    std::vector<std::pair<std::string, std::string>> records;
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return records.size();
+    }
+
+    // waits up to 2s for count records
+    bool wait_for(size_t count) {
+        return ::wait_for([&]() { return size() >= count; });
+    }
+};
+
+std::thread run(Bus & bus, Received & received) {
+    return std::thread([&]() {
+        bus.run([&](std::string_view topic, std::span<const uint8_t> frame) {
+            std::lock_guard<std::mutex> lock(received.mutex);
+            received.records.emplace_back(topic, std::string(frame.begin(), frame.end()));
+        });
+    });
+}
+
+void test_bus() {
+
+    Bus first;
+    Received first_received;
+
+    if (!first.open(bus_path, 64)) {
+        printf("FAILED create the bus\n");
+        return;
+    }
+
+    std::thread first_reader = run(first, first_received);
+
+    // gets the ring from the first one
+    Bus second;
+    Received second_received;
+
+    if (!second.open(bus_path)) {
+        printf("FAILED join the bus\n");
+        first.close();
+        first_reader.join();
+        return;
+    }
+
+    // over several slots, wrapping around the end of the ring
+    std::string large(3000, 'x');
+    for (int i = 0; i < 5; i++)
+        second.publish("large", bytes(large));
+    second.publish("news", bytes("hello"));
+
+    if (!first_received.wait_for(6) || first_received.records[0].second != large ||
+        first_received.records[5] != std::make_pair(std::string("news"), std::string("hello")))
+    {
+        printf("FAILED records of the other bus, %zu received\n", first_received.size());
+    }
+
+    if (second.publish("huge", bytes(std::string(64 * BUS_SLOT_SIZE, 'x'))))
+        printf("FAILED record larger than half of the ring accepted\n");
+
+    // a process that does not read is lapped
+    for (int i = 0; i < 100; i++)
+        first.publish("flood", bytes(std::to_string(i)));
+    first.publish("news", bytes("latest"));
+
+    std::thread second_reader = run(second, second_received);
+
+    // skips to the end of the ring
+    for (int i = 0; i < 200 && second.lost() == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    first.publish("news", bytes("after"));
+
+    if (!second_received.wait_for(1) || second_received.records[0].second != "after" || second.lost() == 0)
+        printf("FAILED lapped reader, lost %lu\n", second.lost());
+
+    // a process of its own
+    pid_t child = fork();
+    if (child == 0) {
+        Bus bus;
+        bool published = bus.open(bus_path) && bus.publish("news", bytes("from child"));
+        _exit(published ? 0 : 1);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    if (WEXITSTATUS(status) != 0 || !first_received.wait_for(7) || first_received.records.back().second != "from child")
+        printf("FAILED record of another process\n");
+
+    // only the other processes get a record
+    if (first_received.size() != 7)
+        printf("FAILED %zu records, a process received its own\n", first_received.size());
+
+    first.close();
+    second.close();
+    first_reader.join();
+    second_reader.join();
+
+}
+
+// the processes left take over serving the ring, one of them
+void test_bus_take_over() {
+
+    const char * path = "/tmp/wsserver_pubsub_test_take_over.bus";
+
+    Bus second, third;
+    Received second_received, third_received;
+
+    {
+        Bus first;
+        Received first_received;
+
+        if (!first.open(path, 64)) {
+            printf("FAILED create the bus\n");
+            return;
+        }
+
+        std::thread first_reader = run(first, first_received);
+
+        if (!second.open(path) || !third.open(path))
+            printf("FAILED join the bus\n");
+
+        first.close();
+        first_reader.join();
+    }
+
+    // both of them find the stale socket of the first one
+    std::thread second_reader = run(second, second_received);
+    std::thread third_reader = run(third, third_received);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(3 * BUS_TAKEOVER_MS));
+
+    // gets the ring of the two, not a new one
+    Bus fourth;
+    if (!fourth.open(path) || !fourth.publish("news", bytes("after the take over")))
+        printf("FAILED join after the take over\n");
+
+    if (!second_received.wait_for(1) || !third_received.wait_for(1))
+        printf("FAILED record after the take over, %zu and %zu received\n", second_received.size(), third_received.size());
+
+    second.close();
+    third.close();
+    second_reader.join();
+    third_reader.join();
+
+}
+
+std::string joined(const std::vector<std::span<const uint8_t>> & parts) {
+    std::string text;
+    for (std::span<const uint8_t> part : parts)
+        text.append(part.begin(), part.end());
+    return text;
+}
+
+void test_history() {
+
+    History history(4, 16);
+    std::vector<std::span<const uint8_t>> parts;
+
+    for (const char * frame : { "aaaa", "bbbb", "cccc" })
+        history.append(bytes(frame));
+
+    if (!history.since(1, parts) || parts.size() != 1 || joined(parts) != "bbbbcccc")
+        printf("FAILED history since 1\n");
+
+    if (!history.since(3, parts) || !parts.empty())
+        printf("FAILED history without missed frames\n");
+
+    if (history.since(4, parts))
+        printf("FAILED history of the future\n");
+
+    // does not fit behind "cccc", starts over at the front and drops "aaaa"
+    // and "bbbb"
+    history.append(bytes("dddddd"));
+
+    if (history.since(1, parts))
+        printf("FAILED dropped frames replayed\n");
+
+    if (!history.since(2, parts) || parts.size() != 2 || joined(parts) != "ccccdddddd")
+        printf("FAILED history around the end, %zu parts\n", parts.size());
+
+    // "g" takes the place of "cccc"
+    for (const char * frame : { "e", "f", "g" })
+        history.append(bytes(frame));
+
+    if (history.size() != 4 || history.sequence() != 7 || !history.since(3, parts) || joined(parts) != "ddddddefg")
+        printf("FAILED history behind the front\n");
+
+    // at most 4 frames
+    history.append(bytes("h"));
+
+    if (history.size() != 4 || history.since(3, parts) || !history.since(4, parts) || joined(parts) != "efgh")
+        printf("FAILED history frame limit\n");
+
+    if (history.append(std::vector<uint8_t>(17)) != 9 || history.size() != 0 || history.since(7, parts))
+        printf("FAILED oversize frame kept\n");
+
+}
+
+std::string read_frames(int fd) {
+
+    std::string data;
+    char buffer[1024];
+    pollfd pfd { fd, POLLIN, 0 };
+
+    while (poll(&pfd, 1, data.empty() ? 2000 : 200) > 0) {
+        ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+        if (bytes_read <= 0)
+            break;
+        data.append(buffer, bytes_read);
+    }
+
+    return data;
+
+}
+
+// two servers on one bus, as two processes would be
+void test_broker(int port) {
+
+    Socket publisher_socket(port, false, 16);
+    Socket subscriber_socket(port + 1, false, 16);
+
+    for (Socket * socket : { &publisher_socket, &subscriber_socket }) {
+        socket->set_drain_timeout(std::chrono::milliseconds(100));
+        if (!socket->listen(true)) {
+            printf("FAILED listen\n");
+            return;
+        }
+    }
+
+    Broker publisher(publisher_socket);
+    Broker subscriber(subscriber_socket);
+
+    if (!publisher.join(bus_path) || !subscriber.join(bus_path)) {
+        printf("FAILED join\n");
+        return;
+    }
+
+    subscriber_socket.on_open([&](WebSocket * ws) {
+        subscriber.subscribe(ws, "news");
+    });
+
+    publisher_socket.on_open([&](WebSocket * ws) {
+        publisher.subscribe(ws, "news");
+        publisher.subscribe(ws, "sports");
+    });
+
+    int remote = connect_client(port + 1);
+    int local = connect_client(port);
+
+    while (subscriber.subscribers("news") != 1 || publisher.subscribers("news") != 1)
+        std::this_thread::yield();
+
+    publisher.publish("sports", "goal");
+    publisher.publish("news", "hello");
+
+    std::string expected = std::string("\x81\x05") + "hello";
+
+    if (read_frames(remote) != expected)
+        printf("FAILED message of the other broker\n");
+
+    if (read_frames(local) != std::string("\x81\x04") + "goal" + expected)
+        printf("FAILED message of the local broker\n");
+
+    // closed connections are dropped from their topics
+    close(remote);
+    while (subscriber_socket.connections() != 0)
+        std::this_thread::yield();
+
+    publisher.publish("news", "again");
+    for (int i = 0; i < 200 && subscriber.subscribers("news") != 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    if (subscriber.subscribers("news") != 0)
+        printf("FAILED closed connection still subscribed\n");
+
+    close(local);
+
+    publisher_socket.stop();
+    subscriber_socket.stop();
+
+}
+
+// a reconnecting client gets what it missed before the new messages
+void test_replay(int port) {
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(100));
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    Broker broker(socket);
+    broker.keep_history("news", 16, 4096);
+
+    std::atomic<int> incomplete = 0;
+
+    socket.on_open([&](WebSocket * ws) {
+        ws->on_handshake([&broker, &incomplete, ws]() {
+            std::string since = ws->url().parameter("since");
+            if (ws->url().path != "/news")
+                printf("FAILED path %s\n", ws->url().path.c_str());
+            if (!broker.subscribe(ws, "news", strtoull(since.c_str(), nullptr, 10)))
+                incomplete++;
+        });
+    });
+
+    for (const char * message : { "one", "two", "three" })
+        broker.publish("news", message);
+
+    if (broker.sequence("news") != 3 || broker.publish("news", "four") != 4 || broker.sequence("sports") != 0)
+        printf("FAILED sequence\n");
+
+    int client = connect_client(port, "/news?since=2&x=1");
+
+    while (broker.subscribers("news") != 1)
+        std::this_thread::yield();
+
+    broker.publish("news", "five");
+
+    std::string expected = std::string("\x81\x05") + "three" + "\x81\x04" + "four" + "\x81\x04" + "five";
+    if (read_frames(client) != expected)
+        printf("FAILED replay\n");
+
+    close(client);
+    while (socket.connections() != 0)
+        std::this_thread::yield();
+
+    // the history does not reach back to the client, it only gets new ones
+    for (int i = 0; i < 20; i++)
+        broker.publish("news", "more");
+
+    client = connect_client(port, "/news?since=1");
+    while (broker.subscribers("news") != 1 || incomplete != 1)
+        std::this_thread::yield();
+
+    broker.publish("news", "last");
+
+    if (read_frames(client) != std::string("\x81\x04") + "last")
+        printf("FAILED replay older than the history\n");
+
+    close(client);
+    socket.stop();
+
+}
+
+// a client matching with several patterns gets a message once
+void test_patterns(int port) {
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(100));
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    Broker broker(socket);
+
+    socket.on_open([&](WebSocket * ws) {
+        broker.subscribe(ws, "prices.EU.*");
+        broker.subscribe(ws, "prices.#");
+    });
+
+    int client = connect_client(port);
+
+    while (broker.subscribers("prices.#") != 1)
+        std::this_thread::yield();
+
+    broker.publish("prices.EU.SAP", "1");
+    broker.publish("orders.EU.SAP", "2");
+    broker.publish("prices.US", "3");
+
+    if (read_frames(client) != std::string("\x81\x01") + "1" + "\x81\x01" + "3")
+        printf("FAILED messages of the patterns\n");
+
+    // a closed connection leaves all of its patterns
+    close(client);
+    while (socket.connections() != 0)
+        std::this_thread::yield();
+
+    broker.publish("prices.EU.SAP", "4");
+
+    if (broker.subscribers("prices.EU.*") != 0 || broker.subscribers("prices.#") != 0)
+        printf("FAILED closed connection still subscribed to a pattern\n");
+
+    socket.stop();
+
+}
+
+// a subscriber that does not read holds up neither publish() nor the others
+void test_slow_subscriber(int port) {
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(100));
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    Broker broker(socket);
+
+    socket.on_open([&](WebSocket * ws) {
+        broker.subscribe(ws, "news");
+    });
+
+    int slow = connect_client(port);
+    int fast = connect_client(port);
+
+    while (broker.subscribers("news") != 2)
+        std::this_thread::yield();
+
+    // far more than the socket buffers of the slow one take
+    std::string message(256 * 1024, 'x');
+    size_t count = 128;
+    std::atomic<bool> published = false;
+
+    std::thread publisher([&]() {
+        for (size_t i = 0; i < count; i++)
+            broker.publish("news", message);
+        published = true;
+    });
+
+    size_t expected = count * (message.size() + 10);
+    size_t received = 0;
+    char buffer[64 * 1024];
+    pollfd pfd { fast, POLLIN, 0 };
+
+    while (received < expected && poll(&pfd, 1, 2000) > 0) {
+        ssize_t bytes_read = read(fast, buffer, sizeof(buffer));
+        if (bytes_read <= 0)
+            break;
+        received += bytes_read;
+    }
+
+    if (!wait_for([&]() { return published.load(); }))
+        printf("FAILED publish() blocked by a subscriber that does not read\n");
+
+    if (received != expected)
+        printf("FAILED %zu of %zu bytes to the other subscriber\n", received, expected);
+
+    // unblocks its writer (and the publisher without one)
+    close(slow);
+    publisher.join();
+    close(fast);
+
+    socket.stop();
+
+}
+
+// the same filter of two connections is evaluated once per message
+void test_filters(int port) {
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(100));
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    Broker broker(socket);
+    std::atomic<int> opened = 0;
+
+    socket.on_open([&](WebSocket * ws) {
+        if (opened++ == 0)
+            broker.subscribe(ws, "trades.#", "symbol in {SAP, BMW} && qty > 1000");
+        else
+            broker.subscribe(ws, "trades.#", "qty>1000&&symbol in {\"BMW\",SAP}");
+    });
+
+    int first = connect_client(port);
+    while (broker.subscribers("trades.#") != 1)
+        std::this_thread::yield();
+
+    int second = connect_client(port);
+    while (broker.subscribers("trades.#") != 2)
+        std::this_thread::yield();
+
+    if (broker.filters().size() != 1)
+        printf("FAILED %zu filters instead of one\n", broker.filters().size());
+
+    broker.publish("trades.EU", "{\"symbol\":\"SAP\",\"qty\":5000}");
+    broker.publish("trades.EU", "{\"symbol\":\"SAP\",\"qty\":10}");
+    broker.publish("trades.EU", "{\"symbol\":\"VOW\",\"qty\":5000}");
+    broker.publish("trades.US", "{\"qty\":2000,\"symbol\":\"BMW\"}");
+
+    std::string expected = std::string("\x81\x1b") + "{\"symbol\":\"SAP\",\"qty\":5000}" +
+                           "\x81\x1b" + "{\"qty\":2000,\"symbol\":\"BMW\"}";
+
+    if (read_frames(first) != expected || read_frames(second) != expected)
+        printf("FAILED filtered messages\n");
+
+    if (broker.filters().evaluations() != 4)
+        printf("FAILED %llu evaluations for four messages\n", (unsigned long long) broker.filters().evaluations());
+
+    // an invalid filter subscribes nothing
+    socket.on_open([&](WebSocket * ws) {
+        if (broker.subscribe(ws, "orders", "qty >"))
+            printf("FAILED invalid filter accepted\n");
+        opened++;
+    });
+
+    int third = connect_client(port);
+    while (opened != 3)
+        std::this_thread::yield();
+
+    if (broker.subscribers("orders") != 0)
+        printf("FAILED subscribed with an invalid filter\n");
+
+    close(first);
+    close(second);
+    close(third);
+    while (socket.connections() != 0)
+        std::this_thread::yield();
+
+    // the filter goes with its last subscriber
+    broker.publish("trades.EU", "{}");
+    if (broker.filters().size() != 0)
+        printf("FAILED filter of closed connections kept\n");
+
+    socket.stop();
+
+}
+
+int main() {
+
+    test_history();
+    test_bus();
+    test_bus_take_over();
+    test_broker(TEST_PORT);
+    test_replay(TEST_PORT + 2);
+    test_patterns(TEST_PORT + 3);
+    test_filters(TEST_PORT + 4);
+    test_slow_subscriber(TEST_PORT + 5);
+
+    return 0;
+
+}
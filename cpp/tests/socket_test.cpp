@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <string>
+#include "socket/socket.h"
+#include "test_helpers.h"
+
+#define TEST_PORT 39517
+
+// waits for the close frame of the server, answers it if requested
+void expect_close_frame(int fd, bool answer) {
+
+    uint8_t frame[4];
+    pollfd pfd { fd, POLLIN, 0 };
+
+    if (poll(&pfd, 1, 2000) <= 0 || read(fd, frame, 4) != 4) {
+        printf("FAILED no close frame\n");
+        return;
+    }
+
+    if (frame[0] != 0x88 || ((frame[2] << 8) | frame[3]) != 1001)
+        printf("FAILED unexpected close frame %x %d\n", frame[0], (frame[2] << 8) | frame[3]);
+
+    if (answer) {
+        uint8_t close_frame[] = { 0x88, 0x82, 0, 0, 0, 0, 0x03, 0xe9 };
+        write(fd, close_frame, sizeof(close_frame));
+    }
+
+}
+
+void test_drain(int port, bool answer) {
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(500));
+
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    int clients[3];
+    for (int & client : clients)
+        client = connect_client(port);
+
+    while (socket.connections() != 3)
+        std::this_thread::yield();
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread stopper([&]() { socket.stop(); });
+
+    for (int client : clients)
+        expect_close_frame(client, answer);
+
+    stopper.join();
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    if (answer && duration >= 500)
+        printf("FAILED stop() waited %lldms although all clients answered\n", (long long) duration);
+
+    if (!answer && duration > 2000)
+        printf("FAILED stop() took %lldms\n", (long long) duration);
+
+    if (socket.connections() != 0 || socket.state() != Socket::Stopped)
+        printf("FAILED %zu connections left after stop()\n", socket.connections());
+
+    for (int client : clients)
+        close(client);
+
+}
+
+void test_handoff(int port) {
+
+    const char * path = "/tmp/wsserver_handoff_test.sock";
+
+    Socket old_socket(port, false, 16);
+    old_socket.set_handoff_path(path);
+    old_socket.set_handoff_grace(std::chrono::milliseconds(300));
+    old_socket.set_drain_timeout(std::chrono::milliseconds(300));
+
+    if (!old_socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    struct stat handoff {};
+    if (stat(path, &handoff) < 0 || (handoff.st_mode & 0777) != 0600)
+        printf("FAILED handoff socket mode %o\n", handoff.st_mode & 0777);
+
+    int old_client = connect_client(port);
+
+    while (old_socket.connections() != 1)
+        std::this_thread::yield();
+
+    // the port is still bound by the old process
+    Socket new_socket(port + 1000, false, 16);
+    new_socket.set_handoff_path(path);
+    new_socket.set_drain_timeout(std::chrono::milliseconds(300));
+
+    if (!new_socket.listen(true) || new_socket.port() != port) {
+        printf("FAILED take over, listening on %d\n", new_socket.port());
+        return;
+    }
+
+    int new_client = connect_client(port);
+
+    while (new_socket.connections() != 1)
+        std::this_thread::yield();
+
+    if (old_socket.connections() != 1)
+        printf("FAILED old socket lost its connection during the handoff\n");
+
+    // the old process closes its remaining client after the grace period
+    expect_close_frame(old_client, true);
+    old_socket.wait();
+
+    if (new_socket.connections() != 1 || new_socket.state() != Socket::Running)
+        printf("FAILED new socket affected by the drain\n");
+
+    new_socket.stop();
+
+    close(old_client);
+    close(new_client);
+    unlink(path);
+
+}
+
+void test_addresses(int port) {
+
+    const char * path = "/tmp/wsserver_socket_test.sock";
+
+    Socket socket(0, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(300));
+
+    std::vector<std::string> addresses = {
+        "127.0.0.1:" + std::to_string(port),
+        "[::1]:" + std::to_string(port + 1),
+        std::string("unix:") + path
+    };
+
+    for (auto & address : addresses)
+        socket.add_address(address);
+
+    if (socket.add_address("localhost:80") || socket.add_address("[::1]:99999"))
+        printf("FAILED invalid addresses accepted\n");
+
+    if (!socket.listen(true) || socket.port() != port) {
+        printf("FAILED listen on several addresses, port %d\n", socket.port());
+        return;
+    }
+
+    // one event loop serves all of them
+    std::vector<int> clients;
+    for (auto & address : addresses)
+        clients.push_back(connect_client(address));
+
+    while (socket.connections() != addresses.size())
+        std::this_thread::yield();
+
+    socket.stop();
+
+    for (int client : clients)
+        close(client);
+
+    if (access(path, F_OK) == 0)
+        printf("FAILED %s left behind by stop()\n", path);
+
+    // "*:0" dual-stack on a port chosen by the kernel
+    Socket dual_stack(0, false, 16);
+    dual_stack.add_address("*:0");
+
+    if (!dual_stack.listen(true) || dual_stack.port() <= 0) {
+        printf("FAILED dual-stack listen\n");
+        return;
+    }
+
+    int v4 = connect_client("127.0.0.1:" + std::to_string(dual_stack.port()));
+    int v6 = connect_client("[::1]:" + std::to_string(dual_stack.port()));
+
+    while (dual_stack.connections() != 2)
+        std::this_thread::yield();
+
+    dual_stack.set_drain_timeout(std::chrono::milliseconds(100));
+    dual_stack.stop();
+
+    close(v4);
+    close(v6);
+
+}
+
+// a reconnect storm against a socket admitting 20 handshakes per second
+void test_admission(int port) {
+
+    Socket socket(port, false, 64);
+    socket.set_handshake_rate(20, 2);
+    socket.set_max_pending(4);
+    socket.set_handshake_timeout(std::chrono::milliseconds(400));
+    socket.set_drain_timeout(std::chrono::milliseconds(100));
+
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    Address::Endpoint endpoint;
+    Address::parse("127.0.0.1:" + std::to_string(port), endpoint);
+
+    int clients[10];
+    for (int & client : clients) {
+        client = ::socket(AF_INET, SOCK_STREAM, 0);
+        connect(client, endpoint.addr(), endpoint.length);
+        write(client, handshake_request, strlen(handshake_request));
+    }
+
+    int upgraded = 0, rejected = 0;
+    char buffer[512];
+
+    for (int client : clients) {
+        pollfd pfd { client, POLLIN, 0 };
+        if (poll(&pfd, 1, 1000) <= 0) {
+            printf("FAILED client neither upgraded nor rejected\n");
+            continue;
+        }
+        ssize_t bytes_read = read(client, buffer, sizeof(buffer));
+        if (bytes_read > 12 && strncmp(buffer, "HTTP/1.1 101", 12) == 0)
+            upgraded++;
+        else
+            rejected++;
+    }
+
+    // 2 at once, the queue of 4 within the handshake timeout
+    if (upgraded < 2 || upgraded > 2 + 4 + 2 || rejected == 0 || rejected != (int) socket.rejected())
+        printf("FAILED %d upgraded, %d rejected (%zu)\n", upgraded, rejected, socket.rejected());
+
+    socket.stop();
+
+    for (int client : clients)
+        close(client);
+
+    // the second client waits longer than the handshake timeout for a token
+    Socket slow(port + 1, false, 64);
+    slow.set_handshake_rate(0.1, 1);
+    slow.set_handshake_timeout(std::chrono::milliseconds(300));
+    slow.set_drain_timeout(std::chrono::milliseconds(100));
+
+    if (!slow.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    int first = connect_client(port + 1);
+
+    int second = ::socket(AF_INET, SOCK_STREAM, 0);
+    Address::parse("127.0.0.1:" + std::to_string(port + 1), endpoint);
+    connect(second, endpoint.addr(), endpoint.length);
+    write(second, handshake_request, strlen(handshake_request));
+
+    auto start = std::chrono::steady_clock::now();
+    pollfd pfd { second, POLLIN, 0 };
+    // reset, the request was never read
+    if (poll(&pfd, 1, 2000) <= 0 || read(second, buffer, sizeof(buffer)) > 0 || slow.rejected() != 1)
+        printf("FAILED queued client was not closed\n");
+
+    if (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(250))
+        printf("FAILED queued client closed before the handshake timeout\n");
+
+    slow.stop();
+
+    close(first);
+    close(second);
+
+}
+
+int get_option(int fd, int level, int name) {
+    int value = -1;
+    socklen_t size = sizeof(value);
+    getsockopt(fd, level, name, &value, &size);
+    return value;
+}
+
+void test_tuning(int port) {
+
+    const char * path = "/tmp/wsserver_tuning_test.sock";
+
+    Socket socket(0, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(100));
+
+    if (socket.set_tuning("fastest"))
+        printf("FAILED unknown preset accepted\n");
+
+    if (!socket.set_tuning("low-latency") || !socket.tuning().no_delay)
+        printf("FAILED low-latency preset\n");
+
+    Tuning::Options tuning = socket.tuning();
+    tuning.send_buffer = 256 * 1024;
+    socket.set_tuning(tuning);
+
+    socket.add_address("127.0.0.1:" + std::to_string(port));
+    socket.add_address(std::string("unix:") + path);
+
+    std::vector<int> accepted;
+    std::mutex mutex;
+    socket.on_open([&](WebSocket * ws) {
+        std::lock_guard<std::mutex> lock(mutex);
+        accepted.push_back(ws->connection());
+    });
+
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    int tcp_client = connect_client(port);
+    while (socket.connections() != 1)
+        std::this_thread::yield();
+
+    int unix_client = connect_client(std::string("unix:") + path);
+    while (socket.connections() != 2)
+        std::this_thread::yield();
+
+    // copied from the listener by the kernel
+    int tcp = accepted[0];
+    if (get_option(tcp, IPPROTO_TCP, TCP_NODELAY) != 1 ||
+        get_option(tcp, SOL_SOCKET, SO_KEEPALIVE) != 1 ||
+        get_option(tcp, IPPROTO_TCP, TCP_KEEPIDLE) != 60 ||
+        get_option(tcp, IPPROTO_TCP, TCP_NOTSENT_LOWAT) != 16 * 1024)
+        printf("FAILED accepted TCP connection not tuned\n");
+
+    // the kernel doubles the value for its bookkeeping
+    if (get_option(tcp, SOL_SOCKET, SO_SNDBUF) != 2 * 256 * 1024 ||
+        get_option(accepted[1], SOL_SOCKET, SO_SNDBUF) != 2 * 256 * 1024)
+        printf("FAILED send buffer not set\n");
+
+    socket.stop();
+
+    close(tcp_client);
+    close(unix_client);
+
+}
+
+int main() {
+
+    test_drain(TEST_PORT, true);
+    test_drain(TEST_PORT + 1, false);
+    test_handoff(TEST_PORT + 2);
+    test_addresses(TEST_PORT + 3);
+    test_admission(TEST_PORT + 5);
+    test_tuning(TEST_PORT + 7);
+
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <thread>
+
+#include "socket/address.h"
+#include "websocket/websocket.h"
+#include "event/task.h"
+
+// fixtures shared by the tests
+
+// the opening handshake of rfc6455 section-1.3
+inline const char * handshake_request =
+    "GET /chat HTTP/1.1\r\n"
+    "Host: server.example.com\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n\r\n";
+
+// the same handshake offering subprotocols, none if protocols is empty
+inline std::string handshake_request_with(const std::string & protocols, const std::string & resource = "/chat") {
+
+    std::string request =
+        "GET " + resource + " HTTP/1.1\r\n"
+        "Host: server.example.com\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n";
+
+    if (!protocols.empty())
+        request += "Sec-WebSocket-Protocol: " + protocols + "\r\n";
+
+    return request + "Sec-WebSocket-Version: 13\r\n\r\n";
+
+}
+
+inline std::span<const uint8_t> bytes(const std::string & text) {
+    return { (const uint8_t *) text.data(), text.size() };
+}
+
+// a frame of the client, masked with a zero key so the payload is sent as is
+inline std::string client_frame(uint8_t opcode, const std::string & payload, bool fin = true) {
+
+    std::string frame;
+    frame += (char) ((fin ? 0x80 : 0) | opcode);
+
+    size_t size = payload.size();
+
+    if (size > 0xffff) {
+        frame += (char) (0x80 | 127);
+        for (int i = 7; i >= 0; i--)
+            frame += (char) (size >> (i * 8));
+    } else if (size > 125) {
+        frame += (char) (0x80 | 126);
+        frame += (char) (size >> 8);
+        frame += (char) size;
+    } else {
+        frame += (char) (0x80 | size);
+    }
+
+    frame.append(4, 0);
+    return frame + payload;
+
+}
+
+// a frame of the server (unmasked) with up to 125 bytes of payload
+inline std::string server_frame(uint8_t opcode, const std::string & payload) {
+
+    std::string frame;
+    frame += (char) (0x80 | opcode);
+    frame += (char) payload.size();
+    return frame + payload;
+
+}
+
+// reads for up to 2s until expected bytes arrived, then until the socket
+// has been quiet for 200ms or is closed
+inline std::string read_available(int fd, size_t expected = 1) {
+
+    std::string data;
+    char buffer[4096];
+    pollfd pfd { fd, POLLIN, 0 };
+
+    while (poll(&pfd, 1, expected > data.size() ? 2000 : 200) > 0) {
+        ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+        if (bytes_read <= 0)
+            break;
+        data.append(buffer, bytes_read);
+    }
+
+    return data;
+
+}
+
+// a client connected to address (see Address::parse()) past the handshake,
+// only the response is read, the frames behind it are left in the socket
+inline int connect_client(const std::string & address, const std::string & resource = "/chat") {
+
+    Address::Endpoint endpoint;
+    Address::parse(address, endpoint);
+
+    int fd = socket(endpoint.family(), SOCK_STREAM, 0);
+
+    if (connect(fd, endpoint.addr(), endpoint.length) < 0) {
+        printf("FAILED connect to %s errno %d\n", address.c_str(), errno);
+        close(fd);
+        return -1;
+    }
+
+    std::string request = handshake_request_with("", resource);
+    write(fd, request.data(), request.size());
+
+    std::string response;
+    char byte;
+    pollfd pfd { fd, POLLIN, 0 };
+    while (!response.ends_with("\r\n\r\n")) {
+        if (poll(&pfd, 1, 1000) <= 0 || read(fd, &byte, 1) <= 0) {
+            printf("FAILED no handshake response\n");
+            break;
+        }
+        response += byte;
+    }
+
+    return fd;
+
+}
+
+inline int connect_client(int port, const std::string & resource = "/chat") {
+    return connect_client("127.0.0.1:" + std::to_string(port), resource);
+}
+
+// echoes the messages of a connection, counting them if asked
+inline Task echo_messages(WebSocket & ws, int * received, bool * closed) {
+
+    while (auto message = co_await ws.receive()) {
+        if (received != nullptr)
+            (*received)++;
+        co_await ws.send(message->data());
+    }
+
+    if (closed != nullptr)
+        *closed = true;
+
+}
+
+// the handler of Socket::on_connection()
+inline Task echo(WebSocket & ws) {
+    return echo_messages(ws, nullptr, nullptr);
+}
+
+// waits up to timeout for done()
+template <typename F>
+bool wait_for(F done, std::chrono::milliseconds timeout = std::chrono::seconds(2)) {
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!done() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return done();
+
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <string>
+#include "socket/socket.h"
+#include "test_helpers.h"
+
+#define TEST_PORT 39530
+
+#if WITH_TLS
+
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+
+const char * certificate_file = "/tmp/wsserver_tls_test_cert.pem";
+const char * key_file = "/tmp/wsserver_tls_test_key.pem";
+
+// same as ./build.sh cert, a self-signed P-256 certificate for localhost
+bool create_certificate() {
+
+    EVP_PKEY * key = EVP_EC_gen("P-256");
+    X509 * cert = X509_new();
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+
+    X509_NAME * name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) "localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    FILE * cert_out = fopen(certificate_file, "w");
+    FILE * key_out = fopen(key_file, "w");
+    bool written = cert_out != nullptr && key_out != nullptr &&
+                   PEM_write_X509(cert_out, cert) &&
+                   PEM_write_PrivateKey(key_out, key, nullptr, nullptr, 0, nullptr, nullptr);
+
+    if (cert_out != nullptr) fclose(cert_out);
+    if (key_out != nullptr) fclose(key_out);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+
+    return written;
+
+}
+
+struct Client {
+    int fd = -1;
+    SSL * ssl = nullptr;
+};
+
+// TLS handshake with the server, resumes session if given
+Client connect_client(SSL_CTX * ctx, int port, SSL_SESSION * session) {
+
+    Client client;
+    client.fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    if (connect(client.fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        printf("FAILED connect errno %d\n", errno);
+        return client;
+    }
+
+    client.ssl = SSL_new(ctx);
+    SSL_set_fd(client.ssl, client.fd);
+    if (session != nullptr)
+        SSL_set_session(client.ssl, session);
+
+    if (SSL_connect(client.ssl) != 1)
+        printf("FAILED TLS handshake\n");
+
+    return client;
+
+}
+
+// reads until the expected number of bytes arrived or 1s passed
+std::string read_tls(Client & client, size_t expected) {
+
+    std::string data;
+    char buffer[512];
+    pollfd pfd { client.fd, POLLIN, 0 };
+
+    while (data.size() < expected && (SSL_pending(client.ssl) > 0 || poll(&pfd, 1, 1000) > 0)) {
+        int bytes_read = SSL_read(client.ssl, buffer, sizeof(buffer));
+        if (bytes_read <= 0)
+            break;
+        data.append(buffer, bytes_read);
+    }
+
+    return data;
+
+}
+
+// upgrade, one masked "Hello" frame, the echo of the server and the close handshake
+void talk(Client & client) {
+
+    SSL_write(client.ssl, handshake_request, strlen(handshake_request));
+
+    std::string response = read_tls(client, 1);
+    if (response.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == std::string::npos) {
+        printf("FAILED handshake response: %s\n", response.c_str());
+        return;
+    }
+
+    uint8_t frame[] = { 0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58 };
+    SSL_write(client.ssl, frame, sizeof(frame));
+
+    std::string echo = read_tls(client, 7);
+    if (echo.size() != 7 || echo.substr(2) != "Hello")
+        printf("FAILED echo over TLS: %zu bytes\n", echo.size());
+
+    uint8_t close_frame[] = { 0x88, 0x82, 0, 0, 0, 0, 0x03, 0xe8 };
+    SSL_write(client.ssl, close_frame, sizeof(close_frame));
+
+    std::string answer = read_tls(client, 4);
+    if (answer.size() < 2 || (uint8_t) answer[0] != 0x88)
+        printf("FAILED no close frame over TLS\n");
+
+}
+
+void disconnect(Client & client) {
+    // without close_notify OpenSSL marks the session as not resumable
+    SSL_shutdown(client.ssl);
+    SSL_free(client.ssl);
+    close(client.fd);
+}
+
+void test_tls(int port, bool event_loop) {
+
+    Socket socket(port, true, 16);
+    socket.set_certificate(certificate_file, key_file);
+    socket.set_drain_timeout(std::chrono::milliseconds(300));
+
+    if (event_loop) {
+        socket.on_connection(echo);
+    } else {
+        socket.on_open([](WebSocket * ws) {
+            ws->on_message([ws](std::string message) {
+                ws->send_message(message);
+            });
+        });
+    }
+
+    if (!socket.listen(true)) {
+        printf("FAILED listen with TLS\n");
+        return;
+    }
+
+    SSL_CTX * ctx = SSL_CTX_new(TLS_client_method());
+
+    Client first = connect_client(ctx, port, nullptr);
+    talk(first);
+
+    // the session ticket arrives after the handshake
+    SSL_SESSION * session = SSL_get1_session(first.ssl);
+    disconnect(first);
+
+    Client second = connect_client(ctx, port, session);
+    if (!SSL_session_reused(second.ssl))
+        printf("FAILED TLS session was not resumed\n");
+    talk(second);
+    disconnect(second);
+
+    // a plain text client must not get a WebSocket
+    Client plain;
+    plain.fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    connect(plain.fd, (sockaddr *) &addr, sizeof(addr));
+    write(plain.fd, handshake_request, strlen(handshake_request));
+
+    char buffer[512];
+    pollfd pfd { plain.fd, POLLIN, 0 };
+    if (poll(&pfd, 1, 1000) > 0 && read(plain.fd, buffer, sizeof(buffer)) > 0 &&
+        std::string(buffer, 12).find("HTTP/1.1 101") != std::string::npos)
+        printf("FAILED plain text upgrade on a TLS socket\n");
+    close(plain.fd);
+
+    SSL_SESSION_free(session);
+    SSL_CTX_free(ctx);
+
+    socket.stop();
+
+    if (socket.connections() != 0)
+        printf("FAILED %zu TLS connections left after stop()\n", socket.connections());
+
+}
+
+int main() {
+
+    if (!create_certificate()) {
+        printf("FAILED could not write the test certificate\n");
+        return 1;
+    }
+
+    test_tls(TEST_PORT, false);
+    test_tls(TEST_PORT + 1, true);
+
+    return 0;
+
+}
+
+#else
+
+int main() {
+    printf("TLS support was not compiled in, skipped\n");
+    return 0;
+}
+
+#endif
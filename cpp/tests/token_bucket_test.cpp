@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include "ratelimit/token_bucket.h"
+
+using namespace std::chrono;
+
+int main() {
+
+    auto now = steady_clock::now();
+
+    TokenBucket unlimited;
+    for (int i = 0; i < 1000; i++)
+        if (!unlimited.try_take(1, now))
+            printf("FAILED unlimited bucket denied\n");
+
+    // 10 per second, bursts of 3
+    TokenBucket bucket(10, 3);
+
+    int taken = 0;
+    while (bucket.try_take(1, now))
+        taken++;
+
+    if (taken != 3)
+        printf("FAILED burst of %d instead of 3\n", taken);
+
+    auto wait = bucket.wait_time(1, now);
+    if (wait <= milliseconds(0) || wait > milliseconds(100))
+        printf("FAILED wait time %lldns\n", (long long) wait.count());
+
+    if (bucket.try_take(1, now + milliseconds(50)))
+        printf("FAILED token after 50ms\n");
+
+    if (!bucket.try_take(1, now + milliseconds(101)))
+        printf("FAILED no token after 100ms\n");
+
+    // idle time refills up to the burst only
+    taken = 0;
+    while (bucket.try_take(1, now + seconds(10)))
+        taken++;
+
+    if (taken != 3)
+        printf("FAILED refilled %d instead of 3\n", taken);
+
+    if (bucket.wait_time(2, now + seconds(10)) < milliseconds(199))
+        printf("FAILED wait time for 2 tokens\n");
+
+    return 0;
+
+}
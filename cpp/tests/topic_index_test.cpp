@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "pubsub/topic_index.h"
+
+std::string join(const std::vector<uint64_t> & ids) {
+    std::string text;
+    for (uint64_t id : ids)
+        text += (text.empty() ? "" : ",") + std::to_string(id);
+    return text;
+}
+
+void expect(const TopicIndex & index, const char * topic, const char * expected) {
+
+    std::vector<uint64_t> ids;
+    index.match(topic, ids);
+
+    if (join(ids) != expected)
+        printf("FAILED %s matched %s instead of %s\n", topic, join(ids).c_str(), expected);
+
+}
+
+void test_wildcards() {
+
+    TopicIndex index;
+
+    index.subscribe("prices.EU.SAP", 1);
+    index.subscribe("prices.EU.*", 2);
+    index.subscribe("prices.*.SAP", 3);
+    index.subscribe("orders.#", 4);
+    index.subscribe("#", 5);
+    index.subscribe("orders.#.done", 6);
+    index.subscribe("*", 7);
+
+    expect(index, "prices.EU.SAP", "1,2,3,5");
+    expect(index, "prices.US.SAP", "3,5");
+    expect(index, "prices.EU", "5");
+    expect(index, "prices.EU.SAP.bid", "5");
+    expect(index, "orders", "4,5,7");
+    expect(index, "orders.new.42", "4,5");
+    expect(index, "orders.done", "4,5,6");
+    expect(index, "orders.new.42.done", "4,5,6");
+    expect(index, "news", "5,7");
+
+    // several patterns of one connection, the message goes once
+    index.subscribe("prices.#", 2);
+    expect(index, "prices.EU.SAP", "1,2,3,5");
+
+    if (index.subscribe("", 1) || index.subscribe("a..b", 1) || index.subscribe("a.", 1))
+        printf("FAILED invalid patterns accepted\n");
+
+    expect(index, "", "");
+
+}
+
+void test_subscribers() {
+
+    TopicIndex index;
+
+    index.subscribe("a.b.c", 1);
+    index.subscribe("a.b.c", 2);
+    index.subscribe("a.b.c", 2);
+    index.subscribe("a.*.c", 3);
+
+    if (index.subscribers("a.b.c") != 2 || index.subscribers("a.*.c") != 1 || index.subscribers("a.b") != 0 ||
+        index.subscribers("a.#") != 0 || index.subscribers("a.b.c.d") != 0)
+        printf("FAILED subscribers of a pattern\n");
+
+    if (!index.unsubscribe("a.b.c", 2) || index.unsubscribe("a.b.c", 2) || index.unsubscribe("x.y", 1))
+        printf("FAILED unsubscribe result\n");
+
+    expect(index, "a.b.c", "1,3");
+
+}
+
+// a chain of words is one node, split where patterns part
+void test_compression() {
+
+    TopicIndex index;
+
+    index.subscribe("a.b.c.d.e", 1);
+    if (index.nodes() != 2)
+        printf("FAILED %zu nodes for one chain\n", index.nodes());
+
+    index.subscribe("a.b.x", 2);
+    // root, "a.b", "c.d.e", "x"
+    if (index.nodes() != 4)
+        printf("FAILED %zu nodes after a split\n", index.nodes());
+
+    index.subscribe("a.b", 3);
+    expect(index, "a.b", "3");
+    expect(index, "a.b.c.d.e", "1");
+    expect(index, "a.b.x", "2");
+    expect(index, "a.b.c", "");
+
+    // the emptied nodes go, the chain is joined again
+    index.unsubscribe("a.b.x", 2);
+    index.unsubscribe("a.b", 3);
+    if (index.nodes() != 2)
+        printf("FAILED %zu nodes after unsubscribing\n", index.nodes());
+
+    index.unsubscribe("a.b.c.d.e", 1);
+    if (index.nodes() != 1)
+        printf("FAILED %zu nodes of an empty index\n", index.nodes());
+
+    expect(index, "a.b.c.d.e", "");
+
+}
+
+// many subscribers of one pattern span several chunks
+void test_chunks() {
+
+    TopicIndex index;
+    size_t count = 10 * TOPIC_CHUNK_SIZE;
+
+    // out of order, the chunks split in the middle as well as at the end
+    for (size_t i = 0; i < count; i++)
+        index.subscribe("chat", (i * 7919) % count + 1, i % 3);
+
+    for (uint64_t id = 1; id <= count; id += 2)
+        index.unsubscribe("chat", id);
+
+    index.subscribe("chat", 2, 42);
+
+    std::vector<TopicIndex::Subscription> subscriptions;
+    index.match("chat", subscriptions);
+
+    bool sorted = subscriptions.size() == count / 2;
+    for (size_t i = 0; sorted && i < subscriptions.size(); i++)
+        sorted = subscriptions[i].id == 2 * (i + 1);
+
+    if (!sorted || index.subscribers("chat") != count / 2 || subscriptions[0].filter != 42)
+        printf("FAILED %zu subscribers in chunks\n", subscriptions.size());
+
+    for (uint64_t id = 2; id <= count; id += 2)
+        index.unsubscribe("chat", id);
+
+    if (index.subscribers("chat") != 0 || index.nodes() != 1)
+        printf("FAILED chunks left after unsubscribing\n");
+
+}
+
+// publishers match while the subscriptions change
+void test_concurrent() {
+
+    TopicIndex index;
+    index.subscribe("feed.#", 1);
+
+    std::atomic<bool> done = false;
+    std::atomic<int> missing = 0;
+
+    std::thread reader([&]() {
+        std::vector<uint64_t> ids;
+        while (!done) {
+            index.match("feed.EU.SAP", ids);
+            if (ids.empty() || ids.front() != 1)
+                missing++;
+        }
+    });
+
+    for (int round = 0; round < 20; round++) {
+        for (uint64_t id = 2; id < 200; id++)
+            index.subscribe("feed.*." + std::to_string(id % 13), id);
+        for (uint64_t id = 2; id < 200; id++)
+            index.unsubscribe("feed.*." + std::to_string(id % 13), id);
+    }
+
+    done = true;
+    reader.join();
+
+    if (missing != 0)
+        printf("FAILED a stable subscription was missed %d times\n", missing.load());
+
+    if (index.nodes() != 3)
+        printf("FAILED %zu nodes left\n", index.nodes());
+
+}
+
+int main() {
+
+    test_wildcards();
+    test_subscribers();
+    test_compression();
+    test_chunks();
+    test_concurrent();
+
+    return 0;
+
+}
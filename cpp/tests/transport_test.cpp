@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "socket/socket.h"
+#include "transport/memory_transport.h"
+#include "test_helpers.h"
+
+// reads until size bytes arrived or the other end is closed
+std::string read_bytes(MemoryTransport & transport, int connection, size_t size) {
+
+    std::string data;
+    char buffer[512];
+
+    while (data.size() < size) {
+        iovec iov { buffer, std::min(sizeof(buffer), size - data.size()) };
+        ssize_t bytes_read = transport.read(connection, &iov, 1);
+        if (bytes_read <= 0)
+            break;
+        data.append(buffer, bytes_read);
+    }
+
+    return data;
+
+}
+
+void test_pipe() {
+
+    MemoryTransport transport(2, false);
+
+    auto [a, b] = transport.pair();
+    auto [c, d] = transport.pair();
+
+    if (a < 0 || c < 0 || transport.pair().first != -1)
+        printf("FAILED pairs\n");
+
+    char buffer[4];
+    iovec iov { buffer, sizeof(buffer) };
+
+    if (transport.read(a, &iov, 1) != -1 || errno != EAGAIN)
+        printf("FAILED read without bytes\n");
+
+    // the pairs are independent
+    transport.send(a, bytes("hello"));
+    transport.send(c, bytes("other"));
+
+    if (transport.available(b) != 5 || transport.available(a) != 0)
+        printf("FAILED available\n");
+
+    // scattered like readv()
+    char rest[8];
+    iovec parts[2] = { { buffer, 2 }, { rest, sizeof(rest) } };
+    if (transport.read(b, parts, 2) != 5 || std::string(buffer, 2) + std::string(rest, 3) != "hello")
+        printf("FAILED scattered read\n");
+
+    if (transport.read(d, &iov, 1) != 4 || std::string(buffer, 4) != "othe")
+        printf("FAILED read of the second pair\n");
+
+    // the rest before the end of the stream
+    transport.close(c);
+    if (transport.read(d, &iov, 1) != 1 || transport.read(d, &iov, 1) != 0)
+        printf("FAILED end of the stream\n");
+
+    if (transport.send(d, bytes("x")) != -1 || errno != EPIPE)
+        printf("FAILED write to a closed end\n");
+
+}
+
+// the whole stack on the memory transport, without a listener
+void test_serve() {
+
+    Socket socket(0, false, 4);
+    MemoryTransport transport;
+
+    socket.on_open([](WebSocket * ws) {
+        ws->on_message([ws](std::string message) {
+            ws->send_message("echo " + message);
+        });
+    });
+
+    auto [server, client] = transport.pair();
+    socket.serve(&transport, server);
+
+    transport.send(client, bytes(handshake_request));
+
+    // byte by byte, the frames behind the response stay in the pipe
+    std::string response;
+    while (!response.ends_with("\r\n\r\n")) {
+        std::string byte = read_bytes(transport, client, 1);
+        if (byte.empty())
+            break;
+        response += byte;
+    }
+    if (response.rfind("HTTP/1.1 101", 0) != 0 || !response.ends_with("\r\n\r\n"))
+        printf("FAILED handshake: %s\n", response.c_str());
+
+    if (socket.connections() != 1)
+        printf("FAILED %zu connections\n", socket.connections());
+
+    transport.send(client, bytes(client_frame(DataFrame::TextFrame, "hi")));
+
+    if (read_bytes(transport, client, 9) != std::string("\x81\x07") + "echo hi")
+        printf("FAILED echo\n");
+
+    transport.send(client, bytes(client_frame(DataFrame::ConectionClose, "\x03\xe8")));
+
+    // the close frame, then the end of the stream
+    if (read_bytes(transport, client, 100) != "\x88\x02\x03\xe8")
+        printf("FAILED closing handshake\n");
+
+    while (socket.connections() != 0)
+        std::this_thread::yield();
+
+    transport.close(client);
+
+}
+
+int main() {
+
+    test_pipe();
+    test_serve();
+
+    return 0;
+
+}
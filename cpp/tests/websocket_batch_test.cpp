@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <string>
+#include "websocket/websocket.h"
+#include "event/task.h"
+#include "test_helpers.h"
+
+// SOCK_SEQPACKET keeps the boundaries of the writes, every read returns what
+// the server sent with one syscall
+
+// one write of the server, empty after 2s
+std::string read_write(int fd) {
+
+    char buffer[64 * 1024];
+    pollfd pfd { fd, POLLIN, 0 };
+
+    if (poll(&pfd, 1, 2000) <= 0)
+        return "";
+
+    ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+    return std::string(buffer, std::max<ssize_t>(bytes_read, 0));
+
+}
+
+// ten messages and a ping with one write
+void send_pipelined(int fd, std::string & expected) {
+
+    std::string frames;
+
+    for (int i = 0; i < 10; i++) {
+        frames += client_frame(DataFrame::TextFrame, "message " + std::to_string(i));
+        expected += server_frame(DataFrame::TextFrame, "message " + std::to_string(i));
+    }
+
+    frames += client_frame(DataFrame::Ping, "");
+    expected += server_frame(DataFrame::Pong, "");
+
+    write(fd, frames.data(), frames.size());
+
+}
+
+void test_listen() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds);
+
+    WebSocket ws;
+    ws.reset(fds[0], 1);
+    ws.on_message([&](std::string message) { ws.send_message(message); });
+    std::thread reader([&]() { ws.listen(); });
+
+    write(fds[1], handshake_request, strlen(handshake_request));
+    if (read_write(fds[1]).find("101") == std::string::npos)
+        printf("FAILED handshake\n");
+
+    std::string expected;
+    send_pipelined(fds[1], expected);
+
+    std::string answer = read_write(fds[1]);
+    if (answer != expected)
+        printf("FAILED %zu of %zu bytes of the answers with one write\n", answer.size(), expected.size());
+
+    // the close frame leaves before the connection is closed
+    std::string frames = client_frame(DataFrame::TextFrame, "last");
+    frames += client_frame(DataFrame::ConectionClose, "\x03\xe8");
+    write(fds[1], frames.data(), frames.size());
+
+    answer = read_write(fds[1]);
+    if (answer != server_frame(DataFrame::TextFrame, "last") + server_frame(DataFrame::ConectionClose, "\x03\xe8"))
+        printf("FAILED answer and close frame not sent together\n");
+
+    reader.join();
+    close(fds[1]);
+
+}
+
+void test_event_loop() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds);
+
+    EventLoop loop;
+    WebSocket ws(fds[0]);
+
+    ws.attach(&loop, [&]() { loop.stop(); });
+    echo(ws).start();
+
+    std::thread loop_thread([&]() { loop.run(); });
+
+    write(fds[1], handshake_request, strlen(handshake_request));
+    read_write(fds[1]);
+
+    std::string expected;
+    send_pipelined(fds[1], expected);
+
+    std::string answer = read_write(fds[1]);
+    if (answer != expected)
+        printf("FAILED %zu of %zu bytes of the coroutine answers with one write\n", answer.size(), expected.size());
+
+    std::string close_frame = client_frame(DataFrame::ConectionClose, "\x03\xe8");
+    write(fds[1], close_frame.data(), close_frame.size());
+
+    loop_thread.join();
+    close(fds[1]);
+
+}
+
+// a message larger than the read buffer is read in one go (READ_SPILL_SIZE)
+void test_large_read() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds);
+
+    int size = 256 * 1024;
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    WebSocket ws;
+    ws.reset(fds[0], 1);
+
+    size_t received = 0;
+    ws.on_message([&](std::string message) { received = message.size(); });
+    std::thread reader([&]() { ws.listen(); });
+
+    write(fds[1], handshake_request, strlen(handshake_request));
+    read_write(fds[1]);
+
+    // a record is read completely or truncated, never in two reads
+    std::string payload(20000, 'a');
+    std::string frame = { (char) 0x81, (char) (0x80 | 126), (char) (payload.size() >> 8), (char) (payload.size() & 0xff) };
+    frame.append(4, 0);
+    frame += payload;
+    write(fds[1], frame.data(), frame.size());
+
+    std::string close_frame = client_frame(DataFrame::ConectionClose, "\x03\xe8");
+    write(fds[1], close_frame.data(), close_frame.size());
+
+    reader.join();
+    close(fds[1]);
+
+    if (received != payload.size())
+        printf("FAILED large message read with %zu bytes\n", received);
+
+}
+
+std::vector<uint8_t> text_frame(const std::string & text) {
+    return DataFrame::get_text_frame(text).get_raw_frame();
+}
+
+// a client that does not read only gets the latest value of each key
+void test_conflation() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    int size = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    EventLoop loop;
+    WebSocket ws(fds[0]);
+
+    ws.attach(&loop, [&]() { loop.stop(); });
+    echo(ws).start();
+
+    std::thread loop_thread([&]() { loop.run(); });
+
+    write(fds[1], handshake_request, strlen(handshake_request));
+    std::string response;
+    char byte;
+    while (!response.ends_with("\r\n\r\n") && read(fds[1], &byte, 1) == 1)
+        response += byte;
+
+    // more than the kernel takes
+    std::vector<uint8_t> filler = text_frame(std::string(100, 'f'));
+    std::string expected;
+    for (int i = 0; i < 10000; i++) {
+        ws.send_raw(filler);
+        expected.append(filler.begin(), filler.end());
+    }
+
+    for (const char * update : { "A1", "B1", "A2", "A3" }) {
+        std::vector<uint8_t> frame = text_frame(update);
+        ws.send_latest(std::string(1, update[0]), frame);
+    }
+
+    for (auto & frame : { text_frame("A3"), text_frame("B1") })
+        expected.append(frame.begin(), frame.end());
+
+    std::string received;
+    char buffer[64 * 1024];
+    pollfd pfd { fds[1], POLLIN, 0 };
+    while (received.size() < expected.size() && poll(&pfd, 1, 2000) > 0) {
+        ssize_t bytes_read = read(fds[1], buffer, sizeof(buffer));
+        if (bytes_read <= 0)
+            break;
+        received.append(buffer, bytes_read);
+    }
+
+    if (received != expected || ws.conflated() != 2)
+        printf("FAILED conflated %lu, %zu of %zu bytes\n", ws.conflated(), received.size(), expected.size());
+
+    // without congestion every value is sent
+    ws.send_latest("A", text_frame("A4"));
+    std::vector<uint8_t> frame = text_frame("A4");
+    if (read_write(fds[1]) != std::string(frame.begin(), frame.end()))
+        printf("FAILED latest value of a fast client\n");
+
+    std::string close_frame = client_frame(DataFrame::ConectionClose, "\x03\xe8");
+    write(fds[1], close_frame.data(), close_frame.size());
+
+    loop_thread.join();
+    close(fds[1]);
+
+}
+
+int main() {
+
+    test_listen();
+    test_event_loop();
+    test_large_read();
+    test_conflation();
+
+    return 0;
+
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <string>
+#include "socket/socket.h"
+#include "websocket/websocket_client.h"
+#include "test_helpers.h"
+
+#define TEST_PORT 39580
+
+void test_masking_key() {
+
+    std::set<uint32_t> keys;
+    for (int i = 0; i < 1000; i++)
+        keys.insert(WebSocketClient::masking_key());
+
+    if (keys.size() < 990)
+        printf("FAILED %zu distinct masking keys of 1000\n", keys.size());
+
+}
+
+void test_echo(int port) {
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(500));
+    socket.on_open([](WebSocket * ws) {
+        ws->on_message([ws](std::string message) {
+            ws->send_message("echo " + message);
+        });
+    });
+
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    EventLoop loop;
+    WebSocketClient client(&loop);
+
+    std::mutex mutex;
+    std::vector<std::string> messages;
+    std::atomic<bool> opened = false;
+    std::atomic<int> closed = 0;
+
+    client.on_open([&]() {
+        opened = true;
+        client.send("after the upgrade");
+    });
+    client.on_message([&](const WebSocket::Message & message) {
+        std::lock_guard<std::mutex> lock(mutex);
+        messages.emplace_back(message.text());
+        if (messages.size() == 3)
+            client.close(1000);
+    });
+    client.on_close([&](uint16_t statuscode) {
+        closed = statuscode;
+    });
+
+    if (!client.connect("127.0.0.1:" + std::to_string(port), "/feed"))
+        printf("FAILED connect\n");
+
+    // pipelined behind the upgrade request
+    client.send("with the request");
+    std::vector<uint8_t> large(100000, 'x');
+    client.send(large, DataFrame::TextFrame);
+
+    std::thread thread([&]() { loop.run(); });
+
+    if (!wait_for([&]() { return closed != 0; }))
+        printf("FAILED connection not closed\n");
+
+    loop.stop();
+    thread.join();
+
+    if (!opened)
+        printf("FAILED on_open not called\n");
+
+    if (closed != 1000)
+        printf("FAILED closed with %d\n", closed.load());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> expected = { "echo with the request", "echo " + std::string(100000, 'x'), "echo after the upgrade" };
+    if (messages != expected)
+        printf("FAILED %zu messages\n", messages.size());
+
+    socket.stop();
+
+}
+
+// the close frame of the server is answered with its status code
+void test_server_close(int port) {
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(500));
+
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    EventLoop loop;
+    WebSocketClient client(&loop);
+    std::atomic<bool> opened = false;
+    std::atomic<int> closed = 0;
+
+    client.on_open([&]() { opened = true; });
+    client.on_close([&](uint16_t statuscode) { closed = statuscode; });
+    client.connect("127.0.0.1:" + std::to_string(port));
+
+    std::thread thread([&]() { loop.run(); });
+
+    if (!wait_for([&]() { return opened.load(); }))
+        printf("FAILED not open\n");
+
+    // waits for the answer of the client
+    socket.stop();
+
+    if (!wait_for([&]() { return closed != 0; }) || closed != 1001)
+        printf("FAILED closed with %d instead of 1001\n", closed.load());
+
+    loop.stop();
+    thread.join();
+
+}
+
+// continuations beyond MAX_MESSAGE_SIZE close the connection before they are
+// buffered
+void test_message_limit(int port) {
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(100));
+    socket.on_open([](WebSocket * ws) {
+        ws->on_handshake([ws]() {
+            std::vector<uint8_t> fragment;
+            for (size_t i = 0; i <= MAX_MESSAGE_SIZE / (1024 * 1024); i++) {
+                fragment.clear();
+                DataFrame::append_header(fragment, false, i == 0 ? DataFrame::TextFrame : DataFrame::ContinuationFrame, 1024 * 1024);
+                fragment.resize(fragment.size() + 1024 * 1024, 'x');
+                ws->send_raw(fragment);
+            }
+        });
+    });
+
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    EventLoop loop;
+    WebSocketClient client(&loop);
+    std::atomic<int> closed = 0;
+
+    client.on_message([](const WebSocket::Message &) { printf("FAILED message over the limit\n"); });
+    client.on_close([&](uint16_t statuscode) { closed = statuscode; });
+    client.connect("127.0.0.1:" + std::to_string(port));
+
+    std::thread thread([&]() { loop.run(); });
+
+    if (!wait_for([&]() { return closed != 0; }, std::chrono::seconds(5)) || closed != 1009)
+        printf("FAILED fragmented message over the limit closed with %d\n", closed.load());
+
+    loop.stop();
+    thread.join();
+
+    socket.stop();
+
+}
+
+// frames no server may send fail the connection
+void test_invalid_frames(int port) {
+
+    const std::vector<std::string> frames = {
+        // masked
+        std::string("\x81\x81\0\0\0\0a", 7),
+        // ping over 125 bytes
+        std::string("\x89\x7e\x00\x7e", 4) + std::string(126, 'a'),
+        // fragmented ping
+        std::string("\x09\x01" "a", 3)
+    };
+    std::atomic<size_t> next = 0;
+
+    Socket socket(port, false, 16);
+    socket.set_drain_timeout(std::chrono::milliseconds(100));
+    socket.on_open([&](WebSocket * ws) {
+        ws->on_handshake([&, ws]() {
+            const std::string & frame = frames[next++ % frames.size()];
+            ws->send_raw(std::vector<uint8_t>(frame.begin(), frame.end()));
+        });
+    });
+
+    if (!socket.listen(true)) {
+        printf("FAILED listen\n");
+        return;
+    }
+
+    for (size_t i = 0; i < frames.size(); i++) {
+
+        EventLoop loop;
+        WebSocketClient client(&loop);
+        std::atomic<int> closed = 0;
+
+        client.on_close([&](uint16_t statuscode) { closed = statuscode; });
+        client.connect("127.0.0.1:" + std::to_string(port));
+
+        std::thread thread([&]() { loop.run(); });
+
+        if (!wait_for([&]() { return closed != 0; }) || closed != 1002)
+            printf("FAILED invalid frame %zu closed with %d\n", i, closed.load());
+
+        loop.stop();
+        thread.join();
+
+    }
+
+    socket.stop();
+
+}
+
+void test_refused(int port) {
+
+    EventLoop loop;
+    WebSocketClient client(&loop);
+    std::atomic<int> closed = 0;
+
+    client.on_open([]() { printf("FAILED opened without a server\n"); });
+    client.on_close([&](uint16_t statuscode) { closed = statuscode; });
+    client.connect("127.0.0.1:" + std::to_string(port));
+
+    std::thread thread([&]() { loop.run(); });
+
+    if (!wait_for([&]() { return closed != 0; }) || closed != 1006)
+        printf("FAILED refused connection closed with %d\n", closed.load());
+
+    loop.stop();
+    thread.join();
+
+    if (client.connect("not an address"))
+        printf("FAILED connect to an invalid address\n");
+
+}
+
+int main() {
+
+    test_masking_key();
+    test_echo(TEST_PORT);
+    test_server_close(TEST_PORT + 1);
+    test_refused(TEST_PORT + 2);
+    test_message_limit(TEST_PORT + 3);
+    test_invalid_frames(TEST_PORT + 4);
+
+    return 0;
+
+}
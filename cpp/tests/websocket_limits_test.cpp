@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) 2022, Tobias <git@tsmr.eu>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include "websocket/websocket.h"
+#include "event/task.h"
+#include "test_helpers.h"
+
+void write_all(int fd, const std::string & data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t bytes = write(fd, data.data() + sent, data.size() - sent);
+        if (bytes <= 0)
+            return;
+        sent += bytes;
+    }
+}
+
+uint16_t close_code(const std::string & data) {
+
+    // the close frame is the last thing the server sends
+    if (data.size() < 4 || (uint8_t) data[data.size() - 4] != 0x88)
+        return 0;
+
+    return ((uint8_t) data[data.size() - 2] << 8) | (uint8_t) data[data.size() - 1];
+
+}
+
+struct Connection {
+
+    int fds[2];
+    WebSocket::Limits limits;
+    WebSocket ws;
+    std::thread reader;
+
+    Connection(const WebSocket::Limits & limits, MemoryBudget * budget = nullptr, Throttling * throttling = nullptr) : limits(limits) {
+
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        ws.reset(fds[0], 1);
+        ws.set_limits(&this->limits);
+        ws.set_memory_budget(budget);
+        ws.set_throttling(throttling);
+
+        ws.on_message([this](std::string message) {
+            ws.send_message(message);
+        });
+
+        reader = std::thread([this]() { ws.listen(); });
+
+        write(fds[1], handshake_request, strlen(handshake_request));
+        if (read_available(fds[1], 1).find("101") == std::string::npos)
+            printf("FAILED handshake\n");
+
+    }
+
+    ~Connection() {
+        ::shutdown(fds[1], SHUT_RDWR);
+        reader.join();
+        close(fds[1]);
+    }
+
+};
+
+void test_split_reads() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    WebSocket ws;
+    ws.reset(fds[0], 1);
+    ws.on_message([&](std::string message) { ws.send_message(message); });
+    std::thread reader([&]() { ws.listen(); });
+
+    // the request and a frame header, each in two parts
+    size_t half = strlen(handshake_request) / 2;
+    write(fds[1], handshake_request, half);
+    usleep(20000);
+    write(fds[1], handshake_request + half, strlen(handshake_request) - half);
+
+    if (read_available(fds[1], 1).find("101") == std::string::npos)
+        printf("FAILED split handshake request\n");
+
+    std::string frame = client_frame(DataFrame::TextFrame, std::string(300, 'a'));
+    write_all(fds[1], frame.substr(0, 3));
+    usleep(20000);
+    write_all(fds[1], frame.substr(3));
+
+    std::string echo = read_available(fds[1], 304);
+    if (echo.size() != 304 || echo.substr(4) != std::string(300, 'a'))
+        printf("FAILED echo of a split frame header: %zu bytes\n", echo.size());
+
+    ::shutdown(fds[1], SHUT_RDWR);
+    reader.join();
+    close(fds[1]);
+
+}
+
+void test_frame_limit() {
+
+    WebSocket::Limits limits;
+    limits.max_frame_size = 1000;
+
+    Connection connection(limits);
+    write_all(connection.fds[1], client_frame(DataFrame::TextFrame, std::string(2000, 'a')));
+
+    std::string answer = read_available(connection.fds[1], 4);
+    if (close_code(answer) != 1009)
+        printf("FAILED frame above the limit: close code %d\n", close_code(answer));
+
+}
+
+void test_message_limit() {
+
+    WebSocket::Limits limits;
+    limits.max_frame_size = 1000;
+    limits.max_message_size = 3000;
+
+    Connection connection(limits);
+
+    std::string frames = client_frame(DataFrame::TextFrame, std::string(800, 'a'), false);
+    for (int i = 0; i < 4; i++) {
+        std::string continuation = client_frame(DataFrame::ContinuationFrame, std::string(800, 'a'), false);
+        frames += continuation;
+    }
+    write_all(connection.fds[1], frames);
+
+    std::string answer = read_available(connection.fds[1], 4);
+    if (close_code(answer) != 1009)
+        printf("FAILED message above the limit: close code %d\n", close_code(answer));
+
+}
+
+void test_memory_budget() {
+
+    MemoryBudget budget(READ_BUFFER_MIN + 1000);
+
+    {
+        Connection connection(WebSocket::Limits(), &budget);
+
+        write_all(connection.fds[1], client_frame(DataFrame::TextFrame, std::string(500, 'a')));
+        if (read_available(connection.fds[1], 504).size() != 504)
+            printf("FAILED message within the budget\n");
+
+        write_all(connection.fds[1], client_frame(DataFrame::TextFrame, std::string(2000, 'a')));
+
+        std::string answer = read_available(connection.fds[1], 4);
+        if (close_code(answer) != 1013)
+            printf("FAILED message above the budget: close code %d\n", close_code(answer));
+    }
+
+    if (budget.used() != 0)
+        printf("FAILED %zu bytes of the budget still used\n", budget.used());
+
+}
+
+void test_control_frame_limit() {
+
+    {
+        Connection connection { WebSocket::Limits() };
+        write_all(connection.fds[1], client_frame(DataFrame::Ping, std::string(126, 'a')));
+
+        std::string answer = read_available(connection.fds[1], 4);
+        if (close_code(answer) != 1002)
+            printf("FAILED ping above 125 bytes: close code %d\n", close_code(answer));
+    }
+
+    {
+        Connection connection { WebSocket::Limits() };
+        write_all(connection.fds[1], client_frame(DataFrame::Ping, "a", false));
+
+        std::string answer = read_available(connection.fds[1], 4);
+        if (close_code(answer) != 1002)
+            printf("FAILED fragmented ping: close code %d\n", close_code(answer));
+    }
+
+}
+
+void test_send_budget() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    MemoryBudget budget(64 * 1024);
+
+    EventLoop loop;
+    WebSocket ws;
+    ws.reset(fds[0], 1);
+    ws.set_memory_budget(&budget);
+
+    std::atomic<bool> disconnected = false;
+    ws.attach(&loop, [&]() {
+        disconnected = true;
+        loop.stop();
+    });
+    echo(ws).start();
+
+    std::thread loop_thread([&]() { loop.run(); });
+
+    write(fds[1], handshake_request, strlen(handshake_request));
+    read_available(fds[1], 1);
+
+    // the client never reads, far more than the socket buffers and the
+    // budget hold
+    std::vector<uint8_t> frame = DataFrame::get_text_frame(std::string(16 * 1024, 'a')).get_raw_frame();
+    size_t most_used = 0;
+
+    loop.post([&]() {
+        for (int i = 0; i < 128; i++) {
+            ws.send_raw(frame);
+            most_used = std::max(most_used, budget.used());
+        }
+    });
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!disconnected && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    if (!disconnected) {
+        printf("FAILED client that does not read was not closed\n");
+        ::shutdown(fds[1], SHUT_RDWR);
+    }
+
+    loop_thread.join();
+
+    if (most_used == 0 || most_used > budget.limit())
+        printf("FAILED queued frames took %zu bytes of the budget\n", most_used);
+
+    // released like a slot of the connection table
+    ws.reset(-1, 1);
+    if (budget.used() != 0)
+        printf("FAILED %zu bytes of the budget still used\n", budget.used());
+
+    close(fds[1]);
+
+}
+
+// frames of n bytes back to back
+std::string client_frames(uint8_t opcode, size_t count, size_t size) {
+
+    std::string frames;
+    for (size_t i = 0; i < count; i++)
+        frames += client_frame(opcode, std::string(size, 'a'));
+    return frames;
+
+}
+
+void test_rate_close() {
+
+    WebSocket::Limits limits;
+    limits.frames_per_second = 5;
+    limits.rate_action = WebSocket::Close;
+    Throttling throttling;
+
+    Connection connection(limits, nullptr, &throttling);
+    write_all(connection.fds[1], client_frames(DataFrame::TextFrame, 20, 1));
+
+    // the burst of one second is echoed, then the connection is closed
+    std::string answer = read_available(connection.fds[1], 5 * 3 + 4);
+    if (close_code(answer) != 1008 || answer.size() != 5 * 3 + 4)
+        printf("FAILED flood not closed with 1008: close code %d, %zu bytes\n", close_code(answer), answer.size());
+
+    if (throttling.closed != 1 || connection.ws.throttled() != 1)
+        printf("FAILED %llu connections closed\n", (unsigned long long) throttling.closed.load());
+
+}
+
+void test_rate_drop() {
+
+    WebSocket::Limits limits;
+    limits.control_frames_per_second = 2;
+    limits.bytes_per_second = 1000;
+    limits.rate_action = WebSocket::Drop;
+    Throttling throttling;
+
+    Connection connection(limits, nullptr, &throttling);
+
+    // two pongs, the other pings are skipped
+    write_all(connection.fds[1], client_frames(DataFrame::Ping, 10, 4));
+    write_all(connection.fds[1], client_frame(DataFrame::TextFrame, std::string(4, 'a')));
+
+    std::string answer = read_available(connection.fds[1], 3 * 6);
+    if (answer != std::string("\x8a\x04") + "aaaa" + "\x8a\x04" + "aaaa" + "\x81\x04" + "aaaa")
+        printf("FAILED ping flood: %zu bytes\n", answer.size());
+
+    if (throttling.dropped != 8)
+        printf("FAILED %llu pings dropped\n", (unsigned long long) throttling.dropped.load());
+
+    // a message over the bytes goes with all of its frames, also the ones
+    // of later reads
+    std::string frames = client_frame(DataFrame::TextFrame, std::string(100, 'a'), false);
+    std::string large = client_frame(DataFrame::ContinuationFrame, std::string(5000, 'a'), false);
+    std::string last = client_frame(DataFrame::ContinuationFrame, std::string(10, 'a'));
+    frames += large.substr(0, 2000);
+    write_all(connection.fds[1], frames);
+    usleep(20000);
+
+    frames = large.substr(2000);
+    frames += last;
+    std::string next = client_frame(DataFrame::TextFrame, std::string(5, 'a'));
+    frames += next;
+    write_all(connection.fds[1], frames);
+
+    answer = read_available(connection.fds[1], 7);
+    if (answer != "\x81\x05" + std::string(5, 'a'))
+        printf("FAILED message over the byte rate: %zu bytes\n", answer.size());
+
+    if (throttling.dropped != 10 || connection.ws.buffered() > READ_BUFFER_MAX)
+        printf("FAILED %llu frames dropped\n", (unsigned long long) throttling.dropped.load());
+
+    // the skipped rest of a dropped message takes no bytes from the next one
+    Connection fresh(limits);
+
+    frames = client_frame(DataFrame::TextFrame, std::string(100, 'a'), false);
+    frames += client_frame(DataFrame::ContinuationFrame, std::string(5000, 'a'), false);
+    frames += client_frame(DataFrame::ContinuationFrame, std::string(800, 'a'));
+    frames += client_frame(DataFrame::TextFrame, std::string(500, 'a'));
+    write_all(fresh.fds[1], frames);
+
+    answer = read_available(fresh.fds[1], 504);
+    if (answer != "\x81\x7e\x01\xf4" + std::string(500, 'a'))
+        printf("FAILED message after a dropped one: %zu bytes\n", answer.size());
+
+}
+
+void test_rate_delay() {
+
+    WebSocket::Limits limits;
+    limits.frames_per_second = 20;
+    Throttling throttling;
+
+    Connection connection(limits, nullptr, &throttling);
+
+    // the burst at once, the rest at the rate
+    auto start = std::chrono::steady_clock::now();
+    write_all(connection.fds[1], client_frames(DataFrame::TextFrame, 30, 1));
+
+    std::string answer = read_available(connection.fds[1], 30 * 3);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    if (answer.size() != 30 * 3)
+        printf("FAILED %zu bytes of delayed echos\n", answer.size());
+    if (elapsed < std::chrono::milliseconds(400) || throttling.delayed == 0)
+        printf("FAILED flood not delayed: %lldms\n", (long long) (elapsed / std::chrono::milliseconds(1)));
+
+}
+
+// the event loop does not read from a throttled connection meanwhile
+void test_rate_delay_loop() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    EventLoop loop;
+    WebSocket ws;
+    ws.reset(fds[0], 1);
+
+    WebSocket::Limits limits;
+    limits.frames_per_second = 20;
+    ws.set_limits(&limits);
+
+    ws.attach(&loop, [&]() { loop.stop(); });
+    echo(ws).start();
+
+    std::thread loop_thread([&]() { loop.run(); });
+
+    write(fds[1], handshake_request, strlen(handshake_request));
+    read_available(fds[1], 1);
+
+    auto start = std::chrono::steady_clock::now();
+    write_all(fds[1], client_frames(DataFrame::TextFrame, 30, 1));
+
+    std::string answer = read_available(fds[1], 30 * 3);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    if (answer.size() != 30 * 3)
+        printf("FAILED %zu bytes of delayed echos on the event loop\n", answer.size());
+    if (elapsed < std::chrono::milliseconds(400) || ws.throttled() == 0)
+        printf("FAILED flood not delayed on the event loop: %lldms\n", (long long) (elapsed / std::chrono::milliseconds(1)));
+
+    uint8_t close_frame[] = { 0x88, 0x82, 0, 0, 0, 0, 0x03, 0xe8 };
+    write(fds[1], close_frame, sizeof(close_frame));
+
+    loop_thread.join();
+    close(fds[1]);
+
+}
+
+void test_idle_connection() {
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    EventLoop loop;
+    WebSocket ws(fds[0]);
+
+    ws.attach(&loop, [&]() { loop.stop(); });
+    echo(ws).start();
+
+    std::thread loop_thread([&]() { loop.run(); });
+
+    write(fds[1], handshake_request, strlen(handshake_request));
+    read_available(fds[1], 1);
+
+    // a bulk message grows the read buffer
+    size_t size = 100 * 1024;
+    write_all(fds[1], client_frame(DataFrame::BinaryFrame, std::string(size, 'a')));
+    write_all(fds[1], client_frame(DataFrame::TextFrame, std::string(size, 'a')));
+
+    std::string echoed = read_available(fds[1], 2 * (size + 10));
+    if (echoed.size() != 2 * (size + 10))
+        printf("FAILED bulk message echoed with %zu bytes\n", echoed.size());
+
+    std::atomic<size_t> buffered { SIZE_MAX };
+    loop.post([&]() { buffered = ws.buffered(); });
+    while (buffered == SIZE_MAX)
+        std::this_thread::yield();
+
+    if (buffered != 0)
+        printf("FAILED idle connection still buffers %zu bytes\n", buffered.load());
+
+    // ten cache lines, what the fields of a connection used by few of them
+    // (rates, conflation, strand) take is allocated when they need it
+    if (sizeof(WebSocket) > 640)
+        printf("FAILED an idle WebSocket takes %zu bytes\n", sizeof(WebSocket));
+
+    uint8_t close_frame[] = { 0x88, 0x82, 0, 0, 0, 0, 0x03, 0xe8 };
+    write(fds[1], close_frame, sizeof(close_frame));
+
+    loop_thread.join();
+    close(fds[1]);
+
+}
+
+int main() {
+
+    test_split_reads();
+    test_frame_limit();
+    test_message_limit();
+    test_memory_budget();
+    test_control_frame_limit();
+    test_send_budget();
+    test_rate_close();
+    test_rate_drop();
+    test_rate_delay();
+    test_rate_delay_loop();
+    test_idle_connection();
+
+    return 0;
+
+}